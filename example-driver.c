@@ -50,6 +50,41 @@ void on_pdo1(struct co_drv* drv, const void* data, size_t size)
 	printf("%s: %llx\n", self->name, value);
 }
 
+/* The mapping is stored in the device, so it is only sent when it changes.
+ * The output enable is not, so it is sent every time.
+ */
+int configure(struct co_drv* drv)
+{
+	static struct co_pdo_map_entry entries[] = {
+		{ .index = 0x6000, .subindex = 1, .length = 64 },
+		{ 0 }
+	};
+
+	static const struct co_pdo_map map = {
+		.type = CO_TPDO1,
+		.xmission_type = CO_PDO_XMISSION_STANDARD_EVENT_DRIVEN,
+		.entries = entries,
+	};
+
+	if (co_config_begin(drv) < 0)
+		return -1;
+
+	co_map_pdo(drv, &map);
+
+	if (co_config_end(drv) < 0)
+		return -1;
+
+	/* The outputs are disabled again whenever the device resets */
+	static const uint8_t enable = 0xff;
+
+	if (co_config_begin_volatile(drv) < 0)
+		return -1;
+
+	co_sdo_send_blob(drv, 0x6206, 1, &enable, sizeof(enable));
+
+	return co_config_end(drv) < 0 ? -1 : 0;
+}
+
 EXPORT
 int co_drv_init(struct co_drv* drv)
 {
@@ -63,6 +98,9 @@ int co_drv_init(struct co_drv* drv)
 
 	co_set_pdo1_fn(drv, on_pdo1);
 
+	if (configure(drv) < 0)
+		return -1;
+
 	start_read_name(drv, self);
 
 	return 0;
@@ -0,0 +1,61 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_BOOT_CACHE_H_
+#define CANOPEN_BOOT_CACHE_H_
+
+#include <stdint.h>
+
+/* Boot cache file format:
+ *
+ * The file starts with a struct boot_cache_file_header, followed by one
+ * struct boot_cache_entry for every node id from 0 to CANOPEN_NODEID_MAX. All
+ * values are in host byte order. A file with a different magic, version or
+ * entry size is ignored as a whole.
+ */
+#define BOOT_CACHE_MAGIC "COBOOTCA"
+#define BOOT_CACHE_VERSION 1
+
+struct boot_cache_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t n_entries;
+} __attribute__((packed));
+
+struct boot_cache_entry {
+	uint32_t is_valid;
+	uint32_t device_type;
+	uint32_t vendor_id;
+	uint32_t product_code;
+	uint32_t revision_number;
+	uint32_t serial_number;
+	char name[64];
+	char hw_version[64];
+	char sw_version[64];
+};
+
+int boot_cache_load(const char* path);
+int boot_cache_save(void);
+void boot_cache_cleanup(void);
+
+int boot_cache_is_enabled(void);
+
+/* Returns -1 if there is no valid entry for the node */
+int boot_cache_get(int nodeid, struct boot_cache_entry* entry);
+void boot_cache_set(int nodeid, const struct boot_cache_entry* entry);
+void boot_cache_invalidate(int nodeid);
+
+#endif /* CANOPEN_BOOT_CACHE_H_ */
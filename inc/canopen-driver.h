@@ -143,6 +143,29 @@ enum co_sdo_status co_sdo_req_get_status(const struct co_sdo_req* self);
 int co_sdo_send_blob(struct co_drv* self, int index, int subindex,
 		     const void* payload, size_t size);
 
+/* Configuration blocks
+ *
+ * Downloads made with co_sdo_send(), co_sdo_send_blob() and co_map_pdo()
+ * between co_config_begin() and co_config_end() are collected rather than
+ * sent. co_config_end() compares a digest of the block with the one that the
+ * device stored in 0x1020:2 the last time it was configured. If they match,
+ * the downloads are skipped. Otherwise, they are queued in order, followed by
+ * the new digest.
+ *
+ * Only configuration that the device keeps across restarts belongs in a
+ * block. co_config_end() returns 1 if the block was queued, 0 if it was
+ * skipped and -1 on failure.
+ *
+ * Configuration that the device loses when it resets goes into a block opened
+ * with co_config_begin_volatile(). Such a block is always queued, and the
+ * master keeps it to send again if the node drops off the bus and comes back
+ * within its reintegration grace period. In that case the driver instance is
+ * kept and only the start function is called again.
+ */
+int co_config_begin(struct co_drv* self);
+int co_config_begin_volatile(struct co_drv* self);
+int co_config_end(struct co_drv* self);
+
 int co_map_pdo(struct co_drv* self, const struct co_pdo_map* map);
 
 void co_byteorder(void* dst, const void* src, size_t dst_size, size_t src_size);
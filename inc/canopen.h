@@ -19,7 +19,10 @@
 #define CANOPEN_NODEID_MIN 1
 #define CANOPEN_NODEID_MAX 127
 
+#define CANOPEN_COB_ID_INVALID (1UL << 31)
+
 struct can_frame;
+struct co_nodeset;
 
 enum canopen_range {
 	R_NMT = 0,
@@ -69,5 +72,13 @@ struct canopen_msg {
 int canopen_get_object_type(struct canopen_msg* msg,
 			    const struct can_frame* frame);
 
+/* Parses "<nodeid>[-<nodeid>],..." and adds the nodes to the set */
+int canopen_parse_nodes(struct co_nodeset* nodes, const char* list);
+
+/* Parses a comma separated list of nmt, sync, emcy, timestamp, tpdo, rpdo, pdo,
+ * sdo and heartbeat into a mask of enum canopen_object
+ */
+int canopen_parse_objects(unsigned int* objects, const char* list);
+
 #endif /* _CANOPEN_H */
 
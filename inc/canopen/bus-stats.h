@@ -0,0 +1,95 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* CAN bus statistics
+ *
+ * Frames are counted per COB-ID in fixed-size tables, so that the memory and
+ * time spent per frame does not depend on the traffic. Times are in
+ * microseconds.
+ */
+
+#ifndef CANOPEN_BUS_STATS_H_
+#define CANOPEN_BUS_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "canopen.h"
+#include "canopen/sdo_trace.h"
+
+#define BUS_STATS_N_COBS (CAN_SFF_MASK + 1)
+
+/* Bus load peaks are measured over windows of this length */
+#define BUS_STATS_LOAD_WINDOW 100000 /* us */
+
+struct bus_stats_cob {
+	uint64_t n_frames;
+	uint64_t n_bits;
+	uint64_t last_time;
+
+	/* Time between consecutive frames */
+	uint64_t n_periods;
+	uint64_t period_min;
+	uint64_t period_max;
+	double period_sum;
+	double period_sum_sq;
+};
+
+struct bus_stats {
+	unsigned int bitrate;
+
+	uint64_t start_time;
+	uint64_t end_time;
+	uint64_t n_frames;
+	uint64_t n_bits;
+	uint64_t n_error_frames;
+
+	uint64_t window_start;
+	uint64_t window_bits;
+	uint64_t peak_window_bits;
+
+	struct bus_stats_cob cob[BUS_STATS_N_COBS];
+	struct bus_stats_cob extended;
+
+	/* Time from each SDO request to its response */
+	uint64_t sdo_request_time[CANOPEN_NODEID_MAX + 1];
+	struct sdo_trace_hist sdo_latency[CANOPEN_NODEID_MAX + 1];
+};
+
+void bus_stats_init(struct bus_stats* self, unsigned int bitrate);
+
+/* Starts a new reporting period. Frame and SDO request times are kept, so
+ * that periods and latencies spanning the boundary are still measured.
+ */
+void bus_stats_reset(struct bus_stats* self);
+
+/* Returns the length of the frame on the bus in bits, including stuff bits
+ * and the interframe space.
+ */
+unsigned int bus_stats_frame_bits(const struct can_frame* cf);
+
+void bus_stats_add(struct bus_stats* self, uint64_t timestamp,
+		   const struct can_frame* cf);
+
+/* Bus load over the whole period and the peak window, in percent */
+double bus_stats_load(const struct bus_stats* self);
+double bus_stats_peak_load(const struct bus_stats* self);
+
+double bus_stats_period_jitter(const struct bus_stats_cob* cob);
+
+void bus_stats_print(const struct bus_stats* self, FILE* output);
+
+#endif /* CANOPEN_BUS_STATS_H_ */
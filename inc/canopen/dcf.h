@@ -0,0 +1,101 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Concise device configuration (CiA 302-3)
+ *
+ * A concise DCF is the binary form of a device configuration, as stored in
+ * object 0x1F22 of a manager. It holds a 32 bit entry count, followed by
+ * entries made up of a 16 bit index, an 8 bit sub-index, a 32 bit data size
+ * and the data itself. All numbers are little endian.
+ *
+ * The digest identifies a configuration. After a successful download, it is
+ * written to the verify configuration object (0x1020) of the device so that
+ * the download can be skipped the next time: sub-index 1 holds the digest of
+ * the DCF and sub-index 2 holds the digest of the driver's configuration.
+ */
+
+#ifndef CANOPEN_DCF_H_
+#define CANOPEN_DCF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vector.h"
+
+struct ini_file;
+struct canopen_eds;
+
+struct co_dcf {
+	struct vector data;
+	uint32_t n_entries;
+};
+
+struct co_dcf_entry {
+	int index;
+	int subindex;
+	const void* data;
+	size_t size;
+};
+
+struct co_dcf_iter {
+	const struct co_dcf* dcf;
+	size_t pos;
+};
+
+int co_dcf_init(struct co_dcf* self);
+void co_dcf_destroy(struct co_dcf* self);
+
+/* Appends an entry; objects may be written more than once */
+int co_dcf_append(struct co_dcf* self, int index, int subindex,
+		  const void* data, size_t size);
+
+/* An existing entry for the same object is replaced */
+int co_dcf_add(struct co_dcf* self, int index, int subindex, const void* data,
+	       size_t size);
+
+const struct co_dcf_entry* co_dcf_find(const struct co_dcf* self, int index,
+				       int subindex,
+				       struct co_dcf_entry* entry);
+
+/* Returns the configuration in concise DCF format */
+const void* co_dcf_get_data(const struct co_dcf* self);
+size_t co_dcf_get_size(const struct co_dcf* self);
+
+static inline unsigned int co_dcf_length(const struct co_dcf* self)
+{
+	return self->n_entries;
+}
+
+/* Entries are merged into the configuration */
+int co_dcf_load_concise(struct co_dcf* self, const void* data, size_t size);
+
+/* Loads sections with a ParameterValue from a DCF. The type of an object is
+ * taken from its DataType or else from the EDS, which may be NULL. Values may
+ * be given relative to the node id, as in "$NODEID+0x180".
+ */
+int co_dcf_load_ini(struct co_dcf* self, const struct ini_file* ini,
+		    const struct canopen_eds* eds, int nodeid);
+
+/* Files ending in ".dcf" are read as DCF, others as concise DCF. errno is
+ * ENOENT if the file does not exist.
+ */
+int co_dcf_load_file(struct co_dcf* self, const char* path,
+		     const struct canopen_eds* eds, int nodeid);
+
+void co_dcf_iter_init(struct co_dcf_iter* iter, const struct co_dcf* dcf);
+int co_dcf_iter_next(struct co_dcf_iter* iter, struct co_dcf_entry* entry);
+
+uint32_t co_dcf_digest(const struct co_dcf* self);
+
+#endif /* CANOPEN_DCF_H_ */
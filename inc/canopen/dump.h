@@ -43,4 +43,36 @@ enum co_dump_options {
 
 int co_dump(const char* addr, enum co_dump_options options);
 
+/* SDOs and PDOs are decoded using the EDS of each node, which is found by the
+ * identity seen in uploads of 0x1018 unless it is given by name here. PDO
+ * mappings are learned from the bus, or else taken from a DCF if one is given,
+ * or else from the defaults in the EDS. These must be set before co_dump() and
+ * the strings must outlive it.
+ */
+int co_dump_set_eds(int nodeid, const char* name);
+int co_dump_set_dcf(int nodeid, const char* path);
+
+/* Large trace files are decoded on up to n threads. The default of 0 means one
+ * per CPU.
+ */
+void co_dump_set_jobs(unsigned int n);
+
+/* Instead of listening to the bus, the frames are taken from the trace
+ * subscription service of a master at host[:port], which applies the filter
+ * line before sending them. See canopen/trace-sub.h for the filter options.
+ */
+void co_dump_set_subscription(const char* line);
+
+/* Prints bus statistics instead of the frames. The report is printed every
+ * interval ms of traffic, or only at the end if interval is 0.
+ */
+int co_dump_stats(const char* addr, enum co_dump_options options,
+		  unsigned int bitrate, unsigned int interval);
+
+/* Captures frames from a CAN interface into a file that can be decoded later
+ * with CO_DUMP_FILE, until SIGINT or SIGTERM. Drop counts are reported on
+ * stderr at the end. A path of "-" writes to stdout.
+ */
+int co_dump_capture(const char* iface, const char* path);
+
 #endif /*  CANOPEN_DUMP_H_ */
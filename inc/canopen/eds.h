@@ -70,6 +70,10 @@ static inline int eds_obj_subindex(const struct eds_obj* obj)
 	return obj->key & 0xff;
 }
 
+/* Parse section names such as "1018" and "1018sub1" */
+int eds__get_section_index(const char* str);
+unsigned int eds__get_section_subindex(const char* str);
+
 struct canopen_eds* eds_db_get(int index);
 size_t eds_db_length(void);
 
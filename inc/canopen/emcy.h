@@ -40,7 +40,8 @@ static inline uint64_t emcy_get_manufacturer_error(const struct can_frame* frame
 	uint64_t tmp = 0;
 	uint64_t result = 0;
 
-	memcpy(&tmp, &frame->data[4], 5);
+	/* The frame ends 4 bytes after data[4] */
+	memcpy(&tmp, &frame->data[4], 4);
 
 	byteorder(&result, &tmp, sizeof(result));
 
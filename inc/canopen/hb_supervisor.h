@@ -0,0 +1,132 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Heartbeat supervision
+ *
+ * All supervised nodes share one periodic timer. Receiving a heartbeat only
+ * stores a new deadline for the node; the deadlines are checked in bulk on
+ * each tick, so there is no timer system call per frame.
+ *
+ * The supervisor also sends node guarding requests for nodes that don't
+ * produce heartbeats on their own.
+ *
+ * The ticks may run on a loop of their own, on another thread; see
+ * hb_supervisor_init_on(). The callbacks are then collected on each tick and
+ * called from the default loop, so they never run concurrently with it.
+ */
+
+#ifndef CANOPEN_HB_SUPERVISOR_H_
+#define CANOPEN_HB_SUPERVISOR_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "canopen.h"
+#include "canopen/nodeset.h"
+#include "time-utils.h"
+
+struct mloop;
+struct mloop_timer;
+struct mloop_async;
+struct hb_supervisor;
+
+typedef void (*hb_supervisor_fn)(struct hb_supervisor*, int nodeid);
+
+struct hb_supervisor_node {
+	uint64_t deadline; /* us */
+	uint64_t timeout; /* us */
+	uint64_t ping_deadline; /* us */
+	uint64_t ping_period; /* us; 0 means no node guarding requests */
+};
+
+struct hb_supervisor {
+	struct hb_supervisor_node node[CANOPEN_NODEID_MAX + 1];
+	struct co_nodeset active; /* only changed from the default loop */
+	struct co_nodeset seen;
+	unsigned int n_active;
+	uint64_t tick; /* us */
+	struct mloop_timer* timer;
+
+	/* Only used when ticking on another loop than the default one */
+	struct mloop_async* dispatch;
+	pthread_mutex_t mutex;
+	struct co_nodeset pending_timeout;
+	struct co_nodeset pending_ping;
+	struct co_nodeset pending_seen;
+
+	/* Called on every tick that passes a node's deadline without a
+	 * heartbeat. The next deadline is one timeout later.
+	 */
+	hb_supervisor_fn on_timeout;
+
+	/* Called when it's time to send a node guarding request */
+	hb_supervisor_fn on_ping;
+
+	/* Called once per tick for each node that was heard from since the
+	 * previous tick.
+	 */
+	hb_supervisor_fn on_seen;
+
+	void* context;
+};
+
+int hb_supervisor_init(struct hb_supervisor* self, uint64_t tick);
+
+/* The loop must outlive the supervisor. If it is not the default loop, its
+ * thread must be stopped before hb_supervisor_destroy() is called.
+ */
+int hb_supervisor_init_on(struct hb_supervisor* self, struct mloop* loop,
+			  uint64_t tick);
+void hb_supervisor_destroy(struct hb_supervisor* self);
+
+/* timeout and ping_period are in microseconds */
+void hb_supervisor_start(struct hb_supervisor* self, int nodeid,
+			 uint64_t timeout, uint64_t ping_period);
+void hb_supervisor_stop(struct hb_supervisor* self, int nodeid);
+
+void hb_supervisor_process(struct hb_supervisor* self, uint64_t now);
+
+static inline int hb_supervisor_is_active(const struct hb_supervisor* self,
+					  int nodeid)
+{
+	return co_nodeset_has(&self->active, nodeid);
+}
+
+static inline void hb_supervisor__lock(struct hb_supervisor* self)
+{
+	if (self->dispatch)
+		pthread_mutex_lock(&self->mutex);
+}
+
+static inline void hb_supervisor__unlock(struct hb_supervisor* self)
+{
+	if (self->dispatch)
+		pthread_mutex_unlock(&self->mutex);
+}
+
+static inline void hb_supervisor_feed(struct hb_supervisor* self, int nodeid)
+{
+	if (!hb_supervisor_is_active(self, nodeid))
+		return;
+
+	hb_supervisor__lock(self);
+
+	struct hb_supervisor_node* node = &self->node[nodeid];
+	node->deadline = gettime_us(CLOCK_MONOTONIC) + node->timeout;
+	co_nodeset_add(&self->seen, nodeid);
+
+	hb_supervisor__unlock(self);
+}
+
+#endif /* CANOPEN_HB_SUPERVISOR_H_ */
@@ -0,0 +1,123 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_INCIDENT_H_
+#define CANOPEN_INCIDENT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/can.h>
+
+#include "trace-buffer.h"
+
+/* Matches every node or every code in a trigger */
+#define INCIDENT_ANY (-1)
+
+/* Number of captures that are remembered for listing */
+#define INCIDENT_HISTORY 64
+
+#define INCIDENT_MAX_TRIGGERS 32
+
+enum incident_trigger_type {
+	INCIDENT_TRIGGER_EMCY = 0,
+	INCIDENT_TRIGGER_SDO_ABORT,
+	INCIDENT_TRIGGER_HEARTBEAT_TIMEOUT,
+	INCIDENT_TRIGGER_BUS_OFF,
+	INCIDENT_TRIGGER_REST,
+};
+
+struct incident_trigger {
+	enum incident_trigger_type type;
+	int nodeid;
+	int64_t code; /* EMCY error code or SDO abort code */
+};
+
+enum incident_state {
+	INCIDENT_PENDING = 0,
+	INCIDENT_WRITING,
+	INCIDENT_DONE,
+	INCIDENT_FAILED,
+	INCIDENT_DELETED,
+};
+
+struct incident {
+	unsigned int id; /* 0 if the slot is unused */
+	enum incident_state state;
+	char trigger[64];
+	uint64_t time; /* us since the epoch, like trace buffer timestamps */
+	uint64_t begin;
+	uint64_t end;
+	size_t n_frames;
+	unsigned int n_suppressed;
+	char path[256];
+};
+
+struct incident_config {
+	const char* path; /* Directory for capture files */
+	unsigned int pre_trigger; /* ms; 0 captures the whole ring */
+	unsigned int post_trigger; /* ms */
+	unsigned int min_interval; /* ms between captures */
+	unsigned int max_files; /* Older captures are deleted; 0: no limit */
+	int is_compact;
+};
+
+/* Trigger expressions are separated by commas or whitespace and have the form
+ * <type>[:<nodeid>[:<code>]], where <type> is one of emcy, sdo-abort,
+ * heartbeat-timeout or bus-off and "*" or a missing field matches anything.
+ * E.g. "emcy:5:0x8130, sdo-abort, heartbeat-timeout:12, bus-off".
+ *
+ * Returns the number of triggers or -1 if the expression is invalid.
+ */
+int incident_parse_triggers(struct incident_trigger* triggers, size_t max,
+			    const char* str);
+
+int incident_trigger_is_match(const struct incident_trigger* trigger,
+			      enum incident_trigger_type type, int nodeid,
+			      int64_t code);
+
+int incident_init(struct tracebuffer* tb, const struct incident_config* config,
+		  const char* triggers);
+void incident_cleanup(void);
+
+/* Returns 1 if any of the triggers needs error frames */
+int incident_wants_error_frames(void);
+
+/* Checks a received frame against the configured triggers */
+void incident_feed(const struct can_frame* cf);
+
+/* Starts a capture if the event matches a configured trigger, or always for
+ * INCIDENT_TRIGGER_REST. Captures are rate limited; a trigger within
+ * min_interval of the previous capture is counted on that capture instead.
+ *
+ * Returns the id of the new capture or -1 if none was started.
+ */
+int incident_trigger(enum incident_trigger_type type, int nodeid,
+		     int64_t code);
+
+const struct incident* incident_get(unsigned int id);
+
+/* Writes the frames within [begin, end] and returns the number written */
+ssize_t incident_write_frames(FILE* stream, const struct tb_frame* frames,
+			      size_t n, uint64_t begin, uint64_t end,
+			      int is_compact);
+
+/* Deletes all but the newest max_files capture files in the directory, going
+ * by modification time. Returns the number of files deleted or -1.
+ */
+int incident_prune_files(const char* dir, unsigned int max_files);
+
+void incident_print_json(FILE* output);
+
+#endif /* CANOPEN_INCIDENT_H_ */
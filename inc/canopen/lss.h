@@ -0,0 +1,209 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Layer setting services (CiA 305)
+ *
+ * The LSS master finds devices that have no node id by their identity
+ * (vendor id, product code, revision number and serial number) and configures
+ * them. All operations are asynchronous and run on the main loop, one at a
+ * time; frames must be passed in through co_lss_feed().
+ *
+ * The slave side is a plain state machine without any I/O so that it can be
+ * used by virtual nodes.
+ */
+
+#ifndef CANOPEN_LSS_H_
+#define CANOPEN_LSS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+
+#define LSS_COB_ID_SLAVE 0x7e4
+#define LSS_COB_ID_MASTER 0x7e5
+
+#define LSS_NODEID_UNCONFIGURED 0xff
+
+#define LSS_FASTSCAN_CONFIRM 0x80
+
+struct sock;
+struct mloop_timer;
+struct co_lss;
+
+enum lss_cs {
+	LSS_CS_SWITCH_GLOBAL = 0x04,
+	LSS_CS_CONFIGURE_NODE_ID = 0x11,
+	LSS_CS_CONFIGURE_BIT_TIMING = 0x13,
+	LSS_CS_ACTIVATE_BIT_TIMING = 0x15,
+	LSS_CS_STORE_CONFIGURATION = 0x17,
+	LSS_CS_SWITCH_SELECTIVE_VENDOR = 0x40,
+	LSS_CS_SWITCH_SELECTIVE_PRODUCT = 0x41,
+	LSS_CS_SWITCH_SELECTIVE_REVISION = 0x42,
+	LSS_CS_SWITCH_SELECTIVE_SERIAL = 0x43,
+	LSS_CS_SWITCH_SELECTIVE_RESPONSE = 0x44,
+	LSS_CS_IDENTIFY_SLAVE = 0x4f,
+	LSS_CS_FASTSCAN = 0x51,
+};
+
+enum lss_mode {
+	LSS_MODE_WAITING = 0,
+	LSS_MODE_CONFIGURATION = 1,
+};
+
+enum lss_op {
+	LSS_OP_NONE = 0,
+	LSS_OP_FASTSCAN,
+	LSS_OP_SWITCH_SELECTIVE,
+	LSS_OP_CONFIGURE_NODE_ID,
+	LSS_OP_CONFIGURE_BIT_TIMING,
+	LSS_OP_STORE_CONFIGURATION,
+};
+
+/* vendor id, product code, revision number, serial number */
+struct lss_address {
+	uint32_t id[4];
+};
+
+static inline enum lss_cs lss_get_cs(const struct can_frame* cf)
+{
+	return (enum lss_cs)cf->data[0];
+}
+
+static inline void lss_set_cs(struct can_frame* cf, enum lss_cs cs)
+{
+	cf->data[0] = cs;
+}
+
+static inline uint32_t lss_get_u32(const struct can_frame* cf)
+{
+	return (uint32_t)cf->data[1] | (uint32_t)cf->data[2] << 8
+	     | (uint32_t)cf->data[3] << 16 | (uint32_t)cf->data[4] << 24;
+}
+
+static inline void lss_set_u32(struct can_frame* cf, uint32_t value)
+{
+	cf->data[1] = value;
+	cf->data[2] = value >> 8;
+	cf->data[3] = value >> 16;
+	cf->data[4] = value >> 24;
+}
+
+static inline void lss_clear_frame(struct can_frame* cf, int cob_id)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = cob_id;
+	cf->can_dlc = 8;
+}
+
+/* Fast scan request: data[1..4] id number, data[5] bit checked,
+ * data[6] LSS sub, data[7] LSS next.
+ */
+static inline int lss_fastscan_get_bit(const struct can_frame* cf)
+{
+	return cf->data[5];
+}
+
+static inline int lss_fastscan_get_sub(const struct can_frame* cf)
+{
+	return cf->data[6];
+}
+
+static inline int lss_fastscan_get_next(const struct can_frame* cf)
+{
+	return cf->data[7];
+}
+
+static inline void lss_fastscan_set(struct can_frame* cf, uint32_t id,
+				    int bit, int sub, int next)
+{
+	lss_set_cs(cf, LSS_CS_FASTSCAN);
+	lss_set_u32(cf, id);
+	cf->data[5] = bit;
+	cf->data[6] = sub;
+	cf->data[7] = next;
+}
+
+struct lss_slave {
+	struct lss_address address;
+	enum lss_mode mode;
+	int nodeid; /* pending node id */
+	int bit_timing; /* pending bit timing index */
+	int fastscan_pos;
+	int selective_pos;
+	int is_stored;
+};
+
+void lss_slave_init(struct lss_slave* self, const struct lss_address* address,
+		    int nodeid);
+
+/* Processes a frame sent by the master. Returns 1 and fills in response if
+ * the slave must answer, otherwise 0.
+ */
+int lss_slave_feed(struct lss_slave* self, const struct can_frame* cf,
+		   struct can_frame* response);
+
+typedef void (*co_lss_fn)(struct co_lss*, int status);
+
+/* status is 0 on success, -1 if the slave did not answer in time and the
+ * error code from the slave if it rejected the request. A fast scan that finds
+ * nothing ends with -1.
+ */
+struct co_lss {
+	const struct sock* sock;
+	unsigned int timeout; /* ms */
+	enum lss_op op;
+	enum lss_cs expected_cs;
+	struct lss_address address;
+	int sub;
+	int bit;
+	int has_response;
+	struct mloop_timer* timer;
+	co_lss_fn on_done;
+	void* context;
+};
+
+int co_lss_init(struct co_lss* self, const struct sock* sock);
+void co_lss_destroy(struct co_lss* self);
+
+static inline int co_lss_is_busy(const struct co_lss* self)
+{
+	return self->op != LSS_OP_NONE;
+}
+
+/* These have no confirmation, so they are sent right away */
+int co_lss_switch_global(struct co_lss* self, enum lss_mode mode);
+int co_lss_activate_bit_timing(struct co_lss* self, unsigned int delay_ms);
+
+/* Finds one unconfigured slave in waiting mode. On success, the identity of
+ * the slave is in self->address and the slave is in configuration mode.
+ */
+int co_lss_fastscan(struct co_lss* self, co_lss_fn on_done);
+
+int co_lss_switch_selective(struct co_lss* self,
+			    const struct lss_address* address,
+			    co_lss_fn on_done);
+int co_lss_configure_node_id(struct co_lss* self, int nodeid,
+			     co_lss_fn on_done);
+int co_lss_configure_bit_timing(struct co_lss* self, int index,
+				co_lss_fn on_done);
+int co_lss_store_configuration(struct co_lss* self, co_lss_fn on_done);
+
+/* Returns 0 if the frame was consumed */
+int co_lss_feed(struct co_lss* self, const struct can_frame* cf);
+
+void co_lss__on_timeout(struct co_lss* self);
+
+#endif /* CANOPEN_LSS_H_ */
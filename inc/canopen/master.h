@@ -28,6 +28,8 @@ enum co_master_driver_type {
 	CO_MASTER_DRIVER_NEW
 };
 
+struct co_dcf;
+
 typedef int (*co_drv_init_fn)(struct co_drv*);
 
 struct co_drv {
@@ -45,6 +47,10 @@ struct co_drv {
 
 	enum co_options options;
 
+	struct co_dcf* config; /* the configuration block being collected */
+	int is_config_volatile;
+	struct co_dcf* volatile_config; /* sent again on reintegration */
+
 	char iface[256];
 };
 
@@ -59,10 +65,8 @@ struct co_master_node {
 	uint32_t device_type;
 	int is_heartbeat_supported;
 
-	uint32_t vendor_id, product_code, revision_number;
-
-	struct mloop_timer* heartbeat_timer;
-	struct mloop_timer* ping_timer;
+	uint32_t vendor_id, product_code, revision_number, serial_number;
+	int has_identity;
 
 	char name[64];
 	char hw_version[64];
@@ -70,6 +74,28 @@ struct co_master_node {
 
 	int is_loading;
 	int is_initialized;
+	int is_started;
+	int is_start_pending;
+
+	/* 0x1020:1 and 0x1020:2 as read at boot-up; they hold the digests of
+	 * the DCF and of the driver's configuration.
+	 */
+	uint32_t config_digest[2];
+	int has_config_digest;
+
+	uint64_t load_time; /* us, monotonic */
+	uint64_t time_to_operational; /* us */
+
+	/* A node that times out is suspended rather than unloaded if it has a
+	 * reintegration grace period. If it boots again with the same identity
+	 * within that period, the driver instance is kept.
+	 */
+	int is_suspended;
+	int is_reintegrated;
+	uint64_t suspend_time; /* us, monotonic */
+	unsigned int n_reintegrations;
+	uint64_t reintegration_time; /* us, from boot-up to reintegrated */
+	uint64_t downtime; /* us, from time-out to reintegrated */
 
 	uint32_t ntimeouts;
 };
@@ -96,6 +122,8 @@ void co_drv_unload(struct co_drv* drv);
 
 int co__rpdox(int nodeid, int type, const void* data, size_t size);
 int co__start(int nodeid);
+int co__configure(int nodeid, const struct co_dcf* config);
+int co__configure_volatile(int nodeid, const struct co_dcf* config);
 
 static inline struct co_master_node* co_drv_node(const struct co_drv* drv)
 {
@@ -20,6 +20,36 @@
 
 struct can_frame;
 struct sock;
+struct mloop_timer;
+struct co_net_discovery;
+
+typedef void (*co_net_discovery_fn)(struct co_net_discovery*);
+typedef void (*co_net_discovery_node_fn)(struct co_net_discovery*, int nodeid);
+
+/* Asynchronous network discovery on the main loop.
+ *
+ * All nodes in the range are reset at once and, after probe_delay, the ones
+ * that have not yet answered are asked for their heartbeat. on_node is called
+ * for each node as soon as it answers. Discovery ends after timeout or when
+ * all expected nodes have answered, whichever comes first; then on_done is
+ * called. Frames must be passed in through co_net_discovery_feed().
+ */
+struct co_net_discovery {
+	const struct sock* sock;
+	char* nodes_seen;
+	int start, end;
+	unsigned int probe_delay; /* ms */
+	unsigned int timeout; /* ms */
+	uint64_t expected[2];
+	unsigned int n_expected;
+	unsigned int n_missing;
+	int is_running;
+	struct mloop_timer* probe_timer;
+	struct mloop_timer* deadline_timer;
+	co_net_discovery_node_fn on_node;
+	co_net_discovery_fn on_done;
+	void* context;
+};
 
 /* Reset the network and see which nodes respond to the reset signal.
  *
@@ -49,6 +79,23 @@ int co_net_probe(const struct sock* sock, char* nodes_seen, int start, int end,
 int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 		     int end, int timeout);
 
+/* nodes_seen must be an array of length 128; prior values are not cleared.
+ * start/end is an inclusive range of node ids to discover.
+ */
+int co_net_discovery_init(struct co_net_discovery* self,
+			  const struct sock* sock, char* nodes_seen, int start,
+			  int end);
+void co_net_discovery_destroy(struct co_net_discovery* self);
+
+void co_net_discovery_expect(struct co_net_discovery* self, int nodeid);
+int co_net_discovery_start(struct co_net_discovery* self);
+
+/* Returns 0 if the frame was consumed by the discovery. Only the first
+ * heartbeat from each node is consumed.
+ */
+int co_net_discovery_feed(struct co_net_discovery* self,
+			  const struct can_frame* cf);
+
 int co_net_send_nmt(const struct sock* sock, int cs, int nodeid);
 int co_net__request_device_type(const struct sock* sock, int nodeid);
 
@@ -0,0 +1,113 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Node sets
+ *
+ * A set of node ids is a 128 bit bitmap, so that loops over the nodes in a
+ * given state only visit the members. The iteration macros look up the next
+ * member after each step, so members may be added or removed inside the loop.
+ */
+
+#ifndef CANOPEN_NODESET_H_
+#define CANOPEN_NODESET_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define CO_NODESET_WORDS 2
+
+struct co_nodeset {
+	uint64_t bits[CO_NODESET_WORDS];
+};
+
+static inline void co_nodeset_clear(struct co_nodeset* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+static inline void co_nodeset_add(struct co_nodeset* self, int nodeid)
+{
+	self->bits[nodeid / 64] |= 1ULL << (nodeid % 64);
+}
+
+static inline void co_nodeset_remove(struct co_nodeset* self, int nodeid)
+{
+	self->bits[nodeid / 64] &= ~(1ULL << (nodeid % 64));
+}
+
+static inline void co_nodeset_assign(struct co_nodeset* self, int nodeid,
+				     int is_member)
+{
+	if (is_member)
+		co_nodeset_add(self, nodeid);
+	else
+		co_nodeset_remove(self, nodeid);
+}
+
+static inline int co_nodeset_has(const struct co_nodeset* self, int nodeid)
+{
+	return !!(self->bits[nodeid / 64] & (1ULL << (nodeid % 64)));
+}
+
+static inline int co_nodeset_is_empty(const struct co_nodeset* self)
+{
+	return (self->bits[0] | self->bits[1]) == 0;
+}
+
+static inline unsigned int co_nodeset_count(const struct co_nodeset* self)
+{
+	return __builtin_popcountll(self->bits[0])
+	     + __builtin_popcountll(self->bits[1]);
+}
+
+/* Returns the first member that is not less than nodeid, or -1 */
+static inline int co_nodeset_next(const struct co_nodeset* self, int nodeid)
+{
+	for (int i = nodeid / 64; i < CO_NODESET_WORDS; ++i) {
+		uint64_t bits = self->bits[i];
+		if (i == nodeid / 64)
+			bits &= ~0ULL << (nodeid % 64);
+
+		if (bits)
+			return i * 64 + __builtin_ctzll(bits);
+	}
+
+	return -1;
+}
+
+/* Returns the last member that is not greater than nodeid, or -1 */
+static inline int co_nodeset_prev(const struct co_nodeset* self, int nodeid)
+{
+	for (int i = nodeid / 64; i >= 0; --i) {
+		uint64_t bits = self->bits[i];
+		if (i == nodeid / 64)
+			bits &= ~0ULL >> (63 - nodeid % 64);
+
+		if (bits)
+			return i * 64 + 63 - __builtin_clzll(bits);
+	}
+
+	return -1;
+}
+
+#define co_nodeset_for_each(nodeid, set) \
+	for ((nodeid) = co_nodeset_next((set), 0); (nodeid) >= 0; \
+	     (nodeid) = co_nodeset_next((set), (nodeid) + 1))
+
+#define co_nodeset_for_each_reverse(nodeid, set) \
+	for ((nodeid) = co_nodeset_prev((set), CO_NODESET_WORDS * 64 - 1); (nodeid) >= 0; \
+	     (nodeid) = (nodeid) > 0 ? co_nodeset_prev((set), (nodeid) - 1) : -1)
+
+#endif /* CANOPEN_NODESET_H_ */
@@ -0,0 +1,91 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Replay of trace files
+ *
+ * Frames from a trace file are sent onto a CAN interface or a TCP CAN bridge,
+ * spaced out as they were recorded, faster by a given factor or as fast as the
+ * bus allows. Each frame has an absolute deadline on CLOCK_MONOTONIC, so that
+ * lateness does not accumulate over a long replay.
+ *
+ * In responder mode, only the frames that the nodes sent are replayed, and
+ * SDO requests from a live master are answered with the responses that were
+ * recorded for the same requests. This reproduces a bus of real nodes well
+ * enough to run a master against it.
+ */
+
+#ifndef CANOPEN_REPLAY_H_
+#define CANOPEN_REPLAY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "canopen/nodeset.h"
+#include "canopen/sdo_trace.h"
+#include "canopen/trace-convert.h"
+
+struct sock;
+
+struct co_replay_options {
+	enum co_trace_format input_format;
+
+	/* 1 replays with the recorded timing, 2 twice as fast and so on. 0
+	 * sends the frames as fast as possible.
+	 */
+	double speed;
+
+	/* Frames of nodes outside the set are left out, unless it is empty.
+	 * Frames that do not belong to a node, such as NMT and SYNC, are not
+	 * affected.
+	 */
+	struct co_nodeset nodes;
+
+	/* A mask of enum canopen_object. 0 means all types. */
+	unsigned int objects;
+
+	int is_responder;
+};
+
+struct co_replay_stats {
+	uint64_t n_frames;
+	uint64_t n_filtered;
+	uint64_t n_send_errors;
+
+	/* Responder mode */
+	uint64_t n_requests;
+	uint64_t n_responses;
+	uint64_t n_unanswered;
+
+	/* Microseconds */
+	uint64_t trace_duration;
+	uint64_t duration;
+	struct sdo_trace_hist lateness;
+};
+
+/* A signal stops the replay early, as does the other end closing a TCP
+ * connection. Returns -1 if the file cannot be read.
+ */
+int co_replay_sock(const char* path, const struct sock* sock,
+		   const struct co_replay_options* options,
+		   struct co_replay_stats* stats);
+
+/* The address is a CAN interface, or host[:port] of a CAN bridge if is_tcp */
+int co_replay(const char* path, const char* addr, int is_tcp,
+	      const struct co_replay_options* options,
+	      struct co_replay_stats* stats);
+
+void co_replay_print_stats(const struct co_replay_stats* stats, FILE* output);
+
+#endif /* CANOPEN_REPLAY_H_ */
@@ -72,6 +72,9 @@ enum sdo_abort_code {
 	SDO_ABORT_SUBNEXIST     = 0x06090011,
 	SDO_ABORT_NVAL     	= 0x06090030,
 	SDO_ABORT_GENERAL       = 0x08000000,
+	SDO_ABORT_STORE		= 0x08000020,
+	SDO_ABORT_LOCAL_CTRL	= 0x08000021,
+	SDO_ABORT_DEV_STATE	= 0x08000022,
 
 };
 
@@ -20,6 +20,7 @@
 #include "vector.h"
 #include "canopen/sdo_req_enums.h"
 #include "canopen/sdo.h"
+#include "canopen/sdo_rtt.h"
 #include "sock.h"
 
 struct sdo_async;
@@ -44,6 +45,8 @@ enum sdo_async_quirks_flags {
 struct sdo_async {
 	struct sock sock;
 	unsigned int nodeid;
+	uint32_t rsdo_cob_id;
+	uint32_t tsdo_cob_id;
 	enum sdo_req_type type;
 	int is_running;
 	enum sdo_async_comm_state comm_state;
@@ -59,6 +62,10 @@ struct sdo_async {
 	void* context;
 	sdo_async_free_fn free_fn;
 	int is_size_indicated;
+	uint64_t send_time;
+	struct sdo_rtt rtt;
+	uint64_t first_response_time;
+	unsigned int n_segments;
 };
 
 struct sdo_async_info {
@@ -57,17 +57,47 @@ struct sdo_req {
 	void* context;
 	sdo_req_free_fn context_free_fn;
 	int is_size_indicated;
+	unsigned int n_retries;
+	int is_requeued;
+	int is_queued;
+	uint64_t enqueue_time;
+	uint64_t start_time;
 };
 
 TAILQ_HEAD(sdo_req_list, sdo_req);
 
+#define SDO_REQ_OBJ_TIMEOUTS_MAX 16
+#define SDO_REQ_CHANNELS_MAX 8
+
+struct sdo_req_obj_timeout {
+	int index;
+	int subindex; /* -1 matches all sub-indices */
+	unsigned long timeout; /* ms */
+};
+
+struct sdo_req_policy {
+	unsigned long timeout; /* ms; 0 means adaptive */
+	unsigned long timeout_min; /* ms */
+	unsigned long timeout_max; /* ms */
+	unsigned int retries;
+	unsigned long backoff; /* ms; doubled for each retry */
+	size_t n_obj_timeouts;
+	struct sdo_req_obj_timeout obj_timeouts[SDO_REQ_OBJ_TIMEOUTS_MAX];
+};
+
 struct sdo_req_queue {
 	pthread_mutex_t mutex;
 	size_t size;
 	size_t limit;
 	struct sdo_req_list list;
 	struct sdo_async sdo_client;
+	struct sdo_async* channels[SDO_REQ_CHANNELS_MAX];
+	size_t n_channels;
 	struct mloop_idle* idle;
+	struct mloop_timer* retry_timer;
+	struct sdo_req_policy policy;
+	int is_backing_off;
+	int is_offline;
 	int nodeid;
 };
 
@@ -82,15 +112,49 @@ void sdo_req_queues_cleanup();
 struct sdo_req_queue* sdo_req_queue_get(int nodeid);
 void sdo_req_queue_flush(struct sdo_req_queue* self);
 
+void sdo_req_queue_set_policy(struct sdo_req_queue* self,
+			      const struct sdo_req_policy* policy);
+void sdo_req_queue_set_offline(struct sdo_req_queue* self, int is_offline);
+
+int sdo_req_queue_add_channel(struct sdo_req_queue* self, uint32_t rsdo_cob_id,
+			      uint32_t tsdo_cob_id);
+void sdo_req_queue_remove_channels(struct sdo_req_queue* self);
+void sdo_req_queue_reset_rtt(struct sdo_req_queue* self);
+struct sdo_async* sdo_req_channel_lookup(uint32_t tsdo_cob_id);
+
+void sdo_req_policy_init(struct sdo_req_policy* self);
+int sdo_req_policy_parse_obj_timeouts(struct sdo_req_policy* self,
+				      const char* str);
+
+/* Every request has room for this many bytes after it, so that wrappers
+ * that embed a struct sdo_req can be allocated from the same pool.
+ */
+#define SDO_REQ_EXTRA_SIZE (4 * sizeof(void*))
+
+struct sdo_req* sdo_req_alloc(void);
 struct sdo_req* sdo_req_new(struct sdo_req_info* info);
 void sdo_req_free(struct sdo_req* self);
+void sdo_req_pool_cleanup(void);
 
 int sdo_req_start(struct sdo_req* self, struct sdo_req_queue* queue);
 void sdo_req_wait(struct sdo_req* self);
 
+/* Removes a request that is still waiting in its queue. The on_done callback
+ * will not be called for it. Returns -1 if the transfer has already begun, in
+ * which case on_done will be called when it finishes.
+ */
+int sdo_req_cancel(struct sdo_req* self);
+
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req);
 struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self);
 
+unsigned long sdo_req_queue__timeout(const struct sdo_req_queue* self,
+				     const struct sdo_async* channel,
+				     const struct sdo_req* req);
+struct sdo_async*
+sdo_req_queue__get_free_channel(const struct sdo_req_queue* self,
+				const struct sdo_req* req);
+
 static inline
 struct sdo_req_queue* sdo_req_queue__from_async(const struct sdo_async* async)
 {
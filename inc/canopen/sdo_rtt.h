@@ -0,0 +1,92 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* SDO round-trip time estimator
+ *
+ * Smoothed round-trip time and variance are tracked in the same way as TCP
+ * does it (RFC 6298). Times are in microseconds. The timeout is doubled for
+ * each consecutive timeout, up to SDO_RTT_BACKOFF_MAX times, and goes back to
+ * normal with the next sample.
+ */
+
+#ifndef SDO_RTT_H_
+#define SDO_RTT_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define SDO_RTT_INITIAL_TIMEOUT 1000 /* ms */
+#define SDO_RTT_BACKOFF_MAX 4
+
+struct sdo_rtt {
+	uint32_t srtt;
+	uint32_t rttvar;
+	int has_sample;
+	unsigned int backoff;
+};
+
+static inline void sdo_rtt_reset(struct sdo_rtt* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+static inline void sdo_rtt_sample(struct sdo_rtt* self, uint32_t rtt)
+{
+	self->backoff = 0;
+
+	if (!self->has_sample) {
+		self->srtt = rtt;
+		self->rttvar = rtt / 2;
+		self->has_sample = 1;
+		return;
+	}
+
+	int64_t err = (int64_t)rtt - (int64_t)self->srtt;
+	int64_t abs_err = err < 0 ? -err : err;
+
+	self->srtt = (int64_t)self->srtt + err / 8;
+	self->rttvar = (int64_t)self->rttvar
+		     + (abs_err - (int64_t)self->rttvar) / 4;
+}
+
+static inline void sdo_rtt_timed_out(struct sdo_rtt* self)
+{
+	if (self->backoff < SDO_RTT_BACKOFF_MAX)
+		++self->backoff;
+}
+
+/* Returns the timeout in milliseconds, clamped to [min, max]. Until the first
+ * sample arrives, SDO_RTT_INITIAL_TIMEOUT is used as the base.
+ */
+static inline unsigned long sdo_rtt_timeout(const struct sdo_rtt* self,
+					    unsigned long min,
+					    unsigned long max)
+{
+	uint64_t rto = self->has_sample
+		     ? (self->srtt + 4ULL * self->rttvar + 999ULL) / 1000ULL
+		     : SDO_RTT_INITIAL_TIMEOUT;
+
+	rto <<= self->backoff;
+
+	if (rto < min)
+		return min;
+
+	if (rto > max)
+		return max;
+
+	return rto;
+}
+
+#endif /* SDO_RTT_H_ */
@@ -0,0 +1,97 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SDO_TRACE_H_
+#define SDO_TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Binary trace file format:
+ *
+ * The file starts with a struct sdo_trace_file_header, followed by records of
+ * the size given in the header. All values are in host byte order. Times are
+ * in microseconds on CLOCK_MONOTONIC; a time of zero means that the event
+ * never happened.
+ */
+#define SDO_TRACE_MAGIC "COSDOTRC"
+#define SDO_TRACE_VERSION 1
+
+struct sdo_trace_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+} __attribute__((packed));
+
+struct sdo_trace_record {
+	uint64_t enqueue_time;
+	uint64_t start_time;
+	uint64_t first_response_time;
+	uint64_t done_time;
+	uint64_t callback_done_time;
+	uint32_t size;
+	uint32_t abort_code;
+	uint16_t index;
+	uint8_t subindex;
+	uint8_t nodeid;
+	uint8_t type;
+	uint8_t status;
+	uint8_t n_retries;
+	uint8_t reserved_;
+	uint32_t n_segments;
+} __attribute__((packed));
+
+/* Bucket i counts latencies in [2^i, 2^(i+1)) us; bucket 0 also counts 0 */
+#define SDO_TRACE_HIST_BUCKETS 24
+
+struct sdo_trace_hist {
+	uint32_t bucket[SDO_TRACE_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+};
+
+struct sdo_trace_node_stats {
+	struct sdo_trace_hist queue;
+	struct sdo_trace_hist bus;
+	struct sdo_trace_hist callback;
+	struct sdo_trace_hist total;
+	uint64_t n_aborts;
+	uint64_t n_retries;
+	uint64_t bytes;
+};
+
+extern int sdo_trace_enabled;
+
+int sdo_trace_init(const char* path);
+void sdo_trace_cleanup(void);
+void sdo_trace_reset(void);
+
+void sdo_trace_record(const struct sdo_trace_record* record);
+
+void sdo_trace_hist_add(struct sdo_trace_hist* self, uint64_t value);
+uint64_t sdo_trace_hist_percentile(const struct sdo_trace_hist* self,
+				   double p);
+
+const struct sdo_trace_node_stats* sdo_trace_get_node_stats(int nodeid);
+const struct sdo_trace_hist* sdo_trace_get_obj_hist(int nodeid, int index,
+						    int subindex);
+
+/* Writes the statistics as JSON. A nodeid of 0 gives a summary of all nodes.
+ * Otherwise, per-object histograms for that node are included.
+ */
+void sdo_trace_print_json(FILE* output, int nodeid);
+
+#endif /* SDO_TRACE_H_ */
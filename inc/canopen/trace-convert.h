@@ -0,0 +1,49 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_TRACE_CONVERT_H_
+#define CANOPEN_TRACE_CONVERT_H_
+
+#include <stdint.h>
+
+enum co_trace_format {
+	CO_TRACE_FORMAT_AUTO = 0,
+	CO_TRACE_FORMAT_BUFFER, /* Array of struct tb_frame */
+	CO_TRACE_FORMAT_RING,
+	CO_TRACE_FORMAT_COMPACT,
+	CO_TRACE_FORMAT_CANDUMP, /* candump -l log file */
+};
+
+struct co_trace_convert_options {
+	enum co_trace_format input_format;
+	enum co_trace_format output_format;
+
+	/* Only frames within [begin, end] are converted. Times are in
+	 * microseconds since the epoch and an end of 0 means no limit.
+	 */
+	uint64_t begin;
+	uint64_t end;
+
+	/* Interface name for candump output */
+	const char* iface;
+};
+
+enum co_trace_format co_trace_format_from_string(const char* str);
+
+/* An output path of "-" writes to stdout */
+int co_trace_convert(const char* input, const char* output,
+		     const struct co_trace_convert_options* options);
+
+#endif /* CANOPEN_TRACE_CONVERT_H_ */
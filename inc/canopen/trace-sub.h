@@ -0,0 +1,149 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Trace subscriptions
+ *
+ * The master serves a filtered view of the bus over TCP. A subscriber sends a
+ * line of filter options and then receives the frames that pass the filter in
+ * batches. Each subscriber has its own bounded queue and is only ever written
+ * to without blocking, so a subscriber that cannot keep up loses its own
+ * frames and is told how many, while the others are not affected.
+ *
+ * The subscription line is made up of space separated options, all of which
+ * are optional. An empty line subscribes to everything:
+ *
+ *   nodes=<nodeid>[-<nodeid>],...    Only frames of these nodes
+ *   objects=<type>,...               Only these types, as for canopen-replay
+ *   index=<index>[-<index>]          Only SDO frames of these objects
+ *   decimate=[<cob-id>:]<n>          Only every n-th frame of each COB-ID
+ *   interval=[<cob-id>:]<ms>         At most one frame per ms of each COB-ID
+ *
+ * Without a COB-ID, decimate and interval apply to all COB-IDs; later options
+ * override earlier ones. Frames that do not belong to a node, such as SYNC,
+ * are not affected by the node filter. A new line replaces the subscription.
+ */
+
+#ifndef CANOPEN_TRACE_SUB_H_
+#define CANOPEN_TRACE_SUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/can.h>
+
+#include "canopen/nodeset.h"
+
+#define TRACE_SUB_DEFAULT_PORT 5556
+#define TRACE_SUB_LINE_MAX 1024
+#define TRACE_SUB_BATCH_MAX 256
+#define TRACE_SUB_N_COBS (CAN_SFF_MASK + 1)
+
+/* Wire format:
+ *
+ * Each batch is a struct trace_sub_header followed by n_records records. All
+ * values are in network byte order, as in the CAN-TCP bridge. Timestamps are
+ * in microseconds since the epoch, like trace buffer timestamps. n_dropped is
+ * the number of frames that passed the filter but were dropped since the
+ * previous batch, because the subscriber's queue was full.
+ */
+#define TRACE_SUB_MAGIC "COTS"
+#define TRACE_SUB_VERSION 1
+
+struct trace_sub_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t n_records;
+	uint32_t seq;
+	uint32_t n_dropped;
+} __attribute__((packed));
+
+struct trace_sub_record {
+	uint64_t timestamp;
+	uint32_t can_id;
+	uint8_t can_dlc;
+	uint8_t reserved_[3];
+	uint8_t data[8];
+} __attribute__((packed));
+
+struct trace_sub_config {
+	int port;
+	size_t queue_size; /* bytes */
+	unsigned int batch_size; /* frames, at most TRACE_SUB_BATCH_MAX */
+	unsigned int flush_interval; /* ms */
+};
+
+struct trace_sub_filter {
+	struct co_nodeset nodes; /* Empty means all nodes */
+	unsigned int objects; /* A mask of enum canopen_object; 0 means all */
+	uint16_t index_min, index_max;
+	uint16_t decimation[TRACE_SUB_N_COBS];
+	uint32_t min_interval[TRACE_SUB_N_COBS]; /* us */
+};
+
+struct trace_sub_stats {
+	uint64_t n_frames;
+	uint64_t n_filtered;
+	uint64_t n_dropped;
+	uint64_t n_batches;
+};
+
+struct trace_sub_client;
+
+int trace_sub_filter_parse(struct trace_sub_filter* filter, const char* line);
+
+/* The client takes ownership of fd, which should be non-blocking */
+struct trace_sub_client*
+trace_sub_client_new(int fd, const struct trace_sub_config* config);
+void trace_sub_client_free(struct trace_sub_client* self);
+
+/* Frames are ignored until the client is subscribed, and also after a
+ * subscription line that cannot be parsed.
+ */
+int trace_sub_client_subscribe(struct trace_sub_client* self,
+			       const char* line);
+
+void trace_sub_client_feed(struct trace_sub_client* self, uint64_t timestamp,
+			   const struct can_frame* cf);
+
+/* Closes the current batch and sends as much of the queue as the socket will
+ * take. Returns -1 if the subscriber has gone away.
+ */
+int trace_sub_client_flush(struct trace_sub_client* self);
+
+const struct trace_sub_stats*
+trace_sub_client_get_stats(const struct trace_sub_client* self);
+
+/* The service on the main loop of the master */
+int trace_sub_init(const struct trace_sub_config* config);
+void trace_sub_cleanup(void);
+
+/* timestamp is the capture time in microseconds (CLOCK_REALTIME), so that
+ * subscribers see the same time as the trace files, or 0 for the current
+ * time.
+ */
+void trace_sub_feed(const struct can_frame* cf, uint64_t timestamp);
+
+/* Subscriber side. The address is host[:port]. Returns a connected socket or
+ * -1.
+ */
+int trace_sub_connect(const char* addr, const char* line);
+
+/* Reads one batch into records, which must have room for TRACE_SUB_BATCH_MAX
+ * records. The header is converted to host byte order and so are the records.
+ * Returns 1 on success, 0 at the end of the stream or -1 on error.
+ */
+int trace_sub_read_batch(int fd, struct trace_sub_header* header,
+			 struct trace_sub_record* records);
+
+#endif /* CANOPEN_TRACE_SUB_H_ */
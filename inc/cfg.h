@@ -31,14 +31,40 @@
 	X(bool, use_tcp, 0) \
 	X(uint, heartbeat_period, 0 /* ms */) \
 	X(uint, heartbeat_timeout, 0 /* ms */) \
+	X(uint, heartbeat_tick, 10 /* ms */) \
+	X(uint, heartbeat_shards, 1) \
 	X(uint, n_timeouts_max, 2) \
 	X(uint, range_start, 0) \
 	X(uint, range_stop, 0) \
+	X(uint, discovery_probe_delay, 100 /* ms */) \
+	X(uint, discovery_timeout, 500 /* ms */) \
+	X(string, expected_nodes, "" /* <nodeid>[-<nodeid>],... */) \
+	X(bool, pipelined_bootup, 0) \
+	X(bool, preload_drivers, 0) \
+	X(string, lss_node_ids, "" /* <nodeid>[-<nodeid>],... */) \
+	X(uint, lss_timeout, 10 /* ms */) \
 	X(uint, sync_interval, 0 /* us */) \
 	X(uint, trace_buffer_size, 0) \
 	X(string, trace_dump_path, "/var/log/canopen") \
 	X(bool, enable_bootup_trace, 0) \
 	X(bool, enable_incident_trace, 0) \
+	X(string, incident_triggers, "heartbeat-timeout") \
+	X(uint, incident_pre_trigger, 0 /* ms */) \
+	X(uint, incident_post_trigger, 0 /* ms */) \
+	X(uint, incident_min_interval, 10000 /* ms */) \
+	X(uint, incident_max_files, 16) \
+	X(bool, enable_persistent_trace, 0) \
+	X(bool, compress_trace_dump, 0) \
+	X(bool, enable_sdo_trace, 0) \
+	X(string, sdo_trace_path, "") \
+	X(bool, enable_trace_sub, 0) \
+	X(uint, trace_sub_port, 5556) \
+	X(uint, trace_sub_queue_size, 65536 /* bytes */) \
+	X(uint, trace_sub_batch_size, 64 /* frames */) \
+	X(uint, trace_sub_flush_interval, 100 /* ms */) \
+	X(bool, enable_boot_cache, 0) \
+	X(string, boot_cache_path, "/var/cache/canopen/boot-cache") \
+	X(string, dcf_path, "" /* directory */) \
 
 #define CFG__NODE_PARAMETERS \
 	X(bool, has_zero_guard_status, 0) \
@@ -48,6 +74,16 @@
 	X(uint, heartbeat_timeout, 1000 /* ms */) \
 	X(uint, n_timeouts_max, 0) \
 	X(bool, enable_node_guarding, 1) \
+	X(uint, sdo_timeout, 0 /* ms; 0 = adaptive */) \
+	X(uint, sdo_timeout_min, 1000 /* ms */) \
+	X(uint, sdo_timeout_max, 5000 /* ms */) \
+	X(string, sdo_object_timeouts, "" /* <index>[:<subindex>]=<ms>,... */) \
+	X(uint, sdo_retries, 0) \
+	X(uint, sdo_retry_backoff, 50 /* ms */) \
+	X(string, sdo_channels, "" /* <rx cob-id>:<tx cob-id>,... */) \
+	X(string, start_after, "" /* <nodeid>,... */) \
+	X(bool, store_parameters, 0) \
+	X(uint, reintegration_grace_period, 0 /* ms; 0 = disabled */) \
 
 #define CFG__DEFINE_bool(name) int name
 #define CFG__DEFINE_uint(name) uint64_t name
@@ -40,6 +40,8 @@
 #define co_atomic_add_fetch(ptr, value) \
 	__atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST)
 
+#define co_atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
 #else
 
 #define co_atomic_cas(ptr, expected, desired) \
@@ -63,6 +65,8 @@
 #define co_atomic_sub_fetch(ptr, value) __sync_sub_and_fetch(ptr, value)
 #define co_atomic_add_fetch(ptr, value) __sync_add_and_fetch(ptr, value)
 
+#define co_atomic_fence() __sync_synchronize()
+
 #endif /* HAVE_NEW_ATOMICS */
 
 #undef HAVE_NEW_ATOMICS
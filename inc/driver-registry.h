@@ -0,0 +1,46 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CANOPEN_DRIVER_REGISTRY_H_
+#define CANOPEN_DRIVER_REGISTRY_H_
+
+#include <stddef.h>
+
+/* Driver registry
+ *
+ * Every driver DSO is opened once and its handle and init function are shared
+ * by all nodes that use it. The driver directory is scanned up front so that
+ * the known drivers can be preloaded before any node needs them.
+ */
+
+/* A NULL path means the default driver path */
+int driver_registry_init(const char* path);
+void driver_registry_cleanup(void);
+
+size_t driver_registry_length(void);
+const char* driver_registry_name(size_t index);
+
+/* Opens the DSO of a scanned driver. This is safe to call from worker
+ * threads. Returns 0 on success and -1 if the driver could not be loaded.
+ */
+int driver_registry_preload(size_t index);
+
+/* Looks up a driver by name, loading it if needed. Drivers that are not found
+ * in the directory scan are looked up on disk once; failures are remembered.
+ * The handle is owned by the registry and must not be closed.
+ */
+int driver_registry_get(const char* name, void** dso, void** init_fn);
+
+#endif /* CANOPEN_DRIVER_REGISTRY_H_ */
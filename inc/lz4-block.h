@@ -0,0 +1,45 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* LZ4 block compression
+ *
+ * A small implementation of the LZ4 block format, so that trace files can be
+ * compressed without depending on liblz4. Blocks written here can be
+ * decompressed by any LZ4 implementation and vice versa. The compressor is
+ * a simple greedy one with a single hash table.
+ */
+
+#ifndef LZ4_BLOCK_H_
+#define LZ4_BLOCK_H_
+
+#include <stddef.h>
+
+/* The largest compressed size of src_size bytes of input */
+static inline size_t lz4_block_bound(size_t src_size)
+{
+	return src_size + src_size / 255 + 16;
+}
+
+/* Returns the compressed size, or -1 if it does not fit into dst_size */
+int lz4_block_compress(void* dst, size_t dst_size, const void* src,
+		       size_t src_size);
+
+/* Returns the decompressed size, or -1 if the input is malformed or the
+ * output does not fit into dst_size.
+ */
+int lz4_block_decompress(void* dst, size_t dst_size, const void* src,
+			 size_t src_size);
+
+#endif /* LZ4_BLOCK_H_ */
@@ -38,6 +38,7 @@ ssize_t net_filtered_read_frame(int fd, struct can_frame* cf, int timeout,
  */
 int net_dont_block(int fd);
 int net_fix_sndbuf(int fd);
+int net_grow_rcvbuf(int fd, int size);
 int net_reuse_addr(int fd);
 int net_dont_delay(int fd);
 
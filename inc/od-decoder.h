@@ -0,0 +1,119 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Symbolic decoding of object dictionary traffic
+ *
+ * A passive observer of the bus learns what it can about each node: its
+ * identity from uploads of 0x1018, and its PDO mappings from transfers of
+ * 0x1600-0x1603 and 0x1A00-0x1A03. The identity selects an EDS which gives
+ * names and types of objects. Until a mapping has been seen on the bus, the
+ * default mapping from the EDS is used. A DCF may be supplied in place of the
+ * observed values.
+ *
+ * Object lookups go through a small direct-mapped cache per node, so that
+ * decoding PDOs does not search the EDS tree for every frame.
+ */
+
+#ifndef OD_DECODER_H_
+#define OD_DECODER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "canopen/types.h"
+
+#define OD_DECODER_N_PDOS 4
+#define OD_DECODER_MAX_MAPPED 64
+#define OD_DECODER_CACHE_SIZE 64 /* Must be a power of 2 */
+
+struct canopen_eds;
+struct eds_obj;
+struct co_dcf;
+
+enum od_decoder_pdo_type {
+	OD_DECODER_RPDO = 0,
+	OD_DECODER_TPDO,
+};
+
+enum od_decoder_source {
+	OD_DECODER_SOURCE_NONE = 0,
+	OD_DECODER_SOURCE_DEFAULT,
+	OD_DECODER_SOURCE_ACTUAL,
+};
+
+struct od_decoder_mapping {
+	enum od_decoder_source source;
+	uint8_t n_entries;
+	uint32_t entry[OD_DECODER_MAX_MAPPED];
+};
+
+struct od_decoder_cache_entry {
+	uint32_t key; /* index << 8 | subindex, plus one; 0 is empty */
+	const struct eds_obj* obj;
+};
+
+struct od_decoder_node {
+	uint32_t vendor;
+	uint32_t product;
+	uint32_t revision;
+	const struct canopen_eds* eds;
+	int is_eds_fixed;
+
+	struct od_decoder_mapping mapping[2][OD_DECODER_N_PDOS];
+
+	struct od_decoder_cache_entry cache[OD_DECODER_CACHE_SIZE];
+};
+
+struct od_decoder {
+	struct od_decoder_node node[127];
+};
+
+void od_decoder_init(struct od_decoder* self);
+
+/* Fixes the EDS of a node so that it is not looked up by identity */
+int od_decoder_set_eds(struct od_decoder* self, int nodeid,
+		       const struct canopen_eds* eds);
+
+/* Identity and PDO mappings are taken from the configuration */
+int od_decoder_load_dcf(struct od_decoder* self, int nodeid,
+			const struct co_dcf* dcf);
+
+/* Feeds the value of an object, as seen in an SDO transfer */
+void od_decoder_learn(struct od_decoder* self, int nodeid, int index,
+		      int subindex, const void* data, size_t size);
+
+const struct eds_obj* od_decoder_find(struct od_decoder* self, int nodeid,
+				      int index, int subindex);
+
+/* Objects that are not in the EDS fall back to the standard dictionary. The
+ * type is CANOPEN_UNKNOWN and the name is NULL if nothing is known.
+ */
+enum canopen_type od_decoder_type(struct od_decoder* self, int nodeid,
+				  int index, int subindex);
+const char* od_decoder_name(struct od_decoder* self, int nodeid, int index,
+			    int subindex);
+
+/* Returns NULL if the type of the object is unknown */
+char* od_decoder_format(struct od_decoder* self, char* dst, size_t dst_size,
+			int nodeid, int index, int subindex,
+			const void* data, size_t size);
+
+/* Writes the mapped objects of a PDO as "{name=value, ...}". Returns -1 if the
+ * mapping is unknown.
+ */
+int od_decoder_decode_pdo(struct od_decoder* self, char* dst, size_t dst_size,
+			  int nodeid, enum od_decoder_pdo_type type, int n,
+			  const void* data, size_t size);
+
+#endif /* OD_DECODER_H_ */
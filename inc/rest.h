@@ -36,12 +36,20 @@ enum rest_client_state {
 	REST_CLIENT_DONE
 };
 
+struct rest_client;
+
+typedef void (*rest_client_fn)(struct rest_client* client);
+
 struct rest_client {
 	int ref;
 	enum rest_client_state state;
 	struct vector buffer;
 	struct http_req req;
 	FILE* output;
+
+	/* Called before the output is closed if the client goes away */
+	rest_client_fn on_disconnect;
+	void* context;
 };
 
 typedef void (*rest_fn)(struct rest_client* client, const void* content);
@@ -61,6 +69,11 @@ int rest_register_service(enum http_method method, const char* path,
 void rest_reply(FILE* output, struct rest_reply_data* data);
 void rest_reply_header(FILE* output, struct rest_reply_data* data);
 
+/* Writes one chunk of a reply whose header had a negative content_length. A
+ * chunk of size 0 ends the reply.
+ */
+void rest_reply_chunk(FILE* output, const void* data, size_t size);
+
 void rest_client_ref(struct rest_client* self);
 int rest_client_unref(struct rest_client* self);
 
@@ -2,5 +2,6 @@
 #define SDO_REST_H_
 
 void sdo_rest_service(struct rest_client* client, const void* content);
+void sdo_rest_stats_service(struct rest_client* client, const void* content);
 
 #endif /* SDO_REST_H_ */
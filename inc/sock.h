@@ -16,6 +16,7 @@
 #ifndef CAN_SOCK_H_
 #define CAN_SOCK_H_
 
+#include <stdint.h>
 #include <unistd.h>
 
 struct can_frame;
@@ -48,6 +49,13 @@ ssize_t sock_send(const struct sock* sock, struct can_frame* cf, int flags);
 int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout);
 
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags);
+
+/* Like sock_recv(), but also yields the time in microseconds
+ * (CLOCK_REALTIME) at which the frame went into the trace buffer, or 0 if
+ * there is no trace buffer.
+ */
+ssize_t sock_recv_traced(const struct sock* sock, struct can_frame* cf,
+			 int flags, uint64_t* timestamp);
 int sock_timed_recv(const struct sock* sock, struct can_frame* cf, int timeout);
 
 static inline int sock_close(struct sock* sock)
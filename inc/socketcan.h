@@ -27,6 +27,9 @@ void socketcan_make_master_filters(struct can_filter* filters, int nodeid);
 int socketcan_open(const char* iface);
 int socketcan_apply_filters(int fd, struct can_filter* filters, int n);
 
+/* Error frames matching the mask are received as frames with CAN_ERR_FLAG */
+int socketcan_set_error_filter(int fd, can_err_mask_t mask);
+
 int socketcan_open_slave(const char* iface, int nodeid);
 int socketcan_open_master(const char* iface, int nodeid);
 
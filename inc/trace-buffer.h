@@ -27,17 +27,74 @@ struct tb_frame {
 	struct can_frame cf;
 };
 
+/* Frames are appended from the main loop and from worker threads without
+ * locking. Each producer claims a position by incrementing head and then
+ * fills the slot at that position. The sequence number of a slot is odd while
+ * it is being written and 2 * (position + 1) when it holds the frame for that
+ * position, so a reader can tell whether its copy is consistent.
+ */
+struct tb_slot {
+	unsigned long seq;
+	struct tb_frame frame;
+};
+
+/* Ring file format:
+ *
+ * A file-backed ring starts with a struct tb_file_header, followed by length
+ * slots of slot_size bytes. head is the number of frames ever appended, so the
+ * write index is head % length and the wrap count is head / length. The file
+ * is written through a shared mapping, so it is up to date after a crash
+ * without any I/O from the master. It can only be read on a machine with the
+ * same word size and byte order.
+ */
+#define TB_FILE_MAGIC "COTRCRNG"
+#define TB_FILE_VERSION 1
+
+struct tb_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint64_t length;
+	union {
+		unsigned long head;
+		uint64_t head_storage_;
+	};
+	char reserved_[32];
+};
+
 struct tracebuffer {
 	size_t length;
-	size_t index;
-	size_t count;
-	int is_blocked;
-	struct tb_frame* data;
+	struct tb_file_header* header;
+	struct tb_slot* slots;
+	size_t map_size; /* 0 if the ring is on the heap */
 };
 
 int tb_init(struct tracebuffer* self, size_t size);
+
+/* Creates a ring of the given size in a file. An existing file at path is
+ * kept as <path>.prev, so that the trace leading up to a crash survives the
+ * restart.
+ */
+int tb_init_file(struct tracebuffer* self, const char* path, size_t size);
+
+/* Maps a ring file read-only for tb_snapshot() */
+int tb_open_file(struct tracebuffer* self, const char* path);
+
 void tb_destroy(struct tracebuffer* self);
 void tb_append(struct tracebuffer* self, const struct can_frame* frame);
-void tb_dump(struct tracebuffer* self, FILE* stream);
+
+/* timestamp is in microseconds, from CLOCK_REALTIME */
+void tb_append_at(struct tracebuffer* self, const struct can_frame* frame,
+		  uint64_t timestamp);
+
+/* Copies the frames in the buffer, oldest first, into dst, which must have
+ * room for self->length frames. Producers are not held up; frames that are
+ * overwritten while they are being copied are left out. Returns the number of
+ * frames copied.
+ */
+size_t tb_snapshot(struct tracebuffer* self, struct tb_frame* dst);
+
+/* Writes a snapshot as an array of struct tb_frame */
+int tb_dump(struct tracebuffer* self, FILE* stream);
 
 #endif /* _TRACE_BUFFER_H */
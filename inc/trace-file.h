@@ -0,0 +1,146 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TRACE_FILE_H_
+#define TRACE_FILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace-buffer.h"
+#include "vector.h"
+
+/* Compact trace file format:
+ *
+ * The file starts with a struct tf_file_header and is followed by blocks of
+ * frames. Each block has a struct tf_block_header and a payload of stored_size
+ * bytes which, after decompression, holds n_frames frames encoded as:
+ *
+ *  - timestamp difference from the previous frame in the block, as a zigzag
+ *    varint (the first frame is relative to min_timestamp of the block)
+ *  - can_id as a varint
+ *  - can_dlc as one byte, followed by min(can_dlc, 8) data bytes
+ *
+ * After the last block comes an index with a struct tf_index_entry per block
+ * and a struct tf_file_trailer. A file without a trailer, e.g. one that was
+ * cut short, can still be read sequentially. Header fields are in host byte
+ * order and timestamps are in microseconds.
+ */
+#define TF_FILE_MAGIC "COTRACE1"
+
+/* File name suffixes that tell compact files from raw struct tb_frame dumps */
+#define TF_FILE_SUFFIX ".cotrace"
+#define TF_RAW_FILE_SUFFIX ".trace"
+
+#define TF_TRAILER_MAGIC "COTRCIDX"
+#define TF_FILE_VERSION 1
+#define TF_BLOCK_MAGIC 0x4b424654 /* "TFBK" */
+
+/* Blocks are closed when their encoded size reaches this */
+#define TF_BLOCK_SIZE (64 * 1024)
+
+enum tf_flags {
+	TF_COMPRESS_LZ4 = 1,
+};
+
+struct tf_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct tf_block_header {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t raw_size;
+	uint32_t stored_size;
+	uint32_t n_frames;
+	uint32_t reserved_;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+} __attribute__((packed));
+
+struct tf_index_entry {
+	uint64_t offset;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+	uint32_t n_frames;
+	uint32_t reserved_;
+} __attribute__((packed));
+
+struct tf_file_trailer {
+	uint64_t index_offset;
+	uint32_t n_blocks;
+	uint32_t reserved_;
+	char magic[8];
+} __attribute__((packed));
+
+struct tf_writer {
+	FILE* stream;
+	int flags;
+	uint64_t offset;
+	struct vector block;
+	struct vector buffer;
+	struct vector index;
+	uint32_t n_frames;
+	uint64_t timestamp;
+	uint64_t first_timestamp;
+	uint64_t min_timestamp;
+	uint64_t max_timestamp;
+};
+
+struct tf_reader {
+	FILE* stream;
+	struct vector block;
+	struct vector buffer;
+	size_t pos;
+	uint32_t n_left;
+	uint64_t timestamp;
+	uint64_t begin;
+	struct tf_index_entry* index;
+	uint32_t n_blocks;
+};
+
+/* The writer does not own the stream; it is left open by tf_writer_finish() */
+int tf_writer_init(struct tf_writer* self, FILE* stream, int flags);
+int tf_writer_add(struct tf_writer* self, const struct tb_frame* frame);
+
+/* Flushes the last block and writes the index */
+int tf_writer_finish(struct tf_writer* self);
+
+int tf_write_frames(FILE* stream, const struct tb_frame* frames, size_t n,
+		    int flags);
+
+/* The stream must be positioned at the start of the file. The index is only
+ * loaded if the stream is seekable.
+ */
+int tf_reader_init(struct tf_reader* self, FILE* stream);
+void tf_reader_destroy(struct tf_reader* self);
+
+/* Positions the reader at the first frame with a timestamp at or after the
+ * given one. Blocks that end before it are skipped without being decoded.
+ */
+int tf_reader_seek(struct tf_reader* self, uint64_t timestamp);
+
+/* Returns 1 if a frame was read, 0 at the end of the file and -1 on error */
+int tf_reader_next(struct tf_reader* self, struct tb_frame* frame);
+
+static inline int tf_is_trace_file(const char* magic)
+{
+	return memcmp(magic, TF_FILE_MAGIC, 8) == 0;
+}
+
+#endif /* TRACE_FILE_H_ */
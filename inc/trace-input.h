@@ -0,0 +1,55 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Reading of trace files
+ *
+ * Frames are read in order from a trace buffer dump, a trace ring file, a
+ * compact trace file or a candump log.
+ */
+
+#ifndef TRACE_INPUT_H_
+#define TRACE_INPUT_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "trace-buffer.h"
+#include "trace-file.h"
+#include "canopen/trace-convert.h"
+
+struct trace_input {
+	enum co_trace_format format;
+	FILE* stream;
+	struct tf_reader reader;
+	struct tracebuffer tb;
+	struct tb_frame* frames;
+	size_t n_frames;
+	size_t pos;
+	char* line;
+	size_t line_size;
+};
+
+/* The format is detected from the file if it is CO_TRACE_FORMAT_AUTO. Compact
+ * files are read from the first block that may hold frames at or after begin;
+ * the other formats are read from the start.
+ */
+int trace_input_open(struct trace_input* self, const char* path,
+		     enum co_trace_format format, uint64_t begin);
+void trace_input_close(struct trace_input* self);
+
+/* Returns 1 if a frame was read, 0 at the end and -1 on error */
+int trace_input_next(struct trace_input* self, struct tb_frame* frame);
+
+#endif /* TRACE_INPUT_H_ */
@@ -18,16 +18,40 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+
+/* Vectors that are initialised with a size of VECTOR_INLINE_SIZE or less keep
+ * their data inside the vector object until they outgrow it. Such a vector
+ * points into itself, so it must not be copied or moved by value; use
+ * vector_swap() instead.
+ */
+#define VECTOR_INLINE_SIZE 8
 
 struct vector {
 	void* data;
 	size_t index;
 	size_t size;
+	union {
+		char bytes[VECTOR_INLINE_SIZE];
+		uint64_t align_;
+	} inline_data;
 };
 
+static inline int vector__is_inline(const struct vector* self)
+{
+	return self->data == self->inline_data.bytes;
+}
+
 static inline int vector_init(struct vector* self, size_t size)
 {
 	memset(self, 0, sizeof(*self));
+
+	if (size <= VECTOR_INLINE_SIZE) {
+		self->size = VECTOR_INLINE_SIZE;
+		self->data = self->inline_data.bytes;
+		return 0;
+	}
+
 	self->size = size;
 	self->data = malloc(size);
 	return self->data ? 0 : -1;
@@ -35,15 +59,27 @@ static inline int vector_init(struct vector* self, size_t size)
 
 static inline void vector_destroy(struct vector* self)
 {
-	free(self->data);
+	if (!vector__is_inline(self))
+		free(self->data);
+
 	self->data = NULL;
 }
 
 static inline int vector__grow(struct vector* self, size_t size)
 {
-	void* data = realloc(self->data, size);
-	if (!data)
-		return -1;
+	void* data;
+
+	if (vector__is_inline(self)) {
+		data = malloc(size);
+		if (!data)
+			return -1;
+		memcpy(data, self->inline_data.bytes, self->index);
+	} else {
+		data = realloc(self->data, size);
+		if (!data)
+			return -1;
+	}
+
 	self->data = data;
 	self->size = size;
 	return 1;
@@ -95,4 +131,18 @@ static inline int vector_copy(struct vector* dst, const struct vector* src)
 	return vector_assign(dst, src->data, src->index);
 }
 
+/* Exchanges the contents of two vectors without copying heap data */
+static inline void vector_swap(struct vector* a, struct vector* b)
+{
+	struct vector tmp = *a;
+	*a = *b;
+	*b = tmp;
+
+	if (a->data == b->inline_data.bytes)
+		a->data = a->inline_data.bytes;
+
+	if (b->data == a->inline_data.bytes)
+		b->data = b->inline_data.bytes;
+}
+
 #endif /* _VECTOR_H_INCLUDED */
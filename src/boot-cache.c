@@ -0,0 +1,250 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Boot cache
+ *
+ * The identity and version strings of every node are stored on disk so that
+ * they don't have to be read over SDO again on the next start-up. An entry is
+ * only used after the identity object of the node has been read and found to
+ * match the entry.
+ *
+ * Entries are read and written by the driver loading jobs on worker threads,
+ * so access is serialised with a mutex.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "canopen.h"
+#include "boot-cache.h"
+#include "plog.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+static pthread_mutex_t boot_cache__mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct boot_cache_entry boot_cache__entries[CANOPEN_NODEID_MAX + 1];
+static char boot_cache__path[256];
+static int boot_cache__is_dirty = 0;
+
+static inline int boot_cache__is_valid_nodeid(int nodeid)
+{
+	return CANOPEN_NODEID_MIN <= nodeid && nodeid <= CANOPEN_NODEID_MAX;
+}
+
+static int boot_cache__is_header_valid(const struct boot_cache_file_header* h)
+{
+	return memcmp(h->magic, BOOT_CACHE_MAGIC, sizeof(h->magic)) == 0
+	    && h->version == BOOT_CACHE_VERSION
+	    && h->entry_size == sizeof(struct boot_cache_entry)
+	    && h->n_entries == CANOPEN_NODEID_MAX + 1;
+}
+
+static int boot_cache__read(FILE* file)
+{
+	struct boot_cache_file_header header;
+
+	if (fread(&header, sizeof(header), 1, file) != 1)
+		return -1;
+
+	if (!boot_cache__is_header_valid(&header))
+		return -1;
+
+	if (fread(boot_cache__entries, sizeof(boot_cache__entries), 1, file)
+			!= 1)
+		return -1;
+
+	return 0;
+}
+
+int boot_cache_load(const char* path)
+{
+	memset(boot_cache__entries, 0, sizeof(boot_cache__entries));
+	boot_cache__is_dirty = 0;
+
+	if (!path || !*path)
+		return -1;
+
+	strlcpy(boot_cache__path, path, sizeof(boot_cache__path));
+
+	FILE* file = fopen(path, "r");
+	if (!file)
+		return 0;
+
+	if (boot_cache__read(file) < 0) {
+		plog(LOG_NOTICE, "boot_cache_load: Ignoring stale or invalid boot cache \"%s\"",
+		     path);
+		memset(boot_cache__entries, 0, sizeof(boot_cache__entries));
+	}
+
+	fclose(file);
+	return 0;
+}
+
+static int boot_cache__write(const char* path)
+{
+	struct boot_cache_file_header header = {
+		.version = BOOT_CACHE_VERSION,
+		.entry_size = sizeof(struct boot_cache_entry),
+		.n_entries = CANOPEN_NODEID_MAX + 1,
+	};
+
+	memcpy(header.magic, BOOT_CACHE_MAGIC, sizeof(header.magic));
+
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return -1;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		goto failure;
+
+	if (fwrite(boot_cache__entries, sizeof(boot_cache__entries), 1, file)
+			!= 1)
+		goto failure;
+
+	if (fflush(file) != 0 || fsync(fileno(file)) < 0)
+		goto failure;
+
+	return fclose(file) == 0 ? 0 : -1;
+
+failure:
+	fclose(file);
+	return -1;
+}
+
+/* The rename is only durable once the directory holding the cache is synced */
+static int boot_cache__sync_dir(const char* path)
+{
+	char dir[sizeof(boot_cache__path)];
+	strlcpy(dir, path, sizeof(dir));
+
+	char* slash = strrchr(dir, '/');
+	if (!slash)
+		strlcpy(dir, ".", sizeof(dir));
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+
+	int rc = fsync(fd);
+	close(fd);
+	return rc;
+}
+
+int boot_cache_save(void)
+{
+	char tmp_path[sizeof(boot_cache__path) + 4];
+	int rc = 0;
+
+	if (!boot_cache_is_enabled())
+		return -1;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	if (!boot_cache__is_dirty)
+		goto done;
+
+	/* Write to a temporary file first and sync it, so that a power failure
+	 * leaves either the old or the new cache behind.
+	 */
+	snprintf(tmp_path, sizeof(tmp_path), "%s.new", boot_cache__path);
+
+	if (boot_cache__write(tmp_path) < 0
+	 || rename(tmp_path, boot_cache__path) < 0) {
+		plog(LOG_WARNING, "boot_cache_save: Could not write \"%s\"",
+		     boot_cache__path);
+		remove(tmp_path);
+		rc = -1;
+		goto done;
+	}
+
+	if (boot_cache__sync_dir(boot_cache__path) < 0)
+		plog(LOG_WARNING, "boot_cache_save: Could not sync the directory of \"%s\"",
+		     boot_cache__path);
+
+	boot_cache__is_dirty = 0;
+
+done:
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return rc;
+}
+
+void boot_cache_cleanup(void)
+{
+	boot_cache_save();
+	boot_cache__path[0] = '\0';
+}
+
+int boot_cache_is_enabled(void)
+{
+	return boot_cache__path[0] != '\0';
+}
+
+int boot_cache_get(int nodeid, struct boot_cache_entry* entry)
+{
+	int rc = -1;
+
+	if (!boot_cache_is_enabled() || !boot_cache__is_valid_nodeid(nodeid))
+		return -1;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	if (boot_cache__entries[nodeid].is_valid) {
+		*entry = boot_cache__entries[nodeid];
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&boot_cache__mutex);
+	return rc;
+}
+
+void boot_cache_set(int nodeid, const struct boot_cache_entry* entry)
+{
+	if (!boot_cache_is_enabled() || !boot_cache__is_valid_nodeid(nodeid))
+		return;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	struct boot_cache_entry* dst = &boot_cache__entries[nodeid];
+	struct boot_cache_entry src = *entry;
+	src.is_valid = 1;
+
+	if (memcmp(dst, &src, sizeof(*dst)) != 0) {
+		*dst = src;
+		boot_cache__is_dirty = 1;
+	}
+
+	pthread_mutex_unlock(&boot_cache__mutex);
+}
+
+void boot_cache_invalidate(int nodeid)
+{
+	if (!boot_cache_is_enabled() || !boot_cache__is_valid_nodeid(nodeid))
+		return;
+
+	pthread_mutex_lock(&boot_cache__mutex);
+
+	if (boot_cache__entries[nodeid].is_valid) {
+		boot_cache__entries[nodeid].is_valid = 0;
+		boot_cache__is_dirty = 1;
+	}
+
+	pthread_mutex_unlock(&boot_cache__mutex);
+}
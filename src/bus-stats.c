@@ -0,0 +1,386 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "canopen.h"
+#include "canopen/bus-stats.h"
+
+#ifndef CAN_MAX_DLC
+#define CAN_MAX_DLC 8
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* CRC delimiter, ACK slot and delimiter, end of frame and interframe space */
+#define BUS_STATS_FRAME_TAIL_BITS (1 + 2 + 7 + 3)
+
+#define BUS_STATS_CRC15_POLY 0x4599
+
+void bus_stats_init(struct bus_stats* self, unsigned int bitrate)
+{
+	memset(self, 0, sizeof(*self));
+	self->bitrate = bitrate;
+}
+
+static void bus_stats__reset_cob(struct bus_stats_cob* cob)
+{
+	uint64_t last_time = cob->last_time;
+
+	memset(cob, 0, sizeof(*cob));
+	cob->last_time = last_time;
+}
+
+void bus_stats_reset(struct bus_stats* self)
+{
+	size_t i;
+
+	self->start_time = self->end_time;
+	self->n_frames = 0;
+	self->n_bits = 0;
+	self->n_error_frames = 0;
+	self->window_start = 0;
+	self->window_bits = 0;
+	self->peak_window_bits = 0;
+
+	for (i = 0; i < BUS_STATS_N_COBS; ++i)
+		bus_stats__reset_cob(&self->cob[i]);
+
+	bus_stats__reset_cob(&self->extended);
+
+	memset(self->sdo_latency, 0, sizeof(self->sdo_latency));
+}
+
+static size_t bus_stats__put_bits(uint8_t* bits, size_t pos, uint32_t value,
+				  unsigned int n)
+{
+	while (n-- > 0)
+		bits[pos++] = (value >> n) & 1;
+
+	return pos;
+}
+
+static unsigned int bus_stats__crc15(const uint8_t* bits, size_t n)
+{
+	unsigned int crc = 0;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		unsigned int next = bits[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7fff;
+		if (next)
+			crc ^= BUS_STATS_CRC15_POLY;
+	}
+
+	return crc;
+}
+
+/* After five equal bits, the transmitter inserts one of the opposite value,
+ * which also counts towards the next run.
+ */
+static unsigned int bus_stats__count_stuff_bits(const uint8_t* bits, size_t n)
+{
+	unsigned int n_stuffed = 0;
+	unsigned int run = 1;
+	uint8_t prev = bits[0];
+	size_t i;
+
+	for (i = 1; i < n; ++i) {
+		if (bits[i] != prev) {
+			prev = bits[i];
+			run = 1;
+			continue;
+		}
+
+		if (++run == 5) {
+			++n_stuffed;
+			prev = !prev;
+			run = 1;
+		}
+	}
+
+	return n_stuffed;
+}
+
+unsigned int bus_stats_frame_bits(const struct can_frame* cf)
+{
+	uint8_t bits[160];
+	size_t n = 0;
+	int is_rtr = !!(cf->can_id & CAN_RTR_FLAG);
+	unsigned int dlc = MIN(cf->can_dlc, CAN_MAX_DLC);
+	unsigned int i;
+
+	n = bus_stats__put_bits(bits, n, 0, 1); /* SOF */
+
+	if (cf->can_id & CAN_EFF_FLAG) {
+		uint32_t id = cf->can_id & CAN_EFF_MASK;
+		n = bus_stats__put_bits(bits, n, id >> 18, 11);
+		n = bus_stats__put_bits(bits, n, 1, 1); /* SRR */
+		n = bus_stats__put_bits(bits, n, 1, 1); /* IDE */
+		n = bus_stats__put_bits(bits, n, id, 18);
+		n = bus_stats__put_bits(bits, n, is_rtr, 1);
+		n = bus_stats__put_bits(bits, n, 0, 2); /* r1, r0 */
+	} else {
+		n = bus_stats__put_bits(bits, n, cf->can_id & CAN_SFF_MASK, 11);
+		n = bus_stats__put_bits(bits, n, is_rtr, 1);
+		n = bus_stats__put_bits(bits, n, 0, 2); /* IDE, r0 */
+	}
+
+	n = bus_stats__put_bits(bits, n, cf->can_dlc, 4);
+
+	if (!is_rtr)
+		for (i = 0; i < dlc; ++i)
+			n = bus_stats__put_bits(bits, n, cf->data[i], 8);
+
+	n = bus_stats__put_bits(bits, n, bus_stats__crc15(bits, n), 15);
+
+	return n + bus_stats__count_stuff_bits(bits, n)
+	     + BUS_STATS_FRAME_TAIL_BITS;
+}
+
+static void bus_stats__add_cob(struct bus_stats_cob* cob, uint64_t timestamp,
+			       unsigned int n_bits)
+{
+	if (cob->last_time != 0 && timestamp >= cob->last_time) {
+		uint64_t period = timestamp - cob->last_time;
+
+		if (cob->n_periods == 0 || period < cob->period_min)
+			cob->period_min = period;
+
+		if (period > cob->period_max)
+			cob->period_max = period;
+
+		cob->n_periods++;
+		cob->period_sum += period;
+		cob->period_sum_sq += (double)period * period;
+	}
+
+	cob->last_time = timestamp;
+	cob->n_frames++;
+	cob->n_bits += n_bits;
+}
+
+static void bus_stats__add_window(struct bus_stats* self, uint64_t timestamp,
+				  unsigned int n_bits)
+{
+	if (timestamp >= self->window_start + BUS_STATS_LOAD_WINDOW) {
+		if (self->window_bits > self->peak_window_bits)
+			self->peak_window_bits = self->window_bits;
+
+		self->window_start = timestamp;
+		self->window_bits = 0;
+	}
+
+	self->window_bits += n_bits;
+}
+
+static void bus_stats__add_sdo(struct bus_stats* self, uint64_t timestamp,
+			       const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return;
+
+	if (msg.object == CANOPEN_RSDO) {
+		self->sdo_request_time[msg.id] = timestamp;
+		return;
+	}
+
+	if (msg.object != CANOPEN_TSDO)
+		return;
+
+	uint64_t request_time = self->sdo_request_time[msg.id];
+	if (request_time == 0 || timestamp < request_time)
+		return;
+
+	sdo_trace_hist_add(&self->sdo_latency[msg.id],
+			   timestamp - request_time);
+	self->sdo_request_time[msg.id] = 0;
+}
+
+void bus_stats_add(struct bus_stats* self, uint64_t timestamp,
+		   const struct can_frame* cf)
+{
+	if (cf->can_id & CAN_ERR_FLAG) {
+		self->n_error_frames++;
+		return;
+	}
+
+	unsigned int n_bits = bus_stats_frame_bits(cf);
+
+	if (self->n_frames == 0 && self->start_time == 0)
+		self->start_time = timestamp;
+
+	if (timestamp > self->end_time)
+		self->end_time = timestamp;
+
+	self->n_frames++;
+	self->n_bits += n_bits;
+	bus_stats__add_window(self, timestamp, n_bits);
+
+	if (cf->can_id & CAN_EFF_FLAG) {
+		bus_stats__add_cob(&self->extended, timestamp, n_bits);
+		return;
+	}
+
+	bus_stats__add_cob(&self->cob[cf->can_id & CAN_SFF_MASK], timestamp,
+			   n_bits);
+
+	if (!(cf->can_id & CAN_RTR_FLAG))
+		bus_stats__add_sdo(self, timestamp, cf);
+}
+
+static inline double bus_stats__duration(const struct bus_stats* self)
+{
+	return (self->end_time - self->start_time) / 1e6;
+}
+
+double bus_stats_load(const struct bus_stats* self)
+{
+	double duration = bus_stats__duration(self);
+
+	if (duration <= 0 || self->bitrate == 0)
+		return 0;
+
+	return 100.0 * self->n_bits / (self->bitrate * duration);
+}
+
+double bus_stats_peak_load(const struct bus_stats* self)
+{
+	uint64_t bits = self->peak_window_bits > self->window_bits
+		      ? self->peak_window_bits : self->window_bits;
+
+	if (self->bitrate == 0)
+		return 0;
+
+	return 100.0 * bits / (self->bitrate * (BUS_STATS_LOAD_WINDOW / 1e6));
+}
+
+/* The standard deviation of the period */
+double bus_stats_period_jitter(const struct bus_stats_cob* cob)
+{
+	if (cob->n_periods < 2)
+		return 0;
+
+	double mean = cob->period_sum / cob->n_periods;
+	double variance = cob->period_sum_sq / cob->n_periods - mean * mean;
+
+	return variance > 0 ? sqrt(variance) : 0;
+}
+
+static const char* bus_stats__object_str(enum canopen_object object)
+{
+	switch (object) {
+	case CANOPEN_NMT: return "NMT";
+	case CANOPEN_SYNC: return "SYNC";
+	case CANOPEN_EMCY: return "EMCY";
+	case CANOPEN_TIMESTAMP: return "TIMESTAMP";
+	case CANOPEN_TPDO1: return "TPDO1";
+	case CANOPEN_RPDO1: return "RPDO1";
+	case CANOPEN_TPDO2: return "TPDO2";
+	case CANOPEN_RPDO2: return "RPDO2";
+	case CANOPEN_TPDO3: return "TPDO3";
+	case CANOPEN_RPDO3: return "RPDO3";
+	case CANOPEN_TPDO4: return "TPDO4";
+	case CANOPEN_RPDO4: return "RPDO4";
+	case CANOPEN_TSDO: return "TSDO";
+	case CANOPEN_RSDO: return "RSDO";
+	case CANOPEN_HEARTBEAT: return "HEARTBEAT";
+	default: break;
+	}
+
+	return "OTHER";
+}
+
+static void bus_stats__print_cob(const struct bus_stats* self, FILE* output,
+				 const char* cob_id, const char* type,
+				 int nodeid, const struct bus_stats_cob* cob)
+{
+	double duration = bus_stats__duration(self);
+	double rate = duration > 0 ? cob->n_frames / duration : 0;
+	double load = duration > 0 && self->bitrate
+		    ? 100.0 * cob->n_bits / (self->bitrate * duration) : 0;
+	double mean = cob->n_periods ? cob->period_sum / cob->n_periods : 0;
+
+	fprintf(output, "%-8s %-9s %4d %10" PRIu64 " %10.1f %6.2f %10.0f %10" PRIu64 " %10" PRIu64 " %10.1f\n",
+		cob_id, type, nodeid, cob->n_frames, rate, load, mean,
+		cob->period_min, cob->period_max,
+		bus_stats_period_jitter(cob));
+}
+
+static void bus_stats__print_sdo(const struct bus_stats* self, FILE* output)
+{
+	int is_first = 1;
+	int i;
+
+	for (i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		const struct sdo_trace_hist* hist = &self->sdo_latency[i];
+		if (hist->count == 0)
+			continue;
+
+		if (is_first)
+			fprintf(output, "\nSDO latency (us):\n"
+				"node      count       mean        p50        p90        p99        max\n");
+		is_first = 0;
+
+		fprintf(output, "%4d %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+			i, hist->count, hist->sum / hist->count,
+			sdo_trace_hist_percentile(hist, 0.5),
+			sdo_trace_hist_percentile(hist, 0.9),
+			sdo_trace_hist_percentile(hist, 0.99),
+			hist->max);
+	}
+}
+
+void bus_stats_print(const struct bus_stats* self, FILE* output)
+{
+	struct canopen_msg msg;
+	char cob_id[16];
+	size_t i;
+
+	fprintf(output, "Duration: %.3f s, frames: %" PRIu64 ", error frames: %" PRIu64 ", bus load: %.2f%% (peak %.2f%% at %u bit/s)\n\n",
+		bus_stats__duration(self), self->n_frames,
+		self->n_error_frames, bus_stats_load(self),
+		bus_stats_peak_load(self), self->bitrate);
+
+	fprintf(output, "cob-id   type      node     frames   frames/s  load%% period(us)    min(us)    max(us) jitter(us)\n");
+
+	for (i = 0; i < BUS_STATS_N_COBS; ++i) {
+		const struct bus_stats_cob* cob = &self->cob[i];
+		if (cob->n_frames == 0)
+			continue;
+
+		struct can_frame cf = { .can_id = i };
+		if (canopen_get_object_type(&msg, &cf) < 0) {
+			msg.object = CANOPEN_UNSPEC;
+			msg.id = 0;
+		}
+
+		snprintf(cob_id, sizeof(cob_id), "%#05zx", i);
+		bus_stats__print_cob(self, output, cob_id,
+				     bus_stats__object_str(msg.object), msg.id,
+				     cob);
+	}
+
+	if (self->extended.n_frames)
+		bus_stats__print_cob(self, output, "extended", "OTHER", 0,
+				     &self->extended);
+
+	bus_stats__print_sdo(self, output);
+}
@@ -28,17 +28,38 @@ const char usage_[] =
 "    -h, --help                 Get help.\n"
 "    -u, --time                 Show time of arrival.\n"
 "    -T, --tcp                  Connect via TCP.\n"
-"    -f, --file                 Dump from trace buffer file.\n"
+"    -f, --file                 Dump from a trace buffer, ring or compact\n"
+"                               trace file.\n"
 "    -n, --nmt                  Show NMT.\n"
 "    -S, --sync                 Show SYNC.\n"
 "    -e, --emcy                 Show EMCY.\n"
 "    -p, --pdo[=mask]           Show PDO.\n"
 "    -s, --sdo                  Show SDO.\n"
 "    -H, --heartbeat            Show heartbeat.\n"
+"    -t, --stats[=seconds]      Show bus load, frame rates, cycle times and\n"
+"                               SDO latencies instead of frames, optionally\n"
+"                               every given number of seconds.\n"
+"    -b, --bitrate=bitrate      Bit rate for bus load (default: 250000).\n"
+"    -c, --capture=FILE         Capture raw frames into FILE without decoding\n"
+"                               them. Decode FILE later with --file.\n"
+"    -E, --eds=NODEID:NAME      Decode objects of a node with the named EDS\n"
+"                               instead of finding it by identity.\n"
+"    -D, --dcf=NODEID:FILE      Take PDO mappings of a node from a DCF until\n"
+"                               they are seen on the bus.\n"
+"    -j, --jobs=N               Decode large files on N threads (default: one\n"
+"                               per CPU).\n"
+"    -F, --subscribe=FILTER     Subscribe to the frames that pass FILTER at\n"
+"                               the trace service of a master, which is then\n"
+"                               given as host[:port] instead of <interface>.\n"
 "\n"
 "Examples:\n"
 "    $ canopen-dump can0\n"
 "    $ canopen-dump -T 127.0.0.1\n"
+"    $ canopen-dump -t1 -b 500000 can0\n"
+"    $ canopen-dump -c capture.trace can0\n"
+"    $ canopen-dump -f capture.trace\n"
+"    $ canopen-dump -sp -E 5:motor -D 5:node5.dcf can0\n"
+"    $ canopen-dump -u -F \"nodes=5 objects=pdo interval=100\" 10.0.0.2\n"
 "\n";
 
 static inline int print_usage(FILE* output, int status)
@@ -54,6 +75,20 @@ unsigned int apply_pdo_option(const char* arg)
 	     : CO_DUMP_FILTER_PDO;
 }
 
+/* Parses arguments of the form "NODEID:VALUE" */
+static int apply_node_option(int (*fn)(int, const char*), const char* arg)
+{
+	char* end = NULL;
+	long nodeid = strtol(arg, &end, 0);
+
+	if (end == arg || *end != ':' || fn(nodeid, end + 1) < 0) {
+		fprintf(stderr, "Invalid argument: %s\n", arg);
+		return -1;
+	}
+
+	return 0;
+}
+
 int main(int argc, char* argv[])
 {
 	static const struct option long_options[] = {
@@ -67,13 +102,24 @@ int main(int argc, char* argv[])
 		{ "pdo",       optional_argument, 0, 'p' },
 		{ "sdo",       no_argument,       0, 's' },
 		{ "heartbeat", no_argument,       0, 'H' },
+		{ "stats",     optional_argument, 0, 't' },
+		{ "bitrate",   required_argument, 0, 'b' },
+		{ "capture",   required_argument, 0, 'c' },
+		{ "eds",       required_argument, 0, 'E' },
+		{ "dcf",       required_argument, 0, 'D' },
+		{ "jobs",      required_argument, 0, 'j' },
+		{ "subscribe", required_argument, 0, 'F' },
 		{ 0, 0, 0, 0 }
 	};
 
 	enum co_dump_options opt = 0;
+	const char* capture_path = NULL;
+	int is_stats = 0;
+	unsigned int stats_interval = 0;
+	unsigned int bitrate = 250000;
 
 	while (1) {
-		int c = getopt_long(argc, argv, "huTfnSepsiH", long_options, NULL);
+		int c = getopt_long(argc, argv, "huTfnSepsiHt::b:c:E:D:j:F:", long_options, NULL);
 		if (c < 0)
 			break;
 
@@ -88,6 +134,22 @@ int main(int argc, char* argv[])
 		case 'p': opt |= apply_pdo_option(optarg); break;
 		case 's': opt |= CO_DUMP_FILTER_SDO; break;
 		case 'H': opt |= CO_DUMP_FILTER_HEARTBEAT; break;
+		case 't':
+			is_stats = 1;
+			stats_interval = optarg ? strtod(optarg, NULL) * 1000 : 0;
+			break;
+		case 'b': bitrate = strtoul(optarg, NULL, 0); break;
+		case 'c': capture_path = optarg; break;
+		case 'E':
+			if (apply_node_option(co_dump_set_eds, optarg) < 0)
+				return 1;
+			break;
+		case 'D':
+			if (apply_node_option(co_dump_set_dcf, optarg) < 0)
+				return 1;
+			break;
+		case 'j': co_dump_set_jobs(strtoul(optarg, NULL, 0)); break;
+		case 'F': co_dump_set_subscription(optarg); break;
 		default: return print_usage(stderr, 1);
 		}
 	}
@@ -100,7 +162,13 @@ int main(int argc, char* argv[])
 
 	const char* iface = args[0];
 
+	if (capture_path)
+		return co_dump_capture(iface, capture_path);
+
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
+	if (is_stats)
+		return co_dump_stats(iface, opt, bitrate, stats_interval);
+
 	return co_dump(iface, opt);
 }
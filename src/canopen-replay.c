@@ -0,0 +1,156 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "canopen.h"
+#include "canopen/replay.h"
+
+const char usage_[] =
+"Usage: canopen-replay [options] <trace> <interface>\n"
+"\n"
+"Sends the frames of a trace file onto a CAN interface with the recorded\n"
+"timing. The trace format is detected from the file unless it is given.\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -T, --tcp                  Connect via TCP.\n"
+"    -i, --input-format=FORMAT  Format of the trace file: buffer, ring,\n"
+"                               compact or candump.\n"
+"    -s, --speed=FACTOR         Replay FACTOR times faster (default: 1).\n"
+"    -m, --max-rate             Replay as fast as possible.\n"
+"    -n, --nodes=LIST           Only replay frames of these nodes, e.g.\n"
+"                               \"1,4-6\".\n"
+"    -o, --objects=LIST         Only replay these types of frames: nmt, sync,\n"
+"                               emcy, timestamp, pdo, tpdo, rpdo, sdo,\n"
+"                               heartbeat.\n"
+"    -r, --respond              Only replay frames sent by the nodes, and\n"
+"                               answer SDO requests with the recorded\n"
+"                               responses.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-replay trace.ctrace vcan0\n"
+"    $ canopen-replay -m -o pdo,heartbeat trace.ctrace vcan0\n"
+"    $ canopen-replay -r -n 3,5 /var/log/canopen/trace-ring vcan0\n"
+"\n";
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+static int parse_format(enum co_trace_format* format, const char* arg)
+{
+	*format = co_trace_format_from_string(arg);
+	return *format == CO_TRACE_FORMAT_AUTO ? -1 : 0;
+}
+
+static int parse_speed(double* speed, const char* arg)
+{
+	char* end;
+
+	*speed = strtod(arg, &end);
+	return *end != '\0' || *speed <= 0 ? -1 : 0;
+}
+
+static void on_stop_signal(int signo)
+{
+	(void)signo;
+}
+
+/* Without SA_RESTART, waiting for the next frame is cut short when the replay
+ * is stopped, so that the statistics are still printed.
+ */
+static void set_stop_signal_handler(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",         no_argument,       0, 'h' },
+		{ "tcp",          no_argument,       0, 'T' },
+		{ "input-format", required_argument, 0, 'i' },
+		{ "speed",        required_argument, 0, 's' },
+		{ "max-rate",     no_argument,       0, 'm' },
+		{ "nodes",        required_argument, 0, 'n' },
+		{ "objects",      required_argument, 0, 'o' },
+		{ "respond",      no_argument,       0, 'r' },
+		{ 0, 0, 0, 0 }
+	};
+
+	struct co_replay_options options = { .speed = 1.0 };
+	struct co_replay_stats stats;
+	int is_tcp = 0;
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hTi:s:mn:o:r", long_options,
+				    NULL);
+		if (c < 0)
+			break;
+
+		int rc = 0;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'T': is_tcp = 1; break;
+		case 'i': rc = parse_format(&options.input_format, optarg); break;
+		case 's': rc = parse_speed(&options.speed, optarg); break;
+		case 'm': options.speed = 0; break;
+		case 'n':
+			rc = canopen_parse_nodes(&options.nodes, optarg);
+			break;
+		case 'o':
+			rc = canopen_parse_objects(&options.objects, optarg);
+			break;
+		case 'r': options.is_responder = 1; break;
+		default: return print_usage(stderr, 1);
+		}
+
+		if (rc < 0)
+			return print_usage(stderr, 1);
+	}
+
+	int nargs = argc - optind;
+	char** args = &argv[optind];
+
+	if (nargs < 2)
+		return print_usage(stderr, 1);
+
+	set_stop_signal_handler();
+
+	int rc = co_replay(args[0], args[1], is_tcp, &options, &stats);
+
+	co_replay_print_stats(&stats, stderr);
+
+	if (rc < 0) {
+		perror("Could not replay trace");
+		return 1;
+	}
+
+	return 0;
+}
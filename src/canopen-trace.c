@@ -0,0 +1,123 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "canopen/trace-convert.h"
+
+const char usage_[] =
+"Usage: canopen-trace [options] <input> <output>\n"
+"\n"
+"Converts between trace file formats. The input format is detected from the\n"
+"file unless it is given.\n"
+"\n"
+"Formats:\n"
+"    buffer                     Trace buffer dump.\n"
+"    ring                       Trace ring file (input only).\n"
+"    compact                    Compressed trace file with a seek index.\n"
+"    candump                    candump log file.\n"
+"\n"
+"Options:\n"
+"    -h, --help                 Get help.\n"
+"    -i, --input-format=FORMAT  Format of the input file.\n"
+"    -o, --output-format=FORMAT Format of the output file (default: compact).\n"
+"    -b, --begin=TIME           Leave out frames before TIME.\n"
+"    -e, --end=TIME             Leave out frames after TIME.\n"
+"    -I, --interface=NAME       Interface name for candump output.\n"
+"\n"
+"TIME is in seconds since the epoch, e.g. 1514764800.25. An output of \"-\"\n"
+"is stdout.\n"
+"\n"
+"Examples:\n"
+"    $ canopen-trace /var/log/canopen/trace-ring trace.ctrace\n"
+"    $ canopen-trace -o candump trace.ctrace -\n"
+"\n";
+
+static inline int print_usage(FILE* output, int status)
+{
+	fprintf(output, "%s", usage_);
+	return status;
+}
+
+static int parse_format(enum co_trace_format* format, const char* arg)
+{
+	*format = co_trace_format_from_string(arg);
+	return *format == CO_TRACE_FORMAT_AUTO ? -1 : 0;
+}
+
+static int parse_time(uint64_t* time, const char* arg)
+{
+	char* end;
+
+	double seconds = strtod(arg, &end);
+	if (*end != '\0' || seconds < 0)
+		return -1;
+
+	*time = seconds * 1e6;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option long_options[] = {
+		{ "help",          no_argument,       0, 'h' },
+		{ "input-format",  required_argument, 0, 'i' },
+		{ "output-format", required_argument, 0, 'o' },
+		{ "begin",         required_argument, 0, 'b' },
+		{ "end",           required_argument, 0, 'e' },
+		{ "interface",     required_argument, 0, 'I' },
+		{ 0, 0, 0, 0 }
+	};
+
+	struct co_trace_convert_options options = { 0 };
+
+	while (1) {
+		int c = getopt_long(argc, argv, "hi:o:b:e:I:", long_options,
+				    NULL);
+		if (c < 0)
+			break;
+
+		int rc = 0;
+
+		switch (c) {
+		case 'h': return print_usage(stdout, 0);
+		case 'i': rc = parse_format(&options.input_format, optarg); break;
+		case 'o': rc = parse_format(&options.output_format, optarg); break;
+		case 'b': rc = parse_time(&options.begin, optarg); break;
+		case 'e': rc = parse_time(&options.end, optarg); break;
+		case 'I': options.iface = optarg; break;
+		default: return print_usage(stderr, 1);
+		}
+
+		if (rc < 0)
+			return print_usage(stderr, 1);
+	}
+
+	int nargs = argc - optind;
+	char** args = &argv[optind];
+
+	if (nargs < 2)
+		return print_usage(stderr, 1);
+
+	if (co_trace_convert(args[0], args[1], &options) < 0) {
+		perror("Could not convert trace");
+		return 1;
+	}
+
+	return 0;
+}
@@ -17,8 +17,11 @@
 #include <linux/can.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "canopen.h"
+#include "canopen/nodeset.h"
 
 int canopen_get_object_type(struct canopen_msg* msg,
 			    const struct can_frame* frame)
@@ -145,3 +148,88 @@ const char* canopen_object_type_to_string_exact(enum canopen_object obj)
 	}
 }
 
+__attribute__((visibility("default")))
+int canopen_parse_nodes(struct co_nodeset* nodes, const char* arg)
+{
+	char* end;
+
+	while (*arg) {
+		long first = strtol(arg, &end, 0);
+		long last = first;
+
+		if (end == arg)
+			return -1;
+
+		if (*end == '-') {
+			arg = end + 1;
+			last = strtol(arg, &end, 0);
+			if (end == arg)
+				return -1;
+		}
+
+		if (first < CANOPEN_NODEID_MIN || last > CANOPEN_NODEID_MAX
+		 || first > last)
+			return -1;
+
+		for (long i = first; i <= last; ++i)
+			co_nodeset_add(nodes, i);
+
+		if (*end == ',')
+			++end;
+		else if (*end != '\0')
+			return -1;
+
+		arg = end;
+	}
+
+	return 0;
+}
+
+static unsigned int canopen__object_from_string(const char* str, size_t len)
+{
+	static const struct {
+		const char* name;
+		unsigned int mask;
+	} objects[] = {
+		{ "nmt", CANOPEN_NMT },
+		{ "sync", CANOPEN_SYNC },
+		{ "emcy", CANOPEN_EMCY },
+		{ "timestamp", CANOPEN_TIMESTAMP },
+		{ "tpdo", CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3
+			  | CANOPEN_TPDO4 },
+		{ "rpdo", CANOPEN_RPDO1 | CANOPEN_RPDO2 | CANOPEN_RPDO3
+			  | CANOPEN_RPDO4 },
+		{ "pdo", CANOPEN_TPDO1 | CANOPEN_TPDO2 | CANOPEN_TPDO3
+			 | CANOPEN_TPDO4 | CANOPEN_RPDO1 | CANOPEN_RPDO2
+			 | CANOPEN_RPDO3 | CANOPEN_RPDO4 },
+		{ "sdo", CANOPEN_TSDO | CANOPEN_RSDO },
+		{ "heartbeat", CANOPEN_HEARTBEAT },
+	};
+
+	for (size_t i = 0; i < sizeof(objects) / sizeof(objects[0]); ++i)
+		if (strlen(objects[i].name) == len
+		 && strncmp(objects[i].name, str, len) == 0)
+			return objects[i].mask;
+
+	return 0;
+}
+
+__attribute__((visibility("default")))
+int canopen_parse_objects(unsigned int* objects, const char* arg)
+{
+	while (*arg) {
+		size_t len = strcspn(arg, ",");
+
+		unsigned int mask = canopen__object_from_string(arg, len);
+		if (!mask)
+			return -1;
+
+		*objects |= mask;
+
+		arg += len;
+		if (*arg == ',')
+			++arg;
+	}
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "canopen/dcf.h"
+#include "canopen/eds.h"
+#include "canopen/types.h"
+#include "conversions.h"
+#include "ini_parser.h"
+
+#define CO_DCF_HEADER_SIZE 4
+#define CO_DCF_ENTRY_HEADER_SIZE 7
+
+static inline uint32_t co_dcf__get_u32(const uint8_t* p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16
+	     | (uint32_t)p[3] << 24;
+}
+
+static inline void co_dcf__set_u32(uint8_t* p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static inline uint8_t* co_dcf__data(const struct co_dcf* self)
+{
+	return self->data.data;
+}
+
+static void co_dcf__set_length(struct co_dcf* self, uint32_t n_entries)
+{
+	self->n_entries = n_entries;
+	co_dcf__set_u32(co_dcf__data(self), n_entries);
+}
+
+int co_dcf_init(struct co_dcf* self)
+{
+	static const uint8_t header[CO_DCF_HEADER_SIZE] = { 0 };
+
+	self->n_entries = 0;
+
+	if (vector_init(&self->data, 256) < 0)
+		return -1;
+
+	return vector_append(&self->data, header, sizeof(header));
+}
+
+void co_dcf_destroy(struct co_dcf* self)
+{
+	vector_destroy(&self->data);
+}
+
+const void* co_dcf_get_data(const struct co_dcf* self)
+{
+	return self->data.data;
+}
+
+size_t co_dcf_get_size(const struct co_dcf* self)
+{
+	return self->data.index;
+}
+
+void co_dcf_iter_init(struct co_dcf_iter* iter, const struct co_dcf* dcf)
+{
+	iter->dcf = dcf;
+	iter->pos = CO_DCF_HEADER_SIZE;
+}
+
+int co_dcf_iter_next(struct co_dcf_iter* iter, struct co_dcf_entry* entry)
+{
+	const uint8_t* data = co_dcf__data(iter->dcf);
+	size_t size = co_dcf_get_size(iter->dcf);
+
+	if (iter->pos + CO_DCF_ENTRY_HEADER_SIZE > size)
+		return 0;
+
+	const uint8_t* p = data + iter->pos;
+
+	entry->index = p[0] | p[1] << 8;
+	entry->subindex = p[2];
+	entry->size = co_dcf__get_u32(p + 3);
+	entry->data = p + CO_DCF_ENTRY_HEADER_SIZE;
+
+	iter->pos += CO_DCF_ENTRY_HEADER_SIZE + entry->size;
+	return 1;
+}
+
+const struct co_dcf_entry* co_dcf_find(const struct co_dcf* self, int index,
+				       int subindex,
+				       struct co_dcf_entry* entry)
+{
+	struct co_dcf_iter iter;
+	co_dcf_iter_init(&iter, self);
+
+	while (co_dcf_iter_next(&iter, entry))
+		if (entry->index == index && entry->subindex == subindex)
+			return entry;
+
+	return NULL;
+}
+
+static void co_dcf__remove(struct co_dcf* self,
+			   const struct co_dcf_entry* entry)
+{
+	uint8_t* start = (uint8_t*)entry->data - CO_DCF_ENTRY_HEADER_SIZE;
+	uint8_t* end = (uint8_t*)entry->data + entry->size;
+	uint8_t* data_end = co_dcf__data(self) + self->data.index;
+
+	memmove(start, end, data_end - end);
+	self->data.index -= end - start;
+
+	co_dcf__set_length(self, self->n_entries - 1);
+}
+
+int co_dcf_append(struct co_dcf* self, int index, int subindex,
+		  const void* data, size_t size)
+{
+	uint8_t header[CO_DCF_ENTRY_HEADER_SIZE];
+
+	header[0] = index;
+	header[1] = index >> 8;
+	header[2] = subindex;
+	co_dcf__set_u32(&header[3], size);
+
+	if (vector_reserve(&self->data, self->data.index + sizeof(header)
+					+ size) < 0)
+		return -1;
+
+	vector_append(&self->data, header, sizeof(header));
+	vector_append(&self->data, data, size);
+
+	co_dcf__set_length(self, self->n_entries + 1);
+	return 0;
+}
+
+int co_dcf_add(struct co_dcf* self, int index, int subindex, const void* data,
+	       size_t size)
+{
+	struct co_dcf_entry existing;
+
+	if (co_dcf_find(self, index, subindex, &existing))
+		co_dcf__remove(self, &existing);
+
+	return co_dcf_append(self, index, subindex, data, size);
+}
+
+int co_dcf_load_concise(struct co_dcf* self, const void* data, size_t size)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = p + size;
+
+	if (size < CO_DCF_HEADER_SIZE)
+		return -1;
+
+	uint32_t n_entries = co_dcf__get_u32(p);
+	p += CO_DCF_HEADER_SIZE;
+
+	for (uint32_t i = 0; i < n_entries; ++i) {
+		if (end - p < CO_DCF_ENTRY_HEADER_SIZE)
+			return -1;
+
+		int index = p[0] | p[1] << 8;
+		int subindex = p[2];
+		uint32_t entry_size = co_dcf__get_u32(p + 3);
+		p += CO_DCF_ENTRY_HEADER_SIZE;
+
+		if ((size_t)(end - p) < entry_size)
+			return -1;
+
+		if (co_dcf_add(self, index, subindex, p, entry_size) < 0)
+			return -1;
+
+		p += entry_size;
+	}
+
+	return 0;
+}
+
+static enum canopen_type co_dcf__get_type(const struct ini_section* section,
+					  const struct canopen_eds* eds,
+					  int index, int subindex)
+{
+	const char* type = ini_find_key(section, "datatype");
+	if (type)
+		return strtoul(type, NULL, 0);
+
+	const struct eds_obj* obj = eds ? eds_obj_find(eds, index, subindex)
+					: NULL;
+	return obj ? obj->type : CANOPEN_UNKNOWN;
+}
+
+static int co_dcf__add_value(struct co_dcf* self, enum canopen_type type,
+			     int index, int subindex, const char* value,
+			     int nodeid)
+{
+	struct canopen_data data;
+	char buffer[32];
+
+	if (strncasecmp(value, "$nodeid", 7) == 0) {
+		unsigned long long offset = 0;
+		const char* rest = value + 7;
+
+		if (*rest == '+')
+			offset = strtoull(rest + 1, NULL, 0);
+		else if (*rest != '\0')
+			return -1;
+
+		snprintf(buffer, sizeof(buffer), "%llu", offset + nodeid);
+		value = buffer;
+	}
+
+	if (canopen_data_fromstring(&data, type, value) < 0)
+		return -1;
+
+	return co_dcf_add(self, index, subindex, data.data, data.size);
+}
+
+int co_dcf_load_ini(struct co_dcf* self, const struct ini_file* ini,
+		    const struct canopen_eds* eds, int nodeid)
+{
+	for (size_t i = 0; i < ini_get_length(ini); ++i) {
+		const struct ini_section* section = ini_get_section(ini, i);
+
+		const char* value = ini_find_key(section, "parametervalue");
+		if (!value)
+			continue;
+
+		int index = eds__get_section_index(section->section);
+		if (index < 0)
+			continue;
+
+		int subindex = eds__get_section_subindex(section->section);
+		if (subindex < 0)
+			continue;
+
+		enum canopen_type type = co_dcf__get_type(section, eds, index,
+							  subindex);
+
+		if (co_dcf__add_value(self, type, index, subindex, value,
+				      nodeid) < 0) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int co_dcf__load_ini_file(struct co_dcf* self, FILE* stream,
+				 const struct canopen_eds* eds, int nodeid)
+{
+	struct ini_file ini;
+
+	if (ini_parse(&ini, stream) < 0)
+		return -1;
+
+	int rc = co_dcf_load_ini(self, &ini, eds, nodeid);
+
+	ini_destroy(&ini);
+	return rc;
+}
+
+static int co_dcf__load_concise_file(struct co_dcf* self, FILE* stream)
+{
+	struct vector buffer;
+	char chunk[1024];
+	size_t size;
+	int rc = -1;
+
+	if (vector_init(&buffer, sizeof(chunk)) < 0)
+		return -1;
+
+	while ((size = fread(chunk, 1, sizeof(chunk), stream)) > 0)
+		if (vector_append(&buffer, chunk, size) < 0)
+			goto done;
+
+	if (ferror(stream))
+		goto done;
+
+	rc = co_dcf_load_concise(self, buffer.data, buffer.index);
+	if (rc < 0)
+		errno = EINVAL;
+
+done:
+	vector_destroy(&buffer);
+	return rc;
+}
+
+static inline int co_dcf__is_text_file(const char* path)
+{
+	const char* ext = strrchr(path, '.');
+	return ext && strcasecmp(ext, ".dcf") == 0;
+}
+
+int co_dcf_load_file(struct co_dcf* self, const char* path,
+		     const struct canopen_eds* eds, int nodeid)
+{
+	FILE* stream = fopen(path, "r");
+	if (!stream)
+		return -1;
+
+	int rc = co_dcf__is_text_file(path)
+	       ? co_dcf__load_ini_file(self, stream, eds, nodeid)
+	       : co_dcf__load_concise_file(self, stream);
+
+	fclose(stream);
+	return rc;
+}
+
+/* FNV-1a, folded to 32 bits */
+uint32_t co_dcf_digest(const struct co_dcf* self)
+{
+	const uint8_t* data = co_dcf__data(self);
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < self->data.index; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash ^ (hash >> 32);
+}
@@ -0,0 +1,276 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Driver registry
+ *
+ * Drivers are looked up from the driver loading jobs on worker threads, so the
+ * list of entries is protected by a mutex. Each entry has its own mutex so
+ * that different drivers can be opened at the same time while nodes using the
+ * same driver wait for the first one to finish.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include "vector.h"
+#include "string-utils.h"
+#include "driver-registry.h"
+#include "plog.h"
+
+#ifndef DRIVER_PATH
+#define DRIVER_PATH "/usr/lib/canopen"
+#endif
+
+#define DRIVER_PREFIX "co_drv_"
+#define DRIVER_SUFFIX ".so"
+
+size_t strlcpy(char*, const char*, size_t);
+
+struct driver_registry_entry {
+	char name[64];
+	pthread_mutex_t mutex;
+	int is_loaded;
+	int is_present;
+	void* dso;
+	void* init_fn;
+};
+
+static pthread_mutex_t driver_registry__mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct vector driver_registry__entries;
+static char driver_registry__path[256] = DRIVER_PATH;
+
+static inline size_t driver_registry__length(void)
+{
+	return driver_registry__entries.index / sizeof(void*);
+}
+
+static inline struct driver_registry_entry* driver_registry__at(size_t index)
+{
+	return ((struct driver_registry_entry**)
+		driver_registry__entries.data)[index];
+}
+
+static struct driver_registry_entry* driver_registry__find(const char* name)
+{
+	for (size_t i = 0; i < driver_registry__length(); ++i) {
+		struct driver_registry_entry* entry = driver_registry__at(i);
+		if (strcmp(entry->name, name) == 0)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct driver_registry_entry* driver_registry__add(const char* name,
+							  int is_present)
+{
+	struct driver_registry_entry* entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return NULL;
+
+	strlcpy(entry->name, name, sizeof(entry->name));
+	string_tolower(entry->name);
+	pthread_mutex_init(&entry->mutex, NULL);
+	entry->is_present = is_present;
+
+	if (vector_append(&driver_registry__entries, &entry, sizeof(entry)) < 0)
+		goto failure;
+
+	return entry;
+
+failure:
+	pthread_mutex_destroy(&entry->mutex);
+	free(entry);
+	return NULL;
+}
+
+static int driver_registry__get_name(char* dst, size_t size, const char* file)
+{
+	size_t prefix_len = strlen(DRIVER_PREFIX);
+	size_t suffix_len = strlen(DRIVER_SUFFIX);
+	size_t len = strlen(file);
+
+	if (len <= prefix_len + suffix_len)
+		return -1;
+
+	if (strncmp(file, DRIVER_PREFIX, prefix_len) != 0)
+		return -1;
+
+	if (strcmp(file + len - suffix_len, DRIVER_SUFFIX) != 0)
+		return -1;
+
+	len -= prefix_len + suffix_len;
+	if (len >= size)
+		return -1;
+
+	memcpy(dst, file + prefix_len, len);
+	dst[len] = '\0';
+	return 0;
+}
+
+int driver_registry_init(const char* path)
+{
+	char name[64];
+
+	driver_registry_cleanup();
+
+	if (vector_init(&driver_registry__entries, 16 * sizeof(void*)) < 0)
+		return -1;
+
+	strlcpy(driver_registry__path, path ? path : DRIVER_PATH,
+		sizeof(driver_registry__path));
+
+	DIR* dir = opendir(driver_registry__path);
+	if (!dir) {
+		plog(LOG_WARNING, "driver_registry_init: Could not open driver directory '%s'",
+		     driver_registry__path);
+		return 0;
+	}
+
+	struct dirent* ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (driver_registry__get_name(name, sizeof(name), ent->d_name) < 0)
+			continue;
+
+		if (driver_registry__find(string_tolower(name)))
+			continue;
+
+		if (!driver_registry__add(name, 1))
+			break;
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+void driver_registry_cleanup(void)
+{
+	if (!driver_registry__entries.data)
+		return;
+
+	for (size_t i = 0; i < driver_registry__length(); ++i) {
+		struct driver_registry_entry* entry = driver_registry__at(i);
+
+		if (entry->dso)
+			dlclose(entry->dso);
+
+		pthread_mutex_destroy(&entry->mutex);
+		free(entry);
+	}
+
+	vector_destroy(&driver_registry__entries);
+	memset(&driver_registry__entries, 0, sizeof(driver_registry__entries));
+}
+
+size_t driver_registry_length(void)
+{
+	pthread_mutex_lock(&driver_registry__mutex);
+	size_t length = driver_registry__length();
+	pthread_mutex_unlock(&driver_registry__mutex);
+	return length;
+}
+
+const char* driver_registry_name(size_t index)
+{
+	const char* name = NULL;
+
+	pthread_mutex_lock(&driver_registry__mutex);
+	if (index < driver_registry__length())
+		name = driver_registry__at(index)->name;
+	pthread_mutex_unlock(&driver_registry__mutex);
+
+	return name;
+}
+
+static void driver_registry__open(struct driver_registry_entry* entry)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/" DRIVER_PREFIX "%s" DRIVER_SUFFIX,
+		 driver_registry__path, entry->name);
+
+	if (!entry->is_present && access(path, R_OK) < 0)
+		return;
+
+	entry->dso = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	const char* err = dlerror();
+	if (!entry->dso) {
+		plog(LOG_ERROR, "driver: Failed to load driver for '%s': %s",
+		     entry->name, err);
+		return;
+	}
+
+	entry->init_fn = dlsym(entry->dso, "co_drv_init");
+	dlerror();
+	if (entry->init_fn)
+		return;
+
+	plog(LOG_ERROR, "driver: DSO for '%s' does not export an 'init' function",
+	     entry->name);
+
+	dlclose(entry->dso);
+	entry->dso = NULL;
+}
+
+static int driver_registry__load(struct driver_registry_entry* entry)
+{
+	pthread_mutex_lock(&entry->mutex);
+
+	if (!entry->is_loaded) {
+		driver_registry__open(entry);
+		entry->is_loaded = 1;
+	}
+
+	int rc = entry->init_fn ? 0 : -1;
+
+	pthread_mutex_unlock(&entry->mutex);
+	return rc;
+}
+
+int driver_registry_preload(size_t index)
+{
+	struct driver_registry_entry* entry = NULL;
+
+	pthread_mutex_lock(&driver_registry__mutex);
+	if (index < driver_registry__length())
+		entry = driver_registry__at(index);
+	pthread_mutex_unlock(&driver_registry__mutex);
+
+	return entry ? driver_registry__load(entry) : -1;
+}
+
+int driver_registry_get(const char* name, void** dso, void** init_fn)
+{
+	char key[64];
+	strlcpy(key, name, sizeof(key));
+	string_tolower(key);
+
+	pthread_mutex_lock(&driver_registry__mutex);
+	struct driver_registry_entry* entry = driver_registry__find(key);
+	if (!entry)
+		entry = driver_registry__add(key, 0);
+	pthread_mutex_unlock(&driver_registry__mutex);
+
+	if (!entry || driver_registry__load(entry) < 0)
+		return -1;
+
+	*dso = entry->dso;
+	*init_fn = entry->init_fn;
+	return 0;
+}
@@ -15,20 +15,15 @@
 
 #include <stdlib.h>
 #include <stdint.h>
-#include <dlfcn.h>
-#include <unistd.h>
 #include "socketcan.h"
 #include "canopen/master.h"
 #include "canopen/sdo_req.h"
 #include "canopen/emcy.h"
+#include "canopen/dcf.h"
 #include "canopen-driver.h"
-#include "string-utils.h"
+#include "driver-registry.h"
 #include "plog.h"
 
-#ifndef DRIVER_PATH
-#define DRIVER_PATH "/usr/lib/canopen"
-#endif
-
 #define RPDO_COMMUNICATION_START_INDEX 0x1400
 #define RPDO_MAPPING_START_INDEX 0x1600
 #define TPDO_COMMUNICATION_START_INDEX 0x1800
@@ -39,63 +34,43 @@
 #define PDO_COMMUNICATION_INHIBIT_TIME 3
 #define PDO_COMMUNICATION_EVENT_TIME 5
 
-size_t strlcpy(char*, const char*, size_t);
-
 struct co_sdo_req {
 	struct sdo_req req;
 	struct co_drv* drv;
 	co_sdo_done_fn on_done;
 };
 
-const char* co__drv_find_dso(const char* name)
-{
-	static __thread char result[256];
-
-	char name_buffer[256];
-	strlcpy(name_buffer, name, 256);
-
-	snprintf(result, sizeof(result), DRIVER_PATH "/co_drv_%s.so",
-		 string_tolower(name_buffer));
-	result[sizeof(result) - 1] = '\0';
-
-	if (access(result, R_OK) < 0)
-		return NULL;
-
-	return result;
-}
-
 int co_drv_load(struct co_drv* drv, const char* name)
 {
 	assert(!drv->dso);
 
-	const char* path = co__drv_find_dso(name);
-	if (!path)
+	void* init_fn = NULL;
+	if (driver_registry_get(name, &drv->dso, &init_fn) < 0)
 		return -1;
 
-	drv->dso = dlopen(path, RTLD_NOW | RTLD_LOCAL);
-	const char* err = dlerror();
-	if (!drv->dso) {
-		plog(LOG_ERROR, "driver: Failed to load driver for '%s': %s",
-		     name, err);
-		return -1;
-	}
+	drv->init_fn = (co_drv_init_fn)init_fn;
+	return 0;
+}
 
-	drv->init_fn = dlsym(drv->dso, "co_drv_init");
-	dlerror();
-	if (drv->init_fn)
-		return 0;
+int co_drv_init(struct co_drv* drv)
+{
+	return drv->init_fn(drv);
+}
 
-	plog(LOG_ERROR, "driver: DSO for '%s' does not export an 'init' function",
-	     name);
+static void co__dcf_free(struct co_dcf** dcf)
+{
+	if (!*dcf)
+		return;
 
-	dlclose(drv->dso);
-	memset(drv, 0, sizeof(*drv));
-	return -1;
+	co_dcf_destroy(*dcf);
+	free(*dcf);
+	*dcf = NULL;
 }
 
-int co_drv_init(struct co_drv* drv)
+static void co__config_free(struct co_drv* self)
 {
-	return drv->init_fn(drv);
+	co__dcf_free(&self->config);
+	co__dcf_free(&self->volatile_config);
 }
 
 void co_drv_unload(struct co_drv* drv)
@@ -103,8 +78,9 @@ void co_drv_unload(struct co_drv* drv)
 	if (drv->context && drv->free_fn)
 		drv->free_fn(drv->context);
 
-	dlclose(drv->dso);
+	co__config_free(drv);
 
+	/* The DSO is owned by the driver registry */
 	memset(drv, 0, sizeof(*drv));
 }
 
@@ -275,15 +251,16 @@ static void co__sdo_req_on_done(struct sdo_req* req)
 
 struct co_sdo_req* co_sdo_req_new(struct co_drv* drv)
 {
-	struct co_sdo_req* self = malloc(sizeof(*self));
-	if (!self)
-		return NULL;
+	_Static_assert(sizeof(struct co_sdo_req)
+		       <= sizeof(struct sdo_req) + SDO_REQ_EXTRA_SIZE,
+		       "struct co_sdo_req does not fit in the sdo_req pool");
 
-	memset(self, 0, sizeof(*self));
+	struct sdo_req* req = sdo_req_alloc();
+	if (!req)
+		return NULL;
 
-	struct sdo_req* req = &self->req;
+	struct co_sdo_req* self = (void*)req;
 
-	req->ref = 1;
 	req->on_done = co__sdo_req_on_done;
 	self->drv = drv;
 
@@ -384,6 +361,10 @@ int co_sdo_send_blob(struct co_drv* self, int index, int subindex,
 		.dl_size = size,
 	};
 
+	if (self->config)
+		return co_dcf_append(self->config, index, subindex, payload,
+				     size);
+
 	struct sdo_req* req = sdo_req_new(&info);
 	if (!req)
 		return -1;
@@ -393,6 +374,83 @@ int co_sdo_send_blob(struct co_drv* self, int index, int subindex,
 	return r;
 }
 
+int co_config_begin(struct co_drv* self)
+{
+	if (self->config)
+		return -1;
+
+	self->config = malloc(sizeof(*self->config));
+	if (!self->config)
+		return -1;
+
+	if (co_dcf_init(self->config) < 0) {
+		free(self->config);
+		self->config = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+int co_config_begin_volatile(struct co_drv* self)
+{
+	if (co_config_begin(self) < 0)
+		return -1;
+
+	self->is_config_volatile = 1;
+	return 0;
+}
+
+static int co__config_keep_volatile(struct co_drv* self,
+				    const struct co_dcf* config)
+{
+	struct co_dcf_iter iter;
+	struct co_dcf_entry entry;
+
+	if (!self->volatile_config) {
+		self->volatile_config = malloc(sizeof(*self->volatile_config));
+		if (!self->volatile_config)
+			return -1;
+
+		if (co_dcf_init(self->volatile_config) < 0) {
+			free(self->volatile_config);
+			self->volatile_config = NULL;
+			return -1;
+		}
+	}
+
+	co_dcf_iter_init(&iter, config);
+	while (co_dcf_iter_next(&iter, &entry))
+		if (co_dcf_append(self->volatile_config, entry.index,
+				  entry.subindex, entry.data, entry.size) < 0)
+			return -1;
+
+	return 0;
+}
+
+int co_config_end(struct co_drv* self)
+{
+	if (!self->config)
+		return -1;
+
+	struct co_dcf* config = self->config;
+	int is_volatile = self->is_config_volatile;
+	self->config = NULL;
+	self->is_config_volatile = 0;
+
+	int rc = -1;
+	int nodeid = co_get_nodeid(self);
+
+	if (!is_volatile)
+		rc = co__configure(nodeid, config);
+	else if (co__config_keep_volatile(self, config) >= 0)
+		rc = co__configure_volatile(nodeid, config);
+
+	co_dcf_destroy(config);
+	free(config);
+	return rc;
+}
+
 void co_byteorder(void* dst, const void* src, size_t dst_size, size_t src_size)
 {
 	return byteorder2(dst, src, dst_size, src_size);
@@ -0,0 +1,354 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Raw frame capture for canopen-dump
+ *
+ * Decoding and printing every frame as it arrives cannot keep up with a fully
+ * loaded bus on a small CPU, and the frames that are lost when the socket
+ * buffer overflows are usually the interesting ones. Here, frames are instead
+ * received in batches with recvmmsg() and kernel timestamps and put into a
+ * large ring. A separate thread writes the ring to a file as an array of
+ * struct tb_frame, which can be decoded later with canopen-dump --file.
+ *
+ * Frames that the kernel drops are counted through SO_RXQ_OVFL and frames
+ * that do not fit into the ring because the file can't keep up are counted
+ * separately, so it is known whether the capture is complete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "socketcan.h"
+#include "net-util.h"
+#include "trace-buffer.h"
+#include "time-utils.h"
+#include "canopen/dump.h"
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+#define CAPTURE_BATCH 64
+#define CAPTURE_RING_LENGTH (64 * 1024) /* Must be a power of 2 */
+#define CAPTURE_RCVBUF (4 * 1024 * 1024)
+#define CAPTURE_OUTPUT_BUFFER (1024 * 1024)
+
+struct capture {
+	int fd;
+	FILE* output;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct tb_frame* ring;
+	size_t head;
+	size_t tail;
+	int is_done;
+	int has_write_error;
+
+	uint64_t n_frames;
+	uint64_t n_buffer_drops;
+	uint32_t n_kernel_drops;
+};
+
+static volatile sig_atomic_t capture__is_stopped = 0;
+
+static void capture__on_signal(int signo)
+{
+	(void)signo;
+	capture__is_stopped = 1;
+}
+
+static int capture__set_signal_handlers(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = capture__on_signal;
+
+	/* No SA_RESTART, so that ppoll() returns when we are stopped */
+	if (sigaction(SIGINT, &sa, NULL) < 0)
+		return -1;
+
+	return sigaction(SIGTERM, &sa, NULL);
+}
+
+static void* capture__write_thread(void* ptr)
+{
+	struct capture* self = ptr;
+
+	pthread_mutex_lock(&self->mutex);
+
+	while (1) {
+		while (self->head == self->tail && !self->is_done)
+			pthread_cond_wait(&self->cond, &self->mutex);
+
+		if (self->head == self->tail)
+			break;
+
+		/* Write up to the end of the ring without holding the lock */
+		size_t start = self->tail & (CAPTURE_RING_LENGTH - 1);
+		size_t n = self->head - self->tail;
+		if (start + n > CAPTURE_RING_LENGTH)
+			n = CAPTURE_RING_LENGTH - start;
+
+		pthread_mutex_unlock(&self->mutex);
+
+		size_t n_written = fwrite(&self->ring[start],
+					  sizeof(struct tb_frame), n,
+					  self->output);
+
+		pthread_mutex_lock(&self->mutex);
+
+		self->tail += n;
+		if (n_written != n)
+			self->has_write_error = 1;
+	}
+
+	pthread_mutex_unlock(&self->mutex);
+	return NULL;
+}
+
+static void capture__read_cmsgs(struct capture* self, struct msghdr* msg,
+				struct tb_frame* frame)
+{
+	struct cmsghdr* cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SO_TIMESTAMP) {
+			struct timeval tv;
+			memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+			frame->timestamp = tv.tv_sec * 1000000ULL + tv.tv_usec;
+		} else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&self->n_kernel_drops, CMSG_DATA(cmsg),
+			       sizeof(self->n_kernel_drops));
+		}
+	}
+}
+
+static void capture__push(struct capture* self, struct mmsghdr* msgs,
+			  struct can_frame* frames, int n)
+{
+	int i;
+
+	pthread_mutex_lock(&self->mutex);
+
+	for (i = 0; i < n; ++i) {
+		if (self->head - self->tail >= CAPTURE_RING_LENGTH) {
+			self->n_buffer_drops++;
+			continue;
+		}
+
+		struct tb_frame* frame =
+			&self->ring[self->head++ & (CAPTURE_RING_LENGTH - 1)];
+
+		frame->timestamp = 0;
+		frame->cf = frames[i];
+		capture__read_cmsgs(self, &msgs[i].msg_hdr, frame);
+
+		if (frame->timestamp == 0)
+			frame->timestamp = gettime_us(CLOCK_REALTIME);
+
+		self->n_frames++;
+	}
+
+	pthread_cond_signal(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* The stop signals must be blocked by the caller. They are only let through
+ * by wait_mask while waiting for frames, so a signal that arrives just after
+ * the check of capture__is_stopped interrupts the wait instead of being
+ * noticed only when the next frame arrives.
+ */
+static int capture__run(struct capture* self, const sigset_t* wait_mask)
+{
+	struct pollfd pfd = { .fd = self->fd, .events = POLLIN };
+	static struct can_frame frames[CAPTURE_BATCH];
+	static struct mmsghdr msgs[CAPTURE_BATCH];
+	static struct iovec iov[CAPTURE_BATCH];
+	static char control[CAPTURE_BATCH][CMSG_SPACE(sizeof(struct timeval))
+					 + CMSG_SPACE(sizeof(uint32_t))];
+	int i;
+
+	while (!capture__is_stopped) {
+		if (ppoll(&pfd, 1, NULL, wait_mask) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		memset(msgs, 0, sizeof(msgs));
+
+		for (i = 0; i < CAPTURE_BATCH; ++i) {
+			iov[i].iov_base = &frames[i];
+			iov[i].iov_len = sizeof(frames[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
+
+		int n = recvmmsg(self->fd, msgs, CAPTURE_BATCH, MSG_DONTWAIT,
+				 NULL);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		if (n == 0)
+			break;
+
+		capture__push(self, msgs, frames, n);
+	}
+
+	return 0;
+}
+
+static int capture__open_socket(const char* iface)
+{
+	int one = 1;
+
+	int fd = socketcan_open(iface);
+	if (fd < 0)
+		return -1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) < 0
+	 || setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (net_grow_rcvbuf(fd, CAPTURE_RCVBUF) < 0)
+		perror("Could not grow the socket receive buffer");
+
+	return fd;
+}
+
+static void capture__get_stop_signals(sigset_t* set)
+{
+	sigemptyset(set);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGTERM);
+}
+
+/* The write thread inherits the blocked stop signals, so it never takes
+ * them.
+ */
+static int capture__start_writer(struct capture* self, pthread_t* thread)
+{
+	int rc = pthread_create(thread, NULL, capture__write_thread, self);
+	return rc == 0 ? 0 : -1;
+}
+
+static void capture__print_stats(const struct capture* self, FILE* output)
+{
+	fprintf(output, "Captured %" PRIu64 " frames; %" PRIu32 " dropped by the kernel, %" PRIu64 " dropped in the capture buffer%s\n",
+		self->n_frames, self->n_kernel_drops, self->n_buffer_drops,
+		self->has_write_error ? "; the output file is incomplete" : "");
+}
+
+__attribute__((visibility("default")))
+int co_dump_capture(const char* iface, const char* path)
+{
+	struct capture self;
+	pthread_t writer;
+	sigset_t stop_signals, old_mask, wait_mask;
+	int rc = 1;
+
+	capture__is_stopped = 0;
+
+	memset(&self, 0, sizeof(self));
+	pthread_mutex_init(&self.mutex, NULL);
+	pthread_cond_init(&self.cond, NULL);
+
+	self.ring = malloc(CAPTURE_RING_LENGTH * sizeof(*self.ring));
+	if (!self.ring) {
+		perror("Could not allocate capture buffer");
+		goto ring_failure;
+	}
+
+	self.output = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if (!self.output) {
+		perror("Could not open output file");
+		goto output_failure;
+	}
+
+	setvbuf(self.output, NULL, _IOFBF, CAPTURE_OUTPUT_BUFFER);
+
+	self.fd = capture__open_socket(iface);
+	if (self.fd < 0) {
+		perror("Could not open CAN bus");
+		goto socket_failure;
+	}
+
+	capture__get_stop_signals(&stop_signals);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+	wait_mask = old_mask;
+	sigdelset(&wait_mask, SIGINT);
+	sigdelset(&wait_mask, SIGTERM);
+
+	if (capture__set_signal_handlers() < 0
+	 || capture__start_writer(&self, &writer) < 0) {
+		perror("Could not start capture");
+		goto writer_failure;
+	}
+
+	if (capture__run(&self, &wait_mask) < 0)
+		perror("Could not receive from CAN bus");
+	else
+		rc = 0;
+
+	pthread_mutex_lock(&self.mutex);
+	self.is_done = 1;
+	pthread_cond_signal(&self.cond);
+	pthread_mutex_unlock(&self.mutex);
+
+	pthread_join(writer, NULL);
+
+	if (fflush(self.output) != 0)
+		self.has_write_error = 1;
+
+	capture__print_stats(&self, stderr);
+
+	if (self.has_write_error)
+		rc = 1;
+
+writer_failure:
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	close(self.fd);
+socket_failure:
+	if (self.output != stdout)
+		fclose(self.output);
+output_failure:
+	free(self.ring);
+ring_failure:
+	pthread_cond_destroy(&self.cond);
+	pthread_mutex_destroy(&self.mutex);
+	return rc;
+}
@@ -14,9 +14,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <time.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "socketcan.h"
 #include "canopen.h"
@@ -33,6 +40,12 @@
 #include "canopen/error.h"
 #include "time-utils.h"
 #include "trace-buffer.h"
+#include "trace-file.h"
+#include "canopen/bus-stats.h"
+#include "canopen/eds.h"
+#include "canopen/dcf.h"
+#include "od-decoder.h"
+#include "canopen/trace-sub.h"
 
 #ifndef CAN_MAX_DLC
 #define CAN_MAX_DLC 8
@@ -40,8 +53,12 @@
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+#define DUMP_MIN_CHUNK_FRAMES 65536
+#define DUMP_MAX_THREADS 64
+
 #define printx(cf, fmt, ...) \
-	printf(fmt "%s\n", ## __VA_ARGS__, (cf)->can_id & CAN_RTR_FLAG ? " [RTR]" : "")
+	fprintf(output_, fmt "%s\n", ## __VA_ARGS__, \
+		(cf)->can_id & CAN_RTR_FLAG ? " [RTR]" : "")
 
 struct node_state {
 	uint32_t current_mux;
@@ -49,9 +66,21 @@ struct node_state {
 	int device_type;
 };
 
+/* Large trace files are decoded in chunks on several threads, so the decoding
+ * state is per thread.
+ */
+static __thread FILE* output_ = NULL;
+static __thread struct node_state node_state_[127] = { 0 };
+static __thread uint64_t current_time_ = 0;
+static __thread struct od_decoder* decoder_ = NULL;
+
 static enum co_dump_options options_ = 0;
-static struct node_state node_state_[127] = { 0 };
-static uint64_t current_time_ = 0;
+static struct bus_stats* stats_ = NULL;
+static uint64_t stats_interval_ = 0;
+static const char* eds_name_[128] = { 0 };
+static const char* dcf_path_[128] = { 0 };
+static unsigned int n_jobs_ = 0;
+static const char* subscription_ = NULL;
 
 char* strlcpy(char* dst, const char* src, size_t size);
 const char* hexdump(const void* data, size_t size);
@@ -68,7 +97,7 @@ static inline void print_ts(void)
 	char buffer[256];
 
 	strftime(buffer, sizeof(buffer), "%FT%T", localtime_r(&seconds, &tm));
-	printf("%s.%06"PRIu32"Z ", buffer, microseconds);
+	fprintf(output_, "%s.%06"PRIu32"Z ", buffer, microseconds);
 }
 
 static inline struct node_state* get_node_state(int nodeid)
@@ -82,6 +111,12 @@ static void node_state_init(void)
 		vector_init(&node_state_[i].sdo_data, 8);
 }
 
+static void node_state_cleanup(void)
+{
+	for (int i = 0; i < 127; ++i)
+		vector_destroy(&node_state_[i].sdo_data);
+}
+
 static const char* nmt_cs_str(enum nmt_cs cs)
 {
 	switch (cs) {
@@ -178,9 +213,19 @@ static int dump_pdo(int type, int n, struct canopen_msg* msg,
 
 	print_ts();
 
-	printx(cf, "%cPDO%d %d length=%d,data=%s", type, n, msg->id,
-	       cf->can_dlc, hexdump(cf->data, cf->can_dlc));
+	fprintf(output_, "%cPDO%d %d length=%d,data=%s", type, n, msg->id,
+		cf->can_dlc, hexdump(cf->data, cf->can_dlc));
+
+	char values[1024];
+	enum od_decoder_pdo_type pdo_type = type == 'T' ? OD_DECODER_TPDO
+							: OD_DECODER_RPDO;
 
+	if (decoder_ && od_decoder_decode_pdo(decoder_, values, sizeof(values),
+					      msg->id, pdo_type, n, cf->data,
+					      cf->can_dlc) == 0)
+		fprintf(output_, ",values=%s", values);
+
+	printx(cf, "");
 	return 0;
 }
 
@@ -192,6 +237,25 @@ static size_t get_expediated_size(const struct can_frame* cf)
 	     ? MIN(sdo_get_expediated_size(cf), max_size) : max_size;
 }
 
+static void print_obj_name(int nodeid, int index, int subindex)
+{
+	const char* name = decoder_
+			 ? od_decoder_name(decoder_, nodeid, index, subindex)
+			 : NULL;
+	if (name)
+		fprintf(output_, ",name=\"%s\"", name);
+}
+
+static void print_obj_value(int nodeid, int index, int subindex,
+			    const void* data, size_t size)
+{
+	char value[256];
+
+	if (decoder_ && od_decoder_format(decoder_, value, sizeof(value),
+					  nodeid, index, subindex, data, size))
+		fprintf(output_, ",value=%s", value);
+}
+
 static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 {
 	struct node_state* state = get_node_state(msg->id);
@@ -207,8 +271,10 @@ static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("RSDO %d init-download-%s index=%x,subindex=%d", msg->id,
-	       is_expediated ? "expediated" : "segment", index, subindex);
+	fprintf(output_, "RSDO %d init-download-%s index=%x,subindex=%d",
+		msg->id, is_expediated ? "expediated" : "segment", index,
+		subindex);
+	print_obj_name(msg->id, index, subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
 		size_t size = sdo_get_indicated_size(cf);
@@ -219,14 +285,21 @@ static int dump_sdo_dl_init_req(struct canopen_msg* msg, struct can_frame* cf)
 		}
 	} else if (is_expediated) {
 		size_t size = get_expediated_size(cf);
-		printx(cf, ",size=%zu,data=%s", size,
-		       hexdump(&cf->data[SDO_EXPEDIATED_DATA_IDX], size));
+		const void* payload = &cf->data[SDO_EXPEDIATED_DATA_IDX];
+
+		fprintf(output_, ",size=%zu,data=%s", size,
+			hexdump(payload, size));
+
+		print_obj_value(msg->id, index, subindex, payload, size);
+		printx(cf, "");
+	} else {
+		printx(cf, "");
 	}
 
 	return 0;
 }
 
-static struct vector string_buffer_;
+static __thread struct vector string_buffer_;
 
 static char* make_string(const char* str, size_t size)
 {
@@ -236,15 +309,25 @@ static char* make_string(const char* str, size_t size)
 	return string_buffer_.data;
 }
 
-static const char* get_segment_data(const struct node_state* state,
+static int is_string_obj(int nodeid, uint32_t mux)
+{
+	if (!decoder_)
+		return sdo_dict_type(mux) == CANOPEN_VISIBLE_STRING;
+
+	return canopen_type_is_string(od_decoder_type(decoder_, nodeid,
+						      mux >> 16, mux & 0xff));
+}
+
+static const char* get_segment_data(int nodeid, const struct node_state* state,
 				    const void* data, size_t size)
 {
-	if (state && sdo_dict_type(state->current_mux) == CANOPEN_VISIBLE_STRING)
+	if (state && is_string_obj(nodeid, state->current_mux))
 		return make_string(data, size);
 
 	return hexdump(data, size);
 }
 
+
 static int dump_sdo_dl_seg_req(struct canopen_msg* msg, struct can_frame* cf)
 {
 	struct node_state* state = get_node_state(msg->id);
@@ -259,15 +342,17 @@ static int dump_sdo_dl_seg_req(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("RSDO %d download-segment%s size=%zu,data=%s", msg->id,
-	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
+	fprintf(output_, "RSDO %d download-segment%s size=%zu,data=%s", msg->id,
+		is_end ? "-end" : "", size,
+		get_segment_data(msg->id, state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%zu,final-data=%s", final_size,
-		       get_segment_data(state, final_data, final_size));
+		fprintf(output_, ",final-size=%zu,final-data=%s", final_size,
+			get_segment_data(msg->id, state, final_data,
+					 final_size));
 
 		state->current_mux = 0;
 	}
@@ -282,8 +367,10 @@ static int dump_sdo_ul_init_req(struct canopen_msg* msg, struct can_frame* cf)
 	int subindex = sdo_get_subindex(cf);
 
 	print_ts();
-	printx(cf, "RSDO %d init-upload-segment index=%x,subindex=%d", msg->id,
-	       index, subindex);
+	fprintf(output_, "RSDO %d init-upload-segment index=%x,subindex=%d",
+		msg->id, index, subindex);
+	print_obj_name(msg->id, index, subindex);
+	printx(cf, "");
 
 	return 0;
 
@@ -306,13 +393,46 @@ static int dump_sdo_abort(int type, struct canopen_msg* msg,
 	const char* reason = sdo_strerror(sdo_get_abort_code(cf));
 
 	print_ts();
-	printx(cf, "%cSDO %d abort index=%x,subindex=%d,reason=\"%s\"", type,
-	       msg->id, index, subindex, reason);
+	fprintf(output_, "%cSDO %d abort index=%x,subindex=%d", type,
+		msg->id, index, subindex);
+	print_obj_name(msg->id, index, subindex);
+	printx(cf, ",reason=\"%s\"", reason);
 	return 0;
 }
 
+/* Device types, identities and PDO mappings fit in expediated transfers, so
+ * those are all that is tracked. This is done even if SDOs are not shown, so
+ * that EMCYs and PDOs can be decoded. A download may still be aborted, but a
+ * passive observer has no better guess for the new value.
+ */
+static void track_sdo(struct canopen_msg* msg, struct can_frame* cf)
+{
+	struct node_state* state = get_node_state(msg->id);
+
+	if (!state || !sdo_is_expediated(cf)
+	 || cf->can_dlc <= SDO_EXPEDIATED_DATA_IDX)
+		return;
+
+	int index = sdo_get_index(cf);
+	int subindex = sdo_get_subindex(cf);
+	size_t size = get_expediated_size(cf);
+	const void* payload = &cf->data[SDO_EXPEDIATED_DATA_IDX];
+
+	if (index == 0x1000 && subindex == 0)
+		byteorder2(&state->device_type, payload,
+			   sizeof(state->device_type),
+			   MIN(sizeof(state->device_type), size));
+
+	if (decoder_)
+		od_decoder_learn(decoder_, msg->id, index, subindex, payload,
+				 size);
+}
+
 static int dump_rsdo(struct canopen_msg* msg, struct can_frame* cf)
 {
+	if (sdo_get_cs(cf) == SDO_CCS_DL_INIT_REQ)
+		track_sdo(msg, cf);
+
 	if (!(options_ & CO_DUMP_FILTER_SDO))
 		return 0;
 
@@ -348,8 +468,10 @@ static int dump_sdo_ul_init_res(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("TSDO %d init-upload-%s index=%x,subindex=%d", msg->id,
-	       is_expediated ? "expediated" : "segment", index, subindex);
+	fprintf(output_, "TSDO %d init-upload-%s index=%x,subindex=%d",
+		msg->id, is_expediated ? "expediated" : "segment", index,
+		subindex);
+	print_obj_name(msg->id, index, subindex);
 
 	if (!is_expediated && is_size_indicated && cf->can_dlc == CAN_MAX_DLC) {
 		size_t size = sdo_get_indicated_size(cf);
@@ -362,12 +484,12 @@ static int dump_sdo_ul_init_res(struct canopen_msg* msg, struct can_frame* cf)
 		size_t size = get_expediated_size(cf);
 		const void* payload = &cf->data[SDO_EXPEDIATED_DATA_IDX];
 
-		if (index == 0x1000 && subindex == 0)
-			byteorder2(&state->device_type, payload,
-				   sizeof(state->device_type),
-				   MIN(sizeof(state->device_type), size));
-
-		printx(cf, ",size=%zu,data=%s", size, hexdump(payload, size));
+		fprintf(output_, ",size=%zu,data=%s", size,
+			hexdump(payload, size));
+		print_obj_value(msg->id, index, subindex, payload, size);
+		printx(cf, "");
+	} else {
+		printx(cf, "");
 	}
 
 	return 0;
@@ -387,15 +509,17 @@ static int dump_sdo_ul_seg_res(struct canopen_msg* msg, struct can_frame* cf)
 
 	print_ts();
 
-	printf("TSDO %d upload-segment%s size=%zu,data=%s", msg->id,
-	       is_end ? "-end" : "", size, get_segment_data(state, data, size));
+	fprintf(output_, "TSDO %d upload-segment%s size=%zu,data=%s", msg->id,
+		is_end ? "-end" : "", size,
+		get_segment_data(msg->id, state, data, size));
 
 	if (state && is_end) {
 		const void* final_data = state->sdo_data.data;
 		size_t final_size = state->sdo_data.index;
 
-		printf(",final-size=%zu,final-data=%s", final_size,
-		       get_segment_data(state, final_data, final_size));
+		fprintf(output_, ",final-size=%zu,final-data=%s", final_size,
+			get_segment_data(msg->id, state, final_data,
+					 final_size));
 	}
 
 	printx(cf, "");
@@ -423,6 +547,9 @@ static int dump_sdo_dl_seg_res(struct canopen_msg* msg, struct can_frame* cf)
 
 static int dump_tsdo(struct canopen_msg* msg, struct can_frame* cf)
 {
+	if (sdo_get_cs(cf) == SDO_SCS_UL_INIT_RES)
+		track_sdo(msg, cf);
+
 	if (!(options_ & CO_DUMP_FILTER_SDO))
 		return 0;
 
@@ -506,6 +633,29 @@ static int multiplex(struct can_frame* cf)
 	return -1;
 }
 
+static void report_stats(void)
+{
+	bus_stats_print(stats_, stdout);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void on_frame(struct can_frame* cf)
+{
+	if (!stats_) {
+		multiplex(cf);
+		return;
+	}
+
+	if (stats_interval_ && stats_->n_frames > 0
+	 && current_time_ >= stats_->start_time + stats_interval_) {
+		report_stats();
+		bus_stats_reset(stats_);
+	}
+
+	bus_stats_add(stats_, current_time_, cf);
+}
+
 static void run_dumper(struct sock* sock)
 {
 	struct can_frame cf;
@@ -517,10 +667,47 @@ static void run_dumper(struct sock* sock)
 			break;
 
 		current_time_ = gettime_us(CLOCK_REALTIME);
-		multiplex(&cf);
+		on_frame(&cf);
 	}
 }
 
+/* The master has already filtered the frames, so only the frames that it
+ * dropped for us need to be reported.
+ */
+static int dump_subscription(const char* addr)
+{
+	static struct trace_sub_record records[TRACE_SUB_BATCH_MAX];
+	struct trace_sub_header header;
+	struct can_frame cf;
+	int rc;
+
+	int fd = trace_sub_connect(addr, subscription_);
+	if (fd < 0)
+		return -1;
+
+	while ((rc = trace_sub_read_batch(fd, &header, records)) > 0) {
+		if (header.n_dropped && !stats_) {
+			current_time_ = gettime_us(CLOCK_REALTIME);
+			print_ts();
+			fprintf(output_, "DROPPED count=%"PRIu32"\n",
+				header.n_dropped);
+		}
+
+		for (unsigned int i = 0; i < header.n_records; ++i) {
+			memset(&cf, 0, sizeof(cf));
+			cf.can_id = records[i].can_id;
+			cf.can_dlc = MIN(records[i].can_dlc, CAN_MAX_DLC);
+			memcpy(cf.data, records[i].data, sizeof(cf.data));
+
+			current_time_ = records[i].timestamp;
+			on_frame(&cf);
+		}
+	}
+
+	close(fd);
+	return rc;
+}
+
 static void resolve_filters(enum co_dump_options options)
 {
 	options_ |= options & ~CO_DUMP_FILTER_MASK;
@@ -530,29 +717,406 @@ static void resolve_filters(enum co_dump_options options)
 		  : CO_DUMP_FILTER_MASK;
 }
 
+/* A ring file may have been left behind by a crashed master, so the frames
+ * are read through the same consistency checks as a live dump.
+ */
+static int dump_ring_file(const char* path)
+{
+	struct tracebuffer tb;
+
+	if (tb_open_file(&tb, path) < 0)
+		return -1;
+
+	struct tb_frame* frames = malloc(tb.length * sizeof(*frames));
+	if (!frames) {
+		tb_destroy(&tb);
+		return -1;
+	}
+
+	size_t n = tb_snapshot(&tb, frames);
+	for (size_t i = 0; i < n; ++i) {
+		current_time_ = frames[i].timestamp;
+		on_frame(&frames[i].cf);
+	}
+
+	free(frames);
+	tb_destroy(&tb);
+	return 0;
+}
+
+static int dump_compact_file(FILE* stream)
+{
+	struct tf_reader reader;
+	struct tb_frame frame;
+	int rc;
+
+	if (tf_reader_init(&reader, stream) < 0)
+		return -1;
+
+	while ((rc = tf_reader_next(&reader, &frame)) > 0) {
+		current_time_ = frame.timestamp;
+		on_frame(&frame.cf);
+	}
+
+	tf_reader_destroy(&reader);
+	return rc;
+}
+
+struct dump_chunk {
+	const struct tb_frame* frames;
+	size_t replay_start;
+	size_t start;
+	size_t end;
+	struct od_decoder* decoder;
+	int device_type[127];
+	FILE* output;
+	pthread_t thread;
+	int is_started;
+};
+
+static void decode_frames(const struct tb_frame* frames, size_t start,
+			  size_t end)
+{
+	for (size_t i = start; i < end; ++i) {
+		struct can_frame cf = frames[i].cf;
+		current_time_ = frames[i].timestamp;
+		on_frame(&cf);
+	}
+}
+
+/* The frames before the start of the chunk are replayed without output, so
+ * that segmented transfers that are in progress at the start are reassembled.
+ */
+static void* decode_chunk(void* arg)
+{
+	struct dump_chunk* chunk = arg;
+
+	vector_init(&string_buffer_, 256);
+	node_state_init();
+
+	for (int i = 0; i < 127; ++i)
+		node_state_[i].device_type = chunk->device_type[i];
+
+	decoder_ = chunk->decoder;
+
+	output_ = fopen("/dev/null", "w");
+	if (output_) {
+		decode_frames(chunk->frames, chunk->replay_start, chunk->start);
+		fclose(output_);
+	}
+
+	output_ = chunk->output;
+	decode_frames(chunk->frames, chunk->start, chunk->end);
+	fflush(output_);
+
+	node_state_cleanup();
+	vector_destroy(&string_buffer_);
+	return NULL;
+}
+
+/* Tracks the state that is carried between frames: expediated values through
+ * track_sdo() and the first frame of each segmented transfer in progress.
+ */
+static void track_frame(const struct tb_frame* frame, size_t pos,
+			size_t* open_since)
+{
+	struct can_frame cf = frame->cf;
+	struct canopen_msg msg;
+
+	if (canopen_get_object_type(&msg, &cf) != 0
+	 || msg.id < 1 || msg.id > 127)
+		return;
+
+	int cs = sdo_get_cs(&cf);
+	size_t* open = &open_since[msg.id - 1];
+
+	if (msg.object == CANOPEN_RSDO) {
+		if (cs == SDO_CCS_DL_INIT_REQ)
+			track_sdo(&msg, &cf);
+
+		if (cs == SDO_CCS_DL_INIT_REQ && !sdo_is_expediated(&cf))
+			*open = pos;
+		else if ((cs == SDO_CCS_DL_SEG_REQ && sdo_is_end_segment(&cf))
+		      || cs == SDO_CCS_ABORT)
+			*open = SIZE_MAX;
+	} else if (msg.object == CANOPEN_TSDO) {
+		if (cs == SDO_SCS_UL_INIT_RES)
+			track_sdo(&msg, &cf);
+
+		if (cs == SDO_SCS_UL_INIT_RES && !sdo_is_expediated(&cf))
+			*open = pos;
+		else if ((cs == SDO_SCS_UL_SEG_RES && sdo_is_end_segment(&cf))
+		      || cs == SDO_SCS_ABORT)
+			*open = SIZE_MAX;
+	}
+}
+
+/* A quick pass over the SDO frames hands the state at each chunk boundary over
+ * to the chunk that starts there.
+ */
+static void prepare_chunks(struct dump_chunk* chunks, size_t n_chunks)
+{
+	size_t open_since[127];
+
+	for (int i = 0; i < 127; ++i)
+		open_since[i] = SIZE_MAX;
+
+	for (size_t k = 0; k < n_chunks; ++k) {
+		struct dump_chunk* chunk = &chunks[k];
+
+		chunk->replay_start = chunk->start;
+
+		for (int i = 0; i < 127; ++i) {
+			chunk->device_type[i] = node_state_[i].device_type;
+			if (open_since[i] < chunk->replay_start)
+				chunk->replay_start = open_since[i];
+		}
+
+		if (decoder_)
+			memcpy(chunk->decoder, decoder_, sizeof(*decoder_));
+
+		if (k + 1 == n_chunks)
+			break;
+
+		for (size_t i = chunk->start; i < chunk->end; ++i)
+			track_frame(&chunk->frames[i], i, open_since);
+	}
+}
+
+static int copy_stream(FILE* dst, FILE* src)
+{
+	char buffer[65536];
+	size_t size;
+
+	rewind(src);
+
+	while ((size = fread(buffer, 1, sizeof(buffer), src)) > 0)
+		if (fwrite(buffer, 1, size, dst) != size)
+			return -1;
+
+	return ferror(src) ? -1 : 0;
+}
+
+static int init_chunk(struct dump_chunk* chunk, const struct tb_frame* frames,
+		      size_t start, size_t end)
+{
+	chunk->frames = frames;
+	chunk->start = start;
+	chunk->end = end;
+
+	chunk->output = tmpfile();
+	if (!chunk->output)
+		return -1;
+
+	if (!decoder_)
+		return 0;
+
+	chunk->decoder = malloc(sizeof(*chunk->decoder));
+	return chunk->decoder ? 0 : -1;
+}
+
+static void destroy_chunk(struct dump_chunk* chunk)
+{
+	if (chunk->output)
+		fclose(chunk->output);
+
+	free(chunk->decoder);
+}
+
+/* Each chunk is decoded into a temporary file on its own thread. The outputs
+ * are copied to stdout in order as the threads finish.
+ */
+static int decode_parallel(const struct tb_frame* frames, size_t n_frames,
+			   size_t n_chunks)
+{
+	int rc = -1;
+	size_t k;
+
+	struct dump_chunk* chunks = calloc(n_chunks, sizeof(*chunks));
+	if (!chunks)
+		return -1;
+
+	for (k = 0; k < n_chunks; ++k)
+		if (init_chunk(&chunks[k], frames, n_frames * k / n_chunks,
+			       n_frames * (k + 1) / n_chunks) < 0)
+			goto failure;
+
+	prepare_chunks(chunks, n_chunks);
+
+	for (k = 0; k < n_chunks; ++k) {
+		if (pthread_create(&chunks[k].thread, NULL, decode_chunk,
+				   &chunks[k]) != 0)
+			goto failure;
+
+		chunks[k].is_started = 1;
+	}
+
+	rc = 0;
+
+failure:
+	for (k = 0; k < n_chunks; ++k) {
+		if (chunks[k].is_started) {
+			pthread_join(chunks[k].thread, NULL);
+
+			if (rc == 0 && copy_stream(output_, chunks[k].output) < 0)
+				rc = -1;
+		}
+
+		destroy_chunk(&chunks[k]);
+	}
+
+	free(chunks);
+	return rc;
+}
+
+static size_t get_n_chunks(size_t n_frames)
+{
+	if (stats_)
+		return 1;
+
+	long n_jobs = n_jobs_ ? n_jobs_ : sysconf(_SC_NPROCESSORS_ONLN);
+	size_t n = n_frames / DUMP_MIN_CHUNK_FRAMES;
+
+	if (n_jobs > 0 && n > (size_t)n_jobs)
+		n = n_jobs;
+
+	return n > DUMP_MAX_THREADS ? DUMP_MAX_THREADS : n;
+}
+
+/* Regular files are mapped into memory and large ones are decoded in parallel.
+ * Anything else, such as a pipe, is read one frame at a time.
+ */
+static int dump_raw_file(FILE* stream)
+{
+	struct stat st;
+	int rc = 0;
+
+	if (fstat(fileno(stream), &st) < 0 || !S_ISREG(st.st_mode)
+	 || st.st_size < (off_t)sizeof(struct tb_frame)) {
+		struct tb_frame frame;
+		while (fread(&frame, sizeof(frame), 1, stream))
+			decode_frames(&frame, 0, 1);
+
+		return 0;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			 fileno(stream), 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	size_t n_frames = st.st_size / sizeof(struct tb_frame);
+	size_t n_chunks = get_n_chunks(n_frames);
+
+	if (n_chunks > 1)
+		rc = decode_parallel(map, n_frames, n_chunks);
+	else
+		decode_frames(map, 0, n_frames);
+
+	munmap(map, st.st_size);
+	return rc;
+}
+
 static int dump_file(const char* path, enum co_dump_options options)
 {
+	char magic[8] = { 0 };
+
 	FILE* stream = fopen(path, "r");
 	if (!stream)
 		return -1;
 
-	struct tb_frame frame;
-	while (fread(&frame, sizeof(frame), 1, stream)) {
-		current_time_ = frame.timestamp;
-		multiplex(&frame.cf);
+	if (fread(magic, sizeof(magic), 1, stream) == 1
+	 && memcmp(magic, TB_FILE_MAGIC, sizeof(magic)) == 0) {
+		fclose(stream);
+		return dump_ring_file(path);
+	}
+
+	rewind(stream);
+
+	if (tf_is_trace_file(magic)) {
+		int rc = dump_compact_file(stream);
+		fclose(stream);
+		return rc;
 	}
 
+	int rc = dump_raw_file(stream);
+
 	fclose(stream);
+	return rc;
+}
+
+static int load_node_dcf(int nodeid, const char* path)
+{
+	struct co_dcf dcf;
+
+	if (co_dcf_init(&dcf) < 0)
+		return -1;
+
+	const struct canopen_eds* eds = eds_name_[nodeid]
+				      ? eds_db_find_by_name(eds_name_[nodeid])
+				      : NULL;
+
+	if (co_dcf_load_file(&dcf, path, eds, nodeid) < 0) {
+		co_dcf_destroy(&dcf);
+		return -1;
+	}
+
+	od_decoder_load_dcf(decoder_, nodeid, &dcf);
+
+	co_dcf_destroy(&dcf);
 	return 0;
 }
 
-__attribute__((visibility("default")))
-int co_dump(const char* addr, enum co_dump_options options)
+/* The EDS database is only loaded if there is something to decode */
+static int decoder_init(void)
 {
-	vector_init(&string_buffer_, 256);
-	node_state_init();
+	if (stats_ || !(options_ & (CO_DUMP_FILTER_SDO | CO_DUMP_FILTER_PDO)))
+		return 0;
 
-	resolve_filters(options);
+	decoder_ = malloc(sizeof(*decoder_));
+	if (!decoder_)
+		return -1;
+
+	od_decoder_init(decoder_);
+	eds_db_load();
+
+	for (int i = 1; i <= 127; ++i) {
+		if (eds_name_[i]) {
+			const struct canopen_eds* eds;
+			eds = eds_db_find_by_name(eds_name_[i]);
+			if (!eds) {
+				fprintf(stderr, "Could not find EDS \"%s\"\n",
+					eds_name_[i]);
+				return -1;
+			}
+
+			od_decoder_set_eds(decoder_, i, eds);
+		}
+
+		if (dcf_path_[i] && load_node_dcf(i, dcf_path_[i]) < 0) {
+			fprintf(stderr, "Could not load DCF \"%s\": %s\n",
+				dcf_path_[i], strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void decoder_cleanup(void)
+{
+	if (!decoder_)
+		return;
+
+	eds_db_unload();
+	free(decoder_);
+	decoder_ = NULL;
+}
+
+static int run_dump(const char* addr, enum co_dump_options options)
+{
 
 	if (options & CO_DUMP_FILE) {
 		if (dump_file(addr, options) < 0) {
@@ -563,6 +1127,15 @@ int co_dump(const char* addr, enum co_dump_options options)
 		return 0;
 	}
 
+	if (subscription_) {
+		if (dump_subscription(addr) < 0) {
+			perror("Could not read trace subscription");
+			return 1;
+		}
+
+		return 0;
+	}
+
 	struct sock sock;
 	enum sock_type type = options & CO_DUMP_TCP ? SOCK_TYPE_TCP
 						    : SOCK_TYPE_CAN;
@@ -579,3 +1152,99 @@ int co_dump(const char* addr, enum co_dump_options options)
 	sock_close(&sock);
 	return 0;
 }
+
+__attribute__((visibility("default")))
+int co_dump(const char* addr, enum co_dump_options options)
+{
+	vector_init(&string_buffer_, 256);
+	node_state_init();
+	output_ = stdout;
+
+	resolve_filters(options);
+
+	int rc = 1;
+	if (decoder_init() >= 0)
+		rc = run_dump(addr, options);
+
+	decoder_cleanup();
+	node_state_cleanup();
+	vector_destroy(&string_buffer_);
+	return rc;
+}
+
+__attribute__((visibility("default")))
+int co_dump_set_eds(int nodeid, const char* name)
+{
+	if (nodeid < 1 || nodeid > 127)
+		return -1;
+
+	eds_name_[nodeid] = name;
+	return 0;
+}
+
+__attribute__((visibility("default")))
+void co_dump_set_jobs(unsigned int n)
+{
+	n_jobs_ = n;
+}
+
+__attribute__((visibility("default")))
+void co_dump_set_subscription(const char* line)
+{
+	subscription_ = line;
+}
+
+__attribute__((visibility("default")))
+int co_dump_set_dcf(int nodeid, const char* path)
+{
+	if (nodeid < 1 || nodeid > 127)
+		return -1;
+
+	dcf_path_[nodeid] = path;
+	return 0;
+}
+
+static void on_stop_signal(int signo)
+{
+	(void)signo;
+}
+
+/* Without SA_RESTART, a blocking receive returns when the dumper is stopped,
+ * so that the final report is still printed.
+ */
+static void set_stop_signal_handler(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+__attribute__((visibility("default")))
+int co_dump_stats(const char* addr, enum co_dump_options options,
+		  unsigned int bitrate, unsigned int interval)
+{
+	struct bus_stats* stats = malloc(sizeof(*stats));
+	if (!stats) {
+		perror("Could not allocate statistics");
+		return 1;
+	}
+
+	bus_stats_init(stats, bitrate);
+	stats_ = stats;
+	stats_interval_ = interval * 1000ULL;
+
+	if (!(options & CO_DUMP_FILE))
+		set_stop_signal_handler();
+
+	int rc = co_dump(addr, options);
+
+	report_stats();
+
+	stats_ = NULL;
+	free(stats);
+	return rc;
+}
@@ -42,7 +42,7 @@ append_code(char* dst, uint16_t code, const char* (*lookup)(uint16_t))
 static const char*
 convert_to_string(uint16_t code, const char* (*lookup)(uint16_t))
 {
-	static char buf[256];
+	static __thread char buf[256];
 	uint16_t current_code, last_code = 0;
 
 	if (code == 0)
@@ -0,0 +1,236 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "mloop.h"
+#include "canopen/hb_supervisor.h"
+
+static void hb_supervisor__on_tick(struct mloop_timer* timer)
+{
+	struct hb_supervisor* self = mloop_timer_get_context(timer);
+	hb_supervisor_process(self, gettime_us(CLOCK_MONOTONIC));
+}
+
+static void hb_supervisor__call(struct hb_supervisor* self, hb_supervisor_fn fn,
+				const struct co_nodeset* nodes)
+{
+	int nodeid;
+
+	if (!fn)
+		return;
+
+	co_nodeset_for_each(nodeid, nodes)
+		if (hb_supervisor_is_active(self, nodeid))
+			fn(self, nodeid);
+}
+
+/* Runs on the default loop */
+static void hb_supervisor__on_dispatch(struct mloop_async* async)
+{
+	struct hb_supervisor* self = mloop_async_get_context(async);
+
+	pthread_mutex_lock(&self->mutex);
+
+	struct co_nodeset seen = self->pending_seen;
+	struct co_nodeset ping = self->pending_ping;
+	struct co_nodeset timeout = self->pending_timeout;
+
+	co_nodeset_clear(&self->pending_seen);
+	co_nodeset_clear(&self->pending_ping);
+	co_nodeset_clear(&self->pending_timeout);
+
+	pthread_mutex_unlock(&self->mutex);
+
+	hb_supervisor__call(self, self->on_seen, &seen);
+	hb_supervisor__call(self, self->on_ping, &ping);
+	hb_supervisor__call(self, self->on_timeout, &timeout);
+}
+
+int hb_supervisor_init_on(struct hb_supervisor* self, struct mloop* loop,
+			  uint64_t tick)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->tick = tick;
+
+	if (pthread_mutex_init(&self->mutex, NULL) != 0)
+		return -1;
+
+	self->timer = mloop_timer_new(loop);
+	if (!self->timer)
+		goto timer_failure;
+
+	mloop_timer_set_type(self->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(self->timer, tick * 1000ULL);
+	mloop_timer_set_context(self->timer, self, NULL);
+	mloop_timer_set_callback(self->timer, hb_supervisor__on_tick);
+
+	if (loop == mloop_default())
+		return 0;
+
+	self->dispatch = mloop_async_new(mloop_default());
+	if (!self->dispatch)
+		goto dispatch_failure;
+
+	mloop_async_set_context(self->dispatch, self, NULL);
+	mloop_async_set_callback(self->dispatch, hb_supervisor__on_dispatch);
+
+	/* Timers can't be started or stopped from another thread than the one
+	 * that runs their loop, so this one just keeps ticking.
+	 */
+	if (mloop_timer_start(self->timer) < 0)
+		goto start_failure;
+
+	return 0;
+
+start_failure:
+	mloop_async_unref(self->dispatch);
+	self->dispatch = NULL;
+dispatch_failure:
+	mloop_timer_unref(self->timer);
+	self->timer = NULL;
+timer_failure:
+	pthread_mutex_destroy(&self->mutex);
+	return -1;
+}
+
+int hb_supervisor_init(struct hb_supervisor* self, uint64_t tick)
+{
+	return hb_supervisor_init_on(self, mloop_default(), tick);
+}
+
+void hb_supervisor_destroy(struct hb_supervisor* self)
+{
+	mloop_timer_stop(self->timer);
+	mloop_timer_unref(self->timer);
+
+	if (self->dispatch) {
+		mloop_async_cancel(self->dispatch);
+		mloop_async_unref(self->dispatch);
+	}
+
+	pthread_mutex_destroy(&self->mutex);
+}
+
+void hb_supervisor_start(struct hb_supervisor* self, int nodeid,
+			 uint64_t timeout, uint64_t ping_period)
+{
+	struct hb_supervisor_node* node = &self->node[nodeid];
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	hb_supervisor__lock(self);
+
+	node->timeout = timeout;
+	node->deadline = now + timeout;
+	node->ping_period = ping_period;
+	node->ping_deadline = now + ping_period;
+
+	if (!hb_supervisor_is_active(self, nodeid)) {
+		co_nodeset_add(&self->active, nodeid);
+
+		if (self->n_active++ == 0 && !self->dispatch)
+			mloop_timer_start(self->timer);
+	}
+
+	hb_supervisor__unlock(self);
+}
+
+void hb_supervisor_stop(struct hb_supervisor* self, int nodeid)
+{
+	if (!hb_supervisor_is_active(self, nodeid))
+		return;
+
+	hb_supervisor__lock(self);
+
+	co_nodeset_remove(&self->active, nodeid);
+	co_nodeset_remove(&self->seen, nodeid);
+
+	if (--self->n_active == 0 && !self->dispatch)
+		mloop_timer_stop(self->timer);
+
+	hb_supervisor__unlock(self);
+}
+
+static void hb_supervisor__emit(struct hb_supervisor* self, hb_supervisor_fn fn,
+				struct co_nodeset* pending, int nodeid)
+{
+	if (self->dispatch)
+		co_nodeset_add(pending, nodeid);
+	else if (fn)
+		fn(self, nodeid);
+}
+
+static void hb_supervisor__process_node(struct hb_supervisor* self,
+					int nodeid, uint64_t now)
+{
+	struct hb_supervisor_node* node = &self->node[nodeid];
+
+	if (node->ping_period && now >= node->ping_deadline) {
+		node->ping_deadline += node->ping_period;
+		if (node->ping_deadline <= now)
+			node->ping_deadline = now + node->ping_period;
+
+		hb_supervisor__emit(self, self->on_ping, &self->pending_ping,
+				    nodeid);
+	}
+
+	if (now < node->deadline)
+		return;
+
+	node->deadline += node->timeout;
+	if (node->deadline <= now)
+		node->deadline = now + node->timeout;
+
+	hb_supervisor__emit(self, self->on_timeout, &self->pending_timeout,
+			    nodeid);
+}
+
+static int hb_supervisor__have_pending(const struct hb_supervisor* self)
+{
+	return !co_nodeset_is_empty(&self->pending_seen)
+	    || !co_nodeset_is_empty(&self->pending_ping)
+	    || !co_nodeset_is_empty(&self->pending_timeout);
+}
+
+void hb_supervisor_process(struct hb_supervisor* self, uint64_t now)
+{
+	int nodeid;
+
+	hb_supervisor__lock(self);
+
+	struct co_nodeset seen = self->seen;
+	co_nodeset_clear(&self->seen);
+
+	co_nodeset_for_each(nodeid, &seen)
+		if (hb_supervisor_is_active(self, nodeid))
+			hb_supervisor__emit(self, self->on_seen,
+					    &self->pending_seen, nodeid);
+
+	/* Callbacks may stop supervision, which removes the node from the set
+	 * while it is being iterated.
+	 */
+	co_nodeset_for_each(nodeid, &self->active)
+		hb_supervisor__process_node(self, nodeid, now);
+
+	int have_pending = self->dispatch && hb_supervisor__have_pending(self);
+
+	hb_supervisor__unlock(self);
+
+	/* If the dispatch is already queued, it picks these up as well; if it
+	 * is running, they are retried on the next tick.
+	 */
+	if (have_pending)
+		mloop_async_start(self->dispatch);
+}
@@ -0,0 +1,690 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Triggered incident capture
+ *
+ * When an event matches one of the configured triggers, the frames from
+ * pre_trigger ms before it until post_trigger ms after it are copied out of
+ * the trace buffer into a file of their own. The trace buffer keeps running
+ * throughout, so the post-trigger part is taken by waiting until the window
+ * has passed before the snapshot is taken on a worker thread.
+ *
+ * Everything except the file writing happens on the main loop, so the state
+ * here is not locked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <linux/can/error.h>
+#include <mloop.h>
+
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/emcy.h"
+#include "canopen/incident.h"
+#include "trace-file.h"
+#include "time-utils.h"
+#include "string-utils.h"
+#include "vector.h"
+#include "plog.h"
+
+#define INCIDENT_CHECK_INTERVAL 50 /* ms */
+
+struct incident_job {
+	unsigned int id;
+	struct tracebuffer* tb;
+	uint64_t deadline; /* CLOCK_MONOTONIC, us */
+	uint64_t begin;
+	uint64_t end;
+	int is_compact;
+	char path[256];
+	ssize_t n_frames;
+};
+
+static struct tracebuffer* incident__tb = NULL;
+static struct incident_config incident__config;
+static struct incident_trigger incident__triggers[INCIDENT_MAX_TRIGGERS];
+static int incident__n_triggers = 0;
+
+static struct incident incident__history[INCIDENT_HISTORY];
+static struct incident_job* incident__pending[INCIDENT_HISTORY];
+static unsigned int incident__last_id = 0;
+static uint64_t incident__last_time = 0;
+static struct mloop_timer* incident__timer = NULL;
+
+static const char* incident__type_str(enum incident_trigger_type type)
+{
+	switch (type) {
+	case INCIDENT_TRIGGER_EMCY: return "emcy";
+	case INCIDENT_TRIGGER_SDO_ABORT: return "sdo-abort";
+	case INCIDENT_TRIGGER_HEARTBEAT_TIMEOUT: return "heartbeat-timeout";
+	case INCIDENT_TRIGGER_BUS_OFF: return "bus-off";
+	case INCIDENT_TRIGGER_REST: return "rest";
+	}
+
+	abort();
+	return NULL;
+}
+
+static int incident__type_from_str(enum incident_trigger_type* type,
+				   const char* str)
+{
+	enum incident_trigger_type i;
+
+	for (i = INCIDENT_TRIGGER_EMCY; i < INCIDENT_TRIGGER_REST; ++i)
+		if (strcmp(str, incident__type_str(i)) == 0) {
+			*type = i;
+			return 0;
+		}
+
+	return -1;
+}
+
+static int incident__parse_field(int64_t* value, const char* str)
+{
+	char* end = NULL;
+
+	if (!str || *str == '\0' || strcmp(str, "*") == 0) {
+		*value = INCIDENT_ANY;
+		return 0;
+	}
+
+	*value = strtoll(str, &end, 0);
+	return *end == '\0' && *value >= 0 ? 0 : -1;
+}
+
+static int incident__parse_trigger(struct incident_trigger* trigger,
+				   char* str)
+{
+	char* context = NULL;
+	int64_t nodeid;
+
+	char* type = strtok_r(str, ":", &context);
+	char* node = strtok_r(NULL, ":", &context);
+	char* code = strtok_r(NULL, ":", &context);
+
+	if (!type || strtok_r(NULL, ":", &context))
+		return -1;
+
+	if (incident__type_from_str(&trigger->type, type) < 0)
+		return -1;
+
+	if (incident__parse_field(&nodeid, node) < 0
+	 || incident__parse_field(&trigger->code, code) < 0)
+		return -1;
+
+	if (nodeid > CANOPEN_NODEID_MAX)
+		return -1;
+
+	trigger->nodeid = nodeid;
+	return 0;
+}
+
+int incident_parse_triggers(struct incident_trigger* triggers, size_t max,
+			    const char* str)
+{
+	char* context = NULL;
+	size_t n = 0;
+	char* token;
+
+	char* copy = strdup(str);
+	if (!copy)
+		return -1;
+
+	for (token = strtok_r(copy, ", \t", &context); token;
+	     token = strtok_r(NULL, ", \t", &context)) {
+		if (n >= max || incident__parse_trigger(&triggers[n], token) < 0)
+			goto failure;
+		++n;
+	}
+
+	free(copy);
+	return n;
+
+failure:
+	free(copy);
+	return -1;
+}
+
+int incident_trigger_is_match(const struct incident_trigger* trigger,
+			      enum incident_trigger_type type, int nodeid,
+			      int64_t code)
+{
+	return trigger->type == type
+	    && (trigger->nodeid == INCIDENT_ANY || trigger->nodeid == nodeid)
+	    && (trigger->code == INCIDENT_ANY || trigger->code == code);
+}
+
+static int incident__is_triggered(enum incident_trigger_type type, int nodeid,
+				  int64_t code)
+{
+	int i;
+
+	if (type == INCIDENT_TRIGGER_REST)
+		return 1;
+
+	for (i = 0; i < incident__n_triggers; ++i)
+		if (incident_trigger_is_match(&incident__triggers[i], type,
+					      nodeid, code))
+			return 1;
+
+	return 0;
+}
+
+int incident_wants_error_frames(void)
+{
+	int i;
+
+	for (i = 0; i < incident__n_triggers; ++i)
+		if (incident__triggers[i].type == INCIDENT_TRIGGER_BUS_OFF)
+			return 1;
+
+	return 0;
+}
+
+int incident_init(struct tracebuffer* tb, const struct incident_config* config,
+		  const char* triggers)
+{
+	int n = incident_parse_triggers(incident__triggers,
+					INCIDENT_MAX_TRIGGERS, triggers);
+	if (n < 0) {
+		plog(LOG_ERROR, "incident_init: Invalid trigger expression: \"%s\"",
+		     triggers);
+		return -1;
+	}
+
+	incident__n_triggers = n;
+	incident__tb = tb;
+	incident__config = *config;
+	incident__last_id = 0;
+	incident__last_time = 0;
+
+	memset(incident__history, 0, sizeof(incident__history));
+	memset(incident__pending, 0, sizeof(incident__pending));
+
+	return 0;
+}
+
+void incident_cleanup(void)
+{
+	int i;
+
+	if (incident__timer) {
+		mloop_timer_stop(incident__timer);
+		mloop_timer_unref(incident__timer);
+		incident__timer = NULL;
+	}
+
+	for (i = 0; i < INCIDENT_HISTORY; ++i) {
+		free(incident__pending[i]);
+		incident__pending[i] = NULL;
+	}
+
+	incident__tb = NULL;
+	incident__n_triggers = 0;
+}
+
+static inline struct incident* incident__slot(unsigned int id)
+{
+	return &incident__history[id % INCIDENT_HISTORY];
+}
+
+const struct incident* incident_get(unsigned int id)
+{
+	struct incident* incident = incident__slot(id);
+	return id != 0 && incident->id == id ? incident : NULL;
+}
+
+ssize_t incident_write_frames(FILE* stream, const struct tb_frame* frames,
+			      size_t n, uint64_t begin, uint64_t end,
+			      int is_compact)
+{
+	struct tf_writer writer;
+	ssize_t n_written = 0;
+	size_t i;
+
+	if (is_compact && tf_writer_init(&writer, stream, TF_COMPRESS_LZ4) < 0)
+		return -1;
+
+	for (i = 0; i < n; ++i) {
+		if (frames[i].timestamp < begin || frames[i].timestamp > end)
+			continue;
+
+		int rc = is_compact
+		       ? tf_writer_add(&writer, &frames[i])
+		       : fwrite(&frames[i], sizeof(frames[i]), 1, stream) == 1
+			 ? 0 : -1;
+		if (rc < 0) {
+			n_written = -1;
+			break;
+		}
+
+		++n_written;
+	}
+
+	if (is_compact && tf_writer_finish(&writer) < 0)
+		return -1;
+
+	return n_written;
+}
+
+static void incident__do_capture(struct mloop_work* work)
+{
+	struct incident_job* job = mloop_work_get_context(work);
+
+	job->n_frames = -1;
+
+	struct tb_frame* frames = malloc(job->tb->length * sizeof(*frames));
+	if (!frames)
+		return;
+
+	size_t n = tb_snapshot(job->tb, frames);
+
+	FILE* stream = fopen(job->path, "w");
+	if (stream) {
+		job->n_frames = incident_write_frames(stream, frames, n,
+						      job->begin, job->end,
+						      job->is_compact);
+		if (fclose(stream) != 0)
+			job->n_frames = -1;
+	}
+
+	free(frames);
+}
+
+struct incident__file {
+	time_t mtime;
+	char name[256];
+};
+
+static int incident__is_capture_file(const char* name)
+{
+	return string_begins_with("incident-", name)
+	    && (string_ends_with(TF_FILE_SUFFIX, name)
+	     || string_ends_with(TF_RAW_FILE_SUFFIX, name));
+}
+
+/* Newest first */
+static int incident__cmp_files(const void* ptr_a, const void* ptr_b)
+{
+	const struct incident__file* a = ptr_a;
+	const struct incident__file* b = ptr_b;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+
+	return -strcmp(a->name, b->name);
+}
+
+static void incident__mark_deleted(const char* path)
+{
+	int i;
+
+	for (i = 0; i < INCIDENT_HISTORY; ++i)
+		if (incident__history[i].id != 0
+		 && strcmp(incident__history[i].path, path) == 0)
+			incident__history[i].state = INCIDENT_DELETED;
+}
+
+int incident_prune_files(const char* dir_path, unsigned int max_files)
+{
+	struct vector files;
+	struct dirent* ent;
+	char path[512];
+	int n_removed = 0;
+
+	DIR* dir = opendir(dir_path);
+	if (!dir)
+		return -1;
+
+	vector_init(&files, 64 * sizeof(struct incident__file));
+
+	while ((ent = readdir(dir)) != NULL) {
+		struct incident__file file = { 0 };
+		struct stat st;
+
+		if (!incident__is_capture_file(ent->d_name))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir_path, ent->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		file.mtime = st.st_mtime;
+		strncpy(file.name, ent->d_name, sizeof(file.name) - 1);
+
+		if (vector_append(&files, &file, sizeof(file)) < 0) {
+			n_removed = -1;
+			goto done;
+		}
+	}
+
+	struct incident__file* list = files.data;
+	size_t n_files = files.index / sizeof(*list);
+
+	qsort(list, n_files, sizeof(*list), incident__cmp_files);
+
+	for (size_t i = max_files; i < n_files; ++i) {
+		snprintf(path, sizeof(path), "%s/%s", dir_path, list[i].name);
+
+		if (unlink(path) < 0)
+			continue;
+
+		incident__mark_deleted(path);
+		++n_removed;
+	}
+
+done:
+	vector_destroy(&files);
+	closedir(dir);
+	return n_removed;
+}
+
+/* Only the newest max_files captures are kept on disk, including those from
+ * earlier runs.
+ */
+static void incident__remove_old_files(void)
+{
+	if (incident__config.max_files == 0)
+		return;
+
+	if (incident_prune_files(incident__config.path,
+				 incident__config.max_files) < 0)
+		plog(LOG_WARNING, "incident__remove_old_files: Could not clean up \"%s\"",
+		     incident__config.path);
+}
+
+static void incident__on_capture_done(struct mloop_work* work)
+{
+	struct incident_job* job = mloop_work_get_context(work);
+	struct incident* incident = incident__slot(job->id);
+
+	if (incident->id != job->id)
+		return;
+
+	if (job->n_frames < 0) {
+		plog(LOG_ERROR, "incident__on_capture_done: Failed to write \"%s\"",
+		     job->path);
+		incident->state = INCIDENT_FAILED;
+		return;
+	}
+
+	incident->state = INCIDENT_DONE;
+	incident->n_frames = job->n_frames;
+
+	plog(LOG_NOTICE, "Captured %zd frames for incident %u (%s) in \"%s\"",
+	     job->n_frames, job->id, incident->trigger, job->path);
+
+	incident__remove_old_files();
+}
+
+static int incident__start_capture(struct incident_job* job)
+{
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work) {
+		free(job);
+		return -1;
+	}
+
+	mloop_work_set_context(work, job, free);
+	mloop_work_set_work_fn(work, incident__do_capture);
+	mloop_work_set_done_fn(work, incident__on_capture_done);
+
+	incident__slot(job->id)->state = INCIDENT_WRITING;
+
+	int rc = mloop_work_start(work);
+	mloop_work_unref(work);
+	return rc;
+}
+
+static void incident__on_tick(struct mloop_timer* timer)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	int n_pending = 0;
+	int i;
+
+	for (i = 0; i < INCIDENT_HISTORY; ++i) {
+		struct incident_job* job = incident__pending[i];
+		if (!job)
+			continue;
+
+		if (job->deadline > now) {
+			++n_pending;
+			continue;
+		}
+
+		incident__pending[i] = NULL;
+
+		if (incident__start_capture(job) < 0)
+			incident__slot(job->id)->state = INCIDENT_FAILED;
+	}
+
+	if (n_pending == 0)
+		mloop_timer_stop(timer);
+}
+
+static int incident__start_timer(void)
+{
+	if (!incident__timer) {
+		incident__timer = mloop_timer_new(mloop_default());
+		if (!incident__timer)
+			return -1;
+
+		mloop_timer_set_type(incident__timer, MLOOP_TIMER_PERIODIC);
+		mloop_timer_set_time(incident__timer,
+				     msec_to_nsec(INCIDENT_CHECK_INTERVAL));
+		mloop_timer_set_callback(incident__timer, incident__on_tick);
+	}
+
+	if (mloop_timer_is_started(incident__timer))
+		return 0;
+
+	return mloop_timer_start(incident__timer);
+}
+
+static void incident__describe(char* dst, size_t size,
+			       enum incident_trigger_type type, int nodeid,
+			       int64_t code)
+{
+	int n = snprintf(dst, size, "%s", incident__type_str(type));
+
+	if (nodeid != INCIDENT_ANY && (size_t)n < size)
+		n += snprintf(dst + n, size - n, ":%d", nodeid);
+
+	if (code != INCIDENT_ANY && (size_t)n < size)
+		snprintf(dst + n, size - n, ":%#" PRIx64, (uint64_t)code);
+}
+
+static void incident__compose_path(char* dst, size_t size, unsigned int id,
+				   enum incident_trigger_type type,
+				   int is_compact)
+{
+	char ts[32];
+	struct tm tm;
+	time_t t = time(NULL);
+
+	localtime_r(&t, &tm);
+	strftime(ts, sizeof(ts), "%y%m%d-%H%M%S", &tm);
+
+	snprintf(dst, size, "%s/incident-%s-%u-%s%s",
+		 incident__config.path, ts, id, incident__type_str(type),
+		 is_compact ? TF_FILE_SUFFIX : TF_RAW_FILE_SUFFIX);
+}
+
+int incident_trigger(enum incident_trigger_type type, int nodeid,
+		     int64_t code)
+{
+	if (!incident__tb || !incident__is_triggered(type, nodeid, code))
+		return -1;
+
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	uint64_t min_interval = incident__config.min_interval * 1000ULL;
+
+	if (incident__last_id != 0
+	 && now - incident__last_time < min_interval) {
+		incident__slot(incident__last_id)->n_suppressed++;
+		return -1;
+	}
+
+	struct incident_job* job = malloc(sizeof(*job));
+	if (!job)
+		return -1;
+
+	memset(job, 0, sizeof(*job));
+
+	unsigned int id = ++incident__last_id;
+	incident__last_time = now;
+
+	uint64_t time = gettime_us(CLOCK_REALTIME);
+	uint64_t pre = incident__config.pre_trigger * 1000ULL;
+	uint64_t post = incident__config.post_trigger * 1000ULL;
+
+	job->id = id;
+	job->tb = incident__tb;
+	job->deadline = now + post;
+	job->begin = pre && pre < time ? time - pre : 0;
+	job->end = time + post;
+	job->is_compact = incident__config.is_compact;
+	incident__compose_path(job->path, sizeof(job->path), id, type,
+			       job->is_compact);
+
+	/* A slot that is reused may still have a job waiting */
+	struct incident_job** pending = &incident__pending[id % INCIDENT_HISTORY];
+	free(*pending);
+	*pending = NULL;
+
+	struct incident* incident = incident__slot(id);
+	memset(incident, 0, sizeof(*incident));
+	incident->id = id;
+	incident->state = INCIDENT_PENDING;
+	incident->time = time;
+	incident->begin = job->begin;
+	incident->end = job->end;
+	incident__describe(incident->trigger, sizeof(incident->trigger),
+			   type, nodeid, code);
+	strncpy(incident->path, job->path, sizeof(incident->path) - 1);
+
+	plog(LOG_NOTICE, "Incident %u triggered by %s", id, incident->trigger);
+
+	if (post == 0) {
+		if (incident__start_capture(job) < 0)
+			goto failure;
+		return id;
+	}
+
+	*pending = job;
+
+	if (incident__start_timer() < 0) {
+		*pending = NULL;
+		free(job);
+		goto failure;
+	}
+
+	return id;
+
+failure:
+	incident->state = INCIDENT_FAILED;
+	return -1;
+}
+
+void incident_feed(const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+
+	if (!incident__tb || incident__n_triggers == 0)
+		return;
+
+	if (cf->can_id & CAN_ERR_FLAG) {
+		if (cf->can_id & CAN_ERR_BUSOFF)
+			incident_trigger(INCIDENT_TRIGGER_BUS_OFF,
+					 INCIDENT_ANY, INCIDENT_ANY);
+		return;
+	}
+
+	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG))
+		return;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return;
+
+	switch (msg.object) {
+	case CANOPEN_EMCY:
+		if (cf->can_dlc >= 2 && emcy_get_code(cf) != 0)
+			incident_trigger(INCIDENT_TRIGGER_EMCY, msg.id,
+					 emcy_get_code(cf));
+		break;
+	case CANOPEN_TSDO:
+		if (cf->can_dlc >= 8 && sdo_get_cs(cf) == SDO_SCS_ABORT)
+			incident_trigger(INCIDENT_TRIGGER_SDO_ABORT, msg.id,
+					 sdo_get_abort_code(cf));
+		break;
+	default:
+		break;
+	}
+}
+
+static const char* incident__state_str(enum incident_state state)
+{
+	switch (state) {
+	case INCIDENT_PENDING: return "pending";
+	case INCIDENT_WRITING: return "writing";
+	case INCIDENT_DONE: return "done";
+	case INCIDENT_FAILED: return "failed";
+	case INCIDENT_DELETED: return "deleted";
+	}
+
+	abort();
+	return NULL;
+}
+
+static void incident__print(FILE* output, const struct incident* incident)
+{
+	fprintf(output, "{\"id\": %u, \"state\": \"%s\", \"trigger\": \"%s\", "
+		"\"time\": %" PRIu64 ", \"begin\": %" PRIu64 ", "
+		"\"end\": %" PRIu64 ", \"frames\": %zu, \"suppressed\": %u, "
+		"\"path\": \"%s\"}",
+		incident->id, incident__state_str(incident->state),
+		incident->trigger, incident->time, incident->begin,
+		incident->end, incident->n_frames, incident->n_suppressed,
+		incident->path);
+}
+
+/* Captures are listed oldest first */
+void incident_print_json(FILE* output)
+{
+	unsigned int first = incident__last_id > INCIDENT_HISTORY
+			   ? incident__last_id - INCIDENT_HISTORY + 1 : 1;
+	unsigned int id;
+	int is_first = 1;
+
+	fprintf(output, "[");
+
+	for (id = first; id <= incident__last_id; ++id) {
+		const struct incident* incident = incident_get(id);
+		if (!incident)
+			continue;
+
+		fprintf(output, "%s\n ", is_first ? "" : ",");
+		incident__print(output, incident);
+		is_first = 0;
+	}
+
+	fprintf(output, "\n]\n");
+}
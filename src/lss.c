@@ -0,0 +1,441 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Layer setting services, master and slave
+ *
+ * Fast scan determines the identity of a slave one bit at a time: the master
+ * asks whether any slave has an identity that matches the bits found so far
+ * with the next bit clear. Silence means that the bit is set. Several slaves
+ * may answer the same request, so each step waits for the whole timeout
+ * rather than moving on at the first answer.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <mloop.h>
+
+#include "socketcan.h"
+#include "canopen/lss.h"
+#include "sock.h"
+
+static inline int lss__is_valid_nodeid(int nodeid)
+{
+	return (1 <= nodeid && nodeid <= 127)
+	    || nodeid == LSS_NODEID_UNCONFIGURED;
+}
+
+/* CiA 301 bit timing table; index 5 is reserved */
+static inline int lss__is_valid_bit_timing(int table, int index)
+{
+	return table == 0 && 0 <= index && index <= 9 && index != 5;
+}
+
+void lss_slave_init(struct lss_slave* self, const struct lss_address* address,
+		    int nodeid)
+{
+	memset(self, 0, sizeof(*self));
+	self->address = *address;
+	self->mode = LSS_MODE_WAITING;
+	self->nodeid = nodeid;
+	self->bit_timing = -1;
+}
+
+static int lss_slave__fastscan(struct lss_slave* self,
+			       const struct can_frame* cf)
+{
+	int bit = lss_fastscan_get_bit(cf);
+	int sub = lss_fastscan_get_sub(cf);
+	int next = lss_fastscan_get_next(cf);
+
+	if (self->mode != LSS_MODE_WAITING
+	 || self->nodeid != LSS_NODEID_UNCONFIGURED)
+		return 0;
+
+	if (bit == LSS_FASTSCAN_CONFIRM) {
+		self->fastscan_pos = 0;
+		return 1;
+	}
+
+	if (bit > 31 || sub > 3 || next > 3 || sub != self->fastscan_pos)
+		return 0;
+
+	uint32_t mask = 0xffffffffUL << bit;
+	if ((lss_get_u32(cf) ^ self->address.id[sub]) & mask)
+		return 0;
+
+	if (bit == 0 && next != sub) {
+		self->fastscan_pos = next;
+		if (next < sub)
+			self->mode = LSS_MODE_CONFIGURATION;
+	}
+
+	return 1;
+}
+
+static int lss_slave__switch_selective(struct lss_slave* self,
+				       const struct can_frame* cf)
+{
+	int pos = lss_get_cs(cf) - LSS_CS_SWITCH_SELECTIVE_VENDOR;
+
+	if (pos == 0)
+		self->selective_pos = 0;
+
+	if (pos != self->selective_pos
+	 || lss_get_u32(cf) != self->address.id[pos]) {
+		self->selective_pos = 0;
+		return 0;
+	}
+
+	if (++self->selective_pos < 4)
+		return 0;
+
+	self->selective_pos = 0;
+	self->mode = LSS_MODE_CONFIGURATION;
+	return 1;
+}
+
+int lss_slave_feed(struct lss_slave* self, const struct can_frame* cf,
+		   struct can_frame* response)
+{
+	enum lss_cs cs = lss_get_cs(cf);
+	int error = 0;
+
+	if (cf->can_id != LSS_COB_ID_MASTER || cf->can_dlc != 8)
+		return 0;
+
+	lss_clear_frame(response, LSS_COB_ID_SLAVE);
+
+	switch (cs) {
+	case LSS_CS_SWITCH_GLOBAL:
+		self->mode = cf->data[1] == LSS_MODE_CONFIGURATION
+			   ? LSS_MODE_CONFIGURATION : LSS_MODE_WAITING;
+		self->selective_pos = 0;
+		return 0;
+	case LSS_CS_SWITCH_SELECTIVE_VENDOR:
+	case LSS_CS_SWITCH_SELECTIVE_PRODUCT:
+	case LSS_CS_SWITCH_SELECTIVE_REVISION:
+	case LSS_CS_SWITCH_SELECTIVE_SERIAL:
+		if (!lss_slave__switch_selective(self, cf))
+			return 0;
+
+		lss_set_cs(response, LSS_CS_SWITCH_SELECTIVE_RESPONSE);
+		return 1;
+	case LSS_CS_FASTSCAN:
+		if (!lss_slave__fastscan(self, cf))
+			return 0;
+
+		lss_set_cs(response, LSS_CS_IDENTIFY_SLAVE);
+		return 1;
+	default:
+		break;
+	}
+
+	if (self->mode != LSS_MODE_CONFIGURATION)
+		return 0;
+
+	switch (cs) {
+	case LSS_CS_CONFIGURE_NODE_ID:
+		if (lss__is_valid_nodeid(cf->data[1]))
+			self->nodeid = cf->data[1];
+		else
+			error = 1;
+		break;
+	case LSS_CS_CONFIGURE_BIT_TIMING:
+		if (lss__is_valid_bit_timing(cf->data[1], cf->data[2]))
+			self->bit_timing = cf->data[2];
+		else
+			error = 1;
+		break;
+	case LSS_CS_STORE_CONFIGURATION:
+		self->is_stored = 1;
+		break;
+	default:
+		return 0;
+	}
+
+	lss_set_cs(response, cs);
+	response->data[1] = error;
+	return 1;
+}
+
+static void co_lss__on_timer(struct mloop_timer* timer)
+{
+	co_lss__on_timeout(mloop_timer_get_context(timer));
+}
+
+int co_lss_init(struct co_lss* self, const struct sock* sock)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->sock = sock;
+	self->timeout = 10;
+
+	self->timer = mloop_timer_new(mloop_default());
+	if (!self->timer)
+		return -1;
+
+	mloop_timer_set_type(self->timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_context(self->timer, self, NULL);
+	mloop_timer_set_callback(self->timer, co_lss__on_timer);
+	return 0;
+}
+
+void co_lss_destroy(struct co_lss* self)
+{
+	mloop_timer_stop(self->timer);
+	mloop_timer_unref(self->timer);
+}
+
+static int co_lss__send(struct co_lss* self, struct can_frame* cf)
+{
+	if (sock_send(self->sock, cf, 0) < 0)
+		return -1;
+
+	mloop_timer_stop(self->timer);
+	mloop_timer_set_time(self->timer, self->timeout * 1000000ULL);
+	return mloop_timer_start(self->timer);
+}
+
+static void co_lss__finish(struct co_lss* self, int status)
+{
+	mloop_timer_stop(self->timer);
+	self->op = LSS_OP_NONE;
+
+	if (self->on_done)
+		self->on_done(self, status);
+}
+
+static int co_lss__request(struct co_lss* self, enum lss_op op,
+			   enum lss_cs expected_cs, struct can_frame* cf,
+			   co_lss_fn on_done)
+{
+	if (co_lss_is_busy(self))
+		return -1;
+
+	self->op = op;
+	self->expected_cs = expected_cs;
+	self->has_response = 0;
+	self->on_done = on_done;
+
+	if (co_lss__send(self, cf) < 0) {
+		self->op = LSS_OP_NONE;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int co_lss__send_unconfirmed(struct co_lss* self, enum lss_cs cs,
+				    int arg)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_set_cs(&cf, cs);
+
+	if (cs == LSS_CS_ACTIVATE_BIT_TIMING) {
+		cf.data[1] = arg;
+		cf.data[2] = arg >> 8;
+	} else {
+		cf.data[1] = arg;
+	}
+
+	return sock_send(self->sock, &cf, 0) < 0 ? -1 : 0;
+}
+
+int co_lss_switch_global(struct co_lss* self, enum lss_mode mode)
+{
+	return co_lss__send_unconfirmed(self, LSS_CS_SWITCH_GLOBAL, mode);
+}
+
+int co_lss_activate_bit_timing(struct co_lss* self, unsigned int delay_ms)
+{
+	return co_lss__send_unconfirmed(self, LSS_CS_ACTIVATE_BIT_TIMING,
+					delay_ms);
+}
+
+static int co_lss__send_fastscan(struct co_lss* self, int bit, int next)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_fastscan_set(&cf, self->address.id[self->sub], bit, self->sub,
+			 next);
+
+	self->has_response = 0;
+	return co_lss__send(self, &cf);
+}
+
+int co_lss_fastscan(struct co_lss* self, co_lss_fn on_done)
+{
+	struct can_frame cf;
+
+	memset(&self->address, 0, sizeof(self->address));
+	self->sub = 0;
+	self->bit = LSS_FASTSCAN_CONFIRM;
+
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_fastscan_set(&cf, 0, LSS_FASTSCAN_CONFIRM, 0, 0);
+
+	return co_lss__request(self, LSS_OP_FASTSCAN, LSS_CS_IDENTIFY_SLAVE,
+			       &cf, on_done);
+}
+
+/* self->bit is LSS_FASTSCAN_CONFIRM while checking that anyone answers at
+ * all, 31 to 0 while scanning and -1 while verifying a complete part of the
+ * address.
+ */
+static void co_lss__fastscan_next(struct co_lss* self)
+{
+	int has_response = self->has_response;
+	int rc;
+
+	if (self->bit == LSS_FASTSCAN_CONFIRM) {
+		if (!has_response) {
+			co_lss__finish(self, -1);
+			return;
+		}
+
+		self->bit = 31;
+		rc = co_lss__send_fastscan(self, self->bit, self->sub);
+	} else if (self->bit >= 0) {
+		if (!has_response)
+			self->address.id[self->sub] |= 1UL << self->bit;
+
+		if (self->bit > 0) {
+			--self->bit;
+			rc = co_lss__send_fastscan(self, self->bit, self->sub);
+		} else {
+			self->bit = -1;
+			rc = co_lss__send_fastscan(self, 0,
+						   (self->sub + 1) & 3);
+		}
+	} else {
+		if (!has_response || self->sub == 3) {
+			co_lss__finish(self, has_response ? 0 : -1);
+			return;
+		}
+
+		++self->sub;
+		self->bit = 31;
+		rc = co_lss__send_fastscan(self, self->bit, self->sub);
+	}
+
+	if (rc < 0)
+		co_lss__finish(self, -1);
+}
+
+int co_lss_switch_selective(struct co_lss* self,
+			    const struct lss_address* address,
+			    co_lss_fn on_done)
+{
+	struct can_frame cf;
+	int i;
+
+	if (co_lss_is_busy(self))
+		return -1;
+
+	self->address = *address;
+
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+
+	for (i = 0; i < 3; ++i) {
+		lss_set_cs(&cf, LSS_CS_SWITCH_SELECTIVE_VENDOR + i);
+		lss_set_u32(&cf, address->id[i]);
+		if (sock_send(self->sock, &cf, 0) < 0)
+			return -1;
+	}
+
+	lss_set_cs(&cf, LSS_CS_SWITCH_SELECTIVE_SERIAL);
+	lss_set_u32(&cf, address->id[3]);
+
+	return co_lss__request(self, LSS_OP_SWITCH_SELECTIVE,
+			       LSS_CS_SWITCH_SELECTIVE_RESPONSE, &cf, on_done);
+}
+
+int co_lss_configure_node_id(struct co_lss* self, int nodeid,
+			     co_lss_fn on_done)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_set_cs(&cf, LSS_CS_CONFIGURE_NODE_ID);
+	cf.data[1] = nodeid;
+
+	return co_lss__request(self, LSS_OP_CONFIGURE_NODE_ID,
+			       LSS_CS_CONFIGURE_NODE_ID, &cf, on_done);
+}
+
+int co_lss_configure_bit_timing(struct co_lss* self, int index,
+				co_lss_fn on_done)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_set_cs(&cf, LSS_CS_CONFIGURE_BIT_TIMING);
+	cf.data[1] = 0; /* CiA 301 table */
+	cf.data[2] = index;
+
+	return co_lss__request(self, LSS_OP_CONFIGURE_BIT_TIMING,
+			       LSS_CS_CONFIGURE_BIT_TIMING, &cf, on_done);
+}
+
+int co_lss_store_configuration(struct co_lss* self, co_lss_fn on_done)
+{
+	struct can_frame cf;
+	lss_clear_frame(&cf, LSS_COB_ID_MASTER);
+	lss_set_cs(&cf, LSS_CS_STORE_CONFIGURATION);
+
+	return co_lss__request(self, LSS_OP_STORE_CONFIGURATION,
+			       LSS_CS_STORE_CONFIGURATION, &cf, on_done);
+}
+
+int co_lss_feed(struct co_lss* self, const struct can_frame* cf)
+{
+	if (cf->can_id == LSS_COB_ID_MASTER)
+		return 0;
+
+	if (cf->can_id != LSS_COB_ID_SLAVE)
+		return -1;
+
+	if (!co_lss_is_busy(self) || lss_get_cs(cf) != self->expected_cs)
+		return 0;
+
+	switch (self->op) {
+	case LSS_OP_FASTSCAN:
+		/* The answer is evaluated when the step times out */
+		self->has_response = 1;
+		break;
+	case LSS_OP_SWITCH_SELECTIVE:
+		co_lss__finish(self, 0);
+		break;
+	default:
+		co_lss__finish(self, cf->data[1]);
+		break;
+	}
+
+	return 0;
+}
+
+void co_lss__on_timeout(struct co_lss* self)
+{
+	switch (self->op) {
+	case LSS_OP_NONE:
+		mloop_timer_stop(self->timer);
+		break;
+	case LSS_OP_FASTSCAN:
+		co_lss__fastscan_next(self);
+		break;
+	default:
+		co_lss__finish(self, -1);
+		break;
+	}
+}
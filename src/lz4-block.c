@@ -0,0 +1,199 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz4-block.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+
+static inline uint32_t lz4__read32(const uint8_t* ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static inline uint32_t lz4__hash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+/* Lengths of 15 or more continue in bytes of 255 after the token */
+static uint8_t* lz4__write_length(uint8_t* op, const uint8_t* oend,
+				  size_t length)
+{
+	for (; length >= 255; length -= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+	}
+
+	if (op >= oend)
+		return NULL;
+
+	*op++ = length;
+	return op;
+}
+
+static uint8_t* lz4__write_literals(uint8_t* op, const uint8_t* oend,
+				    const uint8_t* literals, size_t length,
+				    size_t match_length)
+{
+	if (op >= oend)
+		return NULL;
+
+	uint8_t* token = op++;
+	*token = (length >= 15 ? 15 : length) << 4;
+	*token |= match_length >= 15 ? 15 : match_length;
+
+	if (length >= 15 && !(op = lz4__write_length(op, oend, length - 15)))
+		return NULL;
+
+	if ((size_t)(oend - op) < length)
+		return NULL;
+
+	memcpy(op, literals, length);
+	return op + length;
+}
+
+int lz4_block_compress(void* dst, size_t dst_size, const void* src,
+		       size_t src_size)
+{
+	uint32_t table[1 << LZ4_HASH_BITS];
+	const uint8_t* base = src;
+	const uint8_t* ip = base;
+	const uint8_t* anchor = base;
+	const uint8_t* iend = base + src_size;
+	uint8_t* op = dst;
+	const uint8_t* oend = op + dst_size;
+
+	memset(table, 0, sizeof(table));
+
+	while (src_size > LZ4_MF_LIMIT && ip < iend - LZ4_MF_LIMIT) {
+		uint32_t sequence = lz4__read32(ip);
+		uint32_t hash = lz4__hash(sequence);
+		const uint8_t* ref = base + table[hash] - 1;
+		int has_ref = table[hash] != 0;
+
+		table[hash] = ip - base + 1;
+
+		if (!has_ref || ip - ref > LZ4_MAX_OFFSET
+		 || lz4__read32(ref) != sequence) {
+			++ip;
+			continue;
+		}
+
+		const uint8_t* match_limit = iend - LZ4_LAST_LITERALS;
+		size_t length = LZ4_MIN_MATCH;
+		while (ip + length < match_limit && ip[length] == ref[length])
+			++length;
+
+		size_t match_length = length - LZ4_MIN_MATCH;
+		uint16_t offset = ip - ref;
+
+		op = lz4__write_literals(op, oend, anchor, ip - anchor,
+					 match_length);
+		if (!op || oend - op < 2)
+			return -1;
+
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+
+		if (match_length >= 15
+		 && !(op = lz4__write_length(op, oend, match_length - 15)))
+			return -1;
+
+		ip += length;
+		anchor = ip;
+	}
+
+	op = lz4__write_literals(op, oend, anchor, iend - anchor, 0);
+	return op ? op - (uint8_t*)dst : -1;
+}
+
+static const uint8_t* lz4__read_length(const uint8_t* ip, const uint8_t* iend,
+				       size_t* length)
+{
+	uint8_t byte;
+
+	do {
+		if (ip >= iend)
+			return NULL;
+
+		byte = *ip++;
+		*length += byte;
+	} while (byte == 255);
+
+	return ip;
+}
+
+int lz4_block_decompress(void* dst, size_t dst_size, const void* src,
+			 size_t src_size)
+{
+	const uint8_t* ip = src;
+	const uint8_t* iend = ip + src_size;
+	uint8_t* op = dst;
+	uint8_t* oend = op + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t length = token >> 4;
+		if (length == 15 && !(ip = lz4__read_length(ip, iend, &length)))
+			return -1;
+
+		if ((size_t)(iend - ip) < length
+		 || (size_t)(oend - op) < length)
+			return -1;
+
+		memcpy(op, ip, length);
+		ip += length;
+		op += length;
+
+		/* The last sequence only has literals */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst))
+			return -1;
+
+		size_t match_length = token & 15;
+		if (match_length == 15
+		 && !(ip = lz4__read_length(ip, iend, &match_length)))
+			return -1;
+
+		match_length += LZ4_MIN_MATCH;
+		if ((size_t)(oend - op) < match_length)
+			return -1;
+
+		/* The match may overlap the output, so it's copied bytewise */
+		const uint8_t* match = op - offset;
+		while (match_length--)
+			*op++ = *match++;
+	}
+
+	return op - (uint8_t*)dst;
+}
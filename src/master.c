@@ -23,20 +23,29 @@
 #include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <linux/can/error.h>
 #include "plog.h"
 
 #include "mloop.h"
 #include "socketcan.h"
 #include "canopen.h"
 #include "canopen/sdo.h"
+#include "canopen/byteorder.h"
 #include "canopen/sdo_req.h"
 #include "canopen/network.h"
 #include "canopen/nmt.h"
 #include "canopen/heartbeat.h"
+#include "canopen/hb_supervisor.h"
+#include "canopen/lss.h"
+#include "canopen/nodeset.h"
 #include "canopen/emcy.h"
 #include "canopen/eds.h"
+#include "canopen/dcf.h"
 #include "canopen/master.h"
 #include "canopen/sdo_sync.h"
+#include "canopen/sdo_trace.h"
+#include "canopen/incident.h"
+#include "canopen/trace-sub.h"
 #include "canopen/error.h"
 #include "rest.h"
 #include "sdo-rest.h"
@@ -47,7 +56,10 @@
 #include "sock.h"
 #include "cfg.h"
 #include "trace-buffer.h"
+#include "trace-file.h"
 #include "userdata.h"
+#include "boot-cache.h"
+#include "driver-registry.h"
 
 #ifndef NO_MAREL_CODE
 #include <appcbase.h>
@@ -63,22 +75,33 @@
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+#define DCF_DOWNLOAD_WINDOW 32
+#define STORE_PARAMETERS_SIGNATURE 0x65766173 /* "save" */
+#define GRACE_CHECK_INTERVAL 50 /* ms */
+#define IDENTITY_READ_ATTEMPTS 3
+#define LSS_STORE_ATTEMPTS 3
+#define TRACE_RING_NAME "trace-ring"
+
 #define for_each_node(index) \
 	for(index = nodeid_min(); index <= nodeid_max(); ++index)
 
-#define for_each_node_reverse(index) \
-	for(index = nodeid_max(); index >= nodeid_min(); --index)
-
 size_t strlcpy(char* dst, const char* src, size_t dsize);
 
 static struct sock socket_ = { .fd = -1 };
 static char nodes_seen_[CANOPEN_NODEID_MAX + 1];
-static char nodes_seen_late_[CANOPEN_NODEID_MAX + 1];
 /* Note: nodes_seen_[0] is unused */
 
 static unsigned int n_scheduled_bootups = 0;
 static unsigned int n_inhibited_starts = 0;
 
+/* Node identification statistics for profiling; updated by worker threads */
+static unsigned int n_cached_boots = 0;
+static unsigned int n_uncached_boots = 0;
+static uint64_t cached_boot_time = 0;
+static uint64_t uncached_boot_time = 0;
+static unsigned int n_downloaded_configs = 0;
+static unsigned int n_current_configs = 0;
+
 enum master_state {
 	MASTER_STATE_STARTUP = 0,
 	MASTER_STATE_RUNNING,
@@ -97,15 +120,44 @@ static struct tracebuffer tracebuffer_;
 
 static struct userdata userdata_;
 
+static struct co_net_discovery discovery_;
+
+static struct co_lss lss_;
+static struct co_nodeset lss_node_ids_;
+static int lss_n_assigned_ = 0;
+static int lss_n_store_attempts_ = 0;
+
+#define HB_SHARDS_MAX 8
+
+/* Heartbeat supervision is split into contiguous ranges of node ids. With
+ * more than one shard, each one ticks on its own loop and thread.
+ */
+struct hb_shard {
+	struct hb_supervisor supervisor;
+	struct mloop* loop;
+	pthread_t thread;
+};
+
+static struct hb_shard hb_shards_[HB_SHARDS_MAX];
+static unsigned int n_hb_shards_ = 0;
+
+static struct mloop_timer* grace_timer_ = NULL;
+
+/* Nodes by state, so that the main loop only visits the nodes concerned.
+ * These are only changed on the main loop.
+ */
+static struct co_nodeset late_nodes_; /* booted during start-up */
+static struct co_nodeset driver_nodes_; /* have a driver, also while suspended */
+static struct co_nodeset pending_nodes_; /* waiting to be started */
+static struct co_nodeset suspended_nodes_; /* waiting to be reintegrated */
+
 static void* master_iface_init(int nodeid);
 static int master_request_sdo(int nodeid, int index, int subindex);
 static int master_send_sdo(int nodeid, int index, int subindex,
 			   unsigned char* data, size_t size);
 static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size);
 static void unload_legacy_module(int device_type, void* driver);
-static void on_bootup_done(struct mloop_work* self);
-static int init_heartbeat_timer(struct co_master_node* node);
-static int init_ping_timer(struct co_master_node* node);
+static void check_bootup_done(void);
 
 struct co_master_node co_master_node_[CANOPEN_NODEID_MAX + 1];
 /* Note: node_[0] is unused */
@@ -120,14 +172,37 @@ static inline int nodeid_max(void)
 	return cfg.range_stop == 0 ? CANOPEN_NODEID_MAX : cfg.range_stop;
 }
 
+static struct hb_supervisor* hb_supervisor_for(int nodeid)
+{
+	unsigned int n_nodes = nodeid_max() - nodeid_min() + 1;
+	unsigned int shard = (nodeid - nodeid_min()) * n_hb_shards_ / n_nodes;
+
+	return &hb_shards_[shard].supervisor;
+}
+
+static inline void set_start_pending(struct co_master_node* node,
+				     int is_pending)
+{
+	node->is_start_pending = is_pending;
+	co_nodeset_assign(&pending_nodes_, co_master_get_node_id(node),
+			  is_pending);
+}
+
+static inline void set_suspended(struct co_master_node* node, int is_suspended)
+{
+	node->is_suspended = is_suspended;
+	co_nodeset_assign(&suspended_nodes_, co_master_get_node_id(node),
+			  is_suspended);
+}
+
 static inline uint32_t get_device_type(int nodeid)
 {
 	return sdo_sync_read_u32(nodeid, 0x1000, 0);
 }
 
-static inline int node_has_identity(int nodeid)
+static inline unsigned int get_identity_size(int nodeid)
 {
-	return !!sdo_sync_read_u32(nodeid, 0x1018, 0);
+	return sdo_sync_read_u32(nodeid, 0x1018, 0);
 }
 
 static inline uint32_t get_vendor_id(int nodeid)
@@ -145,12 +220,99 @@ static inline uint32_t get_revision_number(int nodeid)
 	return sdo_sync_read_u32(nodeid, 0x1018, 3);
 }
 
+/* The serial number is optional, so 0 is returned if it can't be read */
+static inline uint32_t get_serial_number(int nodeid)
+{
+	int old_errno = errno;
+	uint32_t serial_number = sdo_sync_read_u32(nodeid, 0x1018, 4);
+	errno = old_errno;
+	return serial_number;
+}
+
 static inline int set_heartbeat_period(int nodeid, uint16_t period)
 {
 	struct sdo_req_info info = { .index = 0x1017, .subindex = 0 };
 	return sdo_sync_write_u16(nodeid, &info, period);
 }
 
+/* Configures an additional server SDO (0x1201 - 0x127F) on the node */
+static int set_sdo_server_cob_ids(int nodeid, int index, uint32_t rsdo_cob_id,
+				  uint32_t tsdo_cob_id)
+{
+	struct sdo_req_info info = { .index = index };
+
+	errno = 0;
+	if (sdo_sync_read_u8(nodeid, index, 0) < 2 || errno != 0)
+		return -1;
+
+	/* A COB-ID may only be changed while it is marked invalid, so both are
+	 * invalidated before the new values are written.
+	 */
+	info.subindex = 1;
+	if (sdo_sync_write_u32(nodeid, &info,
+			       rsdo_cob_id | CANOPEN_COB_ID_INVALID) < 0)
+		return -1;
+
+	info.subindex = 2;
+	if (sdo_sync_write_u32(nodeid, &info,
+			       tsdo_cob_id | CANOPEN_COB_ID_INVALID) < 0)
+		return -1;
+
+	if (sdo_sync_write_u32(nodeid, &info, tsdo_cob_id) < 0)
+		return -1;
+
+	info.subindex = 1;
+	return sdo_sync_write_u32(nodeid, &info, rsdo_cob_id);
+}
+
+static void setup_sdo_channels(int nodeid)
+{
+	struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+	const char* str = cfg.node[nodeid].sdo_channels;
+	char* end;
+	int index = 0x1201;
+
+	while (*str) {
+		if (*str == ',' || isspace(*str)) {
+			++str;
+			continue;
+		}
+
+		uint32_t rsdo_cob_id = strtoul(str, &end, 16);
+		if (end == str || *end != ':')
+			goto syntax_error;
+
+		str = end + 1;
+		uint32_t tsdo_cob_id = strtoul(str, &end, 16);
+		if (end == str)
+			goto syntax_error;
+
+		str = end;
+
+		if (set_sdo_server_cob_ids(nodeid, index, rsdo_cob_id,
+					   tsdo_cob_id) < 0) {
+			plog(LOG_ERROR, "setup_sdo_channels: Configuration of SDO server 0x%x on node %d failed",
+			     index, nodeid);
+			return;
+		}
+
+		if (sdo_req_queue_add_channel(queue, rsdo_cob_id,
+					      tsdo_cob_id) < 0) {
+			plog(LOG_WARNING, "setup_sdo_channels: Could not add SDO channel 0x%x/0x%x for node %d",
+			     rsdo_cob_id, tsdo_cob_id, nodeid);
+			return;
+		}
+
+		++index;
+	}
+
+	return;
+
+syntax_error:
+	plog(LOG_WARNING, "setup_sdo_channels: Invalid sdo_channels for node %d: \"%s\"",
+	     nodeid, cfg.node[nodeid].sdo_channels);
+}
+
 static char* get_string(int nodeid, int index, int subindex)
 {
 	static __thread char buffer[256];
@@ -166,30 +328,6 @@ static char* get_string(int nodeid, int index, int subindex)
 	return buffer;
 }
 
-static void stop_heartbeat_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	if (!timer)
-		return;
-
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->heartbeat_timer = NULL;
-}
-
-static void stop_ping_timer(int nodeid)
-{
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->ping_timer;
-	if (!timer)
-		return;
-
-	mloop_timer_stop(timer);
-	mloop_timer_unref(timer);
-	node->ping_timer = NULL;
-}
-
 #ifndef NO_MAREL_CODE
 static void unload_legacy_driver(int nodeid)
 {
@@ -225,15 +363,7 @@ static void turn_off_heartbeat(int nodeid)
 
 static void stop_node_guarding(int nodeid)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-
-	if (!cfg.node[nodeid].enable_node_guarding)
-		return;
-
-	stop_heartbeat_timer(nodeid);
-
-	if (!node->is_heartbeat_supported)
-		stop_ping_timer(nodeid);
+	hb_supervisor_stop(hb_supervisor_for(nodeid), nodeid);
 }
 
 static void unload_driver(int nodeid)
@@ -241,10 +371,15 @@ static void unload_driver(int nodeid)
 	struct co_master_node* node = co_master_get_node(nodeid);
 
 	node->is_initialized = 0;
+	node->is_started = 0;
+	set_start_pending(node, 0);
+	set_suspended(node, 0);
+	co_nodeset_remove(&driver_nodes_, nodeid);
 
 	stop_node_guarding(nodeid);
 
 	sdo_req_queue_flush(sdo_req_queue_get(nodeid));
+	sdo_req_queue_remove_channels(sdo_req_queue_get(nodeid));
 
 	switch (node->driver_type) {
 #ifndef NO_MAREL_CODE
@@ -274,6 +409,88 @@ static void unload_driver(int nodeid)
 #endif /* NO_MAREL_CODE */
 }
 
+static void on_grace_timeout(struct mloop_timer* self)
+{
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	int i;
+
+	co_nodeset_for_each(i, &suspended_nodes_) {
+		struct co_master_node* node = co_master_get_node(i);
+		uint64_t grace = cfg.node[i].reintegration_grace_period;
+
+		/* The outcome of a reintegration in progress decides */
+		if (node->is_loading || now < node->suspend_time + grace * 1000)
+			continue;
+
+		plog(LOG_NOTICE, "Node \"%s\" with id %d did not come back within %"PRIu64" ms; unloading...",
+		     node->name, i, grace);
+
+		unload_driver(i);
+	}
+
+	if (co_nodeset_is_empty(&suspended_nodes_))
+		mloop_timer_stop(self);
+}
+
+static int start_grace_timer(void)
+{
+	if (!grace_timer_) {
+		grace_timer_ = mloop_timer_new(mloop_default());
+		if (!grace_timer_)
+			return -1;
+
+		mloop_timer_set_callback(grace_timer_, on_grace_timeout);
+		mloop_timer_set_type(grace_timer_, MLOOP_TIMER_PERIODIC);
+		mloop_timer_set_time(grace_timer_,
+				     GRACE_CHECK_INTERVAL * 1000000ULL);
+	}
+
+	if (mloop_timer_is_started(grace_timer_))
+		return 0;
+
+	return mloop_timer_start(grace_timer_);
+}
+
+/* Only nodes whose identity can be confirmed when they come back are kept */
+static int is_suspendable(const struct co_master_node* node)
+{
+	int nodeid = co_master_get_node_id(node);
+
+	return cfg.node[nodeid].reintegration_grace_period > 0
+	    && master_state_ == MASTER_STATE_RUNNING
+	    && node->driver_type == CO_MASTER_DRIVER_NEW
+	    && node->is_initialized
+	    && node->has_identity;
+}
+
+/* The driver instance is kept, but frames from the node are not passed to it
+ * until the node has been reintegrated.
+ */
+static int suspend_node(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (!is_suspendable(node) || start_grace_timer() < 0)
+		return -1;
+
+	node->is_initialized = 0;
+	node->is_started = 0;
+	set_start_pending(node, 0);
+	set_suspended(node, 1);
+	node->suspend_time = gettime_us(CLOCK_MONOTONIC);
+
+	stop_node_guarding(nodeid);
+
+	sdo_req_queue_flush(sdo_req_queue_get(nodeid));
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->is_active = 0;
+#endif /* NO_MAREL_CODE */
+
+	return 0;
+}
+
 static char* compose_trace_name(char* dst, size_t size)
 {
 	struct tm tm;
@@ -293,10 +510,25 @@ static void compose_trace_buffer_path(char* path, size_t size, const char* name)
 	if (!name)
 		name = compose_trace_name(ts, sizeof(ts));
 
-	snprintf(path, size, "%s/%s.trace", cfg.trace_dump_path, name);
+	snprintf(path, size, "%s/%s%s", cfg.trace_dump_path, name,
+		 cfg.compress_trace_dump ? TF_FILE_SUFFIX : TF_RAW_FILE_SUFFIX);
 	path[size - 1] = '\0';
 }
 
+static void dump_compact_trace(FILE* stream)
+{
+	struct tb_frame* frames = malloc(tracebuffer_.length * sizeof(*frames));
+	if (!frames)
+		return;
+
+	size_t n = tb_snapshot(&tracebuffer_, frames);
+
+	if (tf_write_frames(stream, frames, n, TF_COMPRESS_LZ4) < 0)
+		plog(LOG_ERROR, "dump_compact_trace: Failed to write trace");
+
+	free(frames);
+}
+
 static void do_dump_tracebuffer(struct mloop_work* work)
 {
 	assert(cfg.trace_buffer_size > 0);
@@ -310,7 +542,10 @@ static void do_dump_tracebuffer(struct mloop_work* work)
 	if (!stream)
 		return;
 
-	tb_dump(&tracebuffer_, stream);
+	if (cfg.compress_trace_dump)
+		dump_compact_trace(stream);
+	else
+		tb_dump(&tracebuffer_, stream);
 
 	fclose(stream);
 }
@@ -335,10 +570,11 @@ static void dump_tracebuffer(const char* name)
 	mloop_work_unref(work);
 }
 
-static void on_heartbeat_timeout(struct mloop_timer* timer)
+static void on_heartbeat_timeout(struct hb_supervisor* supervisor, int nodeid)
 {
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	(void)supervisor;
+
+	struct co_master_node* node = co_master_get_node(nodeid);
 
 	node->ntimeouts++;
 
@@ -353,75 +589,132 @@ static void on_heartbeat_timeout(struct mloop_timer* timer)
 	if (node->ntimeouts <= cfg.node[nodeid].n_timeouts_max)
 		return;
 
-	plog(LOG_NOTICE, "Node \"%s\" with id %d has timed out; unloading...",
-	     node->name, nodeid);
+	incident_trigger(INCIDENT_TRIGGER_HEARTBEAT_TIMEOUT, nodeid,
+			 INCIDENT_ANY);
 
-	if (cfg.enable_incident_trace)
-		dump_tracebuffer(NULL);
+	/* Don't let SDO requests wait for a node that has been lost */
+	sdo_req_queue_set_offline(sdo_req_queue_get(nodeid), 1);
 
 	co_net_send_nmt(&socket_, NMT_CS_RESET_NODE, nodeid);
-	unload_driver(co_master_get_node_id(node));
 	userdata_set_missing(&userdata_, nodeid);
+
+	if (suspend_node(nodeid) >= 0) {
+		plog(LOG_NOTICE, "Node \"%s\" with id %d has timed out; waiting for it to come back...",
+		     node->name, nodeid);
+		return;
+	}
+
+	plog(LOG_NOTICE, "Node \"%s\" with id %d has timed out; unloading...",
+	     node->name, nodeid);
+
+	unload_driver(nodeid);
 }
 
-static struct mloop_timer* get_heartbeat_timer(struct co_master_node* node)
+static void on_ping_timeout(struct hb_supervisor* supervisor, int nodeid)
 {
-	if (!node->heartbeat_timer)
-		init_heartbeat_timer(node);
+	(void)supervisor;
+
+	struct can_frame cf = { 0 };
+
+	cf.can_id = R_HEARTBEAT + nodeid;
+	cf.can_id |= CAN_RTR_FLAG;
+	cf.can_dlc = 1;
+	heartbeat_set_state(&cf, 1);
 
-	return node->heartbeat_timer;
+	sock_send(&socket_, &cf, 0);
 }
 
-static struct mloop_timer* get_ping_timer(struct co_master_node* node)
+/* Called once per supervision tick for each node that was heard from */
+static void on_heartbeat_seen(struct hb_supervisor* supervisor, int nodeid)
 {
-	if (!node->ping_timer)
-		init_ping_timer(node);
+	(void)supervisor;
+	(void)nodeid;
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->last_seen = time(NULL);
+	info->skipped_heartbeats = 0;
+#endif /* NO_MAREL_CODE */
+}
 
-	return node->ping_timer;
+static void* run_hb_shard(void* context)
+{
+	mloop_run(context);
+	return NULL;
 }
 
-static int start_heartbeat_timer(int nodeid)
+static void cleanup_hb_shard(struct hb_shard* shard)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_heartbeat_timer(node);
-	node->ntimeouts = 0;
-	return mloop_timer_start(timer);
+	if (shard->loop != mloop_default()) {
+		mloop_exit(shard->loop);
+		pthread_join(shard->thread, NULL);
+	}
+
+	hb_supervisor_destroy(&shard->supervisor);
+	mloop_unref(shard->loop);
 }
 
-static int restart_heartbeat_timer(int nodeid)
+static int init_hb_shard(struct hb_shard* shard, int is_threaded)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = node->heartbeat_timer;
-	assert(timer);
+	struct hb_supervisor* supervisor = &shard->supervisor;
 
-	if (!cfg.node[nodeid].enable_node_guarding)
-		return 0;
+	shard->loop = is_threaded ? mloop_new() : mloop_default();
+	if (!shard->loop)
+		return -1;
 
-	mloop_timer_stop(timer);
+	if (!is_threaded)
+		mloop_ref(shard->loop);
 
-	return mloop_timer_start(timer);
-}
+	if (hb_supervisor_init_on(supervisor, shard->loop,
+				  cfg.heartbeat_tick * 1000ULL) < 0)
+		goto supervisor_failure;
 
-static void on_ping_timeout(struct mloop_timer* timer)
-{
-	struct co_master_node* node = mloop_timer_get_context(timer);
-	int nodeid = co_master_get_node_id(node);
+	supervisor->on_timeout = on_heartbeat_timeout;
+	supervisor->on_ping = on_ping_timeout;
+	supervisor->on_seen = on_heartbeat_seen;
 
-	struct can_frame cf = { 0 };
+	if (is_threaded && pthread_create(&shard->thread, NULL, run_hb_shard,
+					  shard->loop) != 0)
+		goto thread_failure;
 
-	cf.can_id = R_HEARTBEAT + nodeid;
-	cf.can_id |= CAN_RTR_FLAG;
-	cf.can_dlc = 1;
-	heartbeat_set_state(&cf, 1);
+	return 0;
 
-	sock_send(&socket_, &cf, 0);
+thread_failure:
+	hb_supervisor_destroy(supervisor);
+supervisor_failure:
+	mloop_unref(shard->loop);
+	return -1;
 }
 
-static int start_ping_timer(int nodeid)
+static void cleanup_hb_supervisor(void)
 {
-	struct co_master_node* node = co_master_get_node(nodeid);
-	struct mloop_timer* timer = get_ping_timer(node);
-	return mloop_timer_start(timer);
+	while (n_hb_shards_ > 0)
+		cleanup_hb_shard(&hb_shards_[--n_hb_shards_]);
+}
+
+static int init_hb_supervisor(void)
+{
+	unsigned int n_nodes = nodeid_max() - nodeid_min() + 1;
+	unsigned int n_shards = cfg.heartbeat_shards;
+
+	if (n_shards < 1)
+		n_shards = 1;
+
+	if (n_shards > HB_SHARDS_MAX)
+		n_shards = HB_SHARDS_MAX;
+
+	if (n_shards > n_nodes)
+		n_shards = n_nodes;
+
+	for (n_hb_shards_ = 0; n_hb_shards_ < n_shards; ++n_hb_shards_)
+		if (init_hb_shard(&hb_shards_[n_hb_shards_], n_shards > 1) < 0) {
+			plog(LOG_ERROR, "init_hb_supervisor: Failed to set up shard %u",
+			     n_hb_shards_);
+			cleanup_hb_supervisor();
+			return -1;
+		}
+
+	return 0;
 }
 
 static void start_nodeguarding(int nodeid)
@@ -431,10 +724,13 @@ static void start_nodeguarding(int nodeid)
 	if (!cfg.node[nodeid].enable_node_guarding)
 		return;
 
-	if (!node->is_heartbeat_supported)
-		start_ping_timer(nodeid);
+	uint64_t period = cfg.node[nodeid].heartbeat_period;
+	uint64_t timeout = period + cfg.node[nodeid].heartbeat_timeout;
 
-	start_heartbeat_timer(nodeid);
+	node->ntimeouts = 0;
+	hb_supervisor_start(hb_supervisor_for(nodeid), nodeid,
+			    timeout * 1000ULL,
+			    node->is_heartbeat_supported ? 0 : period * 1000ULL);
 }
 
 #ifndef NO_MAREL_CODE
@@ -586,8 +882,28 @@ static void apply_quirks(struct co_master_node* node)
 		sdo_client->quirks |= SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
 	else
 		sdo_client->quirks &= ~SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME;
+}
+
+static void apply_sdo_policy(int nodeid)
+{
+	struct sdo_req_policy policy;
+	sdo_req_policy_init(&policy);
+
+	policy.timeout = cfg.node[nodeid].sdo_timeout;
+	policy.timeout_min = cfg.node[nodeid].sdo_timeout_min;
+	policy.timeout_max = cfg.node[nodeid].sdo_timeout_max;
+	policy.retries = cfg.node[nodeid].sdo_retries;
+	policy.backoff = cfg.node[nodeid].sdo_retry_backoff;
+
+	if (policy.timeout_max < policy.timeout_min)
+		policy.timeout_max = policy.timeout_min;
 
+	const char* obj_timeouts = cfg.node[nodeid].sdo_object_timeouts;
+	if (sdo_req_policy_parse_obj_timeouts(&policy, obj_timeouts) < 0)
+		plog(LOG_WARNING, "apply_sdo_policy: Invalid sdo_object_timeouts for node %d: \"%s\"",
+		     nodeid, obj_timeouts);
 
+	sdo_req_queue_set_policy(sdo_req_queue_get(nodeid), &policy);
 }
 
 static int load_any_driver(int nodeid, int has_identity)
@@ -603,20 +919,120 @@ static int load_any_driver(int nodeid, int has_identity)
 	return -1;
 }
 
-static int load_driver(int nodeid)
+static void store_node_info(int nodeid, uint32_t serial_number)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
+	struct boot_cache_entry entry;
 
-	node->name[0] = '\0';
-	cfg_load_node(nodeid);
-	apply_quirks(node);
+	memset(&entry, 0, sizeof(entry));
 
-	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
-		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
-		     nodeid);
+	entry.device_type = node->device_type;
+	entry.vendor_id = node->vendor_id;
+	entry.product_code = node->product_code;
+	entry.revision_number = node->revision_number;
+	entry.serial_number = serial_number;
+	strlcpy(entry.name, node->name, sizeof(entry.name));
+	strlcpy(entry.hw_version, node->hw_version, sizeof(entry.hw_version));
+	strlcpy(entry.sw_version, node->sw_version, sizeof(entry.sw_version));
+
+	boot_cache_set(nodeid, &entry);
+}
+
+/* Reads a sub-index of the identity object, trying again if the node does not
+ * answer. Returns 1 if the value was read, 0 if the node refused with an abort
+ * and -1 if there was no answer.
+ */
+static int read_identity(int nodeid, int subindex, uint32_t* value)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = 0x1018,
+		.subindex = subindex
+	};
+	int rc = -1;
+
+	for (int i = 0; i < IDENTITY_READ_ATTEMPTS && rc < 0; ++i) {
+		struct sdo_req* req = sdo_req_new(&info);
+		if (!req)
+			return -1;
+
+		if (sdo_req_start(req, sdo_req_queue_get(nodeid)) >= 0) {
+			sdo_req_wait(req);
+
+			if (req->status == SDO_REQ_OK
+			 && req->data.index <= sizeof(*value)) {
+				*value = 0;
+				byteorder2(value, req->data.data,
+					   sizeof(*value), req->data.index);
+				rc = 1;
+			} else if (req->status == SDO_REQ_REMOTE_ABORT) {
+				rc = 0;
+			}
+		}
+
+		sdo_req_unref(req);
+	}
+
+	return rc;
+}
+
+/* Confirms the cached entry for the node by reading its identity object. The
+ * rest of the node information is taken from the cache. The entry is only
+ * dropped if the node gives a different answer; if it can't be confirmed, the
+ * node is read in full and the entry is left for next time.
+ */
+static int load_node_info_from_cache(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct boot_cache_entry entry;
+
+	if (boot_cache_get(nodeid, &entry) < 0)
 		return -1;
+
+	const uint32_t expected[] = {
+		entry.vendor_id,
+		entry.product_code,
+		entry.revision_number,
+		entry.serial_number,
+	};
+
+	for (int i = 0; i < 4; ++i) {
+		uint32_t value = 0;
+		int rc = read_identity(nodeid, i + 1, &value);
+
+		if (rc < 0) {
+			plog(LOG_DEBUG, "load_driver: Could not confirm boot cache entry for node %d",
+			     nodeid);
+			return -1;
+		}
+
+		/* The serial number is optional and 0 if it's missing */
+		if ((rc == 0 && i != 3) || value != expected[i]) {
+			plog(LOG_DEBUG, "load_driver: Boot cache entry for node %d is stale",
+			     nodeid);
+			boot_cache_invalidate(nodeid);
+			return -1;
+		}
 	}
 
+	node->device_type = entry.device_type;
+	node->vendor_id = entry.vendor_id;
+	node->product_code = entry.product_code;
+	node->revision_number = entry.revision_number;
+	node->serial_number = entry.serial_number;
+	node->has_identity = 1;
+	strlcpy(node->name, entry.name, sizeof(node->name));
+	strlcpy(node->hw_version, entry.hw_version, sizeof(node->hw_version));
+	strlcpy(node->sw_version, entry.sw_version, sizeof(node->sw_version));
+
+	return 0;
+}
+
+static int read_node_info(int nodeid, int* has_identity)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	uint32_t serial_number = 0;
+
 	errno = 0;
 	node->device_type = get_device_type(nodeid);
 	if (node->device_type == 0 && errno != 0) {
@@ -635,20 +1051,18 @@ static int load_driver(int nodeid)
 	string_keep_if(is_nodename_char, name);
 	strlcpy(node->name, name, sizeof(node->name));
 
-	/* Reload config when we have the name of the node */
-	cfg_load_node(nodeid);
-	apply_quirks(node);
-
-	int has_identity = node_has_identity(nodeid);
-	if (has_identity) {
+	unsigned int identity_size = get_identity_size(nodeid);
+	*has_identity = identity_size > 0;
+	if (*has_identity) {
 		node->vendor_id = get_vendor_id(nodeid);
 		node->product_code = get_product_code(nodeid);
 		node->revision_number = get_revision_number(nodeid);
+		if (identity_size >= 4)
+			serial_number = get_serial_number(nodeid);
 	}
 
-	uint64_t heartbeat_period = cfg.node[nodeid].heartbeat_period;
-	if (cfg.node[nodeid].enable_node_guarding)
-		node->is_heartbeat_supported = set_heartbeat_period(nodeid, heartbeat_period) >= 0;
+	node->serial_number = serial_number;
+	node->has_identity = *has_identity;
 
 	char* hw_version = get_string(nodeid, 0x1009, 0);
 	if (!hw_version)
@@ -664,12 +1078,284 @@ static int load_driver(int nodeid)
 	strlcpy(node->sw_version, string_trim(sw_version),
 		sizeof(node->sw_version));
 
-#ifndef NO_MAREL_CODE
-	initialize_info_structure(nodeid);
+	/* Without an identity, there is no way to tell later whether the same
+	 * node is still there.
+	 */
+	if (*has_identity)
+		store_node_info(nodeid, serial_number);
 
-	load_error_register(nodeid);
+	return 0;
+}
+
+static const struct canopen_eds* find_eds(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	const struct canopen_eds* eds;
+
+	if (node->vendor_id == 0)
+		return eds_db_find_by_name(node->name);
+
+	eds = eds_db_find(node->vendor_id, node->product_code,
+			  node->revision_number);
+	return eds ? eds : eds_db_find(node->vendor_id, node->product_code, -1);
+}
+
+static int load_dcf_file(struct co_dcf* dcf, int nodeid, const char* name)
+{
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s", cfg.dcf_path, name);
+
+	if (co_dcf_load_file(dcf, path, find_eds(nodeid), nodeid) < 0) {
+		if (errno == ENOENT)
+			return 0;
+
+		plog(LOG_WARNING, "load_dcf_file: Could not load \"%s\" for node %d: %s",
+		     path, nodeid, strerror(errno));
+		return -1;
+	}
+
+	return 1;
+}
+
+/* The configuration for a device type is in <name>.dcf and it may be
+ * overridden for a single node by <nodeid>.dcf or by <nodeid>.cdcf, which is
+ * a concise DCF. Returns 0 if there is no configuration for the node.
+ */
+static int load_node_dcf(struct co_dcf* dcf, int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	char name[80];
+	int n_found = 0;
+	int rc;
+
+	if (node->name[0]) {
+		snprintf(name, sizeof(name), "%s.dcf", node->name);
+		if ((rc = load_dcf_file(dcf, nodeid, name)) < 0)
+			return -1;
+		n_found += rc;
+	}
+
+	snprintf(name, sizeof(name), "%d.dcf", nodeid);
+	if ((rc = load_dcf_file(dcf, nodeid, name)) < 0)
+		return -1;
+	n_found += rc;
+
+	snprintf(name, sizeof(name), "%d.cdcf", nodeid);
+	if ((rc = load_dcf_file(dcf, nodeid, name)) < 0)
+		return -1;
+	n_found += rc;
+
+	return n_found;
+}
+
+/* Devices without a verify configuration object are configured every time */
+static void read_configuration_digests(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	errno = 0;
+	node->config_digest[0] = sdo_sync_read_u32(nodeid, 0x1020, 1);
+	node->config_digest[1] = sdo_sync_read_u32(nodeid, 0x1020, 2);
+	node->has_config_digest = errno == 0;
+}
+
+static int set_configuration_digest(int nodeid, int subindex, uint32_t digest)
+{
+	struct sdo_req_info info = { .index = 0x1020, .subindex = subindex };
+	return sdo_sync_write_u32(nodeid, &info, digest);
+}
+
+static int store_parameters(int nodeid)
+{
+	struct sdo_req_info info = { .index = 0x1010, .subindex = 1 };
+	return sdo_sync_write_u32(nodeid, &info, STORE_PARAMETERS_SIGNATURE);
+}
+
+static int wait_for_dcf_writes(int nodeid, struct sdo_req** reqs, size_t n)
+{
+	int rc = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		struct sdo_req* req = reqs[i];
+
+		sdo_req_wait(req);
+
+		if (req->status != SDO_REQ_OK) {
+			plog(LOG_WARNING, "download_dcf: Failed to write %#x:%#x on node %d: %s",
+			     req->index, req->subindex, nodeid,
+			     sdo_strerror(req->abort_code));
+			rc = -1;
+		}
+
+		sdo_req_unref(req);
+	}
+
+	return rc;
+}
+
+/* Up to DCF_DOWNLOAD_WINDOW writes are queued at a time, so the next transfer
+ * starts as soon as the previous one is done. They are also spread over any
+ * additional SDO channels.
+ */
+static int download_dcf(int nodeid, const struct co_dcf* dcf)
+{
+	struct sdo_req* window[DCF_DOWNLOAD_WINDOW];
+	struct sdo_req_queue* queue = sdo_req_queue_get(nodeid);
+	struct co_dcf_iter iter;
+	struct co_dcf_entry entry;
+	size_t n = 0;
+	int rc = 0;
+
+	co_dcf_iter_init(&iter, dcf);
+
+	while (co_dcf_iter_next(&iter, &entry)) {
+		struct sdo_req_info info = {
+			.type = SDO_REQ_DOWNLOAD,
+			.index = entry.index,
+			.subindex = entry.subindex,
+			.dl_data = entry.data,
+			.dl_size = entry.size,
+		};
+
+		struct sdo_req* req = sdo_req_new(&info);
+		if (!req) {
+			rc = -1;
+			break;
+		}
+
+		if (sdo_req_start(req, queue) < 0) {
+			sdo_req_unref(req);
+			rc = -1;
+			break;
+		}
+
+		window[n++] = req;
+
+		if (n == DCF_DOWNLOAD_WINDOW) {
+			rc |= wait_for_dcf_writes(nodeid, window, n);
+			n = 0;
+		}
+	}
+
+	rc |= wait_for_dcf_writes(nodeid, window, n);
+	return rc;
+}
+
+/* The configuration digest is cleared before the download, so that a device
+ * that was only partially configured is never taken to be up to date.
+ */
+static void configure_node(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	struct co_dcf dcf;
+
+	if (!*cfg.dcf_path)
+		return;
+
+	if (co_dcf_init(&dcf) < 0)
+		return;
+
+	if (load_node_dcf(&dcf, nodeid) <= 0)
+		goto done;
+
+	uint64_t start_time = gettime_us(CLOCK_MONOTONIC);
+	uint32_t digest = co_dcf_digest(&dcf);
+
+	if (node->has_config_digest && node->config_digest[0] == digest) {
+		__atomic_add_fetch(&n_current_configs, 1, __ATOMIC_RELAXED);
+		profile("Node %d configuration is current; skipped %u entries\n",
+			nodeid, co_dcf_length(&dcf));
+		goto done;
+	}
+
+	/* A stale digest must not survive a partial download */
+	if (node->has_config_digest
+	 && set_configuration_digest(nodeid, 1, 0) < 0) {
+		plog(LOG_ERROR, "configure_node: Could not clear configuration digest of node %d",
+		     nodeid);
+		goto done;
+	}
+
+	if (download_dcf(nodeid, &dcf) < 0) {
+		plog(LOG_ERROR, "configure_node: Configuration of node %d failed",
+		     nodeid);
+		goto done;
+	}
+
+	if (node->has_config_digest
+	 && set_configuration_digest(nodeid, 1, digest) >= 0)
+		node->config_digest[0] = digest;
+
+	if (cfg.node[nodeid].store_parameters
+	 && store_parameters(nodeid) < 0)
+		plog(LOG_WARNING, "configure_node: Node %d could not store its parameters",
+		     nodeid);
+
+	__atomic_add_fetch(&n_downloaded_configs, 1, __ATOMIC_RELAXED);
+	profile("Node %d configured with %u entries in %"PRIu64" us\n", nodeid,
+		co_dcf_length(&dcf), gettime_us(CLOCK_MONOTONIC) - start_time);
+
+done:
+	co_dcf_destroy(&dcf);
+}
+
+static int load_driver(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	node->name[0] = '\0';
+	cfg_load_node(nodeid);
+	apply_quirks(node);
+	apply_sdo_policy(nodeid);
+
+	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
+		plog(LOG_ERROR, "load_driver: A driver is already loaded for node %d",
+		     nodeid);
+		return -1;
+	}
+
+	uint64_t start_time = gettime_us(CLOCK_MONOTONIC);
+
+	int has_identity = 1;
+	int is_cached = load_node_info_from_cache(nodeid) >= 0;
+	if (!is_cached && read_node_info(nodeid, &has_identity) < 0)
+		return -1;
+
+	uint64_t info_time = gettime_us(CLOCK_MONOTONIC) - start_time;
+	if (is_cached) {
+		__atomic_add_fetch(&n_cached_boots, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&cached_boot_time, info_time,
+				   __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&n_uncached_boots, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&uncached_boot_time, info_time,
+				   __ATOMIC_RELAXED);
+	}
+
+	profile("Node %d identified %s in %"PRIu64" us\n", nodeid,
+		is_cached ? "from boot cache" : "over SDO", info_time);
+
+	/* Reload config when we have the name of the node */
+	cfg_load_node(nodeid);
+	apply_quirks(node);
+	apply_sdo_policy(nodeid);
+
+	uint64_t heartbeat_period = cfg.node[nodeid].heartbeat_period;
+	if (cfg.node[nodeid].enable_node_guarding)
+		node->is_heartbeat_supported = set_heartbeat_period(nodeid, heartbeat_period) >= 0;
+
+#ifndef NO_MAREL_CODE
+	initialize_info_structure(nodeid);
+
+	load_error_register(nodeid);
 #endif /* NO_MAREL_CODE */
 
+	setup_sdo_channels(nodeid);
+
+	read_configuration_digests(nodeid);
+	configure_node(nodeid);
+
 	if (load_any_driver(nodeid, has_identity) < 0) {
 		if (node->is_heartbeat_supported)
 			turn_off_heartbeat(nodeid);
@@ -766,26 +1452,6 @@ static int initialize_driver(int nodeid)
 	}
 }
 
-static void run_net_probe(struct mloop_work* self)
-{
-	(void)self;
-
-	profile("Probe network...\n");
-
-	int start = CANOPEN_NODEID_MIN, stop = CANOPEN_NODEID_MAX;
-
-	if (cfg.range_start == 0 && cfg.range_stop == 0) {
-		co_net_reset(&socket_, nodes_seen_, 100);
-	} else  {
-		start = cfg.range_start;
-		stop = cfg.range_stop;
-		co_net_reset_range(&socket_, nodes_seen_, start, stop,
-				   100 * (start - stop + 1));
-	}
-
-	co_net_probe(&socket_, nodes_seen_, start, stop, 100);
-}
-
 static void run_load_driver(struct mloop_work* self)
 {
 	struct co_master_node* node = mloop_work_get_context(self);
@@ -814,20 +1480,103 @@ static void call_start_fn(struct co_master_node* node)
 	}
 }
 
+static void mark_node_started(struct co_master_node* node)
+{
+	node->is_started = 1;
+	set_start_pending(node, 0);
+	node->time_to_operational = gettime_us(CLOCK_MONOTONIC)
+				  - node->load_time;
+
+	profile("Node %d operational after %"PRIu64" us\n",
+		co_master_get_node_id(node), node->time_to_operational);
+}
+
 static void start_single_node(struct co_master_node* node)
 {
 	int nodeid = co_master_get_node_id(node);
 	co_net_send_nmt(&socket_, NMT_CS_START, nodeid);
 	start_nodeguarding(nodeid);
 	call_start_fn(node);
+	mark_node_started(node);
 }
 
-static void on_load_driver_done(struct mloop_work* self)
+/* A dependency is resolved when the node has been started or when it is
+ * certain that it will not be started during this boot-up.
+ */
+static int is_dependency_resolved(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (node->is_started)
+		return 1;
+
+	if (node->is_loading || node->is_initialized)
+		return 0;
+
+	/* Either the driver failed to load or the node was never seen */
+	return nodes_seen_[nodeid] || !discovery_.is_running;
+}
+
+static int are_dependencies_resolved(int nodeid)
+{
+	const char* ptr = cfg.node[nodeid].start_after;
+	char* end;
+
+	while (*ptr) {
+		unsigned long dep = strtoul(ptr, &end, 0);
+		if (end == ptr)
+			break;
+
+		if (CANOPEN_NODEID_MIN <= dep && dep <= CANOPEN_NODEID_MAX
+		 && (int)dep != nodeid && !is_dependency_resolved(dep))
+			return 0;
+
+		ptr = *end == ',' ? end + 1 : end;
+	}
+
+	return 1;
+}
+
+static int is_start_inhibited(const struct co_master_node* node)
+{
+	return node->driver_type == CO_MASTER_DRIVER_NEW
+	    && node->ndrv.options & CO_OPT_INHIBIT_START;
+}
+
+/* Starts nodes that were waiting for other nodes in pipelined boot-up. This is
+ * repeated until nothing changes because each start may resolve the
+ * dependencies of other nodes.
+ */
+static void start_pending_nodes(void)
+{
+	int is_progress;
+	int i;
+
+	do {
+		is_progress = 0;
+
+		co_nodeset_for_each(i, &pending_nodes_) {
+			struct co_master_node* node = co_master_get_node(i);
+
+			if (is_start_inhibited(node))
+				continue;
+
+			if (!are_dependencies_resolved(i))
+				continue;
+
+			start_single_node(node);
+			is_progress = 1;
+		}
+	} while (is_progress);
+}
+
+static void handle_load_driver_done(struct co_master_node* node)
 {
-	struct co_master_node* node = mloop_work_get_context(self);
 	int nodeid = co_master_get_node_id(node);
 
-	--n_scheduled_bootups;
+	/* Nodes that boot after start-up are saved right away */
+	if (master_state_ == MASTER_STATE_RUNNING)
+		boot_cache_save();
 
 	if (node->driver_type == CO_MASTER_DRIVER_NONE)
 		return;
@@ -836,24 +1585,166 @@ static void on_load_driver_done(struct mloop_work* self)
 		return;
 
 	node->is_initialized = 1;
+	co_nodeset_add(&driver_nodes_, nodeid);
 	userdata_clear_missing(&userdata_, nodeid);
 
-	if (master_state_ == MASTER_STATE_STARTUP)
+	if (master_state_ == MASTER_STATE_STARTUP) {
+		set_start_pending(node, cfg.pipelined_bootup);
 		return;
+	}
 
-	if (node->driver_type == CO_MASTER_DRIVER_NEW
-	 && node->ndrv.options & CO_OPT_INHIBIT_START)
+	if (is_start_inhibited(node))
 		return;
 
 	start_single_node(node);
 }
 
+static void on_load_driver_done(struct mloop_work* self)
+{
+	struct co_master_node* node = mloop_work_get_context(self);
+
+	--n_scheduled_bootups;
+
+	handle_load_driver_done(node);
+
+	if (master_state_ != MASTER_STATE_STARTUP)
+		return;
+
+	if (cfg.pipelined_bootup)
+		start_pending_nodes();
+
+	check_bootup_done();
+}
+
+static int is_same_identity(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	errno = 0;
+	return get_device_type(nodeid) == node->device_type
+	    && get_vendor_id(nodeid) == node->vendor_id
+	    && get_product_code(nodeid) == node->product_code
+	    && get_revision_number(nodeid) == node->revision_number
+	    && get_serial_number(nodeid) == node->serial_number
+	    && errno == 0;
+}
+
+/* The node has been reset, so everything that the device does not keep is set
+ * up again. The DCF is only downloaded if the device lost it.
+ */
+static int reintegrate_node(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	if (!is_same_identity(nodeid)) {
+		plog(LOG_NOTICE, "reintegrate_node: Node %d came back with a different identity",
+		     nodeid);
+		return -1;
+	}
+
+	uint64_t heartbeat_period = cfg.node[nodeid].heartbeat_period;
+	if (cfg.node[nodeid].enable_node_guarding)
+		node->is_heartbeat_supported = set_heartbeat_period(nodeid, heartbeat_period) >= 0;
+
+	setup_sdo_channels(nodeid);
+
+	read_configuration_digests(nodeid);
+	configure_node(nodeid);
+
+	if (node->ndrv.volatile_config
+	 && download_dcf(nodeid, node->ndrv.volatile_config) < 0) {
+		plog(LOG_ERROR, "reintegrate_node: Could not restore the volatile configuration of node %d",
+		     nodeid);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void run_reintegrate_node(struct mloop_work* self)
+{
+	struct co_master_node* node = mloop_work_get_context(self);
+	int nodeid = co_master_get_node_id(node);
+	node->is_reintegrated = reintegrate_node(nodeid) >= 0;
+	node->is_loading = 0;
+}
+
+static int schedule_load_driver(int nodeid);
+
+static void on_reintegrate_node_done(struct mloop_work* self)
+{
+	struct co_master_node* node = mloop_work_get_context(self);
+	int nodeid = co_master_get_node_id(node);
+
+	if (!node->is_suspended)
+		return;
+
+	if (!node->is_reintegrated) {
+		unload_driver(nodeid);
+		schedule_load_driver(nodeid);
+		return;
+	}
+
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	set_suspended(node, 0);
+	node->is_initialized = 1;
+	node->n_reintegrations++;
+	node->reintegration_time = now - node->load_time;
+	node->downtime = now - node->suspend_time;
+
+	userdata_clear_missing(&userdata_, nodeid);
+
+#ifndef NO_MAREL_CODE
+	struct canopen_info* info = canopen_info_get(nodeid);
+	info->is_active = 1;
+	info->last_seen = time(NULL);
+#endif /* NO_MAREL_CODE */
+
+	plog(LOG_NOTICE, "Node \"%s\" with id %d was reintegrated in %"PRIu64" us after %"PRIu64" us of downtime",
+	     node->name, nodeid, node->reintegration_time, node->downtime);
+
+	if (!is_start_inhibited(node))
+		start_single_node(node);
+}
+
+static int schedule_reintegration(int nodeid)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+
+	sdo_req_queue_remove_channels(sdo_req_queue_get(nodeid));
+	sdo_req_queue_set_offline(sdo_req_queue_get(nodeid), 0);
+
+	/* A node that has been reset may not answer as it did before */
+	sdo_req_queue_reset_rtt(sdo_req_queue_get(nodeid));
+
+	struct mloop_work* work = mloop_work_new(mloop_default());
+	if (!work)
+		return -1;
+
+	node->load_time = gettime_us(CLOCK_MONOTONIC);
+
+	mloop_work_set_context(work, node, NULL);
+	mloop_work_set_work_fn(work, run_reintegrate_node);
+	mloop_work_set_done_fn(work, on_reintegrate_node_done);
+
+	int rc = mloop_work_start(work);
+	mloop_work_unref(work);
+
+	node->is_loading = rc >= 0;
+
+	return rc;
+}
+
 static int schedule_load_driver(int nodeid)
 {
 	struct co_master_node* node = co_master_get_node(nodeid);
 	if (node->is_loading)
 		return 0;
 
+	if (node->is_suspended)
+		return schedule_reintegration(nodeid);
+
 	if (node->driver_type != CO_MASTER_DRIVER_NONE) {
 		if (!node->is_initialized)
 			return -1;
@@ -862,10 +1753,18 @@ static int schedule_load_driver(int nodeid)
 		userdata_set_missing(&userdata_, nodeid);
 	}
 
+	/* Additional SDO channels are gone after a reset, so they have to be
+	 * set up again while loading.
+	 */
+	sdo_req_queue_remove_channels(sdo_req_queue_get(nodeid));
+	sdo_req_queue_set_offline(sdo_req_queue_get(nodeid), 0);
+
 	struct mloop_work* work = mloop_work_new(mloop_default());
 	if (!work)
 		return -1;
 
+	node->load_time = gettime_us(CLOCK_MONOTONIC);
+
 	mloop_work_set_context(work, node, NULL);
 	mloop_work_set_work_fn(work, run_load_driver);
 	mloop_work_set_done_fn(work, on_load_driver_done);
@@ -886,7 +1785,7 @@ static int handle_bootup(struct co_master_node* node)
 	int nodeid = co_master_get_node_id(node);
 
 	if (master_state_ == MASTER_STATE_STARTUP) {
-		nodes_seen_late_[nodeid] = 1;
+		co_nodeset_add(&late_nodes_, nodeid);
 		return 0;
 	}
 
@@ -957,7 +1856,8 @@ static int handle_heartbeat(struct co_master_node* node,
 	 && !cfg.node[nodeid].has_zero_guard_status)
 		return handle_bootup(node);
 
-	if (master_state_ == MASTER_STATE_STARTUP)
+	/* Nodes that were started early by pipelined boot-up are guarded */
+	if (master_state_ == MASTER_STATE_STARTUP && !node->is_started)
 		return 0;
 
 	/* This can happen if the CAN bus is disconnected but not the power to
@@ -976,18 +1876,19 @@ static int handle_heartbeat(struct co_master_node* node,
 		return -1;
 
 	node->ntimeouts = 0;
-	restart_heartbeat_timer(nodeid);
+	sdo_req_queue_set_offline(sdo_req_queue_get(nodeid), 0);
+
+	/* The info structure is updated on the next supervision tick */
+	struct hb_supervisor* supervisor = hb_supervisor_for(nodeid);
+	if (hb_supervisor_is_active(supervisor, nodeid))
+		hb_supervisor_feed(supervisor, nodeid);
+	else
+		on_heartbeat_seen(supervisor, nodeid);
 
 	/* Make sure the node is in operational state */
 	if (heartbeat_get_state(frame) != NMT_STATE_OPERATIONAL)
 		co_net_send_nmt(&socket_, NMT_CS_START, nodeid);
 
-#ifndef NO_MAREL_CODE
-	struct canopen_info* info = canopen_info_get(nodeid);
-	info->last_seen = time(NULL);
-	info->skipped_heartbeats = 0;
-#endif /* NO_MAREL_CODE */
-
 	return 0;
 }
 
@@ -1091,13 +1992,28 @@ static int handle_with_new_driver(struct co_master_node* node,
 	return -1;
 }
 
-static void mux_on_frame(const struct can_frame* cf)
+static void mux_on_frame(const struct can_frame* cf, uint64_t timestamp)
 {
 	struct canopen_msg msg;
 
+	incident_feed(cf);
+	trace_sub_feed(cf, timestamp);
+
 	if (cf->can_id & (CAN_RTR_FLAG | CAN_EFF_FLAG | CAN_ERR_FLAG))
 		return;
 
+	struct sdo_async* sdo_channel = sdo_req_channel_lookup(cf->can_id);
+	if (sdo_channel) {
+		sdo_async_feed(sdo_channel, cf);
+		return;
+	}
+
+	if (co_lss_feed(&lss_, cf) == 0)
+		return;
+
+	if (co_net_discovery_feed(&discovery_, cf) == 0)
+		return;
+
 	if (canopen_get_object_type(&msg, cf) < 0)
 		return;
 
@@ -1138,14 +2054,16 @@ static void mux_handler_fn(struct mloop_socket* self)
 	while (1) {
 		memset(&cf, 0, sizeof(cf));
 
-		ssize_t rsize = sock_recv(&socket_, &cf, MSG_DONTWAIT);
+		uint64_t timestamp = 0;
+		ssize_t rsize = sock_recv_traced(&socket_, &cf, MSG_DONTWAIT,
+						 &timestamp);
 		if (rsize == 0)
 			mloop_socket_stop(self);
 
 		if (rsize <= 0)
 			return;
 
-		mux_on_frame(&cf);
+		mux_on_frame(&cf, timestamp);
 	}
 }
 
@@ -1161,46 +2079,190 @@ static int init_multiplexer()
 	return mloop_socket_start(mux_handler_);
 }
 
-static void wait_for_bootup(struct mloop_work* self)
+static void on_node_discovered(struct co_net_discovery* discovery, int nodeid)
 {
-	(void)self;
-	while (n_scheduled_bootups > 0)
-		usleep(100);
+	(void)discovery;
+
+	profile("Node %d discovered; loading driver...\n", nodeid);
+	schedule_load_driver(nodeid);
 }
 
-static void schedule_bootup_done(void)
+static void on_discovery_done(struct co_net_discovery* discovery)
 {
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	assert(work);
-	mloop_work_set_work_fn(work, wait_for_bootup);
-	mloop_work_set_done_fn(work, on_bootup_done);
+	if (discovery->n_missing > 0)
+		plog(LOG_WARNING, "Discovery: %u of %u expected nodes did not answer",
+		     discovery->n_missing, discovery->n_expected);
 
-	int rc = mloop_work_start(work);
-	assert(rc == 0);
+	profile("Discovery finished; waiting for drivers...\n");
 
-	mloop_work_unref(work);
-}
+	if (cfg.pipelined_bootup)
+		start_pending_nodes();
 
+	check_bootup_done();
+}
 
-static void run_bootup(void)
+/* The discovery waits for the nodes in expected_nodes, parsed by
+ * canopen_parse_nodes() like lss_node_ids, and for the nodes that userdata
+ * marks as required.
+ */
+static void expect_nodes(struct co_net_discovery* discovery)
 {
+	struct co_nodeset expected;
 	int i;
-	profile("Load drivers...\n");
+
+	co_nodeset_clear(&expected);
+
+	if (canopen_parse_nodes(&expected, cfg.expected_nodes) < 0)
+		plog(LOG_WARNING, "Invalid expected_nodes: \"%s\"",
+		     cfg.expected_nodes);
+
 	for_each_node(i)
-		if (nodes_seen_[i])
-			schedule_load_driver(i);
+		if (co_nodeset_has(&expected, i)
+		 || userdata_is_required(&userdata_, i))
+			co_net_discovery_expect(discovery, i);
+}
+
+static int start_discovery(void)
+{
+	if (co_net_discovery_init(&discovery_, &socket_, nodes_seen_,
+				  nodeid_min(), nodeid_max()) < 0)
+		return -1;
+
+	discovery_.probe_delay = cfg.discovery_probe_delay;
+	discovery_.timeout = cfg.discovery_timeout;
+	discovery_.on_node = on_node_discovered;
+	discovery_.on_done = on_discovery_done;
+
+	expect_nodes(&discovery_);
 
-	schedule_bootup_done();
+	profile("Discover network...\n");
+	return co_net_discovery_start(&discovery_);
+}
+
+static int take_lss_node_id(void)
+{
+	int nodeid = co_nodeset_next(&lss_node_ids_, CANOPEN_NODEID_MIN);
+	if (nodeid >= 0)
+		co_nodeset_remove(&lss_node_ids_, nodeid);
+
+	return nodeid;
+}
+
+/* Assigned node ids become active on the next reset, which is done by the
+ * discovery.
+ */
+static void finish_node_id_assignment(void)
+{
+	co_lss_switch_global(&lss_, LSS_MODE_WAITING);
+
+	profile("LSS finished; %d node ids assigned\n", lss_n_assigned_);
+
+	if (start_discovery() < 0) {
+		plog(LOG_ERROR, "finish_node_id_assignment: Failed to start discovery");
+		mloop_exit(mloop_default());
+	}
+}
+
+static void scan_for_unconfigured_node(void);
+
+/* A node that can't store its node id keeps it only until it loses power, so
+ * it isn't counted as configured.
+ */
+static void on_lss_stored(struct co_lss* lss, int status)
+{
+	if (status != 0 && lss_n_store_attempts_++ < LSS_STORE_ATTEMPTS
+	 && co_lss_store_configuration(lss, on_lss_stored) >= 0)
+		return;
+
+	if (status == 0)
+		++lss_n_assigned_;
+	else
+		plog(LOG_ERROR, "LSS: Node could not store its node id (%d)",
+		     status);
+
+	scan_for_unconfigured_node();
+}
+
+static void on_lss_node_id_configured(struct co_lss* lss, int status)
+{
+	if (status != 0) {
+		plog(LOG_ERROR, "LSS: Node id was rejected (%d)", status);
+		finish_node_id_assignment();
+		return;
+	}
+
+	lss_n_store_attempts_ = 1;
+	if (co_lss_store_configuration(lss, on_lss_stored) < 0)
+		finish_node_id_assignment();
+}
+
+static void on_lss_scan_done(struct co_lss* lss, int status)
+{
+	const uint32_t* id = lss->address.id;
+
+	if (status != 0) {
+		finish_node_id_assignment();
+		return;
+	}
+
+	int nodeid = take_lss_node_id();
+	if (nodeid < 0) {
+		plog(LOG_WARNING, "LSS: No node id left for %08x:%08x:%08x:%08x",
+		     id[0], id[1], id[2], id[3]);
+		finish_node_id_assignment();
+		return;
+	}
+
+	plog(LOG_INFO, "LSS: Assigning node id %d to %08x:%08x:%08x:%08x",
+	     nodeid, id[0], id[1], id[2], id[3]);
+
+	if (co_lss_configure_node_id(lss, nodeid,
+				     on_lss_node_id_configured) < 0)
+		finish_node_id_assignment();
+}
+
+static void scan_for_unconfigured_node(void)
+{
+	co_lss_switch_global(&lss_, LSS_MODE_WAITING);
+
+	if (co_lss_fastscan(&lss_, on_lss_scan_done) < 0)
+		finish_node_id_assignment();
+}
+
+/* Unconfigured nodes are found by LSS fast scan and get node ids from
+ * lss_node_ids before the network is discovered.
+ */
+static int start_node_id_assignment(void)
+{
+	if (!*cfg.lss_node_ids)
+		return start_discovery();
+
+	co_nodeset_clear(&lss_node_ids_);
+
+	if (canopen_parse_nodes(&lss_node_ids_, cfg.lss_node_ids) < 0) {
+		plog(LOG_ERROR, "Invalid lss_node_ids: \"%s\"", cfg.lss_node_ids);
+		return -1;
+	}
+
+	if (co_lss_init(&lss_, &socket_) < 0)
+		return -1;
+
+	lss_.timeout = cfg.lss_timeout;
+
+	profile("Assign node ids via LSS...\n");
+	scan_for_unconfigured_node();
+	return 0;
 }
 
 static void load_late_nodes(void)
 {
 	int i;
-	for_each_node(i)
-		if (nodes_seen_late_[i]) {
-			plog(LOG_WARNING, "Node %d was late", i);
-			schedule_load_driver(i);
-		}
+	co_nodeset_for_each(i, &late_nodes_) {
+		plog(LOG_WARNING, "Node %d was late", i);
+		schedule_load_driver(i);
+	}
+
+	co_nodeset_clear(&late_nodes_);
 }
 
 static void on_sync(struct mloop_timer* self)
@@ -1233,6 +2295,12 @@ static int start_sync_timer(void)
 	return rc;
 }
 
+/* Nodes that were started during pipelined boot-up are skipped */
+static inline int is_startable(const struct co_master_node* node)
+{
+	return node->driver_type != CO_MASTER_DRIVER_NONE && !node->is_started;
+}
+
 static void start_all_nodes(void)
 {
 	int i;
@@ -1241,20 +2309,33 @@ static void start_all_nodes(void)
 	 * that were not properly registered.
 	 */
 	profile("Start nodes...\n");
-	for_each_node_reverse(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+	co_nodeset_for_each_reverse(i, &driver_nodes_)
+		if (is_startable(co_master_get_node(i)))
 			co_net_send_nmt(&socket_, NMT_CS_START, i);
 
 	profile("Start node guarding...\n");
-	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+	co_nodeset_for_each(i, &driver_nodes_)
+		if (is_startable(co_master_get_node(i)))
 			start_nodeguarding(i);
 
 	profile("Notify drivers about start...\n");
-	for_each_node(i)
-		call_start_fn(co_master_get_node(i));
+	co_nodeset_for_each(i, &driver_nodes_) {
+		struct co_master_node* node = co_master_get_node(i);
+		if (node->is_started)
+			continue;
+
+		call_start_fn(node);
+		mark_node_started(node);
+	}
 
 	profile("Boot-up finished!\n");
+	profile("Identified %u nodes from boot cache in %"PRIu64" us and %u nodes over SDO in %"PRIu64" us\n",
+		n_cached_boots, cached_boot_time,
+		n_uncached_boots, uncached_boot_time);
+	profile("Downloaded %u configurations; %u were already current\n",
+		n_downloaded_configs, n_current_configs);
+
+	boot_cache_save();
 
 	master_state_ = MASTER_STATE_RUNNING;
 
@@ -1268,44 +2349,58 @@ static void start_all_nodes(void)
 	userdata_check_missing(&userdata_);
 }
 
-static void on_bootup_done(struct mloop_work* self)
+static void check_bootup_done(void)
 {
-	(void)self;
+	if (discovery_.is_running || n_scheduled_bootups > 0)
+		return;
 
 	if (n_inhibited_starts == 0)
 		start_all_nodes();
 }
 
-static void on_net_probe_done(struct mloop_work* self)
+static void set_priority(void)
 {
-	(void)self;
-
-	profile("Initialize multiplexer...\n");
-	int __unused rc = init_multiplexer();
-	assert(rc == 0);
+	struct sched_param prio = { .sched_priority = 25 };
+	sched_setscheduler(getpid(), SCHED_FIFO, &prio);
+}
 
-	run_bootup();
+static void run_preload_driver(struct mloop_work* self)
+{
+	size_t index = (uintptr_t)mloop_work_get_context(self);
+	driver_registry_preload(index);
 }
 
-static void set_priority(void)
+/* The drivers are opened on the worker threads while the network is being
+ * probed, so that they are ready by the time the nodes have been identified.
+ */
+static void preload_drivers(void)
 {
-	struct sched_param prio = { .sched_priority = 25 };
-	sched_setscheduler(getpid(), SCHED_FIFO, &prio);
+	size_t length = driver_registry_length();
+
+	profile("Preload %zu drivers...\n", length);
+
+	for (size_t i = 0; i < length; ++i) {
+		struct mloop_work* work = mloop_work_new(mloop_default());
+		if (!work)
+			return;
+
+		mloop_work_set_context(work, (void*)(uintptr_t)i, NULL);
+		mloop_work_set_work_fn(work, run_preload_driver);
+		mloop_work_start(work);
+		mloop_work_unref(work);
+	}
 }
 
 static int start_bootup(void)
 {
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	if (!work)
+	profile("Initialize multiplexer...\n");
+	if (init_multiplexer() < 0)
 		return -1;
 
-	mloop_work_set_work_fn(work, run_net_probe);
-	mloop_work_set_done_fn(work, on_net_probe_done);
-
-	int rc = mloop_work_start(work);
-	mloop_work_unref(work);
+	if (cfg.preload_drivers)
+		preload_drivers();
 
-	return rc;
+	return start_node_id_assignment();
 }
 
 #ifndef NO_MAREL_CODE
@@ -1459,14 +2554,267 @@ int co__start(int nodeid)
 
 	node->ndrv.options &= ~CO_OPT_INHIBIT_START;
 
-	if (master_state_ != MASTER_STATE_STARTUP)
+	if (master_state_ != MASTER_STATE_STARTUP) {
 		start_single_node(node);
-	else if (--n_inhibited_starts == 0)
-		start_all_nodes();
+		return 0;
+	}
+
+	--n_inhibited_starts;
+
+	if (cfg.pipelined_bootup)
+		start_pending_nodes();
+
+	check_bootup_done();
+
+	return 0;
+}
+
+static int queue_sdo_request(int nodeid, struct sdo_req_info* info,
+			     sdo_req_free_fn context_free_fn)
+{
+	struct sdo_req* req = sdo_req_new(info);
+	if (!req)
+		return -1;
+
+	req->context_free_fn = context_free_fn;
+
+	int rc = sdo_req_start(req, sdo_req_queue_get(nodeid));
+	sdo_req_unref(req);
+	return rc;
+}
+
+static int queue_sdo_write(int nodeid, int index, int subindex,
+			   const void* data, size_t size)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = index,
+		.subindex = subindex,
+		.dl_data = data,
+		.dl_size = size,
+	};
+
+	return queue_sdo_request(nodeid, &info, NULL);
+}
+
+static int queue_sdo_write_u32(int nodeid, int index, int subindex,
+			       uint32_t value)
+{
+	uint32_t network_order = 0;
+	byteorder(&network_order, &value, sizeof(network_order));
+	return queue_sdo_write(nodeid, index, subindex, &network_order,
+			       sizeof(network_order));
+}
+
+static int queue_dcf(int nodeid, const struct co_dcf* dcf)
+{
+	struct co_dcf_iter iter;
+	struct co_dcf_entry entry;
+
+	co_dcf_iter_init(&iter, dcf);
+	while (co_dcf_iter_next(&iter, &entry))
+		if (queue_sdo_write(nodeid, entry.index, entry.subindex,
+				    entry.data, entry.size) < 0)
+			return -1;
+
+	return 0;
+}
+
+/* A driver configuration is downloaded in the background. Each write holds a
+ * reference to the job, so the job is finished when the last write is done or
+ * cancelled, and the digest is only written if every write succeeded.
+ */
+struct config_job {
+	int ref;
+	int nodeid;
+	uint32_t digest;
+	unsigned int n_writes;
+	unsigned int n_ok;
+	int is_failed;
+};
+
+static void config_job__finish(struct config_job* job);
+
+static void config_job__ref(struct config_job* job)
+{
+	__atomic_add_fetch(&job->ref, 1, __ATOMIC_RELAXED);
+}
+
+static void config_job__unref(void* ptr)
+{
+	struct config_job* job = ptr;
+
+	if (__atomic_sub_fetch(&job->ref, 1, __ATOMIC_ACQ_REL) == 0)
+		config_job__finish(job);
+}
+
+static void config_job__on_write_done(struct sdo_req* req)
+{
+	struct config_job* job = req->context;
+
+	if (req->status == SDO_REQ_OK) {
+		__atomic_add_fetch(&job->n_ok, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	plog(LOG_WARNING, "co__configure: Failed to write %#x:%#x on node %d: %s",
+	     req->index, req->subindex, job->nodeid,
+	     sdo_strerror(req->abort_code));
+}
+
+static int config_job__write(struct config_job* job, int index, int subindex,
+			     const void* data, size_t size)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = index,
+		.subindex = subindex,
+		.dl_data = data,
+		.dl_size = size,
+		.on_done = config_job__on_write_done,
+		.context = job,
+	};
 
+	config_job__ref(job);
+
+	if (queue_sdo_request(job->nodeid, &info, config_job__unref) < 0) {
+		config_job__unref(job);
+		return -1;
+	}
+
+	++job->n_writes;
 	return 0;
 }
 
+static void config_job__store_parameters(struct config_job* job)
+{
+	if (cfg.node[job->nodeid].store_parameters
+	 && queue_sdo_write_u32(job->nodeid, 0x1010, 1,
+				STORE_PARAMETERS_SIGNATURE) < 0)
+		plog(LOG_WARNING, "co__configure: Node %d could not store its parameters",
+		     job->nodeid);
+
+	__atomic_add_fetch(&n_downloaded_configs, 1, __ATOMIC_RELAXED);
+}
+
+static void config_job__fail(struct config_job* job)
+{
+	struct co_master_node* node = co_master_get_node(job->nodeid);
+
+	plog(LOG_ERROR, "co__configure: Configuration of node %d failed",
+	     job->nodeid);
+
+	if (!node->has_config_digest)
+		return;
+
+	node->config_digest[1] = 0;
+	queue_sdo_write_u32(job->nodeid, 0x1020, 2, 0);
+}
+
+static void config_job__on_digest_written(struct sdo_req* req)
+{
+	struct config_job* job = req->context;
+	struct co_master_node* node = co_master_get_node(job->nodeid);
+
+	if (req->status != SDO_REQ_OK) {
+		config_job__fail(job);
+		return;
+	}
+
+	node->config_digest[1] = job->digest;
+	config_job__store_parameters(job);
+}
+
+static void config_job__finish(struct config_job* job)
+{
+	struct co_master_node* node = co_master_get_node(job->nodeid);
+
+	if (job->is_failed || job->n_ok != job->n_writes) {
+		config_job__fail(job);
+		free(job);
+		return;
+	}
+
+	if (!node->has_config_digest) {
+		config_job__store_parameters(job);
+		free(job);
+		return;
+	}
+
+	uint32_t network_order = 0;
+	byteorder(&network_order, &job->digest, sizeof(network_order));
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_DOWNLOAD,
+		.index = 0x1020,
+		.subindex = 2,
+		.dl_data = &network_order,
+		.dl_size = sizeof(network_order),
+		.on_done = config_job__on_digest_written,
+		.context = job,
+	};
+
+	if (queue_sdo_request(job->nodeid, &info, free) < 0) {
+		config_job__fail(job);
+		free(job);
+	}
+}
+
+/* Called from the driver, so the downloads are queued rather than waited for.
+ * The digest is cleared first and only set again once every write of the
+ * configuration has succeeded.
+ */
+int co__configure(int nodeid, const struct co_dcf* config)
+{
+	struct co_master_node* node = co_master_get_node(nodeid);
+	uint32_t digest = co_dcf_digest(config);
+	struct co_dcf_iter iter;
+	struct co_dcf_entry entry;
+
+	if (node->has_config_digest && node->config_digest[1] == digest) {
+		__atomic_add_fetch(&n_current_configs, 1, __ATOMIC_RELAXED);
+		profile("Node %d driver configuration is current; skipped %u entries\n",
+			nodeid, co_dcf_length(config));
+		return 0;
+	}
+
+	struct config_job* job = malloc(sizeof(*job));
+	if (!job)
+		return -1;
+
+	memset(job, 0, sizeof(*job));
+	job->ref = 1;
+	job->nodeid = nodeid;
+	job->digest = digest;
+
+	uint32_t zero = 0;
+	if (node->has_config_digest
+	 && config_job__write(job, 0x1020, 2, &zero, sizeof(zero)) < 0)
+		goto failure;
+
+	co_dcf_iter_init(&iter, config);
+	while (co_dcf_iter_next(&iter, &entry))
+		if (config_job__write(job, entry.index, entry.subindex,
+				      entry.data, entry.size) < 0)
+			goto failure;
+
+	config_job__unref(job);
+	return 1;
+
+failure:
+	job->is_failed = 1;
+	config_job__unref(job);
+	return -1;
+}
+
+/* Volatile configuration is not covered by a digest because the device loses
+ * it on every reset.
+ */
+int co__configure_volatile(int nodeid, const struct co_dcf* config)
+{
+	return queue_dcf(nodeid, config) < 0 ? -1 : 1;
+}
+
 #ifndef NO_MAREL_CODE
 static int master_send_pdo(int nodeid, int n, unsigned char* data, size_t size)
 {
@@ -1494,51 +2842,135 @@ static void* master_iface_init(int nodeid)
 }
 #endif /* NO_MAREL_CODE */
 
-static int init_heartbeat_timer(struct co_master_node* node)
+static void unload_all_drivers()
 {
-	int nodeid = co_master_get_node_id(node);
+	int i;
+	for_each_node(i)
+		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
+			unload_driver(i);
+}
 
-	struct mloop_timer* timer = mloop_timer_new(mloop_default());
-	if (!timer)
-		return -1;
+static void print_node_stats(FILE* output)
+{
+	int is_first = 1;
+	int i;
+
+	fprintf(output, "{\n");
+
+	co_nodeset_for_each(i, &driver_nodes_) {
+		struct co_master_node* node = co_master_get_node(i);
+
+		fprintf(output, "%s \"%d\": {\"name\": \"%s\", \"state\": \"%s\", "
+			"\"time_to_operational\": %"PRIu64", "
+			"\"reintegrations\": %u, \"reintegration_time\": %"PRIu64", "
+			"\"downtime\": %"PRIu64"}",
+			is_first ? "" : ",\n", i, node->name,
+			node->is_suspended ? "suspended"
+			: node->is_started ? "started" : "loaded",
+			node->time_to_operational, node->n_reintegrations,
+			node->reintegration_time, node->downtime);
+		is_first = 0;
+	}
+
+	fprintf(output, "\n}\n");
+}
 
-	uint64_t period = cfg.node[nodeid].heartbeat_period
-			+ cfg.node[nodeid].heartbeat_timeout;
+/* GET /node-stats gives the start-up and reintegration times of every node
+ * that has a driver. Times are in microseconds and the reintegration times
+ * are those of the last reintegration.
+ */
+static void node_stats_rest_service(struct rest_client* client,
+				    const void* content)
+{
+	(void)content;
 
-	if (cfg.node[nodeid].n_timeouts_max > 0)
-		mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
+	char* buffer = NULL;
+	size_t size = 0;
 
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, period * 1000000LL);
-	mloop_timer_set_callback(timer, on_heartbeat_timeout);
-	node->heartbeat_timer = timer;
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		client->state = REST_CLIENT_DONE;
+		return;
+	}
 
-	return 0;
+	print_node_stats(out);
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client->output, &reply);
+	free(buffer);
+
+	client->state = REST_CLIENT_DONE;
 }
 
-static int init_ping_timer(struct co_master_node* node)
+static void rest_reply_text(struct rest_client* client, const char* status,
+			    const char* message)
 {
-	int nodeid = co_master_get_node_id(node);
-
-	struct mloop_timer* timer = mloop_timer_new(mloop_default());
-	if (!timer)
-		return -1;
+	struct rest_reply_data reply = {
+		.status_code = status,
+		.content_type = "text/plain",
+		.content_length = strlen(message),
+		.content = message
+	};
 
-	mloop_timer_set_type(timer, MLOOP_TIMER_PERIODIC);
-	mloop_timer_set_context(timer, node, NULL);
-	mloop_timer_set_time(timer, cfg.node[nodeid].heartbeat_period * 1000000LL);
-	mloop_timer_set_callback(timer, on_ping_timeout);
-	node->ping_timer = timer;
+	rest_reply(client->output, &reply);
 
-	return 0;
+	client->state = REST_CLIENT_DONE;
 }
 
-static void unload_all_drivers()
+/* GET /incidents lists the latest incident captures and PUT /incidents
+ * triggers a new one.
+ */
+static void incidents_rest_service(struct rest_client* client,
+				   const void* content)
 {
-	int i;
-	for_each_node(i)
-		if (co_master_get_node(i)->driver_type != CO_MASTER_DRIVER_NONE)
-			unload_driver(i);
+	(void)content;
+
+	char* buffer = NULL;
+	size_t size = 0;
+
+	if (!cfg.enable_incident_trace || cfg.trace_buffer_size == 0) {
+		rest_reply_text(client, "404 Not Found",
+				"Incident capture is not enabled\r\n");
+		return;
+	}
+
+	if (client->req.method == HTTP_PUT) {
+		int id = incident_trigger(INCIDENT_TRIGGER_REST, INCIDENT_ANY,
+					  INCIDENT_ANY);
+		if (id < 0) {
+			rest_reply_text(client, "429 Too Many Requests",
+					"Incident capture is rate limited\r\n");
+			return;
+		}
+	}
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		client->state = REST_CLIENT_DONE;
+		return;
+	}
+
+	incident_print_json(out);
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client->output, &reply);
+	free(buffer);
+
+	client->state = REST_CLIENT_DONE;
 }
 
 static int init_trace_dump_path(const char* path)
@@ -1558,6 +2990,62 @@ static int init_trace_dump_path(const char* path)
 	return 0;
 }
 
+/* The persistent ring is kept up to date by the kernel, so the frames leading
+ * up to a crash can be read from it afterwards with canopen-dump --file.
+ */
+static int init_tracebuffer(void)
+{
+	char path[256];
+
+	if (!cfg.enable_persistent_trace)
+		return tb_init(&tracebuffer_, cfg.trace_buffer_size);
+
+	snprintf(path, sizeof(path), "%s/%s", cfg.trace_dump_path,
+		 TRACE_RING_NAME);
+
+	if (tb_init_file(&tracebuffer_, path, cfg.trace_buffer_size) >= 0)
+		return 0;
+
+	plog(LOG_WARNING, "init_tracebuffer: Could not create \"%s\": %s; keeping the trace in memory",
+	     path, strerror(errno));
+
+	return tb_init(&tracebuffer_, cfg.trace_buffer_size);
+}
+
+static int init_incident_capture(enum sock_type sock_type)
+{
+	struct incident_config config = {
+		.path = cfg.trace_dump_path,
+		.pre_trigger = cfg.incident_pre_trigger,
+		.post_trigger = cfg.incident_post_trigger,
+		.min_interval = cfg.incident_min_interval,
+		.max_files = cfg.incident_max_files,
+		.is_compact = cfg.compress_trace_dump,
+	};
+
+	if (incident_init(&tracebuffer_, &config, cfg.incident_triggers) < 0)
+		return -1;
+
+	if (sock_type == SOCK_TYPE_CAN && incident_wants_error_frames()
+	 && socketcan_set_error_filter(socket_.fd, CAN_ERR_BUSOFF) < 0)
+		plog(LOG_WARNING, "init_incident_capture: Could not enable error frames: %s",
+		     strerror(errno));
+
+	return 0;
+}
+
+static int init_trace_sub(void)
+{
+	struct trace_sub_config config = {
+		.port = cfg.trace_sub_port,
+		.queue_size = cfg.trace_sub_queue_size,
+		.batch_size = cfg.trace_sub_batch_size,
+		.flush_interval = cfg.trace_sub_flush_interval,
+	};
+
+	return trace_sub_init(&config);
+}
+
 void on_stop_signal(struct mloop_signal* sig, int signo)
 {
 	(void)sig;
@@ -1603,7 +3091,10 @@ int co_master_run(void)
 	profile("Starting up canopen-master...\n");
 
 	memset(nodes_seen_, 0, sizeof(nodes_seen_));
-	memset(nodes_seen_late_, 0, sizeof(nodes_seen_));
+	co_nodeset_clear(&late_nodes_);
+	co_nodeset_clear(&driver_nodes_);
+	co_nodeset_clear(&pending_nodes_);
+	co_nodeset_clear(&suspended_nodes_);
 	memset(co_master_node_, 0, sizeof(co_master_node_));
 
 	mloop_ = mloop_default();
@@ -1612,6 +3103,9 @@ int co_master_run(void)
 	profile("Load EDS database...\n");
 	eds_db_load();
 
+	profile("Scan driver directory...\n");
+	driver_registry_init(NULL);
+
 	profile("Initialize and register SDO REST service...\n");
 	if (rest_init(cfg.rest_port) < 0) {
 		perror("Could not initialize rest service");
@@ -1622,6 +3116,18 @@ int co_master_run(void)
 				  "sdo", sdo_rest_service) < 0)
 		goto rest_service_failure;
 
+	if (rest_register_service(HTTP_GET | HTTP_PUT,
+				  "sdo-stats", sdo_rest_stats_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET, "node-stats",
+				  node_stats_rest_service) < 0)
+		goto rest_service_failure;
+
+	if (rest_register_service(HTTP_GET | HTTP_PUT, "incidents",
+				  incidents_rest_service) < 0)
+		goto rest_service_failure;
+
 	profile("Open interface...\n");
 	enum sock_type sock_type = cfg.use_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
 	if (sock_open(&socket_, sock_type, cfg.iface,
@@ -1648,6 +3154,12 @@ int co_master_run(void)
 	if (sock_type == SOCK_TYPE_CAN)
 		net_fix_sndbuf(socket_.fd);
 
+	profile("Initialize heartbeat supervision...\n");
+	if (init_hb_supervisor() < 0) {
+		rc = 1;
+		goto hb_supervisor_failure;
+	}
+
 #ifndef NO_MAREL_CODE
 	profile("Create legacy driver manager...\n");
 	driver_manager_ = legacy_driver_manager_new();
@@ -1667,20 +3179,52 @@ int co_master_run(void)
 	}
 
 	if (cfg.trace_buffer_size > 0) {
+		if (init_trace_dump_path(cfg.trace_dump_path) < 0) {
+			perror("Could not create directory for trace dump");
+			rc = 1;
+			goto trace_dump_path_failure;
+		}
+
 		profile("Initialize trace buffer...\n");
-		if (tb_init(&tracebuffer_, cfg.trace_buffer_size) < 0) {
+		if (init_tracebuffer() < 0) {
 			perror("Could not initialize trace buffer");
 			rc = 1;
 			goto tracebuffer_failure;
 		}
+	}
 
-		if (init_trace_dump_path(cfg.trace_dump_path) < 0) {
-			perror("Could not create directory for trace dump");
+	if (cfg.enable_incident_trace && cfg.trace_buffer_size > 0) {
+		profile("Initialize incident capture...\n");
+		if (init_incident_capture(sock_type) < 0) {
 			rc = 1;
-			goto trace_dump_path_failure;
+			goto incident_failure;
 		}
 	}
 
+	if (cfg.enable_sdo_trace) {
+		profile("Initialize SDO trace...\n");
+		if (sdo_trace_init(cfg.sdo_trace_path) < 0) {
+			perror("Could not open SDO trace file");
+			rc = 1;
+			goto sdo_trace_failure;
+		}
+	}
+
+	if (cfg.enable_trace_sub) {
+		profile("Initialize trace subscriptions...\n");
+		if (init_trace_sub() < 0) {
+			perror("Could not open trace subscription service");
+			rc = 1;
+			goto trace_sub_failure;
+		}
+	}
+
+	if (cfg.enable_boot_cache) {
+		profile("Load boot cache...\n");
+		if (boot_cache_load(cfg.boot_cache_path) < 0)
+			plog(LOG_WARNING, "co_master_run: No path given for the boot cache");
+	}
+
 	init_signal_handler(mloop_);
 
 #ifndef NO_MAREL_CODE
@@ -1701,17 +3245,37 @@ int co_master_run(void)
 		mloop_socket_unref(mux_handler_);
 	}
 
+	if (grace_timer_) {
+		mloop_timer_stop(grace_timer_);
+		mloop_timer_unref(grace_timer_);
+	}
+
+	if (discovery_.probe_timer)
+		co_net_discovery_destroy(&discovery_);
+
+	if (lss_.timer)
+		co_lss_destroy(&lss_);
+
 bootup_failure:
-trace_dump_path_failure:
+	boot_cache_cleanup();
+	trace_sub_cleanup();
+trace_sub_failure:
+	sdo_trace_cleanup();
+sdo_trace_failure:
+	incident_cleanup();
+incident_failure:
 	if (cfg.trace_buffer_size > 0)
 		tb_destroy(&tracebuffer_);
 tracebuffer_failure:
+trace_dump_path_failure:
 worker_failure:
 #ifndef NO_MAREL_CODE
 	legacy_driver_manager_delete(driver_manager_);
 #endif /* NO_MAREL_CODE */
 
 driver_manager_failure:
+	cleanup_hb_supervisor();
+hb_supervisor_failure:
 	sdo_req_queues_cleanup();
 
 sdo_req_queues_failure:
@@ -1727,6 +3291,7 @@ rest_service_failure:
 	rest_cleanup();
 
 rest_init_failure:
+	driver_registry_cleanup();
 	eds_db_unload();
 
 	mloop_unref(mloop_);
@@ -107,6 +107,15 @@ int net_fix_sndbuf(int fd)
 	return setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
 }
 
+/* SO_RCVBUFFORCE goes past rmem_max, but it needs CAP_NET_ADMIN */
+int net_grow_rcvbuf(int fd, int size)
+{
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0)
+		return 0;
+
+	return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
 int net_reuse_addr(int fd)
 {
 	int one = 1;
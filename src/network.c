@@ -14,6 +14,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 #include <poll.h>
@@ -29,6 +30,7 @@
 #include "net-util.h"
 #include "time-utils.h"
 #include "sock.h"
+#include "mloop.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
@@ -150,3 +152,165 @@ int co_net_probe_sdo(const struct sock* sock, char* nodes_seen, int start,
 
 	return co_net__wait_for_sdo(sock, nodes_seen, start, end, timeout);
 }
+
+static inline int co_net__is_expected(const struct co_net_discovery* self,
+				      int nodeid)
+{
+	return !!(self->expected[nodeid / 64] & (1ULL << (nodeid % 64)));
+}
+
+static void co_net__discovery_finish(struct co_net_discovery* self)
+{
+	self->is_running = 0;
+
+	mloop_timer_stop(self->probe_timer);
+	mloop_timer_stop(self->deadline_timer);
+
+	if (self->on_done)
+		self->on_done(self);
+}
+
+static void co_net__on_discovery_probe(struct mloop_timer* timer)
+{
+	struct co_net_discovery* self = mloop_timer_get_context(timer);
+
+	for (int i = self->start; i <= self->end; ++i)
+		if (!self->nodes_seen[i])
+			co_net__request_heartbeat(self->sock, i);
+}
+
+static void co_net__on_discovery_deadline(struct mloop_timer* timer)
+{
+	struct co_net_discovery* self = mloop_timer_get_context(timer);
+
+	if (self->is_running)
+		co_net__discovery_finish(self);
+}
+
+static struct mloop_timer* co_net__discovery_timer_new(void* context,
+						       mloop_timer_fn fn)
+{
+	struct mloop_timer* timer = mloop_timer_new(mloop_default());
+	if (!timer)
+		return NULL;
+
+	mloop_timer_set_context(timer, context, NULL);
+	mloop_timer_set_callback(timer, fn);
+	return timer;
+}
+
+int co_net_discovery_init(struct co_net_discovery* self,
+			  const struct sock* sock, char* nodes_seen, int start,
+			  int end)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->sock = sock;
+	self->nodes_seen = nodes_seen;
+	self->start = start;
+	self->end = end;
+	self->probe_delay = 100;
+	self->timeout = 500;
+
+	self->probe_timer = co_net__discovery_timer_new(self,
+						co_net__on_discovery_probe);
+	if (!self->probe_timer)
+		return -1;
+
+	self->deadline_timer = co_net__discovery_timer_new(self,
+						co_net__on_discovery_deadline);
+	if (!self->deadline_timer)
+		goto deadline_timer_failure;
+
+	return 0;
+
+deadline_timer_failure:
+	mloop_timer_unref(self->probe_timer);
+	self->probe_timer = NULL;
+	return -1;
+}
+
+void co_net_discovery_destroy(struct co_net_discovery* self)
+{
+	mloop_timer_stop(self->probe_timer);
+	mloop_timer_stop(self->deadline_timer);
+	mloop_timer_unref(self->probe_timer);
+	mloop_timer_unref(self->deadline_timer);
+}
+
+void co_net_discovery_expect(struct co_net_discovery* self, int nodeid)
+{
+	if (!(self->start <= nodeid && nodeid <= self->end))
+		return;
+
+	if (co_net__is_expected(self, nodeid))
+		return;
+
+	self->expected[nodeid / 64] |= 1ULL << (nodeid % 64);
+	++self->n_expected;
+
+	if (!self->nodes_seen[nodeid])
+		++self->n_missing;
+}
+
+int co_net_discovery_start(struct co_net_discovery* self)
+{
+	self->is_running = 1;
+
+	if (self->start == CANOPEN_NODEID_MIN && self->end == CANOPEN_NODEID_MAX)
+		co_net_send_nmt(self->sock, NMT_CS_RESET_COMMUNICATION, 0);
+	else
+		for (int i = self->start; i <= self->end; ++i)
+			co_net_send_nmt(self->sock, NMT_CS_RESET_COMMUNICATION,
+					i);
+
+	mloop_timer_set_time(self->probe_timer,
+			     self->probe_delay * 1000000ULL);
+	mloop_timer_set_time(self->deadline_timer, self->timeout * 1000000ULL);
+
+	if (mloop_timer_start(self->probe_timer) < 0
+	 || mloop_timer_start(self->deadline_timer) < 0) {
+		self->is_running = 0;
+		mloop_timer_stop(self->probe_timer);
+		return -1;
+	}
+
+	return 0;
+}
+
+int co_net_discovery_feed(struct co_net_discovery* self,
+			  const struct can_frame* cf)
+{
+	struct canopen_msg msg;
+
+	if (!self->is_running)
+		return -1;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return -1;
+
+	if (msg.object != CANOPEN_HEARTBEAT)
+		return -1;
+
+	if (!(self->start <= msg.id && msg.id <= self->end))
+		return -1;
+
+	/* Only the answer is consumed; later heartbeats, e.g. boot-ups from
+	 * a node that resets again, must still reach the master.
+	 */
+	if (self->nodes_seen[msg.id])
+		return -1;
+
+	self->nodes_seen[msg.id] = 1;
+
+	if (co_net__is_expected(self, msg.id))
+		--self->n_missing;
+
+	if (self->on_node)
+		self->on_node(self, msg.id);
+
+	if (self->n_expected > 0 && self->n_missing == 0)
+		co_net__discovery_finish(self);
+
+	return 0;
+}
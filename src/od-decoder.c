@@ -0,0 +1,380 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "od-decoder.h"
+#include "canopen/eds.h"
+#include "canopen/dcf.h"
+#include "canopen/types.h"
+#include "canopen/sdo-dict.h"
+#include "canopen/byteorder.h"
+#include "conversions.h"
+
+#define OD_DECODER_RPDO_MAPPING 0x1600
+#define OD_DECODER_TPDO_MAPPING 0x1A00
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static inline struct od_decoder_node* od_decoder__node(struct od_decoder* self,
+							int nodeid)
+{
+	return 0 < nodeid && nodeid <= 127 ? &self->node[nodeid - 1] : NULL;
+}
+
+static inline uint32_t od_decoder__cache_key(int index, int subindex)
+{
+	return ((uint32_t)index << 8 | subindex) + 1;
+}
+
+static uint32_t od_decoder__parse_default(const struct eds_obj* obj)
+{
+	if (!obj || !obj->default_value)
+		return 0;
+
+	return strtoul(obj->default_value, NULL, 0);
+}
+
+static void od_decoder__load_default_mapping(struct od_decoder_mapping* map,
+					     const struct canopen_eds* eds,
+					     int index)
+{
+	const struct eds_obj* count = eds ? eds_obj_find(eds, index, 0) : NULL;
+	if (!count) {
+		map->source = OD_DECODER_SOURCE_NONE;
+		map->n_entries = 0;
+		return;
+	}
+
+	uint32_t n = od_decoder__parse_default(count);
+	map->n_entries = MIN(n, OD_DECODER_MAX_MAPPED);
+
+	for (int i = 0; i < map->n_entries; ++i)
+		map->entry[i] = od_decoder__parse_default(
+				eds_obj_find(eds, index, i + 1));
+
+	map->source = OD_DECODER_SOURCE_DEFAULT;
+}
+
+static void od_decoder__assign_eds(struct od_decoder_node* node,
+				   const struct canopen_eds* eds)
+{
+	static const int base[] = {
+		[OD_DECODER_RPDO] = OD_DECODER_RPDO_MAPPING,
+		[OD_DECODER_TPDO] = OD_DECODER_TPDO_MAPPING,
+	};
+
+	if (node->eds == eds)
+		return;
+
+	node->eds = eds;
+	memset(node->cache, 0, sizeof(node->cache));
+
+	for (int type = 0; type < 2; ++type)
+		for (int n = 0; n < OD_DECODER_N_PDOS; ++n) {
+			struct od_decoder_mapping* map = &node->mapping[type][n];
+			if (map->source != OD_DECODER_SOURCE_ACTUAL)
+				od_decoder__load_default_mapping(map, eds,
+								 base[type] + n);
+		}
+}
+
+void od_decoder_init(struct od_decoder* self)
+{
+	memset(self, 0, sizeof(*self));
+}
+
+int od_decoder_set_eds(struct od_decoder* self, int nodeid,
+		       const struct canopen_eds* eds)
+{
+	struct od_decoder_node* node = od_decoder__node(self, nodeid);
+	if (!node)
+		return -1;
+
+	od_decoder__assign_eds(node, eds);
+	node->is_eds_fixed = 1;
+	return 0;
+}
+
+int od_decoder_load_dcf(struct od_decoder* self, int nodeid,
+			const struct co_dcf* dcf)
+{
+	struct co_dcf_iter iter;
+	struct co_dcf_entry entry;
+
+	if (!od_decoder__node(self, nodeid))
+		return -1;
+
+	co_dcf_iter_init(&iter, dcf);
+
+	while (co_dcf_iter_next(&iter, &entry) > 0)
+		od_decoder_learn(self, nodeid, entry.index, entry.subindex,
+				 entry.data, entry.size);
+
+	return 0;
+}
+
+static void od_decoder__learn_identity(struct od_decoder_node* node,
+				       int subindex, uint32_t value)
+{
+	switch (subindex) {
+	case 1: node->vendor = value; break;
+	case 2: node->product = value; break;
+	case 3: node->revision = value; break;
+	default: return;
+	}
+
+	if (node->is_eds_fixed || !node->vendor || !node->product)
+		return;
+
+	const struct canopen_eds* eds;
+	eds = eds_db_find(node->vendor, node->product, node->revision);
+	if (!eds)
+		eds = eds_db_find(node->vendor, node->product, -1);
+
+	od_decoder__assign_eds(node, eds);
+}
+
+static void od_decoder__learn_mapping(struct od_decoder_mapping* map,
+				      int subindex, uint32_t value)
+{
+	if (subindex == 0)
+		map->n_entries = MIN(value, OD_DECODER_MAX_MAPPED);
+	else if (subindex <= OD_DECODER_MAX_MAPPED)
+		map->entry[subindex - 1] = value;
+	else
+		return;
+
+	map->source = OD_DECODER_SOURCE_ACTUAL;
+}
+
+void od_decoder_learn(struct od_decoder* self, int nodeid, int index,
+		      int subindex, const void* data, size_t size)
+{
+	struct od_decoder_node* node = od_decoder__node(self, nodeid);
+	uint32_t value = 0;
+
+	if (!node || size == 0)
+		return;
+
+	byteorder2(&value, data, sizeof(value), MIN(size, sizeof(value)));
+
+	if (index == 0x1018)
+		od_decoder__learn_identity(node, subindex, value);
+	else if (OD_DECODER_RPDO_MAPPING <= index
+	      && index < OD_DECODER_RPDO_MAPPING + OD_DECODER_N_PDOS)
+		od_decoder__learn_mapping(&node->mapping[OD_DECODER_RPDO]
+					  [index - OD_DECODER_RPDO_MAPPING],
+					  subindex, value);
+	else if (OD_DECODER_TPDO_MAPPING <= index
+	      && index < OD_DECODER_TPDO_MAPPING + OD_DECODER_N_PDOS)
+		od_decoder__learn_mapping(&node->mapping[OD_DECODER_TPDO]
+					  [index - OD_DECODER_TPDO_MAPPING],
+					  subindex, value);
+}
+
+/* Misses are cached too, because objects that are not in the EDS are just as
+ * likely to be seen again.
+ */
+const struct eds_obj* od_decoder_find(struct od_decoder* self, int nodeid,
+				      int index, int subindex)
+{
+	struct od_decoder_node* node = od_decoder__node(self, nodeid);
+	if (!node || !node->eds)
+		return NULL;
+
+	uint32_t key = od_decoder__cache_key(index, subindex);
+	uint32_t pos = (key * 2654435761U) >> 16 & (OD_DECODER_CACHE_SIZE - 1);
+	struct od_decoder_cache_entry* entry = &node->cache[pos];
+
+	if (entry->key != key) {
+		entry->key = key;
+		entry->obj = eds_obj_find(node->eds, index, subindex);
+	}
+
+	return entry->obj;
+}
+
+enum canopen_type od_decoder_type(struct od_decoder* self, int nodeid,
+				  int index, int subindex)
+{
+	const struct eds_obj* obj = od_decoder_find(self, nodeid, index,
+						    subindex);
+	return obj ? obj->type : sdo_dict_type(SDO_MUX(index, subindex));
+}
+
+char* od_decoder_format(struct od_decoder* self, char* dst, size_t dst_size,
+			int nodeid, int index, int subindex,
+			const void* data, size_t size)
+{
+	enum canopen_type type = od_decoder_type(self, nodeid, index, subindex);
+	if (type == CANOPEN_UNKNOWN || dst_size < 3)
+		return NULL;
+
+	struct canopen_data cd = {
+		.type = type,
+		.data = (void*)data,
+		.size = size,
+	};
+
+	if (!canopen_type_is_string(type))
+		return canopen_data_tostring(dst, dst_size, &cd);
+
+	dst[0] = '"';
+	if (!canopen_data_tostring(dst + 1, dst_size - 2, &cd))
+		return NULL;
+
+	size_t len = strlen(dst);
+	dst[len] = '"';
+	dst[len + 1] = '\0';
+	return dst;
+}
+
+const char* od_decoder_name(struct od_decoder* self, int nodeid, int index,
+			    int subindex)
+{
+	const struct eds_obj* obj = od_decoder_find(self, nodeid, index,
+						    subindex);
+	if (obj && obj->name)
+		return obj->name;
+
+	uint32_t mux = SDO_MUX(index, subindex);
+	return sdo_dict_type(mux) != CANOPEN_UNKNOWN
+	     ? sdo_dict_tostring(mux) : NULL;
+}
+
+/* PDO data is packed little endian, starting at the least significant bit */
+static uint64_t od_decoder__get_bits(const uint8_t* data, unsigned int offset,
+				     unsigned int length)
+{
+	uint64_t value = 0;
+
+	for (unsigned int i = 0; i < length; ++i) {
+		unsigned int bit = offset + i;
+		if (data[bit >> 3] & (1 << (bit & 7)))
+			value |= 1ULL << i;
+	}
+
+	return value;
+}
+
+static int od_decoder__append(char* dst, size_t dst_size, size_t* pos,
+			      const char* fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+static int od_decoder__append(char* dst, size_t dst_size, size_t* pos,
+			      const char* fmt, ...)
+{
+	va_list ap;
+
+	if (*pos >= dst_size)
+		return -1;
+
+	va_start(ap, fmt);
+	int rc = vsnprintf(dst + *pos, dst_size - *pos, fmt, ap);
+	va_end(ap);
+
+	if (rc < 0 || (size_t)rc >= dst_size - *pos) {
+		*pos = dst_size;
+		return -1;
+	}
+
+	*pos += rc;
+	return 0;
+}
+
+static void od_decoder__append_entry(struct od_decoder* self, char* dst,
+				     size_t dst_size, size_t* pos, int nodeid,
+				     uint32_t entry, const uint8_t* data,
+				     unsigned int offset)
+{
+	int index = entry >> 16;
+	int subindex = (entry >> 8) & 0xff;
+	unsigned int length = entry & 0xff;
+	char name[16];
+	char value[256];
+
+	const char* name_str = od_decoder_name(self, nodeid, index, subindex);
+	if (!name_str) {
+		snprintf(name, sizeof(name), "%x:%x", index, subindex);
+		name_str = name;
+	}
+
+	if (length % 8 == 0 && offset % 8 == 0) {
+		if (od_decoder_format(self, value, sizeof(value), nodeid,
+				      index, subindex, data + offset / 8,
+				      length / 8))
+			goto done;
+	}
+
+	if (length > 64) {
+		strcpy(value, "?");
+		goto done;
+	}
+
+	uint64_t raw = od_decoder__get_bits(data, offset, length);
+	uint8_t bytes[8];
+	byteorder2(bytes, &raw, sizeof(bytes), sizeof(raw));
+
+	if (!od_decoder_format(self, value, sizeof(value), nodeid, index,
+			       subindex, bytes, (length + 7) / 8))
+		snprintf(value, sizeof(value), "%#"PRIx64, raw);
+
+done:
+	od_decoder__append(dst, dst_size, pos, "%s%s=%s",
+			   *pos > 1 ? ", " : "", name_str, value);
+}
+
+int od_decoder_decode_pdo(struct od_decoder* self, char* dst, size_t dst_size,
+			  int nodeid, enum od_decoder_pdo_type type, int n,
+			  const void* data, size_t size)
+{
+	struct od_decoder_node* node = od_decoder__node(self, nodeid);
+	size_t pos = 0;
+	unsigned int offset = 0;
+
+	if (!node || n < 1 || n > OD_DECODER_N_PDOS)
+		return -1;
+
+	const struct od_decoder_mapping* map = &node->mapping[type][n - 1];
+	if (map->source == OD_DECODER_SOURCE_NONE)
+		return -1;
+
+	od_decoder__append(dst, dst_size, &pos, "{");
+
+	for (int i = 0; i < map->n_entries; ++i) {
+		uint32_t entry = map->entry[i];
+		unsigned int length = entry & 0xff;
+
+		if (offset + length > size * 8)
+			break;
+
+		/* Indices below 0x1000 are dummy entries for padding */
+		if ((entry >> 16) >= 0x1000)
+			od_decoder__append_entry(self, dst, dst_size, &pos,
+						 nodeid, entry, data, offset);
+
+		offset += length;
+	}
+
+	if (od_decoder__append(dst, dst_size, &pos, "}") < 0)
+		return -1;
+
+	return 0;
+}
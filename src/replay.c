@@ -0,0 +1,393 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "socketcan.h"
+#include "sock.h"
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/replay.h"
+#include "trace-input.h"
+#include "time-utils.h"
+#include "vector.h"
+
+#define REPLAY_SEND_TIMEOUT 1000 /* ms */
+
+/* Objects that are sent by the master rather than by the nodes */
+#define REPLAY_MASTER_OBJECTS \
+	(CANOPEN_NMT | CANOPEN_SYNC | CANOPEN_TIMESTAMP | CANOPEN_RPDO1 \
+	 | CANOPEN_RPDO2 | CANOPEN_RPDO3 | CANOPEN_RPDO4 | CANOPEN_RSDO)
+
+struct replay_response {
+	uint64_t key;
+	uint64_t seq;
+	int is_used;
+	struct can_frame cf;
+};
+
+struct replay {
+	const struct sock* sock;
+	const struct co_replay_options* options;
+	struct co_replay_stats* stats;
+	struct vector responses;
+	size_t n_responses;
+};
+
+/* The command byte and multiplexer identify an initiating request. Segment
+ * requests carry no multiplexer, so the responses to them are matched by
+ * the command byte, which includes the toggle bit, in the recorded order.
+ */
+static uint64_t replay__request_key(int nodeid, const struct can_frame* cf)
+{
+	uint64_t key = (uint64_t)nodeid << 32 | cf->data[0];
+
+	switch (sdo_get_cs(cf)) {
+	case SDO_CCS_DL_INIT_REQ:
+	case SDO_CCS_UL_INIT_REQ:
+		key |= (uint64_t)cf->data[1] << 8 | (uint64_t)cf->data[2] << 16
+		     | (uint64_t)cf->data[3] << 24;
+		break;
+	}
+
+	return key;
+}
+
+static int replay__cmp_response(const void* p1, const void* p2)
+{
+	const struct replay_response* a = p1;
+	const struct replay_response* b = p2;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+
+	return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static inline struct replay_response* replay__response(struct replay* self,
+							size_t i)
+{
+	return &((struct replay_response*)self->responses.data)[i];
+}
+
+/* Each SDO response in the trace is paired with the last request to the same
+ * node before it.
+ */
+static int replay__load_responses(struct replay* self, const char* path)
+{
+	struct trace_input input;
+	struct tb_frame frame;
+	struct canopen_msg msg;
+	uint64_t pending[CANOPEN_NODEID_MAX + 1];
+	int has_pending[CANOPEN_NODEID_MAX + 1] = { 0 };
+	int rc;
+
+	if (trace_input_open(&input, path, self->options->input_format, 0) < 0)
+		return -1;
+
+	while ((rc = trace_input_next(&input, &frame)) > 0) {
+		if (canopen_get_object_type(&msg, &frame.cf) < 0
+		 || msg.id < CANOPEN_NODEID_MIN || msg.id > CANOPEN_NODEID_MAX)
+			continue;
+
+		if (msg.object == CANOPEN_RSDO) {
+			pending[msg.id] = replay__request_key(msg.id, &frame.cf);
+			has_pending[msg.id] = 1;
+			continue;
+		}
+
+		if (msg.object != CANOPEN_TSDO || !has_pending[msg.id])
+			continue;
+
+		struct replay_response response = {
+			.key = pending[msg.id],
+			.seq = self->n_responses,
+			.cf = frame.cf,
+		};
+
+		if (vector_append(&self->responses, &response,
+				  sizeof(response)) < 0) {
+			rc = -1;
+			break;
+		}
+
+		self->n_responses++;
+		has_pending[msg.id] = 0;
+	}
+
+	trace_input_close(&input);
+
+	qsort(self->responses.data, self->n_responses,
+	      sizeof(struct replay_response), replay__cmp_response);
+
+	return rc;
+}
+
+/* Returns the first unused response to the request. Once they have all been
+ * used, the last one is repeated.
+ */
+static struct replay_response* replay__find_response(struct replay* self,
+						     uint64_t key)
+{
+	size_t low = 0, high = self->n_responses;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (replay__response(self, mid)->key < key)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	struct replay_response* last = NULL;
+
+	for (size_t i = low; i < self->n_responses; ++i) {
+		struct replay_response* response = replay__response(self, i);
+		if (response->key != key)
+			break;
+
+		if (!response->is_used)
+			return response;
+
+		last = response;
+	}
+
+	return last;
+}
+
+static void replay__send(struct replay* self, const struct can_frame* cf)
+{
+	struct can_frame copy = *cf;
+
+	if (sock_timed_send(self->sock, &copy, REPLAY_SEND_TIMEOUT) < 0)
+		self->stats->n_send_errors++;
+}
+
+/* Returns -1 if the connection is closed */
+static int replay__serve_request(struct replay* self)
+{
+	struct can_frame cf;
+	struct canopen_msg msg;
+
+	ssize_t size = sock_recv(self->sock, &cf, MSG_DONTWAIT);
+	if (size == 0)
+		return -1;
+
+	if (size < 0 || canopen_get_object_type(&msg, &cf) < 0
+	 || msg.object != CANOPEN_RSDO)
+		return 0;
+
+	self->stats->n_requests++;
+
+	struct replay_response* response =
+		replay__find_response(self, replay__request_key(msg.id, &cf));
+	if (!response) {
+		self->stats->n_unanswered++;
+		return 0;
+	}
+
+	response->is_used = 1;
+	replay__send(self, &response->cf);
+	self->stats->n_responses++;
+	return 0;
+}
+
+/* Returns -1 if the replay should stop */
+static int replay__wait_until(struct replay* self, uint64_t deadline)
+{
+	struct timespec ts = ns_to_timespec(deadline);
+
+	if (!self->options->is_responder)
+		return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				       NULL) == EINTR ? -1 : 0;
+
+	while (1) {
+		struct pollfd pollfd = { .fd = self->sock->fd, .events = POLLIN };
+		uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+		uint64_t timeout = deadline > now ? deadline - now : 0;
+
+		ts = ns_to_timespec(timeout);
+
+		int rc = ppoll(&pollfd, 1, &ts, NULL);
+		if (rc < 0)
+			return errno == EINTR ? -1 : 0;
+
+		if (rc == 0)
+			return 0;
+
+		if (replay__serve_request(self) < 0)
+			return -1;
+	}
+}
+
+static int replay__is_wanted(const struct replay* self,
+			     const struct can_frame* cf)
+{
+	const struct co_replay_options* options = self->options;
+	struct canopen_msg msg;
+
+	if (cf->can_id & CAN_ERR_FLAG)
+		return 0;
+
+	if (canopen_get_object_type(&msg, cf) < 0)
+		return !options->objects && !options->is_responder;
+
+	if (options->objects && !(options->objects & msg.object))
+		return 0;
+
+	if (options->is_responder
+	 && (msg.object & (REPLAY_MASTER_OBJECTS | CANOPEN_TSDO)))
+		return 0;
+
+	if (msg.id != 0 && !co_nodeset_is_empty(&options->nodes)
+	 && !co_nodeset_has(&options->nodes, msg.id))
+		return 0;
+
+	return 1;
+}
+
+static int replay__run(struct replay* self, const char* path)
+{
+	struct trace_input input;
+	struct tb_frame frame;
+	struct co_replay_stats* stats = self->stats;
+	double speed = self->options->speed;
+	uint64_t first_timestamp = 0;
+	uint64_t last_timestamp = 0;
+	int rc;
+
+	if (trace_input_open(&input, path, self->options->input_format, 0) < 0)
+		return -1;
+
+	uint64_t start = gettime_ns(CLOCK_MONOTONIC);
+
+	while ((rc = trace_input_next(&input, &frame)) > 0) {
+		if (!replay__is_wanted(self, &frame.cf)) {
+			stats->n_filtered++;
+			continue;
+		}
+
+		if (stats->n_frames == 0)
+			first_timestamp = frame.timestamp;
+
+		last_timestamp = frame.timestamp;
+
+		uint64_t offset = frame.timestamp > first_timestamp
+				? frame.timestamp - first_timestamp : 0;
+		uint64_t deadline = speed > 0
+				  ? start + (uint64_t)(offset * 1000.0 / speed)
+				  : 0;
+
+		if (replay__wait_until(self, deadline) < 0)
+			break;
+
+		replay__send(self, &frame.cf);
+		stats->n_frames++;
+
+		uint64_t now = gettime_ns(CLOCK_MONOTONIC);
+		if (speed > 0)
+			sdo_trace_hist_add(&stats->lateness,
+					   now > deadline
+					   ? (now - deadline) / 1000ULL : 0);
+	}
+
+	stats->duration = (gettime_ns(CLOCK_MONOTONIC) - start) / 1000ULL;
+	stats->trace_duration = last_timestamp - first_timestamp;
+
+	trace_input_close(&input);
+	return rc < 0 ? -1 : 0;
+}
+
+__attribute__((visibility("default")))
+int co_replay_sock(const char* path, const struct sock* sock,
+		   const struct co_replay_options* options,
+		   struct co_replay_stats* stats)
+{
+	struct replay self = {
+		.sock = sock,
+		.options = options,
+		.stats = stats,
+	};
+	int rc = -1;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (vector_init(&self.responses, 256 * sizeof(struct replay_response))
+	    < 0)
+		return -1;
+
+	if (options->is_responder && replay__load_responses(&self, path) < 0)
+		goto done;
+
+	rc = replay__run(&self, path);
+
+done:
+	vector_destroy(&self.responses);
+	return rc;
+}
+
+__attribute__((visibility("default")))
+int co_replay(const char* path, const char* addr, int is_tcp,
+	      const struct co_replay_options* options,
+	      struct co_replay_stats* stats)
+{
+	struct sock sock;
+	enum sock_type type = is_tcp ? SOCK_TYPE_TCP : SOCK_TYPE_CAN;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (sock_open(&sock, type, addr, NULL) < 0)
+		return -1;
+
+	int rc = co_replay_sock(path, &sock, options, stats);
+
+	sock_close(&sock);
+	return rc;
+}
+
+__attribute__((visibility("default")))
+void co_replay_print_stats(const struct co_replay_stats* stats, FILE* output)
+{
+	double duration = stats->duration / 1e6;
+	double trace_duration = stats->trace_duration / 1e6;
+
+	fprintf(output, "Frames: %"PRIu64", filtered: %"PRIu64
+		", send errors: %"PRIu64"\n", stats->n_frames,
+		stats->n_filtered, stats->n_send_errors);
+
+	fprintf(output, "Duration: %.3f s of %.3f s recorded, %.1f frames/s, "
+		"speed %.2fx\n", duration, trace_duration,
+		duration > 0 ? stats->n_frames / duration : 0.0,
+		duration > 0 ? trace_duration / duration : 0.0);
+
+	if (stats->lateness.count > 0)
+		fprintf(output, "Lateness (us): mean %"PRIu64", p50 %"PRIu64
+			", p99 %"PRIu64", max %"PRIu64"\n",
+			stats->lateness.sum / stats->lateness.count,
+			sdo_trace_hist_percentile(&stats->lateness, 0.5),
+			sdo_trace_hist_percentile(&stats->lateness, 0.99),
+			stats->lateness.max);
+
+	if (stats->n_requests > 0)
+		fprintf(output, "SDO requests: %"PRIu64", answered: %"PRIu64
+			", unanswered: %"PRIu64"\n", stats->n_requests,
+			stats->n_responses, stats->n_unanswered);
+}
@@ -222,6 +222,14 @@ void rest_reply(FILE* output, struct rest_reply_data* data)
 	fflush(output);
 }
 
+void rest_reply_chunk(FILE* output, const void* data, size_t size)
+{
+	fprintf(output, "%zx\r\n", size);
+	fwrite(data, 1, size, output);
+	fprintf(output, "\r\n");
+	fflush(output);
+}
+
 void rest__not_found(struct rest_client* client)
 {
 	const char* content = "No service is implemented for the given path.\r\n";
@@ -424,6 +432,12 @@ static void rest__on_socket_free(void* ptr)
 {
 	struct rest_client* client = ptr;
 	client->state = REST_CLIENT_DISCONNECTED;
+
+	rest_client_fn on_disconnect = client->on_disconnect;
+	client->on_disconnect = NULL;
+	if (on_disconnect)
+		on_disconnect(client);
+
 	fclose(client->output);
 	rest_client_unref(client);
 }
@@ -19,6 +19,7 @@
 #include <mloop.h>
 
 #include "canopen/sdo_req.h"
+#include "canopen/sdo_trace.h"
 #include "canopen/eds.h"
 #include "canopen.h"
 #include "canopen/master.h"
@@ -42,14 +43,6 @@ struct sdo_rest_context {
 	struct sdo_rest_path path;
 };
 
-struct sdo_rest_eds_context {
-	unsigned int nodeid;
-	struct rest_client* client;
-	const struct canopen_eds* eds;
-	char* buffer;
-	size_t length;
-};
-
 static int sdo_rest__convert_path(struct sdo_rest_path* dst,
 				  const struct rest_client* client)
 {
@@ -372,48 +365,6 @@ int sdo_rest__process(struct sdo_rest_context* context, const void* content)
 	return -1;
 }
 
-ssize_t sdo_rest__read_value(FILE* out, unsigned int nodeid, int index,
-			     int subindex, enum canopen_type type)
-{
-	struct sdo_req_info info = {
-		.type = SDO_REQ_UPLOAD,
-		.index = index,
-		.subindex = subindex
-	};
-
-	struct sdo_req* req = sdo_req_new(&info);
-	if (!req)
-		goto nomem;
-
-	if (sdo_req_start(req, sdo_req_queue_get(nodeid)) < 0)
-		goto failure;
-
-	sdo_req_wait(req);
-
-	if (req->status != SDO_REQ_OK)
-		goto failure;
-
-	struct canopen_data data = {
-		.type = type,
-		.data = req->data.data,
-		.size = req->data.index,
-		.is_size_unknown = !req->is_size_indicated
-	};
-
-	char buffer[256];
-	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
-	if (!str)
-		goto failure;
-
-	sdo_req_unref(req);
-	return fprintf(out, "\"%s\"", str);
-
-failure:
-	sdo_req_unref(req);
-nomem:
-	return fprintf(out, "null");
-}
-
 static char* sdo_rest__escape_string(const char* str)
 {
 	static __thread char buffer[256];
@@ -445,139 +396,283 @@ static char* sdo_rest__clean_string(const char* str)
 	return string_keep_if(isprint, buffer);
 }
 
-void sdo_rest__eds_job(struct mloop_work* work)
+/* The EDS listing is streamed to the client with chunked encoding. Values are
+ * read through a window of outstanding SDO requests so that the node's queue
+ * stays busy, and the objects are written out in EDS order as soon as all
+ * values before them have arrived.
+ */
+#define SDO_REST_EDS_WINDOW 8
+
+struct sdo_rest_eds_slot {
+	const struct eds_obj* obj;
+	struct sdo_req* req;
+};
+
+struct sdo_rest_eds_stream {
+	int ref;
+	unsigned int nodeid;
+	int with_value;
+	int is_first;
+	int is_finished;
+	struct rest_client* client;
+	const struct canopen_eds* eds;
+	const struct eds_obj* next_obj;
+	size_t head, n_slots;
+	struct sdo_rest_eds_slot slots[SDO_REST_EDS_WINDOW];
+};
+
+static void sdo_rest__eds_stream_unref(struct sdo_rest_eds_stream* self)
 {
-	char* buffer = NULL;
-	size_t size = 0;
+	if (--self->ref > 0)
+		return;
 
-	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
-	const struct canopen_eds* eds = context->eds;
-	struct rest_client* client = context->client;
-	unsigned int nodeid = context->nodeid;
+	rest_client_unref(self->client);
+	free(self);
+}
 
-	int is_const, is_readable, is_writable;
-	int with_value = http_req_query(&client->req, "with_value") != NULL;
+static inline int sdo_rest__eds_obj_has_value(const struct eds_obj* obj)
+{
+	return !!(obj->access & (EDS_OBJ_CONST | EDS_OBJ_R));
+}
 
-	int index, subindex;
+static inline struct sdo_rest_eds_slot*
+sdo_rest__eds_slot(struct sdo_rest_eds_stream* self, size_t i)
+{
+	return &self->slots[(self->head + i) % SDO_REST_EDS_WINDOW];
+}
 
-	FILE* out = open_memstream(&buffer, &size);
-	if (!out) {
-		sdo_rest_server_error(client, "Out of memory\r\n");
-		return;
+static void sdo_rest__print_value(FILE* out, const struct eds_obj* obj,
+				  const struct sdo_req* req)
+{
+	if (!req || req->status != SDO_REQ_OK)
+		goto failure;
+
+	struct canopen_data data = {
+		.type = obj->type,
+		.data = req->data.data,
+		.size = req->data.index,
+		.is_size_unknown = !req->is_size_indicated
+	};
+
+	char buffer[256];
+	char* str = canopen_data_tostring(buffer, sizeof(buffer), &data);
+	if (!str)
+		goto failure;
+
+	fprintf(out, "\"%s\"", str);
+	return;
+
+failure:
+	fprintf(out, "null");
+}
+
+static void sdo_rest__print_eds_obj(FILE* out, const struct eds_obj* obj,
+				    const struct sdo_req* req, int with_value)
+{
+	int is_const = !!(obj->access & EDS_OBJ_CONST);
+	int is_readable = !!(obj->access & EDS_OBJ_R);
+	int is_writable = !!(obj->access & EDS_OBJ_W);
+
+	fprintf(out, " \"%#x:%#x\": {\n", eds_obj_index(obj),
+		eds_obj_subindex(obj));
+
+	fprintf(out, "  \"type\": %u,\n", obj->type);
+	if (is_const) {
+		fprintf(out, "  \"const\": true");
+	} else {
+		fprintf(out, "  \"read-write\": [%s, %s]",
+			       is_readable ? "true" : "false",
+			       is_writable ? "true" : "false");
 	}
 
-	fprintf(out, "{\n");
-	const struct eds_obj* obj = eds_obj_first(eds);
-	if (!obj)
-		goto done;
+	if ((is_const || is_readable) && with_value) {
+		fprintf(out, ",\n  \"value\": ");
+		sdo_rest__print_value(out, obj, req);
+	}
 
-	goto first_object;
-	do {
-		if (client->state == REST_CLIENT_DISCONNECTED)
-			goto failure;
-
-		fprintf(out, ",\n");
-first_object:
-		is_const = !!(obj->access & EDS_OBJ_CONST);
-		is_readable = !!(obj->access & EDS_OBJ_R);
-		is_writable = !!(obj->access & EDS_OBJ_W);
-
-		index = eds_obj_index(obj);
-		subindex = eds_obj_subindex(obj);
-
-		fprintf(out, " \"%#x:%#x\": {\n", index, subindex);
-
-		fprintf(out, "  \"type\": %u,\n", obj->type);
-		if (is_const) {
-			fprintf(out, "  \"const\": true");
-		} else {
-			fprintf(out, "  \"read-write\": [%s, %s]",
-				       is_readable ? "true" : "false",
-				       is_writable ? "true" : "false");
-		}
+	if (obj->name) {
+		const char* clean_name;
+		const char* escaped_name;
+		clean_name = sdo_rest__clean_string(obj->name);
+		escaped_name = sdo_rest__escape_string(clean_name);
 
-		if ((is_const || is_readable) && with_value) {
-			fprintf(out, ",\n  \"value\": ");
-			sdo_rest__read_value(out, nodeid, index,
-						    subindex, obj->type);
-		}
+		fprintf(out, ",\n  \"name\": \"%s\"", escaped_name);
+	}
 
-		if (obj->name) {
-			const char* clean_name;
-			const char* escaped_name;
-			clean_name = sdo_rest__clean_string(obj->name);
-			escaped_name = sdo_rest__escape_string(clean_name);
+	if (obj->default_value)
+		fprintf(out, ",\n  \"default-value\": \"%s\"",
+			obj->default_value);
 
-			fprintf(out, ",\n  \"name\": \"%s\"", escaped_name);
-		}
+	if (obj->low_limit)
+		fprintf(out, ",\n  \"low-limit\": \"%s\"", obj->low_limit);
 
-		if (obj->default_value)
-			fprintf(out, ",\n  \"default-value\": \"%s\"",
-				obj->default_value);
+	if (obj->high_limit)
+		fprintf(out, ",\n  \"high-limit\": \"%s\"", obj->high_limit);
 
-		if (obj->low_limit)
-			fprintf(out, ",\n  \"low-limit\": \"%s\"",
-				obj->low_limit);
+	if (obj->unit)
+		fprintf(out, ",\n  \"unit\": \"%s\"", obj->unit);
 
-		if (obj->high_limit)
-			fprintf(out, ",\n  \"high-limit\": \"%s\"",
-				obj->high_limit);
+	if (obj->scaling)
+		fprintf(out, ",\n  \"scaling\": \"%s\"", obj->scaling);
 
-		if (obj->unit)
-			fprintf(out, ",\n  \"unit\": \"%s\"", obj->unit);
+	fprintf(out, "\n }");
+}
 
-		if (obj->scaling)
-			fprintf(out, ",\n  \"scaling\": \"%s\"", obj->scaling);
+static void sdo_rest__on_eds_value(struct sdo_req* req);
 
-		fprintf(out, "\n }");
-		obj = eds_obj_next(eds, obj);
-	} while (obj);
-done:
-	fprintf(out, "\n}\n");
+static struct sdo_req*
+sdo_rest__eds_start_read(struct sdo_rest_eds_stream* self,
+			 const struct eds_obj* obj)
+{
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.index = eds_obj_index(obj),
+		.subindex = eds_obj_subindex(obj),
+		.on_done = sdo_rest__on_eds_value,
+		.context = self
+	};
 
-	fclose(out);
+	struct sdo_req* req = sdo_req_new(&info);
+	if (!req)
+		return NULL;
 
-	context->buffer = buffer;
-	context->length = size;
+	if (sdo_req_start(req, sdo_req_queue_get(self->nodeid)) < 0) {
+		sdo_req_unref(req);
+		return NULL;
+	}
 
-	return;
+	/* Each outstanding request holds a reference to the stream */
+	++self->ref;
+	return req;
+}
 
-failure:
-	mloop_work_cancel(work);
-	fclose(out);
-	free(buffer);
-	return;
+static void sdo_rest__eds_fill(struct sdo_rest_eds_stream* self)
+{
+	while (self->n_slots < SDO_REST_EDS_WINDOW && self->next_obj) {
+		const struct eds_obj* obj = self->next_obj;
+		struct sdo_rest_eds_slot* slot;
+
+		slot = sdo_rest__eds_slot(self, self->n_slots++);
+		slot->obj = obj;
+		slot->req = self->with_value && sdo_rest__eds_obj_has_value(obj)
+			  ? sdo_rest__eds_start_read(self, obj) : NULL;
+
+		self->next_obj = eds_obj_next(self->eds, obj);
+	}
 }
 
-void sdo_rest__eds_job_done(struct mloop_work* work)
+static inline int sdo_rest__eds_slot_is_ready(const struct sdo_rest_eds_slot* slot)
 {
-	struct sdo_rest_eds_context* context = mloop_work_get_context(work);
-	struct rest_client* client = context->client;
-	char* buffer = context->buffer;
-	size_t length = context->length;
+	return !slot->req || slot->req->status != SDO_REQ_PENDING;
+}
 
-	if (client->state == REST_CLIENT_DISCONNECTED)
+static void sdo_rest__eds_pop(struct sdo_rest_eds_stream* self)
+{
+	struct sdo_rest_eds_slot* slot = sdo_rest__eds_slot(self, 0);
+
+	if (slot->req)
+		sdo_req_unref(slot->req);
+
+	slot->req = NULL;
+	self->head = (self->head + 1) % SDO_REST_EDS_WINDOW;
+	--self->n_slots;
+}
+
+static void sdo_rest__eds_finish(struct sdo_rest_eds_stream* self)
+{
+	self->is_finished = 1;
+	self->client->on_disconnect = NULL;
+	self->client->context = NULL;
+	sdo_rest__eds_stream_unref(self);
+}
+
+static void sdo_rest__eds_cancel(struct sdo_rest_eds_stream* self)
+{
+	while (self->n_slots > 0) {
+		struct sdo_req* req = sdo_rest__eds_slot(self, 0)->req;
+
+		/* Requests that were never started will not call back */
+		if (req && sdo_req_cancel(req) == 0)
+			sdo_rest__eds_stream_unref(self);
+
+		sdo_rest__eds_pop(self);
+	}
+
+	sdo_rest__eds_finish(self);
+}
+
+static void sdo_rest__eds_pump(struct sdo_rest_eds_stream* self)
+{
+	struct rest_client* client = self->client;
+	char* buffer = NULL;
+	size_t size = 0;
+
+	/* The status has already been sent, so the listing is cut short. The
+	 * client sees that as incomplete JSON instead of waiting for more.
+	 */
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		rest_reply_chunk(client->output, NULL, 0);
+		client->state = REST_CLIENT_DONE;
+		sdo_rest__eds_cancel(self);
 		return;
+	}
 
-	struct rest_reply_data reply = {
-		.status_code = "200 OK",
-		.content_type = "application/json",
-		.content_length = length,
-		.content = buffer
-	};
+	for (;;) {
+		sdo_rest__eds_fill(self);
 
-	rest_reply(client->output, &reply);
+		if (self->n_slots == 0)
+			break;
 
+		struct sdo_rest_eds_slot* slot = sdo_rest__eds_slot(self, 0);
+		if (!sdo_rest__eds_slot_is_ready(slot))
+			break;
+
+		if (!self->is_first)
+			fprintf(out, ",\n");
+
+		self->is_first = 0;
+
+		sdo_rest__print_eds_obj(out, slot->obj, slot->req,
+					self->with_value);
+		sdo_rest__eds_pop(self);
+	}
+
+	int is_done = self->n_slots == 0 && !self->next_obj;
+	if (is_done)
+		fprintf(out, "\n}\n");
+
+	fclose(out);
+
+	if (size > 0)
+		rest_reply_chunk(client->output, buffer, size);
+
+	free(buffer);
+
+	if (!is_done)
+		return;
+
+	rest_reply_chunk(client->output, NULL, 0);
 	client->state = REST_CLIENT_DONE;
+	sdo_rest__eds_finish(self);
 }
 
-void sdo_rest__eds_job_free(void* ptr)
+static void sdo_rest__on_eds_value(struct sdo_req* req)
 {
-	struct sdo_rest_eds_context* context = ptr;
-	struct rest_client* client = context->client;
-	rest_client_unref(client);
-	free(context->buffer);
-	free(context);
+	struct sdo_rest_eds_stream* self = req->context;
+
+	if (!self->is_finished)
+		sdo_rest__eds_pump(self);
+
+	sdo_rest__eds_stream_unref(self);
+}
+
+static void sdo_rest__on_eds_disconnect(struct rest_client* client)
+{
+	struct sdo_rest_eds_stream* self = client->context;
+
+	if (!self->is_finished)
+		sdo_rest__eds_cancel(self);
 }
 
 int sdo_rest__send_eds(struct rest_client* client)
@@ -594,31 +689,36 @@ int sdo_rest__send_eds(struct rest_client* client)
 		return -1;
 	}
 
-	struct sdo_rest_eds_context* context = malloc(sizeof(*context));
-	memset(context, 0, sizeof(*context));
-	context->client = client;
-	context->eds = eds;
-	context->nodeid = nodeid;
-
-	struct mloop_work* work = mloop_work_new(mloop_default());
-	if (!work) {
+	struct sdo_rest_eds_stream* self = malloc(sizeof(*self));
+	if (!self) {
 		sdo_rest_server_error(client, "Out of memory\r\n");
-		goto failure;
+		return -1;
 	}
 
-	mloop_work_set_context(work, context, sdo_rest__eds_job_free);
-	mloop_work_set_work_fn(work, sdo_rest__eds_job);
-	mloop_work_set_done_fn(work, sdo_rest__eds_job_done);
-	if (mloop_work_start(work) < 0)
-		sdo_rest_server_error(client, "Failed to schedule response\r\n");
+	memset(self, 0, sizeof(*self));
+	self->ref = 1;
+	self->nodeid = nodeid;
+	self->is_first = 1;
+	self->with_value = http_req_query(&client->req, "with_value") != NULL;
+	self->client = client;
+	self->eds = eds;
+	self->next_obj = eds_obj_first(eds);
 
 	rest_client_ref(client);
-	mloop_work_unref(work);
-	return 0;
+	client->on_disconnect = sdo_rest__on_eds_disconnect;
+	client->context = self;
 
-failure:
-	free(context);
-	return -1;
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = -1,
+	};
+
+	rest_reply_header(client->output, &reply);
+	rest_reply_chunk(client->output, "{\n", 2);
+
+	sdo_rest__eds_pump(self);
+	return 0;
 }
 
 void sdo_rest_service(struct rest_client* client, const void* content)
@@ -649,3 +749,62 @@ void sdo_rest_service(struct rest_client* client, const void* content)
 	if (sdo_rest__process(context, content) < 0)
 		free(context);
 }
+
+static void sdo_rest__send_stats(struct rest_client* client, int nodeid)
+{
+	char* buffer = NULL;
+	size_t size = 0;
+
+	FILE* out = open_memstream(&buffer, &size);
+	if (!out) {
+		sdo_rest_server_error(client, "Out of memory\r\n");
+		return;
+	}
+
+	sdo_trace_print_json(out, nodeid);
+	fclose(out);
+
+	struct rest_reply_data reply = {
+		.status_code = "200 OK",
+		.content_type = "application/json",
+		.content_length = size,
+		.content = buffer
+	};
+
+	rest_reply(client->output, &reply);
+	free(buffer);
+
+	client->state = REST_CLIENT_DONE;
+}
+
+/* GET /sdo-stats gives a summary for all nodes and GET /sdo-stats/<nodeid>
+ * gives the details for one node. PUT /sdo-stats clears the statistics.
+ */
+void sdo_rest_stats_service(struct rest_client* client, const void* content)
+{
+	(void)content;
+
+	if (!sdo_trace_enabled) {
+		sdo_rest_not_found(client, "SDO tracing is not enabled\r\n");
+		return;
+	}
+
+	if (client->req.method == HTTP_PUT) {
+		sdo_trace_reset();
+		sdo_rest__send_stats(client, 0);
+		return;
+	}
+
+	if (client->req.url_index < 2) {
+		sdo_rest__send_stats(client, 0);
+		return;
+	}
+
+	int nodeid = strtoul(client->req.url[1], NULL, 10);
+	if (!is_in_range(nodeid, CANOPEN_NODEID_MIN, CANOPEN_NODEID_MAX)) {
+		sdo_rest_not_found(client, "URL is out of range\r\n");
+		return;
+	}
+
+	sdo_rest__send_stats(client, nodeid);
+}
@@ -23,7 +23,8 @@
  * - Validates data according to state and aborts when receiving unexpected
  *   data.
  *
- * There can be only one of these per node.
+ * There is one of these per SDO channel. Every node has at least the default
+ * channel; additional server SDOs may be configured with other COB-IDs.
  */
 
 #include <assert.h>
@@ -33,6 +34,7 @@
 #include "canopen.h"
 #include "net-util.h"
 #include "sock.h"
+#include "time-utils.h"
 
 #define MIN(a, b) ((a) < (b)) ? (a) : (b);
 
@@ -47,6 +49,8 @@ static int sdo_async__send(struct sdo_async* self, struct can_frame* cf)
 	if (self->quirks & SDO_ASYNC_QUIRK_NEEDS_FULL_FRAME)
 		cf->can_dlc = CAN_MAX_DLC;
 
+	self->send_time = gettime_us(CLOCK_MONOTONIC);
+
 	return sock_send(&self->sock, cf, 0);
 }
 
@@ -89,7 +93,7 @@ static inline void sdo_async__init_frame(const struct sdo_async* self,
 					 struct can_frame* cf)
 {
 	sdo_clear_frame(cf);
-	cf->can_id = R_RSDO + self->nodeid;
+	cf->can_id = self->rsdo_cob_id;
 }
 
 static int sdo_async__abort(struct sdo_async* self, enum sdo_abort_code code)
@@ -108,6 +112,7 @@ static int sdo_async__abort(struct sdo_async* self, enum sdo_abort_code code)
 void sdo_async__on_timeout(struct mloop_timer* timer)
 {
 	struct sdo_async* self = mloop_timer_get_context(timer);
+	sdo_rtt_timed_out(&self->rtt);
 	sdo_async__abort(self, SDO_ABORT_TIMEOUT);
 }
 
@@ -124,6 +129,8 @@ int sdo_async_init(struct sdo_async* self, const struct sock* sock, int nodeid)
 
 	self->sock = *sock;
 	self->nodeid = nodeid;
+	self->rsdo_cob_id = R_RSDO + nodeid;
+	self->tsdo_cob_id = R_TSDO + nodeid;
 	mloop_timer_set_context(self->timer, self, NULL);
 	mloop_timer_set_callback(self->timer, sdo_async__on_timeout);
 
@@ -207,6 +214,8 @@ int sdo_async_start(struct sdo_async* self, const struct sdo_async_info* info)
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->is_size_indicated = 0;
+	self->first_response_time = 0;
+	self->n_segments = 0;
 	mloop_timer_set_time(self->timer, info->timeout * 1000000ULL);
 
 	if (info->type == SDO_REQ_DOWNLOAD)
@@ -425,13 +434,20 @@ int sdo_async__feed_seg_response(struct sdo_async* self,
 
 int sdo_async_feed(struct sdo_async* self, const struct can_frame* cf)
 {
-	assert(cf->can_id == R_TSDO + self->nodeid);
+	assert(cf->can_id == self->tsdo_cob_id);
 
 	if (!self->is_running)
 		return -1;
 
 	mloop_timer_stop(self->timer);
 
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+	sdo_rtt_sample(&self->rtt, now - self->send_time);
+
+	if (!self->first_response_time)
+		self->first_response_time = now;
+	++self->n_segments;
+
 	if (sdo_get_cs(cf) == SDO_SCS_ABORT) {
 		self->status = SDO_REQ_REMOTE_ABORT;
 		self->abort_code = sdo_get_abort_code(cf);
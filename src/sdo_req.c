@@ -24,56 +24,149 @@
  *
  * There are 127 queues available; one for each possible node.
  *
+ * A queue normally drives the node's default SDO channel. If more channels are
+ * added with sdo_req_queue_add_channel(), uploads are spread across all idle
+ * channels. Downloads are never run concurrently with anything else on the
+ * same node, so writes keep their order relative to all other requests.
+ *
  * A request can be handled in either a synchronous or asynchronous manner, by
  * either waiting for it to finish using sdo_req_wait() or registering an
  * "on_done" callback.
+ *
+ * Request objects are recycled through a pool and small payloads are stored
+ * inside the request's vector, so a steady stream of expedited transfers does
+ * not touch the heap.
+ *
+ * Each queue has a policy that decides the timeout for each transfer and how
+ * transient failures are retried. Unless a fixed timeout is configured, the
+ * timeout is derived from the round-trip times observed on the node's SDO
+ * channel. Retries are delayed by an exponentially growing back-off. When a
+ * queue is marked offline, requests fail immediately instead of waiting for a
+ * timeout.
  */
 #include <assert.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <linux/can.h>
 #include "vector.h"
 #include "sys/queue.h"
 #include "canopen/sdo.h"
 #include "canopen/sdo_async.h"
 #include "canopen/sdo_req.h"
+#include "canopen/sdo_trace.h"
 #include "sock.h"
+#include "time-utils.h"
 
-#define SDO_REQ_TIMEOUT 1000 /* ms */
+#define SDO_REQ_TIMEOUT_MIN 1000 /* ms */
+#define SDO_REQ_TIMEOUT_MAX 5000 /* ms */
+#define SDO_REQ_RETRY_BACKOFF 50 /* ms */
+#define SDO_REQ_RETRY_BACKOFF_SHIFT_MAX 6
 #define SDO_REQ_ASYNC_PRIO 1000
 
-#define SDO_BUFFER_INITIAL_SIZE 8
+#define SDO_BUFFER_INITIAL_SIZE VECTOR_INLINE_SIZE
+#define SDO_REQ_POOL_MAX 1024
 
 /* Index 0 is unused */
 static struct sdo_req_queue sdo_req__queues[128];
 
-struct sdo_req* sdo_req_new(struct sdo_req_info* info)
+/* Additional channels, indexed by the server to client COB-ID */
+static struct sdo_async* sdo_req__channel_map[CAN_SFF_MASK + 1];
+
+union sdo_req__slot {
+	union sdo_req__slot* next;
+	struct sdo_req req;
+	char data[sizeof(struct sdo_req) + SDO_REQ_EXTRA_SIZE];
+};
+
+static union sdo_req__slot* sdo_req__pool = NULL;
+static size_t sdo_req__pool_size = 0;
+static pthread_mutex_t sdo_req__pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static union sdo_req__slot* sdo_req__pool_get(void)
 {
-	struct sdo_req* self = malloc(sizeof(*self));
-	if (!self)
+	pthread_mutex_lock(&sdo_req__pool_mutex);
+
+	union sdo_req__slot* slot = sdo_req__pool;
+	if (slot) {
+		sdo_req__pool = slot->next;
+		--sdo_req__pool_size;
+	}
+
+	pthread_mutex_unlock(&sdo_req__pool_mutex);
+
+	return slot ? slot : malloc(sizeof(*slot));
+}
+
+static void sdo_req__pool_put(union sdo_req__slot* slot)
+{
+	pthread_mutex_lock(&sdo_req__pool_mutex);
+
+	if (sdo_req__pool_size < SDO_REQ_POOL_MAX) {
+		slot->next = sdo_req__pool;
+		sdo_req__pool = slot;
+		++sdo_req__pool_size;
+		slot = NULL;
+	}
+
+	pthread_mutex_unlock(&sdo_req__pool_mutex);
+
+	free(slot);
+}
+
+void sdo_req_pool_cleanup(void)
+{
+	pthread_mutex_lock(&sdo_req__pool_mutex);
+
+	while (sdo_req__pool) {
+		union sdo_req__slot* slot = sdo_req__pool;
+		sdo_req__pool = slot->next;
+		free(slot);
+	}
+
+	sdo_req__pool_size = 0;
+
+	pthread_mutex_unlock(&sdo_req__pool_mutex);
+}
+
+struct sdo_req* sdo_req_alloc(void)
+{
+	union sdo_req__slot* slot = sdo_req__pool_get();
+	if (!slot)
 		return NULL;
 
-	memset(self, 0, sizeof(*self));
+	memset(slot, 0, sizeof(*slot));
+
+	struct sdo_req* self = &slot->req;
 
 	self->ref = 1;
+	vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE);
+
+	return self;
+}
+
+struct sdo_req* sdo_req_new(struct sdo_req_info* info)
+{
+	struct sdo_req* self = sdo_req_alloc();
+	if (!self)
+		return NULL;
+
 	self->type = info->type;
 	self->index = info->index;
 	self->subindex = info->subindex;
 	self->on_done = info->on_done;
 	self->context = info->context;
 
-	if (info->type == SDO_REQ_DOWNLOAD) {
+	if (info->type == SDO_REQ_DOWNLOAD)
 		if (vector_assign(&self->data, info->dl_data,
 				  info->dl_size) < 0)
 			goto failure;
-	} else {
-		if (vector_init(&self->data, SDO_BUFFER_INITIAL_SIZE) < 0)
-			goto failure;
-	}
 
 	return self;
 
 failure:
-	free(self);
+	vector_destroy(&self->data);
+	sdo_req__pool_put((union sdo_req__slot*)self);
 	return NULL;
 }
 
@@ -83,13 +176,73 @@ void sdo_req_free(struct sdo_req* self)
 		self->context_free_fn(self->context);
 
 	vector_destroy(&self->data);
-	free(self);
+	sdo_req__pool_put((union sdo_req__slot*)self);
 }
 
 ARC_GENERATE(sdo_req, sdo_req_free)
 
 void sdo_req__process_queue(struct mloop_idle* idle);
 int sdo_req__have_req(struct mloop_idle* idle);
+void sdo_req__on_retry_timeout(struct mloop_timer* timer);
+
+void sdo_req_policy_init(struct sdo_req_policy* self)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->timeout_min = SDO_REQ_TIMEOUT_MIN;
+	self->timeout_max = SDO_REQ_TIMEOUT_MAX;
+	self->backoff = SDO_REQ_RETRY_BACKOFF;
+}
+
+/* Format: "<index>[:<subindex>]=<timeout>", separated by commas or spaces.
+ * Index and sub-index are hexadecimal and the timeout is in milliseconds.
+ */
+int sdo_req_policy_parse_obj_timeouts(struct sdo_req_policy* self,
+				      const char* str)
+{
+	char* end;
+
+	self->n_obj_timeouts = 0;
+
+	while (*str) {
+		if (*str == ',' || isspace(*str)) {
+			++str;
+			continue;
+		}
+
+		if (self->n_obj_timeouts >= SDO_REQ_OBJ_TIMEOUTS_MAX)
+			return -1;
+
+		struct sdo_req_obj_timeout* entry =
+			&self->obj_timeouts[self->n_obj_timeouts];
+
+		entry->index = strtoul(str, &end, 16);
+		if (end == str)
+			return -1;
+
+		str = end;
+		entry->subindex = -1;
+
+		if (*str == ':') {
+			entry->subindex = strtoul(++str, &end, 16);
+			if (end == str)
+				return -1;
+			str = end;
+		}
+
+		if (*str++ != '=')
+			return -1;
+
+		entry->timeout = strtoul(str, &end, 10);
+		if (end == str)
+			return -1;
+
+		str = end;
+		++self->n_obj_timeouts;
+	}
+
+	return 0;
+}
 
 int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 			int nodeid, size_t limit,
@@ -102,7 +255,14 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 
 	self->idle = mloop_idle_new(mloop_default());
 	if (!self->idle)
-		goto failure;
+		goto idle_failure;
+
+	self->retry_timer = mloop_timer_new(mloop_default());
+	if (!self->retry_timer)
+		goto timer_failure;
+
+	mloop_timer_set_context(self->retry_timer, self, NULL);
+	mloop_timer_set_callback(self->retry_timer, sdo_req__on_retry_timeout);
 
 	mloop_idle_set_idle_fn(self->idle, sdo_req__process_queue);
 	mloop_idle_set_cond_fn(self->idle, sdo_req__have_req);
@@ -114,6 +274,11 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 	self->limit = limit;
 	self->nodeid = nodeid;
 
+	self->channels[0] = &self->sdo_client;
+	self->n_channels = 1;
+
+	sdo_req_policy_init(&self->policy);
+
 	pthread_mutexattr_t attr;
 	pthread_mutexattr_init(&attr);
 	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
@@ -124,7 +289,9 @@ int sdo_req__queue_init(struct sdo_req_queue* self, const struct sock* sock,
 
 	return 0;
 
-failure:
+timer_failure:
+	mloop_idle_unref(self->idle);
+idle_failure:
 	sdo_async_destroy(&self->sdo_client);
 	return -1;
 }
@@ -134,6 +301,7 @@ void sdo_req__queue_clear(struct sdo_req_queue* self)
 	while (!TAILQ_EMPTY(&self->list)) {
 		struct sdo_req* req = TAILQ_FIRST(&self->list);
 		TAILQ_REMOVE(&self->list, req, links);
+		req->is_queued = 0;
 		req->status = SDO_REQ_CANCELLED;
 		sdo_req_unref(req);
 	}
@@ -142,6 +310,8 @@ void sdo_req__queue_clear(struct sdo_req_queue* self)
 
 void sdo_req__queue_destroy(struct sdo_req_queue* self)
 {
+	sdo_req_queue_remove_channels(self);
+	mloop_timer_unref(self->retry_timer);
 	mloop_idle_unref(self->idle);
 	sdo_async_destroy(&self->sdo_client);
 	sdo_req__queue_clear(self);
@@ -171,6 +341,8 @@ void sdo_req_queues_cleanup()
 	size_t i;
 	for (i = 1; i < 128; ++i)
 		sdo_req__queue_destroy(&sdo_req__queues[i]);
+
+	sdo_req_pool_cleanup();
 }
 
 struct sdo_req_queue* sdo_req_queue_get(int nodeid)
@@ -192,11 +364,184 @@ void sdo_req_queue__unlock(struct sdo_req_queue* self)
 void sdo_req_queue_flush(struct sdo_req_queue* self)
 {
 	sdo_req_queue__lock(self);
+	mloop_timer_stop(self->retry_timer);
+	self->is_backing_off = 0;
 	sdo_req__queue_clear(self);
-	sdo_async_stop(&self->sdo_client);
+
+	size_t i;
+	for (i = 0; i < self->n_channels; ++i)
+		sdo_async_stop(self->channels[i]);
+
+	sdo_req_queue__unlock(self);
+}
+
+static int sdo_req_queue__has_channel(const struct sdo_req_queue* self,
+				      uint32_t rsdo_cob_id,
+				      uint32_t tsdo_cob_id)
+{
+	size_t i;
+	for (i = 0; i < self->n_channels; ++i)
+		if (self->channels[i]->rsdo_cob_id == rsdo_cob_id
+		 && self->channels[i]->tsdo_cob_id == tsdo_cob_id)
+			return 1;
+
+	return 0;
+}
+
+int sdo_req_queue_add_channel(struct sdo_req_queue* self, uint32_t rsdo_cob_id,
+			      uint32_t tsdo_cob_id)
+{
+	int rc = -1;
+
+	if (rsdo_cob_id > CAN_SFF_MASK || tsdo_cob_id > CAN_SFF_MASK)
+		return -1;
+
+	sdo_req_queue__lock(self);
+
+	if (sdo_req_queue__has_channel(self, rsdo_cob_id, tsdo_cob_id)) {
+		rc = 0;
+		goto done;
+	}
+
+	if (self->n_channels >= SDO_REQ_CHANNELS_MAX
+	 || sdo_req__channel_map[tsdo_cob_id])
+		goto done;
+
+	struct sdo_async* channel = malloc(sizeof(*channel));
+	if (!channel)
+		goto done;
+
+	if (sdo_async_init(channel, &self->sdo_client.sock, self->nodeid) < 0) {
+		free(channel);
+		goto done;
+	}
+
+	channel->quirks = self->sdo_client.quirks;
+	channel->rsdo_cob_id = rsdo_cob_id;
+	channel->tsdo_cob_id = tsdo_cob_id;
+
+	self->channels[self->n_channels++] = channel;
+
+	/* The channel must be complete before it becomes visible to the
+	 * receiving end.
+	 */
+	__sync_synchronize();
+	sdo_req__channel_map[tsdo_cob_id] = channel;
+
+	mloop_iterate(mloop_default());
+
+	rc = 0;
+done:
+	sdo_req_queue__unlock(self);
+	return rc;
+}
+
+void sdo_req_queue_remove_channels(struct sdo_req_queue* self)
+{
+	sdo_req_queue__lock(self);
+
+	while (self->n_channels > 1) {
+		struct sdo_async* channel = self->channels[--self->n_channels];
+		self->channels[self->n_channels] = NULL;
+
+		sdo_req__channel_map[channel->tsdo_cob_id] = NULL;
+		sdo_async_stop(channel);
+		sdo_async_destroy(channel);
+		free(channel);
+	}
+
+	sdo_req_queue__unlock(self);
+}
+
+void sdo_req_queue_reset_rtt(struct sdo_req_queue* self)
+{
+	size_t i;
+
+	sdo_req_queue__lock(self);
+
+	for (i = 0; i < self->n_channels; ++i)
+		sdo_rtt_reset(&self->channels[i]->rtt);
+
+	sdo_req_queue__unlock(self);
+}
+
+struct sdo_async* sdo_req_channel_lookup(uint32_t tsdo_cob_id)
+{
+	if (tsdo_cob_id > CAN_SFF_MASK)
+		return NULL;
+
+	return sdo_req__channel_map[tsdo_cob_id];
+}
+
+struct sdo_async*
+sdo_req_queue__get_free_channel(const struct sdo_req_queue* self,
+				const struct sdo_req* req)
+{
+	struct sdo_async* free_channel = NULL;
+	size_t n_running = 0;
+	size_t i;
+
+	for (i = 0; i < self->n_channels; ++i) {
+		struct sdo_async* channel = self->channels[i];
+
+		if (!channel->is_running) {
+			if (!free_channel)
+				free_channel = channel;
+			continue;
+		}
+
+		if (channel->type == SDO_REQ_DOWNLOAD)
+			return NULL;
+
+		++n_running;
+	}
+
+	if (req->type == SDO_REQ_DOWNLOAD && n_running > 0)
+		return NULL;
+
+	return free_channel;
+}
+
+void sdo_req_queue_set_policy(struct sdo_req_queue* self,
+			      const struct sdo_req_policy* policy)
+{
+	sdo_req_queue__lock(self);
+	self->policy = *policy;
 	sdo_req_queue__unlock(self);
 }
 
+void sdo_req_queue_set_offline(struct sdo_req_queue* self, int is_offline)
+{
+	self->is_offline = is_offline;
+
+	if (is_offline)
+		mloop_iterate(mloop_default());
+}
+
+unsigned long sdo_req_queue__timeout(const struct sdo_req_queue* self,
+				     const struct sdo_async* channel,
+				     const struct sdo_req* req)
+{
+	const struct sdo_req_policy* policy = &self->policy;
+	size_t i;
+
+	for (i = 0; i < policy->n_obj_timeouts; ++i) {
+		const struct sdo_req_obj_timeout* entry =
+			&policy->obj_timeouts[i];
+
+		if (entry->index == req->index
+		 && (entry->subindex < 0 || entry->subindex == req->subindex))
+			return entry->timeout;
+	}
+
+	if (policy->timeout)
+		return policy->timeout;
+
+	/* Each channel may be served differently by the node */
+	return sdo_rtt_timeout(&channel->rtt, policy->timeout_min,
+			       policy->timeout_max);
+}
+
 int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
 {
 	assert(req->parent == NULL);
@@ -209,7 +554,11 @@ int sdo_req_queue__enqueue(struct sdo_req_queue* self, struct sdo_req* req)
 		++self->size;
 
 	req->parent = self;
+	if (sdo_trace_enabled)
+		req->enqueue_time = gettime_us(CLOCK_MONOTONIC);
+
 	TAILQ_INSERT_TAIL(&self->list, req, links);
+	req->is_queued = 1;
 	mloop_iterate(mloop_default());
 
 	rc = 0;
@@ -230,6 +579,7 @@ struct sdo_req* sdo_req_queue__dequeue(struct sdo_req_queue* self)
 	--self->size;
 
 	TAILQ_REMOVE(&self->list, req, links);
+	req->is_queued = 0;
 
 	sdo_req_queue__unlock(self);
 	return req;
@@ -243,6 +593,7 @@ int sdo_req_queue_remove(struct sdo_req_queue* self, struct sdo_req* req)
 	sdo_req_queue__lock(self);
 
 	TAILQ_REMOVE(&self->list, req, links);
+	req->is_queued = 0;
 	req->parent = NULL;
 
 	sdo_req_queue__unlock(self);
@@ -250,6 +601,33 @@ int sdo_req_queue_remove(struct sdo_req_queue* self, struct sdo_req* req)
 	return 0;
 }
 
+int sdo_req_cancel(struct sdo_req* self)
+{
+	struct sdo_req_queue* queue = self->parent;
+	if (!queue)
+		return -1;
+
+	sdo_req_queue__lock(queue);
+
+	if (!self->is_queued) {
+		sdo_req_queue__unlock(queue);
+		return -1;
+	}
+
+	TAILQ_REMOVE(&queue->list, self, links);
+	self->is_queued = 0;
+	self->status = SDO_REQ_CANCELLED;
+
+	assert(queue->size);
+	--queue->size;
+
+	sdo_req_queue__unlock(queue);
+
+	/* Drop the reference that was taken by sdo_req_start() */
+	sdo_req_unref(self);
+	return 0;
+}
+
 void sdo_req_wait(struct sdo_req* self)
 {
 	while (self->status == SDO_REQ_PENDING)
@@ -262,7 +640,7 @@ void sdo_req__on_stop(void* ptr)
 {
 	struct sdo_req* req = ptr;
 
-	if (req->status == SDO_REQ_PENDING)
+	if (req->status == SDO_REQ_PENDING && !req->is_requeued)
 		req->status = SDO_REQ_CANCELLED;
 
 	sdo_req_unref(req);
@@ -271,29 +649,111 @@ void sdo_req__on_stop(void* ptr)
 int sdo_req__have_req(struct mloop_idle* idle)
 {
 	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	if (queue->sdo_client.is_running)
+	if (queue->is_backing_off)
 	       return 0;
 
-	__sync_synchronize();
-	return !TAILQ_EMPTY(&queue->list);
+	sdo_req_queue__lock(queue);
+
+	struct sdo_req* req = TAILQ_FIRST(&queue->list);
+	int rc = req && (queue->is_offline
+			 || sdo_req_queue__get_free_channel(queue, req));
+
+	sdo_req_queue__unlock(queue);
+	return rc;
+}
+
+static void sdo_req__trace(const struct sdo_req* req,
+			   const struct sdo_async* async, uint64_t done_time)
+{
+	struct sdo_trace_record record = {
+		.enqueue_time = req->enqueue_time,
+		.start_time = req->start_time,
+		.first_response_time = async ? async->first_response_time : 0,
+		.done_time = done_time,
+		.callback_done_time = gettime_us(CLOCK_MONOTONIC),
+		.size = req->data.index,
+		.abort_code = req->status == SDO_REQ_OK ? 0 : req->abort_code,
+		.index = req->index,
+		.subindex = req->subindex,
+		.nodeid = req->parent ? req->parent->nodeid : 0,
+		.type = req->type,
+		.status = req->status,
+		.n_retries = req->n_retries,
+		.n_segments = async ? async->n_segments : 0,
+	};
+
+	sdo_trace_record(&record);
+}
+
+static void sdo_req__fail_offline(struct sdo_req* req)
+{
+	req->status = SDO_REQ_LOCAL_ABORT;
+	req->abort_code = SDO_ABORT_TIMEOUT;
+
+	uint64_t done_time = sdo_trace_enabled
+			   ? gettime_us(CLOCK_MONOTONIC) : 0;
+
+	sdo_req_fn on_done = req->on_done;
+	if (on_done)
+		on_done(req);
+
+	if (sdo_trace_enabled)
+		sdo_req__trace(req, NULL, done_time);
+
+	sdo_req_unref(req);
+}
+
+/* The callbacks are called without the lock held because they may enqueue new
+ * requests.
+ */
+static void sdo_req_queue__fail_offline(struct sdo_req_queue* self)
+{
+	struct sdo_req_list failed;
+	TAILQ_INIT(&failed);
+
+	while (!TAILQ_EMPTY(&self->list)) {
+		struct sdo_req* req = sdo_req_queue__dequeue(self);
+		req->is_requeued = 0;
+		TAILQ_INSERT_TAIL(&failed, req, links);
+	}
+
+	sdo_req_queue__unlock(self);
+
+	while (!TAILQ_EMPTY(&failed)) {
+		struct sdo_req* req = TAILQ_FIRST(&failed);
+		TAILQ_REMOVE(&failed, req, links);
+		sdo_req__fail_offline(req);
+	}
 }
 
 void sdo_req__process_queue(struct mloop_idle* idle)
 {
 	struct sdo_req_queue* queue = mloop_idle_get_context(idle);
-	assert(!queue->sdo_client.is_running);
 
 	sdo_req_queue__lock(queue);
 
-	struct sdo_req* req = sdo_req_queue__dequeue(queue);
+	struct sdo_req* req = TAILQ_FIRST(&queue->list);
 	if (!req)
 		goto done;
 
+	if (queue->is_offline) {
+		sdo_req_queue__fail_offline(queue);
+		return;
+	}
+
+	struct sdo_async* channel =
+		sdo_req_queue__get_free_channel(queue, req);
+	if (!channel)
+		goto done;
+
+	req = sdo_req_queue__dequeue(queue);
+	req->is_requeued = 0;
+
 	struct sdo_async_info info = {
 		.type = req->type,
 		.index = req->index,
 		.subindex = req->subindex,
-		.timeout = SDO_REQ_TIMEOUT,
+		.timeout = sdo_req_queue__timeout(queue, channel, req),
 		.data = req->data.data,
 		.size = req->data.index,
 		.on_done = sdo_req__on_done,
@@ -301,32 +761,116 @@ void sdo_req__process_queue(struct mloop_idle* idle)
 		.free_fn = sdo_req__on_stop
 	};
 
-	sdo_async_start(&queue->sdo_client, &info);
+	if (sdo_trace_enabled && !req->start_time)
+		req->start_time = gettime_us(CLOCK_MONOTONIC);
+
+	sdo_async_start(channel, &info);
 
 done:
 	sdo_req_queue__unlock(queue);
 }
 
-void sdo_req__on_done(struct sdo_async* async)
+static int sdo_req__is_transient(const struct sdo_async* async)
+{
+	switch (async->status) {
+	case SDO_REQ_LOCAL_ABORT:
+		return async->abort_code == SDO_ABORT_TIMEOUT;
+	case SDO_REQ_REMOTE_ABORT:
+		switch (async->abort_code) {
+		case SDO_ABORT_TIMEOUT:
+		case SDO_ABORT_LOCAL_CTRL:
+		case SDO_ABORT_DEV_STATE:
+			return 1;
+		default:
+			return 0;
+		}
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int sdo_req__retry(struct sdo_req_queue* queue, struct sdo_req* req)
+{
+	const struct sdo_req_policy* policy = &queue->policy;
+
+	if (req->n_retries >= policy->retries || queue->is_offline)
+		return -1;
+
+	unsigned int shift = req->n_retries < SDO_REQ_RETRY_BACKOFF_SHIFT_MAX
+			   ? req->n_retries : SDO_REQ_RETRY_BACKOFF_SHIFT_MAX;
+	unsigned long backoff = policy->backoff << shift;
+
+	sdo_req_queue__lock(queue);
+
+	/* The request has already left the queue, so it has to wait for room
+	 * like any other.
+	 */
+	if (queue->size >= queue->limit) {
+		sdo_req_queue__unlock(queue);
+		return -1;
+	}
+
+	++req->n_retries;
+	sdo_req_ref(req);
+	req->is_requeued = 1;
+
+	TAILQ_INSERT_HEAD(&queue->list, req, links);
+	req->is_queued = 1;
+	++queue->size;
+
+	if (backoff > 0) {
+		queue->is_backing_off = 1;
+		mloop_timer_set_time(queue->retry_timer, backoff * 1000000ULL);
+		mloop_timer_start(queue->retry_timer);
+	}
+	sdo_req_queue__unlock(queue);
+
+	return 0;
+}
+
+void sdo_req__on_retry_timeout(struct mloop_timer* timer)
 {
-	struct sdo_req_queue* queue = sdo_req_queue__from_async(async);
+	struct sdo_req_queue* queue = mloop_timer_get_context(timer);
+	queue->is_backing_off = 0;
+	mloop_iterate(mloop_default());
+}
 
+void sdo_req__on_done(struct sdo_async* async)
+{
 	struct sdo_req* req = async->context;
 	assert(req != NULL);
 
+	struct sdo_req_queue* queue = req->parent;
+	assert(queue != NULL);
+
 	assert(async->status != SDO_REQ_PENDING);
+
+	if (sdo_req__is_transient(async) && sdo_req__retry(queue, req) == 0) {
+		mloop_iterate(mloop_default());
+		return;
+	}
 	req->status = async->status;
 	req->abort_code = async->abort_code;
 	req->is_size_indicated = async->is_size_indicated;
 
-	if (req->type == SDO_REQ_UPLOAD)
-		if (vector_copy(&req->data, &async->buffer) < 0)
-			req->status = SDO_REQ_NOMEM;
+	/* The request's empty buffer is handed to the channel in exchange */
+	if (req->type == SDO_REQ_UPLOAD) {
+		vector_clear(&req->data);
+		vector_swap(&req->data, &async->buffer);
+	}
+
+	uint64_t done_time = sdo_trace_enabled
+			   ? gettime_us(CLOCK_MONOTONIC) : 0;
 
 	sdo_req_fn on_done = req->on_done;
 	if (on_done)
 		on_done(req);
 
+	if (sdo_trace_enabled)
+		sdo_req__trace(req, async, done_time);
+
 	mloop_iterate(mloop_default());
 }
 
@@ -0,0 +1,353 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* SDO transfer tracing
+ *
+ * Every finished SDO request produces a record with the time it was queued,
+ * started, first answered, finished and handled by its callback. The records
+ * are summarised in latency histograms per node and per object, and they can
+ * also be written to a binary trace file.
+ *
+ * Records are produced on the main loop, which is also where the statistics
+ * are read, so there is no locking here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "canopen.h"
+#include "canopen/sdo_trace.h"
+#include "canopen/sdo_req_enums.h"
+
+#define SDO_TRACE_OBJ_TABLE_SIZE 1024 /* Must be a power of 2 */
+
+struct sdo_trace_obj_stats {
+	uint32_t key;
+	struct sdo_trace_hist total;
+};
+
+int sdo_trace_enabled = 0;
+
+static FILE* sdo_trace__file = NULL;
+static struct sdo_trace_node_stats sdo_trace__nodes[CANOPEN_NODEID_MAX + 1];
+static struct sdo_trace_obj_stats sdo_trace__objs[SDO_TRACE_OBJ_TABLE_SIZE];
+
+static inline uint32_t sdo_trace__obj_key(int nodeid, int index, int subindex)
+{
+	return (uint32_t)nodeid << 24 | (uint32_t)index << 8 | subindex;
+}
+
+static inline int sdo_trace__key_nodeid(uint32_t key)
+{
+	return key >> 24;
+}
+
+static inline int sdo_trace__key_index(uint32_t key)
+{
+	return (key >> 8) & 0xffff;
+}
+
+static inline int sdo_trace__key_subindex(uint32_t key)
+{
+	return key & 0xff;
+}
+
+static struct sdo_trace_obj_stats* sdo_trace__find_obj(uint32_t key,
+						       int do_insert)
+{
+	uint32_t mask = SDO_TRACE_OBJ_TABLE_SIZE - 1;
+	uint32_t pos = (key * 2654435761U) & mask;
+	uint32_t i;
+
+	for (i = 0; i < SDO_TRACE_OBJ_TABLE_SIZE; ++i) {
+		struct sdo_trace_obj_stats* obj =
+			&sdo_trace__objs[(pos + i) & mask];
+
+		if (obj->key == key)
+			return obj;
+
+		if (obj->key == 0) {
+			if (!do_insert)
+				return NULL;
+
+			obj->key = key;
+			return obj;
+		}
+	}
+
+	return NULL;
+}
+
+static void sdo_trace__write_header(FILE* file)
+{
+	struct sdo_trace_file_header header = {
+		.version = SDO_TRACE_VERSION,
+		.record_size = sizeof(struct sdo_trace_record),
+	};
+
+	memcpy(header.magic, SDO_TRACE_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, file);
+}
+
+int sdo_trace_init(const char* path)
+{
+	sdo_trace_reset();
+
+	if (path && *path) {
+		sdo_trace__file = fopen(path, "w");
+		if (!sdo_trace__file)
+			return -1;
+
+		sdo_trace__write_header(sdo_trace__file);
+	}
+
+	sdo_trace_enabled = 1;
+	return 0;
+}
+
+void sdo_trace_cleanup(void)
+{
+	sdo_trace_enabled = 0;
+
+	if (sdo_trace__file) {
+		fclose(sdo_trace__file);
+		sdo_trace__file = NULL;
+	}
+}
+
+void sdo_trace_reset(void)
+{
+	memset(sdo_trace__nodes, 0, sizeof(sdo_trace__nodes));
+	memset(sdo_trace__objs, 0, sizeof(sdo_trace__objs));
+}
+
+static inline unsigned int sdo_trace__bucket(uint64_t value)
+{
+	if (value < 2)
+		return 0;
+
+	unsigned int bucket = 63 - __builtin_clzll(value);
+	return bucket < SDO_TRACE_HIST_BUCKETS
+	     ? bucket : SDO_TRACE_HIST_BUCKETS - 1;
+}
+
+void sdo_trace_hist_add(struct sdo_trace_hist* self, uint64_t value)
+{
+	self->bucket[sdo_trace__bucket(value)]++;
+	self->count++;
+	self->sum += value;
+
+	if (value > self->max)
+		self->max = value;
+}
+
+/* The result is the upper bound of the bucket containing the percentile */
+uint64_t sdo_trace_hist_percentile(const struct sdo_trace_hist* self, double p)
+{
+	uint64_t target = p * self->count;
+	uint64_t n = 0;
+	unsigned int i;
+
+	if (self->count == 0)
+		return 0;
+
+	if (target == 0)
+		target = 1;
+
+	for (i = 0; i < SDO_TRACE_HIST_BUCKETS; ++i) {
+		n += self->bucket[i];
+		if (n >= target)
+			break;
+	}
+
+	uint64_t bound = 2ULL << i;
+	return bound < self->max ? bound : self->max;
+}
+
+static inline uint64_t sdo_trace__diff(uint64_t end, uint64_t start)
+{
+	return end > start && start != 0 ? end - start : 0;
+}
+
+void sdo_trace_record(const struct sdo_trace_record* record)
+{
+	if (!sdo_trace_enabled)
+		return;
+
+	if (record->nodeid < CANOPEN_NODEID_MIN
+	 || record->nodeid > CANOPEN_NODEID_MAX)
+		return;
+
+	struct sdo_trace_node_stats* node = &sdo_trace__nodes[record->nodeid];
+
+	uint64_t total = sdo_trace__diff(record->callback_done_time,
+					 record->enqueue_time);
+
+	sdo_trace_hist_add(&node->queue, sdo_trace__diff(record->start_time,
+							 record->enqueue_time));
+	sdo_trace_hist_add(&node->bus, sdo_trace__diff(record->done_time,
+						       record->start_time));
+	sdo_trace_hist_add(&node->callback,
+			   sdo_trace__diff(record->callback_done_time,
+					   record->done_time));
+	sdo_trace_hist_add(&node->total, total);
+
+	if (record->status != SDO_REQ_OK)
+		node->n_aborts++;
+
+	node->n_retries += record->n_retries;
+	node->bytes += record->size;
+
+	uint32_t key = sdo_trace__obj_key(record->nodeid, record->index,
+					  record->subindex);
+	struct sdo_trace_obj_stats* obj = sdo_trace__find_obj(key, 1);
+	if (obj)
+		sdo_trace_hist_add(&obj->total, total);
+
+	/* Flushed right away so that a crash doesn't take the last records with
+	 * it
+	 */
+	if (sdo_trace__file) {
+		fwrite(record, sizeof(*record), 1, sdo_trace__file);
+		fflush(sdo_trace__file);
+	}
+}
+
+const struct sdo_trace_node_stats* sdo_trace_get_node_stats(int nodeid)
+{
+	if (nodeid < CANOPEN_NODEID_MIN || nodeid > CANOPEN_NODEID_MAX)
+		return NULL;
+
+	return &sdo_trace__nodes[nodeid];
+}
+
+const struct sdo_trace_hist* sdo_trace_get_obj_hist(int nodeid, int index,
+						    int subindex)
+{
+	uint32_t key = sdo_trace__obj_key(nodeid, index, subindex);
+	struct sdo_trace_obj_stats* obj = sdo_trace__find_obj(key, 0);
+	return obj ? &obj->total : NULL;
+}
+
+static void sdo_trace__print_hist(FILE* output,
+				  const struct sdo_trace_hist* hist)
+{
+	int last = SDO_TRACE_HIST_BUCKETS - 1;
+	int i;
+
+	while (last >= 0 && hist->bucket[last] == 0)
+		--last;
+
+	fprintf(output, "{\"count\": %llu, \"mean\": %llu, \"max\": %llu, "
+		"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"buckets\": [",
+		(unsigned long long)hist->count,
+		(unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+		(unsigned long long)hist->max,
+		(unsigned long long)sdo_trace_hist_percentile(hist, 0.5),
+		(unsigned long long)sdo_trace_hist_percentile(hist, 0.9),
+		(unsigned long long)sdo_trace_hist_percentile(hist, 0.99));
+
+	for (i = 0; i <= last; ++i)
+		fprintf(output, "%s%u", i ? ", " : "", hist->bucket[i]);
+
+	fprintf(output, "]}");
+}
+
+static void sdo_trace__print_node(FILE* output,
+				  const struct sdo_trace_node_stats* node)
+{
+	fprintf(output, "\"aborts\": %llu, \"retries\": %llu, \"bytes\": %llu",
+		(unsigned long long)node->n_aborts,
+		(unsigned long long)node->n_retries,
+		(unsigned long long)node->bytes);
+
+	fprintf(output, ",\n  \"queue\": ");
+	sdo_trace__print_hist(output, &node->queue);
+	fprintf(output, ",\n  \"bus\": ");
+	sdo_trace__print_hist(output, &node->bus);
+	fprintf(output, ",\n  \"callback\": ");
+	sdo_trace__print_hist(output, &node->callback);
+	fprintf(output, ",\n  \"total\": ");
+	sdo_trace__print_hist(output, &node->total);
+}
+
+static void sdo_trace__print_summary(FILE* output)
+{
+	int is_first = 1;
+	int i;
+
+	fprintf(output, "{\n");
+
+	for (i = CANOPEN_NODEID_MIN; i <= CANOPEN_NODEID_MAX; ++i) {
+		const struct sdo_trace_node_stats* node = &sdo_trace__nodes[i];
+		if (node->total.count == 0)
+			continue;
+
+		fprintf(output, "%s \"%d\": {", is_first ? "" : ",\n", i);
+		sdo_trace__print_node(output, node);
+		fprintf(output, "}");
+		is_first = 0;
+	}
+
+	fprintf(output, "\n}\n");
+}
+
+static int sdo_trace__cmp_obj(const void* p1, const void* p2)
+{
+	uint32_t a = (*(const struct sdo_trace_obj_stats* const*)p1)->key;
+	uint32_t b = (*(const struct sdo_trace_obj_stats* const*)p2)->key;
+	return a < b ? -1 : a > b;
+}
+
+static void sdo_trace__print_objects(FILE* output, int nodeid)
+{
+	static const struct sdo_trace_obj_stats* objs[SDO_TRACE_OBJ_TABLE_SIZE];
+	size_t n_objs = 0;
+	size_t i;
+
+	for (i = 0; i < SDO_TRACE_OBJ_TABLE_SIZE; ++i)
+		if (sdo_trace__objs[i].key != 0
+		 && sdo_trace__key_nodeid(sdo_trace__objs[i].key) == nodeid)
+			objs[n_objs++] = &sdo_trace__objs[i];
+
+	qsort(objs, n_objs, sizeof(*objs), sdo_trace__cmp_obj);
+
+	for (i = 0; i < n_objs; ++i) {
+		fprintf(output, "%s  \"%#x:%#x\": ", i ? ",\n" : "\n",
+			sdo_trace__key_index(objs[i]->key),
+			sdo_trace__key_subindex(objs[i]->key));
+		sdo_trace__print_hist(output, &objs[i]->total);
+	}
+}
+
+void sdo_trace_print_json(FILE* output, int nodeid)
+{
+	const struct sdo_trace_node_stats* node;
+
+	if (nodeid == 0) {
+		sdo_trace__print_summary(output);
+		return;
+	}
+
+	node = sdo_trace_get_node_stats(nodeid);
+	if (!node)
+		return;
+
+	fprintf(output, "{\"node\": %d, ", nodeid);
+	sdo_trace__print_node(output, node);
+	fprintf(output, ",\n \"objects\": {");
+	sdo_trace__print_objects(output, nodeid);
+	fprintf(output, "\n }\n}\n");
+}
@@ -25,6 +25,7 @@
 #include "net-util.h"
 #include "can-tcp.h"
 #include "trace-buffer.h"
+#include "time-utils.h"
 
 size_t strlcpy(char* dst, const char* src, size_t size);
 
@@ -87,13 +88,26 @@ int sock_timed_send(const struct sock* sock, struct can_frame* cf, int timeout)
 }
 
 ssize_t sock_recv(const struct sock* sock, struct can_frame* cf, int flags)
+{
+	return sock_recv_traced(sock, cf, flags, NULL);
+}
+
+ssize_t sock_recv_traced(const struct sock* sock, struct can_frame* cf,
+			 int flags, uint64_t* timestamp)
 {
 	ssize_t rsize = recv(sock->fd, cf, sizeof(*cf), flags);
 	if (rsize <= 0)
 		return rsize;
 
-	if (sock->tb)
-		tb_append(sock->tb, cf);
+	if (sock->tb) {
+		uint64_t now = gettime_us(CLOCK_REALTIME);
+		tb_append_at(sock->tb, cf, now);
+
+		if (timestamp)
+			*timestamp = now;
+	} else if (timestamp) {
+		*timestamp = 0;
+	}
 
 	sock__frame_ntohl(sock, cf);
 	return rsize;
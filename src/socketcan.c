@@ -102,6 +102,12 @@ int socketcan_apply_filters(int fd, struct can_filter* filters, int n)
 			  n*sizeof(struct can_filter));
 }
 
+int socketcan_set_error_filter(int fd, can_err_mask_t mask)
+{
+	return setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &mask,
+			  sizeof(mask));
+}
+
 int socketcan_open_slave(const char* iface, int nodeid)
 {
 	struct can_filter filters[CANOPEN_SLAVE_FILTER_LENGTH];
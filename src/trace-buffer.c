@@ -24,6 +24,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static inline unsigned long clzl(unsigned long x)
 {
@@ -35,68 +39,219 @@ static inline unsigned long round_up_to_power_of_2(unsigned long x)
 	return 1UL << ((sizeof(x) << 3) - clzl(x - 1UL));
 }
 
-static inline int tb_try_block(struct tracebuffer* self)
+/* A reader only waits this long for a producer that is in the middle of
+ * writing a slot before leaving the frame out.
+ */
+#define TB_SPIN_MAX 1000
+
+static inline size_t tb__length(size_t size)
+{
+	return round_up_to_power_of_2(size / sizeof(struct tb_frame));
+}
+
+static inline size_t tb__map_size(size_t length)
 {
-	return co_atomic_cas(&self->is_blocked, 0, 1);
+	return sizeof(struct tb_file_header) + length * sizeof(struct tb_slot);
 }
 
-static inline void tb_unblock(struct tracebuffer* self)
+static void tb__init_header(struct tb_file_header* header, size_t length)
 {
-	co_atomic_store(&self->is_blocked, 0);
+	memcpy(header->magic, TB_FILE_MAGIC, sizeof(header->magic));
+	header->version = TB_FILE_VERSION;
+	header->slot_size = sizeof(struct tb_slot);
+	header->length = length;
 }
 
-static inline int tb_is_blocked(const struct tracebuffer* self)
+static void tb__attach(struct tracebuffer* self, void* mem, size_t length)
 {
-	return co_atomic_load(&self->is_blocked);
+	self->length = length;
+	self->header = mem;
+	self->slots = (struct tb_slot*)(self->header + 1);
 }
 
 int tb_init(struct tracebuffer* self, size_t size)
 {
 	memset(self, 0, sizeof(*self));
 
-	self->length = round_up_to_power_of_2(size / sizeof(self->data[0]));
-	self->data = malloc(self->length * sizeof(self->data[0]));
+	size_t length = tb__length(size);
+
+	void* mem = calloc(1, tb__map_size(length));
+	if (!mem)
+		return -1;
+
+	tb__attach(self, mem, length);
+	tb__init_header(self->header, length);
+
+	return 0;
+}
+
+static void* tb__map_file(int fd, size_t size, int prot)
+{
+	void* mem = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	return mem != MAP_FAILED ? mem : NULL;
+}
+
+int tb_init_file(struct tracebuffer* self, const char* path, size_t size)
+{
+	char prev_path[256];
+
+	memset(self, 0, sizeof(*self));
+
+	size_t length = tb__length(size);
+	size_t map_size = tb__map_size(length);
+
+	snprintf(prev_path, sizeof(prev_path), "%s.prev", path);
+	if (rename(path, prev_path) < 0 && errno != ENOENT)
+		return -1;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	if (ftruncate(fd, map_size) < 0)
+		goto failure;
+
+	void* mem = tb__map_file(fd, map_size, PROT_READ | PROT_WRITE);
+	if (!mem)
+		goto failure;
+
+	close(fd);
+
+	tb__attach(self, mem, length);
+	self->map_size = map_size;
+	tb__init_header(self->header, length);
+
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+static int tb__is_valid_header(const struct tb_file_header* header,
+			       size_t file_size)
+{
+	return memcmp(header->magic, TB_FILE_MAGIC, sizeof(header->magic)) == 0
+	    && header->version == TB_FILE_VERSION
+	    && header->slot_size == sizeof(struct tb_slot)
+	    && header->length > 0
+	    && (header->length & (header->length - 1)) == 0
+	    && tb__map_size(header->length) <= file_size;
+}
+
+int tb_open_file(struct tracebuffer* self, const char* path)
+{
+	struct stat st;
+
+	memset(self, 0, sizeof(*self));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto failure;
+
+	if ((size_t)st.st_size < sizeof(struct tb_file_header)) {
+		errno = EINVAL;
+		goto failure;
+	}
 
-	return self->data ? 0 : -1;
+	void* mem = tb__map_file(fd, st.st_size, PROT_READ);
+	if (!mem)
+		goto failure;
+
+	close(fd);
+
+	if (!tb__is_valid_header(mem, st.st_size)) {
+		munmap(mem, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	tb__attach(self, mem, ((struct tb_file_header*)mem)->length);
+	self->map_size = st.st_size;
+
+	return 0;
+
+failure:
+	close(fd);
+	return -1;
 }
 
 void tb_destroy(struct tracebuffer* self)
 {
-	free(self->data);
+	if (self->map_size)
+		munmap(self->header, self->map_size);
+	else
+		free(self->header);
 }
 
 void tb_append(struct tracebuffer* self, const struct can_frame* frame)
 {
-	if (tb_is_blocked(self))
-		return;
+	tb_append_at(self, frame, gettime_us(CLOCK_REALTIME));
+}
 
-	struct tb_frame tb_frame = {
-		.timestamp = gettime_us(CLOCK_REALTIME),
-		.cf = *frame,
-	};
+void tb_append_at(struct tracebuffer* self, const struct can_frame* frame,
+		  uint64_t timestamp)
+{
+	unsigned long pos = co_atomic_add_fetch(&self->header->head, 1) - 1;
+	struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+
+	co_atomic_store(&slot->seq, pos * 2 + 1);
+	co_atomic_fence();
 
-	self->data[self->index++] = tb_frame;
-	self->index &= (self->length - 1);
+	slot->frame.timestamp = timestamp;
+	slot->frame.cf = *frame;
 
-	if (self->count < self->length)
-		self->count++;
+	co_atomic_store(&slot->seq, pos * 2 + 2);
 }
 
-void tb_dump(struct tracebuffer* self, FILE* stream)
+static int tb__read_slot(struct tracebuffer* self, unsigned long pos,
+			 struct tb_frame* dst)
 {
-	if (!tb_try_block(self))
-		return;
+	struct tb_slot* slot = &self->slots[pos & (self->length - 1)];
+	unsigned long expected = pos * 2 + 2;
+	unsigned long seq;
+	int i = 0;
 
-	if (self->count < self->length) {
-		fwrite(self->data, sizeof(self->data[0]), self->count, stream);
-	} else {
-		fwrite(&self->data[self->index], sizeof(self->data[0]),
-		       self->length - self->index, stream);
+	while ((seq = co_atomic_load(&slot->seq)) == pos * 2 + 1)
+		if (++i >= TB_SPIN_MAX)
+			return -1;
 
-		fwrite(self->data, sizeof(self->data[0]), self->index, stream);
-	}
+	if (seq != expected)
+		return -1;
+
+	*dst = slot->frame;
+	co_atomic_fence();
+
+	return co_atomic_load(&slot->seq) == expected ? 0 : -1;
+}
+
+size_t tb_snapshot(struct tracebuffer* self, struct tb_frame* dst)
+{
+	unsigned long head = co_atomic_load(&self->header->head);
+	unsigned long count = head < self->length ? head : self->length;
+	size_t n = 0;
+
+	for (unsigned long pos = head - count; pos != head; ++pos)
+		if (tb__read_slot(self, pos, &dst[n]) == 0)
+			++n;
 
-	tb_unblock(self);
+	return n;
+}
 
+int tb_dump(struct tracebuffer* self, FILE* stream)
+{
+	struct tb_frame* frames = malloc(self->length * sizeof(*frames));
+	if (!frames)
+		return -1;
+
+	size_t n = tb_snapshot(self, frames);
+	size_t written = fwrite(frames, sizeof(*frames), n, stream);
+
+	free(frames);
 	fflush(stream);
+
+	return written == n ? 0 : -1;
 }
@@ -0,0 +1,184 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Conversion between trace file formats
+ *
+ * Frames are read from a trace buffer dump, a trace ring file, a compact trace
+ * file or a candump log and written out in any of these formats except the
+ * ring, which only the master writes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "socketcan.h"
+#include "trace-buffer.h"
+#include "trace-file.h"
+#include "trace-input.h"
+#include "canopen/trace-convert.h"
+
+#ifndef CAN_MAX_DLC
+#define CAN_MAX_DLC 8
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+struct trace_output {
+	enum co_trace_format format;
+	FILE* stream;
+	struct tf_writer writer;
+	const char* iface;
+};
+
+__attribute__((visibility("default")))
+enum co_trace_format co_trace_format_from_string(const char* str)
+{
+	if (strcmp(str, "buffer") == 0)
+		return CO_TRACE_FORMAT_BUFFER;
+
+	if (strcmp(str, "ring") == 0)
+		return CO_TRACE_FORMAT_RING;
+
+	if (strcmp(str, "compact") == 0)
+		return CO_TRACE_FORMAT_COMPACT;
+
+	if (strcmp(str, "candump") == 0)
+		return CO_TRACE_FORMAT_CANDUMP;
+
+	return CO_TRACE_FORMAT_AUTO;
+}
+
+static int trace_output_open(struct trace_output* self, const char* path,
+			     enum co_trace_format format, const char* iface)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->format = format ? format : CO_TRACE_FORMAT_COMPACT;
+	self->iface = iface ? iface : "can0";
+
+	if (self->format == CO_TRACE_FORMAT_RING)
+		return -1;
+
+	self->stream = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if (!self->stream)
+		return -1;
+
+	if (self->format == CO_TRACE_FORMAT_COMPACT
+	 && tf_writer_init(&self->writer, self->stream, TF_COMPRESS_LZ4) < 0) {
+		if (self->stream != stdout)
+			fclose(self->stream);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int trace_output_close(struct trace_output* self)
+{
+	int rc = 0;
+
+	if (self->format == CO_TRACE_FORMAT_COMPACT)
+		rc = tf_writer_finish(&self->writer);
+
+	if (self->stream == stdout)
+		return fflush(stdout) == 0 ? rc : -1;
+
+	return fclose(self->stream) == 0 ? rc : -1;
+}
+
+static int write_candump(struct trace_output* self,
+			 const struct tb_frame* frame)
+{
+	const struct can_frame* cf = &frame->cf;
+
+	fprintf(self->stream, "(%" PRIu64 ".%06" PRIu64 ") %s ",
+		frame->timestamp / 1000000, frame->timestamp % 1000000,
+		self->iface);
+
+	if (cf->can_id & CAN_EFF_FLAG)
+		fprintf(self->stream, "%08X#", cf->can_id & CAN_EFF_MASK);
+	else
+		fprintf(self->stream, "%03X#", cf->can_id & CAN_SFF_MASK);
+
+	if (cf->can_id & CAN_RTR_FLAG) {
+		fprintf(self->stream, "R\n");
+		return 0;
+	}
+
+	for (int i = 0; i < MIN(cf->can_dlc, CAN_MAX_DLC); ++i)
+		fprintf(self->stream, "%02X", cf->data[i]);
+
+	return fprintf(self->stream, "\n") < 0 ? -1 : 0;
+}
+
+static int trace_output_write(struct trace_output* self,
+			      const struct tb_frame* frame)
+{
+	switch (self->format) {
+	case CO_TRACE_FORMAT_BUFFER:
+		return fwrite(frame, sizeof(*frame), 1, self->stream) == 1
+		     ? 0 : -1;
+	case CO_TRACE_FORMAT_COMPACT:
+		return tf_writer_add(&self->writer, frame);
+	case CO_TRACE_FORMAT_CANDUMP:
+		return write_candump(self, frame);
+	default:
+		break;
+	}
+
+	return -1;
+}
+
+static inline int is_in_range(const struct tb_frame* frame,
+			      const struct co_trace_convert_options* options)
+{
+	return frame->timestamp >= options->begin
+	    && (options->end == 0 || frame->timestamp <= options->end);
+}
+
+__attribute__((visibility("default")))
+int co_trace_convert(const char* input, const char* output,
+		     const struct co_trace_convert_options* options)
+{
+	struct trace_input in;
+	struct trace_output out;
+	struct tb_frame frame;
+	int rc;
+
+	if (trace_input_open(&in, input, options->input_format,
+			     options->begin) < 0)
+		return -1;
+
+	if (trace_output_open(&out, output, options->output_format,
+			      options->iface) < 0) {
+		trace_input_close(&in);
+		return -1;
+	}
+
+	while ((rc = trace_input_next(&in, &frame)) > 0)
+		if (is_in_range(&frame, options)
+		 && trace_output_write(&out, &frame) < 0) {
+			rc = -1;
+			break;
+		}
+
+	if (trace_output_close(&out) < 0)
+		rc = -1;
+
+	trace_input_close(&in);
+	return rc;
+}
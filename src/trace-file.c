@@ -0,0 +1,458 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace-file.h"
+#include "lz4-block.h"
+
+#ifndef CAN_MAX_DLC
+#define CAN_MAX_DLC 8
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* The longest encoding of a 64 bit varint */
+#define TF_MAX_VARINT_SIZE 10
+
+/* Anything larger than this is not something that tf_writer produced */
+#define TF_MAX_RAW_SIZE (16 * 1024 * 1024)
+
+static inline uint64_t tf__zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t tf__unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static size_t tf__put_varint(uint8_t* dst, uint64_t value)
+{
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		dst[n++] = value | 0x80;
+		value >>= 7;
+	}
+
+	dst[n++] = value;
+	return n;
+}
+
+static const uint8_t* tf__get_varint(const uint8_t* src, const uint8_t* end,
+				     uint64_t* value)
+{
+	unsigned int shift = 0;
+
+	*value = 0;
+
+	while (src < end && shift < 64) {
+		uint8_t byte = *src++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+
+		if (!(byte & 0x80))
+			return src;
+
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+int tf_writer_init(struct tf_writer* self, FILE* stream, int flags)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->stream = stream;
+	self->flags = flags;
+
+	if (vector_init(&self->block, TF_BLOCK_SIZE + 64) < 0)
+		goto block_failure;
+
+	if (vector_init(&self->buffer, lz4_block_bound(TF_BLOCK_SIZE + 64)) < 0)
+		goto buffer_failure;
+
+	if (vector_init(&self->index, 64 * sizeof(struct tf_index_entry)) < 0)
+		goto index_failure;
+
+	struct tf_file_header header = {
+		.version = TF_FILE_VERSION,
+		.flags = flags,
+	};
+
+	memcpy(header.magic, TF_FILE_MAGIC, sizeof(header.magic));
+
+	if (fwrite(&header, sizeof(header), 1, stream) != 1)
+		goto write_failure;
+
+	self->offset = sizeof(header);
+	return 0;
+
+write_failure:
+	vector_destroy(&self->index);
+index_failure:
+	vector_destroy(&self->buffer);
+buffer_failure:
+	vector_destroy(&self->block);
+block_failure:
+	return -1;
+}
+
+static int tf__flush_block(struct tf_writer* self)
+{
+	if (self->n_frames == 0)
+		return 0;
+
+	/* The block starts with room for the first timestamp, which is relative
+	 * to min_timestamp and so is only known now.
+	 */
+	uint8_t first[TF_MAX_VARINT_SIZE];
+	size_t first_size = tf__put_varint(first,
+			tf__zigzag(self->first_timestamp - self->min_timestamp));
+
+	uint8_t* raw = (uint8_t*)self->block.data
+		     + TF_MAX_VARINT_SIZE - first_size;
+	size_t raw_size = self->block.index - (TF_MAX_VARINT_SIZE - first_size);
+
+	memcpy(raw, first, first_size);
+
+	struct tf_block_header header = {
+		.magic = TF_BLOCK_MAGIC,
+		.raw_size = raw_size,
+		.stored_size = raw_size,
+		.n_frames = self->n_frames,
+		.min_timestamp = self->min_timestamp,
+		.max_timestamp = self->max_timestamp,
+	};
+
+	const void* payload = raw;
+
+	/* Blocks that do not shrink are stored as they are */
+	if (self->flags & TF_COMPRESS_LZ4) {
+		int size = lz4_block_compress(self->buffer.data,
+					      self->buffer.size, raw, raw_size);
+		if (size > 0 && (size_t)size < raw_size) {
+			header.flags |= TF_COMPRESS_LZ4;
+			header.stored_size = size;
+			payload = self->buffer.data;
+		}
+	}
+
+	struct tf_index_entry entry = {
+		.offset = self->offset,
+		.min_timestamp = self->min_timestamp,
+		.max_timestamp = self->max_timestamp,
+		.n_frames = self->n_frames,
+	};
+
+	if (vector_append(&self->index, &entry, sizeof(entry)) < 0)
+		return -1;
+
+	if (fwrite(&header, sizeof(header), 1, self->stream) != 1
+	 || fwrite(payload, header.stored_size, 1, self->stream) != 1)
+		return -1;
+
+	self->offset += sizeof(header) + header.stored_size;
+
+	vector_clear(&self->block);
+	self->n_frames = 0;
+	return 0;
+}
+
+int tf_writer_add(struct tf_writer* self, const struct tb_frame* frame)
+{
+	uint8_t data[32];
+	size_t n = 0;
+
+	if (self->n_frames == 0) {
+		self->first_timestamp = frame->timestamp;
+		self->min_timestamp = frame->timestamp;
+		self->max_timestamp = frame->timestamp;
+
+		memset(data, 0, TF_MAX_VARINT_SIZE);
+		if (vector_append(&self->block, data, TF_MAX_VARINT_SIZE) < 0)
+			return -1;
+	} else {
+		n += tf__put_varint(&data[n], tf__zigzag(frame->timestamp
+							 - self->timestamp));
+	}
+
+	n += tf__put_varint(&data[n], frame->cf.can_id);
+	data[n++] = frame->cf.can_dlc;
+
+	size_t dlc = MIN(frame->cf.can_dlc, CAN_MAX_DLC);
+	memcpy(&data[n], frame->cf.data, dlc);
+	n += dlc;
+
+	if (vector_append(&self->block, data, n) < 0)
+		return -1;
+
+	self->timestamp = frame->timestamp;
+	self->n_frames++;
+
+	if (frame->timestamp < self->min_timestamp)
+		self->min_timestamp = frame->timestamp;
+
+	if (frame->timestamp > self->max_timestamp)
+		self->max_timestamp = frame->timestamp;
+
+	return self->block.index >= TF_BLOCK_SIZE ? tf__flush_block(self) : 0;
+}
+
+int tf_writer_finish(struct tf_writer* self)
+{
+	int rc = -1;
+
+	if (tf__flush_block(self) < 0)
+		goto done;
+
+	struct tf_file_trailer trailer = {
+		.index_offset = self->offset,
+		.n_blocks = self->index.index / sizeof(struct tf_index_entry),
+	};
+
+	memcpy(trailer.magic, TF_TRAILER_MAGIC, sizeof(trailer.magic));
+
+	if (self->index.index > 0
+	 && fwrite(self->index.data, self->index.index, 1, self->stream) != 1)
+		goto done;
+
+	if (fwrite(&trailer, sizeof(trailer), 1, self->stream) != 1)
+		goto done;
+
+	rc = fflush(self->stream) == 0 ? 0 : -1;
+
+done:
+	vector_destroy(&self->index);
+	vector_destroy(&self->buffer);
+	vector_destroy(&self->block);
+	return rc;
+}
+
+int tf_write_frames(FILE* stream, const struct tb_frame* frames, size_t n,
+		    int flags)
+{
+	struct tf_writer writer;
+
+	if (tf_writer_init(&writer, stream, flags) < 0)
+		return -1;
+
+	for (size_t i = 0; i < n; ++i)
+		if (tf_writer_add(&writer, &frames[i]) < 0) {
+			tf_writer_finish(&writer);
+			return -1;
+		}
+
+	return tf_writer_finish(&writer);
+}
+
+/* The index is an optimisation, so any failure here just leaves it out */
+static void tf__load_index(struct tf_reader* self)
+{
+	struct tf_file_trailer trailer;
+
+	if (fseek(self->stream, -(long)sizeof(trailer), SEEK_END) < 0)
+		return;
+
+	if (fread(&trailer, sizeof(trailer), 1, self->stream) != 1
+	 || memcmp(trailer.magic, TF_TRAILER_MAGIC, sizeof(trailer.magic)) != 0)
+		goto done;
+
+	size_t size = trailer.n_blocks * sizeof(struct tf_index_entry);
+
+	struct tf_index_entry* index = malloc(size ? size : 1);
+	if (!index)
+		goto done;
+
+	if (fseek(self->stream, trailer.index_offset, SEEK_SET) < 0
+	 || (size && fread(index, size, 1, self->stream) != 1)) {
+		free(index);
+		goto done;
+	}
+
+	self->index = index;
+	self->n_blocks = trailer.n_blocks;
+
+done:
+	clearerr(self->stream);
+	fseek(self->stream, sizeof(struct tf_file_header), SEEK_SET);
+}
+
+int tf_reader_init(struct tf_reader* self, FILE* stream)
+{
+	struct tf_file_header header;
+
+	memset(self, 0, sizeof(*self));
+	self->stream = stream;
+
+	if (fread(&header, sizeof(header), 1, stream) != 1
+	 || !tf_is_trace_file(header.magic)
+	 || header.version != TF_FILE_VERSION)
+		return -1;
+
+	if (vector_init(&self->block, TF_BLOCK_SIZE + 64) < 0)
+		goto block_failure;
+
+	if (vector_init(&self->buffer, lz4_block_bound(TF_BLOCK_SIZE + 64)) < 0)
+		goto buffer_failure;
+
+	tf__load_index(self);
+	return 0;
+
+buffer_failure:
+	vector_destroy(&self->block);
+block_failure:
+	return -1;
+}
+
+void tf_reader_destroy(struct tf_reader* self)
+{
+	free(self->index);
+	vector_destroy(&self->buffer);
+	vector_destroy(&self->block);
+}
+
+int tf_reader_seek(struct tf_reader* self, uint64_t timestamp)
+{
+	self->begin = timestamp;
+	self->n_left = 0;
+
+	/* Without an index, tf__read_block() skips blocks by their headers */
+	if (!self->index)
+		return fseek(self->stream, sizeof(struct tf_file_header),
+			     SEEK_SET);
+
+	for (uint32_t i = 0; i < self->n_blocks; ++i)
+		if (self->index[i].max_timestamp >= timestamp)
+			return fseek(self->stream, self->index[i].offset,
+				     SEEK_SET);
+
+	return fseek(self->stream, 0, SEEK_END);
+}
+
+static int tf__read_payload(struct tf_reader* self,
+			    const struct tf_block_header* header)
+{
+	if (!(header->flags & TF_COMPRESS_LZ4)) {
+		if (vector_reserve(&self->block, header->raw_size) < 0
+		 || fread(self->block.data, header->raw_size, 1,
+			  self->stream) != 1)
+			return -1;
+
+		self->block.index = header->raw_size;
+		return 0;
+	}
+
+	if (vector_reserve(&self->buffer, header->stored_size) < 0
+	 || vector_reserve(&self->block, header->raw_size) < 0)
+		return -1;
+
+	if (fread(self->buffer.data, header->stored_size, 1, self->stream) != 1)
+		return -1;
+
+	int size = lz4_block_decompress(self->block.data, header->raw_size,
+					self->buffer.data, header->stored_size);
+	if (size != (int)header->raw_size)
+		return -1;
+
+	self->block.index = size;
+	return 0;
+}
+
+/* Returns 1 if a block was loaded and 0 at the end of the blocks. A block
+ * that is cut short is treated as the end of the file.
+ */
+static int tf__read_block(struct tf_reader* self)
+{
+	struct tf_block_header header;
+
+	while (1) {
+		if (fread(&header, sizeof(header), 1, self->stream) != 1
+		 || header.magic != TF_BLOCK_MAGIC)
+			return 0;
+
+		if (header.raw_size > TF_MAX_RAW_SIZE
+		 || header.stored_size > TF_MAX_RAW_SIZE)
+			return -1;
+
+		if (header.max_timestamp >= self->begin)
+			break;
+
+		if (fseek(self->stream, header.stored_size, SEEK_CUR) < 0)
+			return -1;
+	}
+
+	if (tf__read_payload(self, &header) < 0)
+		return feof(self->stream) ? 0 : -1;
+
+	self->pos = 0;
+	self->n_left = header.n_frames;
+	self->timestamp = header.min_timestamp;
+	return 1;
+}
+
+static int tf__decode_frame(struct tf_reader* self, struct tb_frame* frame)
+{
+	const uint8_t* start = self->block.data;
+	const uint8_t* ptr = start + self->pos;
+	const uint8_t* end = start + self->block.index;
+	uint64_t delta, can_id;
+
+	ptr = tf__get_varint(ptr, end, &delta);
+	if (!ptr)
+		return -1;
+
+	ptr = tf__get_varint(ptr, end, &can_id);
+	if (!ptr || ptr >= end)
+		return -1;
+
+	memset(frame, 0, sizeof(*frame));
+
+	self->timestamp += tf__unzigzag(delta);
+	frame->timestamp = self->timestamp;
+	frame->cf.can_id = can_id;
+	frame->cf.can_dlc = *ptr++;
+
+	size_t dlc = MIN(frame->cf.can_dlc, CAN_MAX_DLC);
+	if ((size_t)(end - ptr) < dlc)
+		return -1;
+
+	memcpy(frame->cf.data, ptr, dlc);
+	ptr += dlc;
+
+	self->pos = ptr - start;
+	self->n_left--;
+	return 0;
+}
+
+int tf_reader_next(struct tf_reader* self, struct tb_frame* frame)
+{
+	while (1) {
+		if (self->n_left == 0) {
+			int rc = tf__read_block(self);
+			if (rc <= 0)
+				return rc;
+		}
+
+		if (tf__decode_frame(self, frame) < 0)
+			return -1;
+
+		if (frame->timestamp >= self->begin)
+			return 1;
+	}
+}
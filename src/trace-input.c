@@ -0,0 +1,217 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "socketcan.h"
+#include "trace-input.h"
+
+#ifndef CAN_MAX_DLC
+#define CAN_MAX_DLC 8
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static enum co_trace_format detect_format(FILE* stream)
+{
+	char magic[8] = { 0 };
+
+	size_t n = fread(magic, 1, sizeof(magic), stream);
+	rewind(stream);
+
+	if (n == sizeof(magic) && memcmp(magic, TB_FILE_MAGIC, n) == 0)
+		return CO_TRACE_FORMAT_RING;
+
+	if (n == sizeof(magic) && tf_is_trace_file(magic))
+		return CO_TRACE_FORMAT_COMPACT;
+
+	if (n > 0 && magic[0] == '(')
+		return CO_TRACE_FORMAT_CANDUMP;
+
+	return CO_TRACE_FORMAT_BUFFER;
+}
+
+static int open_ring(struct trace_input* self, const char* path)
+{
+	if (tb_open_file(&self->tb, path) < 0)
+		return -1;
+
+	self->frames = malloc(self->tb.length * sizeof(*self->frames));
+	if (!self->frames) {
+		tb_destroy(&self->tb);
+		return -1;
+	}
+
+	self->n_frames = tb_snapshot(&self->tb, self->frames);
+	tb_destroy(&self->tb);
+	return 0;
+}
+
+int trace_input_open(struct trace_input* self, const char* path,
+		     enum co_trace_format format, uint64_t begin)
+{
+	memset(self, 0, sizeof(*self));
+
+	self->stream = fopen(path, "r");
+	if (!self->stream)
+		return -1;
+
+	self->format = format ? format : detect_format(self->stream);
+
+	switch (self->format) {
+	case CO_TRACE_FORMAT_RING:
+		if (open_ring(self, path) < 0)
+			goto failure;
+		break;
+	case CO_TRACE_FORMAT_COMPACT:
+		if (tf_reader_init(&self->reader, self->stream) < 0)
+			goto failure;
+		if (tf_reader_seek(&self->reader, begin) < 0) {
+			tf_reader_destroy(&self->reader);
+			goto failure;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+
+failure:
+	fclose(self->stream);
+	return -1;
+}
+
+void trace_input_close(struct trace_input* self)
+{
+	if (self->format == CO_TRACE_FORMAT_COMPACT)
+		tf_reader_destroy(&self->reader);
+
+	free(self->frames);
+	free(self->line);
+	fclose(self->stream);
+}
+
+static int parse_hex_byte(const char* str, uint8_t* byte)
+{
+	if (!isxdigit(str[0]) || !isxdigit(str[1]))
+		return -1;
+
+	char hex[3] = { str[0], str[1], '\0' };
+	*byte = strtoul(hex, NULL, 16);
+	return 0;
+}
+
+/* Parses "(<sec>.<usec>) <iface> <id>#<data>" as written by candump -l */
+static int parse_candump_line(const char* line, struct tb_frame* frame)
+{
+	char* end;
+
+	memset(frame, 0, sizeof(*frame));
+
+	if (*line++ != '(')
+		return -1;
+
+	uint64_t sec = strtoull(line, &end, 10);
+	if (*end != '.')
+		return -1;
+
+	line = end + 1;
+	uint64_t usec = strtoull(line, &end, 10);
+	size_t n_digits = end - line;
+	if (*end != ')' || n_digits == 0)
+		return -1;
+
+	for (; n_digits < 6; ++n_digits)
+		usec *= 10;
+	for (; n_digits > 6; --n_digits)
+		usec /= 10;
+
+	frame->timestamp = sec * 1000000ULL + usec;
+
+	/* Skip the interface name */
+	line = end + 1;
+	while (isspace(*line))
+		++line;
+	while (*line && !isspace(*line))
+		++line;
+	while (isspace(*line))
+		++line;
+
+	const char* id = line;
+	uint32_t can_id = strtoul(id, &end, 16);
+	if (*end != '#' || end == id)
+		return -1;
+
+	frame->cf.can_id = end - id > 3 ? (can_id & CAN_EFF_MASK) | CAN_EFF_FLAG
+					: can_id & CAN_SFF_MASK;
+	line = end + 1;
+
+	/* CAN FD frames are not supported by the trace formats */
+	if (*line == '#')
+		return -1;
+
+	if (*line == 'R') {
+		frame->cf.can_id |= CAN_RTR_FLAG;
+		if (isdigit(line[1]))
+			frame->cf.can_dlc = MIN(line[1] - '0', CAN_MAX_DLC);
+		return 0;
+	}
+
+	while (frame->cf.can_dlc < CAN_MAX_DLC && isxdigit(*line)) {
+		if (parse_hex_byte(line, &frame->cf.data[frame->cf.can_dlc]) < 0)
+			return -1;
+
+		frame->cf.can_dlc++;
+		line += 2;
+	}
+
+	return 0;
+}
+
+static int read_candump(struct trace_input* self, struct tb_frame* frame)
+{
+	while (getline(&self->line, &self->line_size, self->stream) >= 0)
+		if (parse_candump_line(self->line, frame) == 0)
+			return 1;
+
+	return ferror(self->stream) ? -1 : 0;
+}
+
+int trace_input_next(struct trace_input* self, struct tb_frame* frame)
+{
+	switch (self->format) {
+	case CO_TRACE_FORMAT_BUFFER:
+		if (fread(frame, sizeof(*frame), 1, self->stream) == 1)
+			return 1;
+		return ferror(self->stream) ? -1 : 0;
+	case CO_TRACE_FORMAT_RING:
+		if (self->pos >= self->n_frames)
+			return 0;
+		*frame = self->frames[self->pos++];
+		return 1;
+	case CO_TRACE_FORMAT_COMPACT:
+		return tf_reader_next(&self->reader, frame);
+	case CO_TRACE_FORMAT_CANDUMP:
+		return read_candump(self, frame);
+	default:
+		break;
+	}
+
+	return -1;
+}
@@ -0,0 +1,770 @@
+/* Copyright (c) 2014-2018, Marel
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Trace subscriptions
+ *
+ * Frames are filtered for each subscriber on the main loop as they arrive and
+ * collected into a batch. A full batch is framed into the subscriber's queue
+ * and sent right away, and a periodic timer does the same for partial
+ * batches. Sending never blocks: whatever the socket does not take stays in
+ * the queue, and a batch that does not fit into the queue is dropped and
+ * counted in the next one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <mloop.h>
+
+#include "sys/queue.h"
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/trace-sub.h"
+#include "can-tcp.h"
+#include "net-util.h"
+#include "time-utils.h"
+#include "plog.h"
+
+size_t strlcpy(char*, const char*, size_t);
+
+struct trace_sub_client {
+	int fd;
+	int is_subscribed;
+	int is_dead;
+
+	struct trace_sub_filter filter;
+	uint16_t n_seen[TRACE_SUB_N_COBS];
+	uint64_t last_time[TRACE_SUB_N_COBS];
+	uint16_t sdo_index[CANOPEN_NODEID_MAX + 1];
+
+	unsigned int batch_size;
+	unsigned int n_records;
+	struct trace_sub_record batch[TRACE_SUB_BATCH_MAX];
+
+	uint32_t seq;
+	uint32_t n_dropped; /* Since the last batch */
+
+	char* queue;
+	size_t queue_size;
+	size_t queue_start;
+	size_t queue_end;
+
+	struct trace_sub_stats stats;
+
+	/* Used by the service */
+	struct mloop_socket* socket;
+	char line[TRACE_SUB_LINE_MAX];
+	size_t line_length;
+	LIST_ENTRY(trace_sub_client) links;
+};
+
+LIST_HEAD(trace_sub_list, trace_sub_client);
+
+static struct trace_sub_list trace_sub__clients =
+	LIST_HEAD_INITIALIZER(trace_sub__clients);
+static struct trace_sub_config trace_sub__config;
+static struct mloop_socket* trace_sub__server = NULL;
+static struct mloop_timer* trace_sub__timer = NULL;
+
+static int trace_sub__parse_range(uint16_t* min, uint16_t* max,
+				  const char* arg)
+{
+	char* end;
+
+	unsigned long first = strtoul(arg, &end, 0);
+	unsigned long last = first;
+
+	if (end == arg)
+		return -1;
+
+	if (*end == '-') {
+		arg = end + 1;
+		last = strtoul(arg, &end, 0);
+		if (end == arg)
+			return -1;
+	}
+
+	if (*end != '\0' || first > last || last > UINT16_MAX)
+		return -1;
+
+	*min = first;
+	*max = last;
+	return 0;
+}
+
+/* Parses "[<cob-id>:]<value>". cob is -1 if no COB-ID is given. */
+static int trace_sub__parse_cob_value(int* cob, unsigned long* value,
+				      const char* arg)
+{
+	char* end;
+
+	unsigned long n = strtoul(arg, &end, 0);
+	if (end == arg)
+		return -1;
+
+	*cob = -1;
+
+	if (*end == ':') {
+		if (n >= TRACE_SUB_N_COBS)
+			return -1;
+
+		*cob = n;
+		arg = end + 1;
+		n = strtoul(arg, &end, 0);
+		if (end == arg)
+			return -1;
+	}
+
+	if (*end != '\0')
+		return -1;
+
+	*value = n;
+	return 0;
+}
+
+static int trace_sub__parse_decimation(struct trace_sub_filter* filter,
+				       const char* arg)
+{
+	unsigned long n;
+	int cob;
+
+	if (trace_sub__parse_cob_value(&cob, &n, arg) < 0 || n > UINT16_MAX)
+		return -1;
+
+	if (cob >= 0) {
+		filter->decimation[cob] = n;
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < TRACE_SUB_N_COBS; ++i)
+		filter->decimation[i] = n;
+
+	return 0;
+}
+
+static int trace_sub__parse_interval(struct trace_sub_filter* filter,
+				     const char* arg)
+{
+	unsigned long ms;
+	int cob;
+
+	if (trace_sub__parse_cob_value(&cob, &ms, arg) < 0
+	 || ms > UINT32_MAX / 1000)
+		return -1;
+
+	if (cob >= 0) {
+		filter->min_interval[cob] = ms * 1000;
+		return 0;
+	}
+
+	for (unsigned int i = 0; i < TRACE_SUB_N_COBS; ++i)
+		filter->min_interval[i] = ms * 1000;
+
+	return 0;
+}
+
+static int trace_sub__parse_option(struct trace_sub_filter* filter,
+				   const char* key, const char* value)
+{
+	if (strcmp(key, "nodes") == 0)
+		return canopen_parse_nodes(&filter->nodes, value);
+
+	if (strcmp(key, "objects") == 0)
+		return canopen_parse_objects(&filter->objects, value);
+
+	if (strcmp(key, "index") == 0)
+		return trace_sub__parse_range(&filter->index_min,
+					      &filter->index_max, value);
+
+	if (strcmp(key, "decimate") == 0)
+		return trace_sub__parse_decimation(filter, value);
+
+	if (strcmp(key, "interval") == 0)
+		return trace_sub__parse_interval(filter, value);
+
+	return -1;
+}
+
+int trace_sub_filter_parse(struct trace_sub_filter* filter, const char* line)
+{
+	static const char space[] = " \t\r\n";
+	char option[TRACE_SUB_LINE_MAX];
+
+	memset(filter, 0, sizeof(*filter));
+	filter->index_max = UINT16_MAX;
+
+	while (1) {
+		line += strspn(line, space);
+
+		size_t len = strcspn(line, space);
+		if (len == 0)
+			break;
+
+		if (len >= sizeof(option))
+			return -1;
+
+		memcpy(option, line, len);
+		option[len] = '\0';
+		line += len;
+
+		char* value = strchr(option, '=');
+		if (!value)
+			return -1;
+
+		*value++ = '\0';
+
+		if (trace_sub__parse_option(filter, option, value) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+struct trace_sub_client*
+trace_sub_client_new(int fd, const struct trace_sub_config* config)
+{
+	struct trace_sub_client* self = malloc(sizeof(*self));
+	if (!self)
+		return NULL;
+
+	memset(self, 0, sizeof(*self));
+
+	self->batch_size = config->batch_size;
+	if (self->batch_size == 0 || self->batch_size > TRACE_SUB_BATCH_MAX)
+		self->batch_size = TRACE_SUB_BATCH_MAX;
+
+	/* There must at least be room for one full batch */
+	size_t min_size = sizeof(struct trace_sub_header)
+			+ self->batch_size * sizeof(struct trace_sub_record);
+
+	self->queue_size = config->queue_size > min_size
+			 ? config->queue_size : min_size;
+
+	self->queue = malloc(self->queue_size);
+	if (!self->queue)
+		goto failure;
+
+	self->fd = fd;
+	return self;
+
+failure:
+	free(self);
+	return NULL;
+}
+
+void trace_sub_client_free(struct trace_sub_client* self)
+{
+	if (self->fd >= 0)
+		close(self->fd);
+
+	free(self->queue);
+	free(self);
+}
+
+const struct trace_sub_stats*
+trace_sub_client_get_stats(const struct trace_sub_client* self)
+{
+	return &self->stats;
+}
+
+static void trace_sub__compact_queue(struct trace_sub_client* self)
+{
+	size_t length = self->queue_end - self->queue_start;
+
+	memmove(self->queue, self->queue + self->queue_start, length);
+	self->queue_start = 0;
+	self->queue_end = length;
+}
+
+static void trace_sub__close_batch(struct trace_sub_client* self)
+{
+	struct trace_sub_header header;
+
+	if (self->n_records == 0 && self->n_dropped == 0)
+		return;
+
+	size_t records_size = self->n_records * sizeof(struct trace_sub_record);
+	size_t size = sizeof(header) + records_size;
+
+	if (self->queue_size - self->queue_end < size)
+		trace_sub__compact_queue(self);
+
+	if (self->queue_size - self->queue_end < size) {
+		self->n_dropped += self->n_records;
+		self->stats.n_dropped += self->n_records;
+		self->n_records = 0;
+		return;
+	}
+
+	memcpy(header.magic, TRACE_SUB_MAGIC, sizeof(header.magic));
+	header.version = htons(TRACE_SUB_VERSION);
+	header.n_records = htons(self->n_records);
+	header.seq = htonl(self->seq++);
+	header.n_dropped = htonl(self->n_dropped);
+
+	char* dst = self->queue + self->queue_end;
+	memcpy(dst, &header, sizeof(header));
+	memcpy(dst + sizeof(header), self->batch, records_size);
+	self->queue_end += size;
+
+	self->n_records = 0;
+	self->n_dropped = 0;
+	self->stats.n_batches++;
+}
+
+static int trace_sub__send_queue(struct trace_sub_client* self)
+{
+	while (self->queue_start < self->queue_end) {
+		ssize_t wsize = send(self->fd, self->queue + self->queue_start,
+				     self->queue_end - self->queue_start,
+				     MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (wsize < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK
+			    || errno == EINTR ? 0 : -1;
+
+		self->queue_start += wsize;
+	}
+
+	self->queue_start = 0;
+	self->queue_end = 0;
+	return 0;
+}
+
+int trace_sub_client_flush(struct trace_sub_client* self)
+{
+	if (self->is_dead)
+		return -1;
+
+	trace_sub__close_batch(self);
+
+	if (trace_sub__send_queue(self) < 0) {
+		self->is_dead = 1;
+		return -1;
+	}
+
+	return 0;
+}
+
+int trace_sub_client_subscribe(struct trace_sub_client* self,
+			       const char* line)
+{
+	trace_sub__close_batch(self);
+
+	self->is_subscribed = 0;
+
+	if (trace_sub_filter_parse(&self->filter, line) < 0)
+		return -1;
+
+	memset(self->n_seen, 0, sizeof(self->n_seen));
+	memset(self->last_time, 0, sizeof(self->last_time));
+
+	self->is_subscribed = 1;
+	return 0;
+}
+
+/* Only initiate and abort frames carry the index, so the other frames of a
+ * transfer are taken to belong to the last one that did.
+ */
+static int trace_sub__has_sdo_index(const struct canopen_msg* msg,
+				    const struct can_frame* cf)
+{
+	if (cf->can_dlc < 4)
+		return 0;
+
+	int cs = sdo_get_cs(cf);
+
+	if (msg->object == CANOPEN_RSDO)
+		return cs == SDO_CCS_DL_INIT_REQ || cs == SDO_CCS_UL_INIT_REQ
+		    || cs == SDO_CCS_ABORT;
+
+	return cs == SDO_SCS_UL_INIT_RES || cs == SDO_SCS_DL_INIT_RES
+	    || cs == SDO_SCS_ABORT;
+}
+
+static int trace_sub__is_wanted(struct trace_sub_client* self,
+				uint64_t timestamp, const struct can_frame* cf)
+{
+	const struct trace_sub_filter* filter = &self->filter;
+	struct canopen_msg msg;
+
+	if (cf->can_id & (CAN_EFF_FLAG | CAN_ERR_FLAG)
+	 || canopen_get_object_type(&msg, cf) < 0)
+		return filter->objects == 0
+		    && co_nodeset_is_empty(&filter->nodes);
+
+	int is_sdo = msg.object & (CANOPEN_TSDO | CANOPEN_RSDO);
+
+	if (is_sdo && trace_sub__has_sdo_index(&msg, cf))
+		self->sdo_index[msg.id] = sdo_get_index(cf);
+
+	if (filter->objects && !(msg.object & filter->objects))
+		return 0;
+
+	if (msg.id != 0 && !co_nodeset_is_empty(&filter->nodes)
+	 && !co_nodeset_has(&filter->nodes, msg.id))
+		return 0;
+
+	if (is_sdo && (self->sdo_index[msg.id] < filter->index_min
+		    || self->sdo_index[msg.id] > filter->index_max))
+		return 0;
+
+	uint32_t cob = cf->can_id & CAN_SFF_MASK;
+
+	unsigned int decimation = filter->decimation[cob];
+	if (decimation > 1) {
+		unsigned int n_seen = self->n_seen[cob];
+		self->n_seen[cob] = n_seen + 1 < decimation ? n_seen + 1 : 0;
+		if (n_seen != 0)
+			return 0;
+	}
+
+	uint32_t interval = filter->min_interval[cob];
+	if (interval) {
+		if (self->last_time[cob] != 0
+		 && timestamp < self->last_time[cob] + interval)
+			return 0;
+
+		self->last_time[cob] = timestamp;
+	}
+
+	return 1;
+}
+
+void trace_sub_client_feed(struct trace_sub_client* self, uint64_t timestamp,
+			   const struct can_frame* cf)
+{
+	if (!self->is_subscribed || self->is_dead)
+		return;
+
+	if (!trace_sub__is_wanted(self, timestamp, cf)) {
+		self->stats.n_filtered++;
+		return;
+	}
+
+	struct trace_sub_record* record = &self->batch[self->n_records++];
+
+	memset(record, 0, sizeof(*record));
+	record->timestamp = htobe64(timestamp);
+	record->can_id = htonl(cf->can_id);
+	record->can_dlc = cf->can_dlc;
+	memcpy(record->data, cf->data, sizeof(record->data));
+
+	self->stats.n_frames++;
+
+	if (self->n_records >= self->batch_size)
+		trace_sub_client_flush(self);
+}
+
+static void trace_sub__free_client(void* ptr)
+{
+	struct trace_sub_client* client = ptr;
+	const struct trace_sub_stats* stats = &client->stats;
+
+	plog(LOG_INFO, "trace_sub__free_client: Subscriber left after %llu frames, %llu of which were dropped",
+	     (unsigned long long)stats->n_frames,
+	     (unsigned long long)stats->n_dropped);
+
+	LIST_REMOVE(client, links);
+
+	/* The fd is closed along with the mloop socket */
+	client->fd = -1;
+	trace_sub_client_free(client);
+}
+
+static void trace_sub__on_readable(struct mloop_socket* socket)
+{
+	struct trace_sub_client* client = mloop_socket_get_context(socket);
+	char* line = client->line;
+	char* end;
+
+	ssize_t rsize = recv(client->fd, line + client->line_length,
+			     sizeof(client->line) - client->line_length - 1,
+			     MSG_DONTWAIT);
+	if (rsize < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+			  || errno == EINTR))
+		return;
+
+	if (rsize <= 0) {
+		mloop_socket_stop(socket);
+		return;
+	}
+
+	client->line_length += rsize;
+	line[client->line_length] = '\0';
+
+	while ((end = strchr(line, '\n'))) {
+		*end = '\0';
+
+		if (trace_sub_client_subscribe(client, line) < 0) {
+			plog(LOG_WARNING, "trace_sub__on_readable: Invalid subscription: \"%s\"",
+			     line);
+			mloop_socket_stop(socket);
+			return;
+		}
+
+		line = end + 1;
+	}
+
+	client->line_length = strlen(line);
+	memmove(client->line, line, client->line_length + 1);
+
+	if (client->line_length >= sizeof(client->line) - 1) {
+		plog(LOG_WARNING, "trace_sub__on_readable: Subscription is too long");
+		mloop_socket_stop(socket);
+	}
+}
+
+static void trace_sub__on_connection(struct mloop_socket* socket)
+{
+	int fd = accept(mloop_socket_get_fd(socket), NULL, 0);
+	if (fd < 0) {
+		plog(LOG_WARNING, "trace_sub__on_connection: Could not accept connection: %s",
+		     strerror(errno));
+		return;
+	}
+
+	net_dont_block(fd);
+	net_dont_delay(fd);
+
+	struct trace_sub_client* client =
+		trace_sub_client_new(fd, &trace_sub__config);
+	if (!client)
+		goto client_failure;
+
+	struct mloop_socket* s = mloop_socket_new(mloop_default());
+	if (!s)
+		goto socket_failure;
+
+	client->socket = s;
+	LIST_INSERT_HEAD(&trace_sub__clients, client, links);
+
+	mloop_socket_set_context(s, client, trace_sub__free_client);
+	mloop_socket_set_callback(s, trace_sub__on_readable);
+	mloop_socket_set_fd(s, fd);
+
+	if (mloop_socket_start(s) < 0)
+		plog(LOG_ERROR, "trace_sub__on_connection: Could not start mloop socket");
+
+	mloop_socket_unref(s);
+	return;
+
+socket_failure:
+	trace_sub_client_free(client);
+	return;
+client_failure:
+	close(fd);
+}
+
+static void trace_sub__on_flush(struct mloop_timer* timer)
+{
+	(void)timer;
+
+	struct trace_sub_client* client = LIST_FIRST(&trace_sub__clients);
+
+	while (client) {
+		struct trace_sub_client* next = LIST_NEXT(client, links);
+
+		if (trace_sub_client_flush(client) < 0)
+			mloop_socket_stop(client->socket);
+
+		client = next;
+	}
+}
+
+static int trace_sub__open_server(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	net_reuse_addr(fd);
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		goto failure;
+
+	if (listen(fd, 16) < 0)
+		goto failure;
+
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int trace_sub_init(const struct trace_sub_config* config)
+{
+	trace_sub__config = *config;
+
+	int fd = trace_sub__open_server(config->port);
+	if (fd < 0)
+		return -1;
+
+	trace_sub__server = mloop_socket_new(mloop_default());
+	if (!trace_sub__server)
+		goto server_failure;
+
+	mloop_socket_set_callback(trace_sub__server, trace_sub__on_connection);
+	mloop_socket_set_fd(trace_sub__server, fd);
+
+	if (mloop_socket_start(trace_sub__server) < 0)
+		goto server_start_failure;
+
+	trace_sub__timer = mloop_timer_new(mloop_default());
+	if (!trace_sub__timer)
+		goto timer_failure;
+
+	mloop_timer_set_callback(trace_sub__timer, trace_sub__on_flush);
+	mloop_timer_set_type(trace_sub__timer, MLOOP_TIMER_PERIODIC);
+	mloop_timer_set_time(trace_sub__timer,
+			     config->flush_interval * 1000000ULL);
+
+	if (mloop_timer_start(trace_sub__timer) < 0)
+		goto timer_start_failure;
+
+	return 0;
+
+timer_start_failure:
+	mloop_timer_unref(trace_sub__timer);
+	trace_sub__timer = NULL;
+timer_failure:
+	mloop_socket_stop(trace_sub__server);
+server_start_failure:
+	mloop_socket_unref(trace_sub__server);
+	trace_sub__server = NULL;
+	return -1;
+server_failure:
+	close(fd);
+	return -1;
+}
+
+void trace_sub_cleanup(void)
+{
+	struct trace_sub_client* client = LIST_FIRST(&trace_sub__clients);
+
+	while (client) {
+		struct trace_sub_client* next = LIST_NEXT(client, links);
+		mloop_socket_stop(client->socket);
+		client = next;
+	}
+
+	if (trace_sub__timer) {
+		mloop_timer_stop(trace_sub__timer);
+		mloop_timer_unref(trace_sub__timer);
+		trace_sub__timer = NULL;
+	}
+
+	if (trace_sub__server) {
+		mloop_socket_stop(trace_sub__server);
+		mloop_socket_unref(trace_sub__server);
+		trace_sub__server = NULL;
+	}
+}
+
+void trace_sub_feed(const struct can_frame* cf, uint64_t timestamp)
+{
+	struct trace_sub_client* client;
+
+	if (LIST_EMPTY(&trace_sub__clients))
+		return;
+
+	if (timestamp == 0)
+		timestamp = gettime_us(CLOCK_REALTIME);
+
+	LIST_FOREACH(client, &trace_sub__clients, links)
+		trace_sub_client_feed(client, timestamp, cf);
+}
+
+static int trace_sub__open(const char* addr)
+{
+	char buffer[256];
+	int port = TRACE_SUB_DEFAULT_PORT;
+
+	strlcpy(buffer, addr, sizeof(buffer));
+
+	char* portptr = strchr(buffer, ':');
+	if (portptr) {
+		*portptr++ = '\0';
+		port = atoi(portptr);
+	}
+
+	return can_tcp_open(buffer, port);
+}
+
+int trace_sub_connect(const char* addr, const char* line)
+{
+	char buffer[TRACE_SUB_LINE_MAX];
+
+	int len = snprintf(buffer, sizeof(buffer), "%s\n", line);
+	if (len < 0 || (size_t)len >= sizeof(buffer))
+		return -1;
+
+	int fd = trace_sub__open(addr);
+	if (fd < 0)
+		return -1;
+
+	if (send(fd, buffer, len, MSG_NOSIGNAL) != len)
+		goto failure;
+
+	return fd;
+
+failure:
+	close(fd);
+	return -1;
+}
+
+int trace_sub_read_batch(int fd, struct trace_sub_header* header,
+			 struct trace_sub_record* records)
+{
+	ssize_t rsize = recv(fd, header, sizeof(*header), MSG_WAITALL);
+	if (rsize == 0)
+		return 0;
+
+	if (rsize != sizeof(*header)
+	 || memcmp(header->magic, TRACE_SUB_MAGIC, sizeof(header->magic)) != 0)
+		return -1;
+
+	header->version = ntohs(header->version);
+	header->n_records = ntohs(header->n_records);
+	header->seq = ntohl(header->seq);
+	header->n_dropped = ntohl(header->n_dropped);
+
+	if (header->version != TRACE_SUB_VERSION
+	 || header->n_records > TRACE_SUB_BATCH_MAX)
+		return -1;
+
+	size_t size = header->n_records * sizeof(*records);
+	if (size && recv(fd, records, size, MSG_WAITALL) != (ssize_t)size)
+		return -1;
+
+	for (unsigned int i = 0; i < header->n_records; ++i) {
+		records[i].timestamp = be64toh(records[i].timestamp);
+		records[i].can_id = ntohl(records[i].can_id);
+	}
+
+	return 1;
+}
@@ -142,6 +142,13 @@ int userdata__have_missing_nodes(struct userdata* self)
 	    || (self->missing[1] & self->required[1]);
 }
 
+int userdata_is_required(const struct userdata* self, unsigned int id)
+{
+	assert(id < 128);
+
+	return !!(self->required[id / 64] & (1ULL << (id % 64)));
+}
+
 void userdata_set_missing(struct userdata* self, unsigned int id)
 {
 	if (self->pin == iomc_invalid)
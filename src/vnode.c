@@ -25,6 +25,7 @@
 #include "canopen/sdo_srv.h"
 #include "canopen/nmt.h"
 #include "canopen/heartbeat.h"
+#include "canopen/lss.h"
 #include "canopen/byteorder.h"
 #include "canopen/types.h"
 #include "net-util.h"
@@ -56,6 +57,10 @@ struct vnode {
 	int have_node_guarding;
 	int have_guard_status_bug;
 	enum vnode__bootup_method bootup_method;
+	int have_lss;
+	int is_lss_unconfigured;
+	struct lss_address lss_address;
+	struct lss_slave lss;
 };
 
 struct sock vnode__sock;
@@ -68,6 +73,21 @@ static inline struct vnode* vnode__get_node(int nodeid)
 	return &vnode__node[nodeid - 1];
 }
 
+/* Node ids may be changed via LSS, so they don't always match the slot */
+static struct vnode* vnode__find_node(int nodeid)
+{
+	for (int i = 0; i < 127; ++i)
+		if (vnode__node[i].is_running && vnode__node[i].nodeid == nodeid)
+			return &vnode__node[i];
+
+	return NULL;
+}
+
+static inline int vnode__has_nodeid(const struct vnode* self)
+{
+	return self->nodeid != LSS_NODEID_UNCONFIGURED;
+}
+
 static void vnode__init(struct vnode* self)
 {
 	memset(self, 0, sizeof(*self));
@@ -95,6 +115,13 @@ static int vnode__config_is_true(const struct ini_section* s, const char* key)
 	return value ? strcasecmp(value, "yes") == 0 : 0;
 }
 
+static uint32_t vnode__config_get_u32(const struct ini_section* s,
+				      const char* key)
+{
+	const char* value = ini_find_key(s, key);
+	return value ? strtoul(value, NULL, 0) : 0;
+}
+
 static void vnode__load_device_info(struct vnode* self)
 {
 	const struct ini_section* s;
@@ -107,6 +134,14 @@ static void vnode__load_device_info(struct vnode* self)
 	self->have_guard_status_bug
 		= vnode__config_is_true(s, "guard_status_bug");
 	self->bootup_method = vnode__get_bootup_method(s);
+
+	self->have_lss = vnode__config_is_true(s, "lss");
+	self->is_lss_unconfigured
+		= vnode__config_is_true(s, "lss_unconfigured");
+	self->lss_address.id[0] = vnode__config_get_u32(s, "vendor_id");
+	self->lss_address.id[1] = vnode__config_get_u32(s, "product_code");
+	self->lss_address.id[2] = vnode__config_get_u32(s, "revision_number");
+	self->lss_address.id[3] = vnode__config_get_u32(s, "serial_number");
 }
 
 static int vnode__load_config(struct vnode* self, const char* path)
@@ -153,7 +188,13 @@ static void vnode__send_legacy_bootup(struct vnode* self)
 
 static void vnode__reset_communication(struct vnode* self)
 {
-	if (!(self->bootup_method & VNODE_BOOT_STANDARD))
+	if (self->have_lss && self->lss.nodeid != self->nodeid) {
+		self->nodeid = self->lss.nodeid;
+		self->sdo_srv.nodeid = self->nodeid;
+	}
+
+	if (!(self->bootup_method & VNODE_BOOT_STANDARD)
+	 || !vnode__has_nodeid(self))
 		return;
 
 	self->state = NMT_STATE_BOOTUP;
@@ -205,6 +246,10 @@ static void vnode__nmt(struct vnode* self, const struct can_frame* cf)
 		return;
 
 	enum nmt_cs cs = nmt_get_cs(cf);
+	if (!vnode__has_nodeid(self)
+	 && cs != NMT_CS_RESET_NODE && cs != NMT_CS_RESET_COMMUNICATION)
+		return;
+
 	switch (cs) {
 	case NMT_CS_START:
 		self->state = NMT_STATE_OPERATIONAL;
@@ -367,11 +412,31 @@ static void vnode__rsdo(struct vnode* self, const struct can_frame* cf)
 	sdo_srv_feed(&self->sdo_srv, cf);
 }
 
+static void vnode__lss(struct vnode* self, const struct can_frame* cf)
+{
+	struct can_frame response;
+
+	if (lss_slave_feed(&self->lss, cf, &response))
+		sock_send(&vnode__sock, &response, 0);
+}
+
 static void vnode__on_frame(const struct can_frame* cf)
 {
 	struct vnode* self;
 	struct canopen_msg msg;
 
+	if (cf->can_id == LSS_COB_ID_MASTER) {
+		for (int i = 1; i < 128; ++i) {
+			self = vnode__get_node(i);
+			if (self->is_running && self->have_lss)
+				vnode__lss(self, cf);
+		}
+		return;
+	}
+
+	if (cf->can_id == LSS_COB_ID_SLAVE)
+		return;
+
 	if (canopen_get_object_type(&msg, cf) < 0)
 		return;
 
@@ -380,25 +445,23 @@ static void vnode__on_frame(const struct can_frame* cf)
 		      && msg.id <= CANOPEN_NODEID_MAX))
 			return;
 
-		self = vnode__get_node(msg.id);
-		if (!self)
-			return;
-
-		if (msg.id != self->nodeid)
-			return;
+		self = vnode__find_node(msg.id);
 	} else {
 		if (nmt_get_nodeid(cf) == 0) {
 			for (int i = 1; i < 128; ++i) {
 				self = vnode__get_node(i);
 				if (self->is_running)
 					vnode__nmt(self, cf);
-				return;
 			}
-		} else {
-			self = vnode__get_node(nmt_get_nodeid(cf));
+			return;
 		}
+
+		self = vnode__find_node(nmt_get_nodeid(cf));
 	}
 
+	if (!self)
+		return;
+
 	switch (msg.object) {
 	case CANOPEN_HEARTBEAT:
 		vnode__heartbeat(self, cf);
@@ -501,7 +564,17 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 	self->nodeid = nodeid;
 	self->state = NMT_STATE_BOOTUP;
 
-	if (sdo_srv_init(&self->sdo_srv, &vnode__sock, nodeid,
+	if (self->have_lss) {
+		if (self->is_lss_unconfigured)
+			self->nodeid = LSS_NODEID_UNCONFIGURED;
+
+		if (self->lss_address.id[3] == 0)
+			self->lss_address.id[3] = nodeid;
+
+		lss_slave_init(&self->lss, &self->lss_address, self->nodeid);
+	}
+
+	if (sdo_srv_init(&self->sdo_srv, &vnode__sock, self->nodeid,
 			 vnode__on_sdo_init, vnode__on_sdo_done) < 0)
 		goto srv_failure;
 
@@ -509,7 +582,7 @@ struct vnode* co_vnode_new(enum sock_type type, const char* iface,
 		if (vnode__setup_heartbeat_timer(self) < 0)
 			goto srv_failure;
 
-	if (self->bootup_method & VNODE_BOOT_LEGACY)
+	if (self->bootup_method & VNODE_BOOT_LEGACY && vnode__has_nodeid(self))
 		vnode__send_legacy_bootup(self);
 
 	vnode__reset_communication(self);
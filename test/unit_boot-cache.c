@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "tst.h"
+#include "boot-cache.h"
+
+static void make_entry(struct boot_cache_entry* entry, uint32_t serial_number)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->device_type = 0x20192;
+	entry->vendor_id = 0x1234;
+	entry->product_code = 42;
+	entry->revision_number = 3;
+	entry->serial_number = serial_number;
+	strcpy(entry->name, "drive");
+	strcpy(entry->sw_version, "1.2.3");
+}
+
+static int test_disabled()
+{
+	struct boot_cache_entry entry;
+	make_entry(&entry, 1);
+
+	ASSERT_INT_LT(0, boot_cache_load(""));
+	ASSERT_FALSE(boot_cache_is_enabled());
+
+	boot_cache_set(5, &entry);
+	ASSERT_INT_LT(0, boot_cache_get(5, &entry));
+	ASSERT_INT_LT(0, boot_cache_save());
+
+	return 0;
+}
+
+static int test_save_load()
+{
+	char path[] = "/tmp/unit_boot_cache_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+	unlink(path);
+
+	struct boot_cache_entry entry, result;
+	make_entry(&entry, 1000);
+
+	ASSERT_INT_EQ(0, boot_cache_load(path));
+	ASSERT_TRUE(boot_cache_is_enabled());
+	ASSERT_INT_LT(0, boot_cache_get(5, &result));
+
+	boot_cache_set(5, &entry);
+	boot_cache_set(7, &entry);
+	boot_cache_invalidate(7);
+	boot_cache_set(0, &entry);
+	boot_cache_cleanup();
+
+	ASSERT_INT_EQ(0, boot_cache_load(path));
+	ASSERT_INT_EQ(0, boot_cache_get(5, &result));
+	ASSERT_TRUE(result.is_valid);
+	ASSERT_UINT_EQ(1000, result.serial_number);
+	ASSERT_STR_EQ("drive", result.name);
+	ASSERT_STR_EQ("1.2.3", result.sw_version);
+	ASSERT_INT_LT(0, boot_cache_get(7, &result));
+	ASSERT_INT_LT(0, boot_cache_get(0, &result));
+	boot_cache_cleanup();
+
+	unlink(path);
+	return 0;
+}
+
+static int test_version_mismatch()
+{
+	char path[] = "/tmp/unit_boot_cache_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+	unlink(path);
+
+	struct boot_cache_entry entry;
+	make_entry(&entry, 1);
+
+	ASSERT_INT_EQ(0, boot_cache_load(path));
+	boot_cache_set(5, &entry);
+	boot_cache_cleanup();
+
+	FILE* file = fopen(path, "r+");
+	ASSERT_TRUE(file);
+	struct boot_cache_file_header header;
+	ASSERT_INT_EQ(1, fread(&header, sizeof(header), 1, file));
+	header.version = BOOT_CACHE_VERSION + 1;
+	rewind(file);
+	ASSERT_INT_EQ(1, fwrite(&header, sizeof(header), 1, file));
+	fclose(file);
+
+	ASSERT_INT_EQ(0, boot_cache_load(path));
+	ASSERT_INT_LT(0, boot_cache_get(5, &entry));
+	boot_cache_cleanup();
+
+	unlink(path);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_disabled);
+	RUN_TEST(test_save_load);
+	RUN_TEST(test_version_mismatch);
+	return r;
+}
@@ -0,0 +1,119 @@
+#include <stdlib.h>
+#include "tst.h"
+#include "canopen/bus-stats.h"
+
+static int test_frame_bits()
+{
+	struct can_frame cf = { .can_id = 0, .can_dlc = 0 };
+
+	/* 34 dominant bits need a stuff bit after every 5 */
+	ASSERT_INT_EQ(34 + 6 + 13, bus_stats_frame_bits(&cf));
+
+	cf.can_id = 0x7ff;
+	cf.can_dlc = 8;
+	memset(cf.data, 0x55, 8);
+	unsigned int bits = bus_stats_frame_bits(&cf);
+	ASSERT_TRUE(bits >= 47 + 64);
+	ASSERT_TRUE(bits <= 47 + 64 + 24);
+
+	cf.can_id |= CAN_RTR_FLAG;
+	ASSERT_TRUE(bus_stats_frame_bits(&cf) < bits);
+
+	cf.can_id = 0x12345678 | CAN_EFF_FLAG;
+	cf.can_dlc = 0;
+	bits = bus_stats_frame_bits(&cf);
+	ASSERT_TRUE(bits >= 67);
+	ASSERT_TRUE(bits <= 67 + 13);
+
+	return 0;
+}
+
+static int test_periods()
+{
+	static struct bus_stats stats;
+	bus_stats_init(&stats, 125000);
+
+	struct can_frame cf = { .can_id = 0x80, .can_dlc = 0 };
+
+	bus_stats_add(&stats, 1000000, &cf);
+	bus_stats_add(&stats, 1001000, &cf);
+	bus_stats_add(&stats, 1002100, &cf);
+	bus_stats_add(&stats, 1002900, &cf);
+	bus_stats_add(&stats, 1004000, &cf);
+
+	const struct bus_stats_cob* cob = &stats.cob[0x80];
+	ASSERT_UINT_EQ(5, cob->n_frames);
+	ASSERT_UINT_EQ(4, cob->n_periods);
+	ASSERT_UINT_EQ(800, cob->period_min);
+	ASSERT_UINT_EQ(1100, cob->period_max);
+	ASSERT_TRUE(cob->period_sum == 4000);
+
+	double jitter = bus_stats_period_jitter(cob);
+	ASSERT_TRUE(jitter > 120 && jitter < 125);
+
+	/* 5 frames in 4 ms at 125 kbit/s, i.e. 500 bit times */
+	double expected = 5 * bus_stats_frame_bits(&cf) * 100.0 / 500.0;
+	double load = bus_stats_load(&stats);
+	ASSERT_TRUE(load > expected - 0.01 && load < expected + 0.01);
+
+	bus_stats_reset(&stats);
+	ASSERT_UINT_EQ(0, cob->n_frames);
+
+	bus_stats_add(&stats, 1005000, &cf);
+	ASSERT_UINT_EQ(1, cob->n_periods);
+	ASSERT_UINT_EQ(1000, cob->period_min);
+
+	return 0;
+}
+
+static int test_sdo_latency()
+{
+	static struct bus_stats stats;
+	bus_stats_init(&stats, 250000);
+
+	struct can_frame req = { .can_id = 0x605, .can_dlc = 8 };
+	struct can_frame res = { .can_id = 0x585, .can_dlc = 8 };
+
+	bus_stats_add(&stats, 1000, &req);
+	bus_stats_add(&stats, 1700, &res);
+	bus_stats_add(&stats, 1800, &res);
+
+	ASSERT_UINT_EQ(1, stats.sdo_latency[5].count);
+	ASSERT_UINT_EQ(700, stats.sdo_latency[5].max);
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&buffer, &size);
+	bus_stats_print(&stats, out);
+	fclose(out);
+
+	ASSERT_TRUE(strstr(buffer, "0x605    RSDO         5"));
+	ASSERT_TRUE(strstr(buffer, "SDO latency"));
+	free(buffer);
+
+	return 0;
+}
+
+static int test_error_frames()
+{
+	static struct bus_stats stats;
+	bus_stats_init(&stats, 250000);
+
+	struct can_frame cf = { .can_id = CAN_ERR_FLAG | 0x40, .can_dlc = 8 };
+	bus_stats_add(&stats, 1000, &cf);
+
+	ASSERT_UINT_EQ(1, stats.n_error_frames);
+	ASSERT_UINT_EQ(0, stats.n_frames);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_frame_bits);
+	RUN_TEST(test_periods);
+	RUN_TEST(test_sdo_latency);
+	RUN_TEST(test_error_frames);
+	return r;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tst.h"
+#include "canopen/dcf.h"
+#include "ini_parser.h"
+
+static int test_add_and_replace()
+{
+	struct co_dcf dcf;
+	struct co_dcf_entry entry;
+	uint32_t value = 0x12345678;
+	uint16_t short_value = 0xabcd;
+
+	ASSERT_INT_EQ(0, co_dcf_init(&dcf));
+	ASSERT_UINT_EQ(4, co_dcf_get_size(&dcf));
+
+	ASSERT_INT_EQ(0, co_dcf_add(&dcf, 0x1017, 0, &short_value, 2));
+	ASSERT_INT_EQ(0, co_dcf_add(&dcf, 0x1800, 1, &value, 4));
+	ASSERT_UINT_EQ(2, co_dcf_length(&dcf));
+	ASSERT_UINT_EQ(4 + 7 + 2 + 7 + 4, co_dcf_get_size(&dcf));
+
+	const uint8_t* data = co_dcf_get_data(&dcf);
+	ASSERT_INT_EQ(2, data[0]);
+	ASSERT_INT_EQ(0x17, data[4]);
+	ASSERT_INT_EQ(0x10, data[5]);
+	ASSERT_INT_EQ(2, data[7]);
+
+	uint32_t digest = co_dcf_digest(&dcf);
+
+	ASSERT_INT_EQ(0, co_dcf_add(&dcf, 0x1017, 0, &value, 4));
+	ASSERT_UINT_EQ(2, co_dcf_length(&dcf));
+	ASSERT_UINT_EQ(4 + 7 + 4 + 7 + 4, co_dcf_get_size(&dcf));
+	ASSERT_TRUE(co_dcf_find(&dcf, 0x1017, 0, &entry));
+	ASSERT_UINT_EQ(4, entry.size);
+	ASSERT_INT_EQ(0, memcmp(&value, entry.data, 4));
+	ASSERT_FALSE(co_dcf_find(&dcf, 0x1017, 1, &entry));
+	ASSERT_FALSE(digest == co_dcf_digest(&dcf));
+
+	ASSERT_INT_EQ(0, co_dcf_append(&dcf, 0x1800, 1, &value, 4));
+	ASSERT_UINT_EQ(3, co_dcf_length(&dcf));
+
+	struct co_dcf copy;
+	ASSERT_INT_EQ(0, co_dcf_init(&copy));
+	ASSERT_INT_EQ(0, co_dcf_load_concise(&copy, co_dcf_get_data(&dcf),
+					     co_dcf_get_size(&dcf)));
+	ASSERT_UINT_EQ(2, co_dcf_length(&copy));
+	ASSERT_FALSE(co_dcf_digest(&dcf) == co_dcf_digest(&copy));
+
+	co_dcf_destroy(&dcf);
+	ASSERT_INT_EQ(0, co_dcf_init(&dcf));
+	ASSERT_INT_EQ(0, co_dcf_load_concise(&dcf, co_dcf_get_data(&copy),
+					     co_dcf_get_size(&copy)));
+	ASSERT_TRUE(co_dcf_digest(&dcf) == co_dcf_digest(&copy));
+
+	ASSERT_INT_LT(0, co_dcf_load_concise(&copy, co_dcf_get_data(&dcf),
+					     co_dcf_get_size(&dcf) - 1));
+
+	co_dcf_destroy(&copy);
+	co_dcf_destroy(&dcf);
+	return 0;
+}
+
+static int test_load_ini()
+{
+	const char text[] =
+	"[DeviceInfo]\n"
+	"ProductName=Foo\n"
+	"[1017]\n"
+	"DataType=0x0006\n"
+	"ParameterValue=1000\n"
+	"[1800sub1]\n"
+	"DataType=0x0007\n"
+	"ParameterValue=$NODEID+0x180\n"
+	"[1800sub2]\n"
+	"DataType=0x0005\n"
+	"DefaultValue=255\n";
+
+	FILE* stream = fmemopen((void*)text, sizeof(text) - 1, "r");
+	struct ini_file ini;
+	ASSERT_INT_EQ(0, ini_parse(&ini, stream));
+	fclose(stream);
+
+	struct co_dcf dcf;
+	struct co_dcf_entry entry;
+	ASSERT_INT_EQ(0, co_dcf_init(&dcf));
+	ASSERT_INT_EQ(0, co_dcf_load_ini(&dcf, &ini, NULL, 5));
+	ASSERT_UINT_EQ(2, co_dcf_length(&dcf));
+
+	ASSERT_TRUE(co_dcf_find(&dcf, 0x1017, 0, &entry));
+	ASSERT_UINT_EQ(2, entry.size);
+	ASSERT_INT_EQ(0xe8, ((const uint8_t*)entry.data)[0]);
+	ASSERT_INT_EQ(0x03, ((const uint8_t*)entry.data)[1]);
+
+	ASSERT_TRUE(co_dcf_find(&dcf, 0x1800, 1, &entry));
+	ASSERT_UINT_EQ(4, entry.size);
+	ASSERT_INT_EQ(0x85, ((const uint8_t*)entry.data)[0]);
+	ASSERT_INT_EQ(0x01, ((const uint8_t*)entry.data)[1]);
+
+	co_dcf_destroy(&dcf);
+	ini_destroy(&ini);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_add_and_replace);
+	RUN_TEST(test_load_ini);
+	return r;
+}
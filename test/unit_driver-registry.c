@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tst.h"
+#include "driver-registry.h"
+
+static char dir_[] = "/tmp/unit_driver_registry_XXXXXX";
+
+static void touch(const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir_, name);
+	fclose(fopen(path, "w"));
+}
+
+static void remove_file(const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir_, name);
+	unlink(path);
+}
+
+static int has_name(const char* name)
+{
+	for (size_t i = 0; i < driver_registry_length(); ++i)
+		if (strcmp(driver_registry_name(i), name) == 0)
+			return 1;
+
+	return 0;
+}
+
+static int test_scan()
+{
+	ASSERT_INT_EQ(0, driver_registry_init(dir_));
+
+	ASSERT_UINT_EQ(2, driver_registry_length());
+	ASSERT_TRUE(has_name("foo"));
+	ASSERT_TRUE(has_name("bar"));
+	ASSERT_FALSE(driver_registry_name(2));
+
+	driver_registry_cleanup();
+	ASSERT_UINT_EQ(0, driver_registry_length());
+	return 0;
+}
+
+static int test_missing_directory()
+{
+	ASSERT_INT_EQ(0, driver_registry_init("/nonexistent/canopen"));
+	ASSERT_UINT_EQ(0, driver_registry_length());
+	driver_registry_cleanup();
+	return 0;
+}
+
+static int test_failures_are_cached()
+{
+	void* dso = NULL;
+	void* init_fn = NULL;
+
+	ASSERT_INT_EQ(0, driver_registry_init(dir_));
+
+	/* These are empty files, not shared objects */
+	ASSERT_INT_LT(0, driver_registry_preload(0));
+	ASSERT_INT_LT(0, driver_registry_get("FOO", &dso, &init_fn));
+	ASSERT_INT_LT(0, driver_registry_preload(42));
+
+	ASSERT_INT_LT(0, driver_registry_get("baz", &dso, &init_fn));
+	ASSERT_UINT_EQ(3, driver_registry_length());
+
+	/* A driver that shows up later is not retried */
+	touch("co_drv_baz.so");
+	ASSERT_INT_LT(0, driver_registry_get("baz", &dso, &init_fn));
+	ASSERT_UINT_EQ(3, driver_registry_length());
+	remove_file("co_drv_baz.so");
+
+	ASSERT_PTR_EQ(NULL, dso);
+	ASSERT_PTR_EQ(NULL, init_fn);
+
+	driver_registry_cleanup();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	if (!mkdtemp(dir_))
+		return 1;
+
+	touch("co_drv_foo.so");
+	touch("co_drv_Bar.so");
+	touch("co_drv_.so");
+	touch("co_drv_foo.so.1");
+	touch("libfoo.so");
+
+	RUN_TEST(test_scan);
+	RUN_TEST(test_missing_directory);
+	RUN_TEST(test_failures_are_cached);
+
+	remove_file("co_drv_foo.so");
+	remove_file("co_drv_Bar.so");
+	remove_file("co_drv_.so");
+	remove_file("co_drv_foo.so.1");
+	remove_file("libfoo.so");
+	rmdir(dir_);
+	return r;
+}
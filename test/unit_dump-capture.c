@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "tst.h"
+#include "fff.h"
+#include "socketcan.h"
+#include "trace-buffer.h"
+#include "canopen/dump.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(int, socketcan_open, const char*);
+FAKE_VALUE_FUNC(int, recvmmsg, int, struct mmsghdr*, unsigned int, int,
+		struct timespec*);
+
+#define N_FRAMES 3
+#define N_KERNEL_DROPS 5
+
+static int bus_[2];
+static struct can_frame batch_[N_FRAMES];
+static unsigned int batch_size_;
+static int n_reads_;
+
+static char output_path_[] = "/tmp/unit_dump_capture_XXXXXX";
+static char stats_path_[] = "/tmp/unit_dump_capture_stats_XXXXXX";
+
+struct capture_job {
+	pthread_t thread;
+	int rc;
+};
+
+static void add_cmsg(struct msghdr* hdr, struct cmsghdr** cmsg, int type,
+		     const void* data, size_t size)
+{
+	*cmsg = *cmsg ? CMSG_NXTHDR(hdr, *cmsg) : CMSG_FIRSTHDR(hdr);
+	(*cmsg)->cmsg_level = SOL_SOCKET;
+	(*cmsg)->cmsg_type = type;
+	(*cmsg)->cmsg_len = CMSG_LEN(size);
+	memcpy(CMSG_DATA(*cmsg), data, size);
+}
+
+/* Each datagram on the bus socket stands for one batch from the kernel. The
+ * frames come with timestamps and the kernel's running drop counter.
+ */
+static int fake_recvmmsg(int fd, struct mmsghdr* msgs, unsigned int vlen,
+			 int flags, struct timespec* timeout)
+{
+	(void)flags;
+	(void)timeout;
+
+	char wake;
+	if (recv(fd, &wake, sizeof(wake), MSG_DONTWAIT) < 0)
+		return -1;
+
+	unsigned int n = batch_size_ < vlen ? batch_size_ : vlen;
+	uint32_t n_drops = N_KERNEL_DROPS;
+
+	for (unsigned int i = 0; i < n; ++i) {
+		struct msghdr* hdr = &msgs[i].msg_hdr;
+		struct cmsghdr* cmsg = NULL;
+		struct timeval tv = { .tv_sec = 1, .tv_usec = 2 + i };
+
+		memcpy(hdr->msg_iov->iov_base, &batch_[i], sizeof(batch_[i]));
+		msgs[i].msg_len = sizeof(batch_[i]);
+
+		add_cmsg(hdr, &cmsg, SO_TIMESTAMP, &tv, sizeof(tv));
+		add_cmsg(hdr, &cmsg, SO_RXQ_OVFL, &n_drops, sizeof(n_drops));
+	}
+
+	__atomic_add_fetch(&n_reads_, 1, __ATOMIC_SEQ_CST);
+
+	if (n == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	return n;
+}
+
+static void* run_capture(void* ptr)
+{
+	struct capture_job* job = ptr;
+	job->rc = co_dump_capture("vcan0", output_path_);
+	return NULL;
+}
+
+static int setup(struct capture_job* job, unsigned int batch_size)
+{
+	RESET_FAKE(socketcan_open);
+	RESET_FAKE(recvmmsg);
+
+	ASSERT_INT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, bus_));
+	socketcan_open_fake.return_val = bus_[0];
+	recvmmsg_fake.custom_fake = fake_recvmmsg;
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		batch_[i].can_id = 0x181 + i;
+		batch_[i].can_dlc = 1;
+		batch_[i].data[0] = i;
+	}
+
+	batch_size_ = batch_size;
+	n_reads_ = 0;
+
+	ASSERT_INT_EQ(0, pthread_create(&job->thread, NULL, run_capture, job));
+	ASSERT_INT_EQ(1, write(bus_[1], "", 1));
+
+	/* Once a batch has been read, the capture loop is running with the
+	 * stop signals blocked outside of the wait
+	 */
+	for (int i = 0; i < 1000; ++i) {
+		if (__atomic_load_n(&n_reads_, __ATOMIC_SEQ_CST) > 0)
+			return 0;
+
+		usleep(1000);
+	}
+
+	return 1;
+}
+
+/* The capture must stop on a signal even though no frames arrive after it */
+static int stop(struct capture_job* job)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 1;
+
+	ASSERT_INT_EQ(0, pthread_kill(job->thread, SIGTERM));
+	ASSERT_INT_EQ(0, pthread_timedjoin_np(job->thread, NULL, &deadline));
+
+	close(bus_[1]);
+	return 0;
+}
+
+static int test_drop_counting()
+{
+	struct capture_job job;
+
+	int stats_fd = open(stats_path_, O_RDWR | O_TRUNC);
+	ASSERT_INT_GE(0, stats_fd);
+
+	fflush(stderr);
+	int saved_stderr = dup(STDERR_FILENO);
+	dup2(stats_fd, STDERR_FILENO);
+
+	int rc = setup(&job, N_FRAMES) || stop(&job);
+
+	fflush(stderr);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stderr);
+
+	ASSERT_INT_EQ(0, rc);
+	ASSERT_INT_EQ(0, job.rc);
+
+	struct tb_frame frames[N_FRAMES + 1];
+	FILE* output = fopen(output_path_, "r");
+	ASSERT_TRUE(output);
+	ASSERT_UINT_EQ(N_FRAMES, fread(frames, sizeof(frames[0]),
+				       N_FRAMES + 1, output));
+	fclose(output);
+
+	for (int i = 0; i < N_FRAMES; ++i) {
+		ASSERT_UINT_EQ(0x181u + i, frames[i].cf.can_id);
+		ASSERT_INT_EQ(i, frames[i].cf.data[0]);
+		ASSERT_TRUE(frames[i].timestamp == 1000002ULL + i);
+	}
+
+	char stats[256] = { 0 };
+	ASSERT_TRUE(pread(stats_fd, stats, sizeof(stats) - 1, 0) > 0);
+	close(stats_fd);
+
+	ASSERT_TRUE(strstr(stats, "Captured 3 frames; 5 dropped by the kernel, 0 dropped in the capture buffer\n"));
+	return 0;
+}
+
+static int test_stop_without_frames()
+{
+	struct capture_job job;
+
+	ASSERT_INT_EQ(0, setup(&job, 0));
+	ASSERT_INT_EQ(0, stop(&job));
+	ASSERT_INT_EQ(0, job.rc);
+
+	FILE* output = fopen(output_path_, "r");
+	ASSERT_TRUE(output);
+	fseek(output, 0, SEEK_END);
+	ASSERT_INT_EQ(0, ftell(output));
+	fclose(output);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+
+	close(mkstemp(output_path_));
+	close(mkstemp(stats_path_));
+
+	RUN_TEST(test_drop_counting);
+	RUN_TEST(test_stop_without_frames);
+
+	unlink(output_path_);
+	unlink(stats_path_);
+	return r;
+}
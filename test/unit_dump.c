@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "tst.h"
+#include "trace-buffer.h"
+#include "canopen/dump.h"
+
+/* Enough frames for several chunks of a parallel decode */
+#define N_FRAMES (4 * 65536)
+
+static char trace_path_[] = "/tmp/unit_dump_trace_XXXXXX";
+
+static const uint16_t codes_[] = {
+	0x1000, 0x2310, 0x3210, 0x4210, 0x5000, 0x8110, 0x8130, 0xff00,
+};
+
+static int write_emcy_trace(void)
+{
+	int fd = mkstemp(trace_path_);
+	if (fd < 0)
+		return -1;
+
+	FILE* file = fdopen(fd, "w");
+	if (!file)
+		return -1;
+
+	for (size_t i = 0; i < N_FRAMES; ++i) {
+		struct tb_frame frame;
+		memset(&frame, 0, sizeof(frame));
+
+		uint16_t code = codes_[i % (sizeof(codes_) / sizeof(codes_[0]))];
+
+		frame.timestamp = i;
+		frame.cf.can_id = 0x80 + 1 + i % 16;
+		frame.cf.can_dlc = 8;
+		frame.cf.data[0] = code & 0xff;
+		frame.cf.data[1] = code >> 8;
+		frame.cf.data[2] = 1;
+
+		fwrite(&frame, sizeof(frame), 1, file);
+	}
+
+	return fclose(file);
+}
+
+static char* dump_with_jobs(unsigned int n_jobs, size_t* size)
+{
+	char* buffer = NULL;
+	FILE* output = tmpfile();
+	if (!output)
+		return NULL;
+
+	fflush(stdout);
+	int saved = dup(STDOUT_FILENO);
+	dup2(fileno(output), STDOUT_FILENO);
+
+	co_dump_set_jobs(n_jobs);
+	int rc = co_dump(trace_path_, CO_DUMP_FILE | CO_DUMP_FILTER_EMCY);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+
+	if (rc != 0)
+		goto done;
+
+	*size = lseek(fileno(output), 0, SEEK_END);
+	buffer = malloc(*size + 1);
+	if (!buffer)
+		goto done;
+
+	if (pread(fileno(output), buffer, *size, 0) != (ssize_t)*size) {
+		free(buffer);
+		buffer = NULL;
+	}
+
+done:
+	fclose(output);
+	return buffer;
+}
+
+static int test_parallel_emcy_matches_sequential()
+{
+	size_t sequential_size = 0, parallel_size = 0;
+
+	ASSERT_INT_EQ(0, write_emcy_trace());
+
+	char* sequential = dump_with_jobs(1, &sequential_size);
+	char* parallel = dump_with_jobs(4, &parallel_size);
+
+	ASSERT_TRUE(sequential);
+	ASSERT_TRUE(parallel);
+	ASSERT_TRUE(sequential_size > 0);
+	ASSERT_UINT_EQ(sequential_size, parallel_size);
+	ASSERT_INT_EQ(0, memcmp(sequential, parallel, sequential_size));
+
+	free(sequential);
+	free(parallel);
+	unlink(trace_path_);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parallel_emcy_matches_sequential);
+	return r;
+}
@@ -0,0 +1,221 @@
+#include "tst.h"
+#include "fff.h"
+#include "mloop.h"
+#include "canopen/hb_supervisor.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(struct mloop*, mloop_default);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_type, struct mloop_timer*,
+	       enum mloop_timer_type);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
+FAKE_VALUE_FUNC(struct mloop_async*, mloop_async_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_async_start, struct mloop_async*);
+FAKE_VOID_FUNC(mloop_async_cancel, struct mloop_async*);
+FAKE_VALUE_FUNC(int, mloop_async_unref, struct mloop_async*);
+FAKE_VOID_FUNC(mloop_async_set_context, struct mloop_async*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_async_set_callback, struct mloop_async*, mloop_async_fn);
+FAKE_VALUE_FUNC(void*, mloop_async_get_context, const struct mloop_async*);
+
+static int n_timeouts_[CANOPEN_NODEID_MAX + 1];
+static int n_pings_[CANOPEN_NODEID_MAX + 1];
+static int n_seen_[CANOPEN_NODEID_MAX + 1];
+
+static void on_timeout(struct hb_supervisor* self, int nodeid)
+{
+	++n_timeouts_[nodeid];
+	if (n_timeouts_[nodeid] > 1)
+		hb_supervisor_stop(self, nodeid);
+}
+
+static void on_ping(struct hb_supervisor* self, int nodeid)
+{
+	(void)self;
+	++n_pings_[nodeid];
+}
+
+static void on_seen(struct hb_supervisor* self, int nodeid)
+{
+	(void)self;
+	++n_seen_[nodeid];
+}
+
+static int init(struct hb_supervisor* self)
+{
+	RESET_FAKE(mloop_timer_new);
+	RESET_FAKE(mloop_timer_start);
+	RESET_FAKE(mloop_timer_stop);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
+	memset(n_timeouts_, 0, sizeof(n_timeouts_));
+	memset(n_pings_, 0, sizeof(n_pings_));
+	memset(n_seen_, 0, sizeof(n_seen_));
+
+	if (hb_supervisor_init(self, 10000) < 0)
+		return -1;
+
+	self->on_timeout = on_timeout;
+	self->on_ping = on_ping;
+	self->on_seen = on_seen;
+	return 0;
+}
+
+static int test_start_stop()
+{
+	struct hb_supervisor supervisor;
+	ASSERT_INT_EQ(0, init(&supervisor));
+
+	hb_supervisor_start(&supervisor, 1, 1000000, 0);
+	hb_supervisor_start(&supervisor, 127, 1000000, 0);
+	hb_supervisor_start(&supervisor, 127, 1000000, 0);
+	ASSERT_UINT_EQ(2, supervisor.n_active);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+
+	ASSERT_TRUE(hb_supervisor_is_active(&supervisor, 127));
+	ASSERT_FALSE(hb_supervisor_is_active(&supervisor, 2));
+
+	hb_supervisor_stop(&supervisor, 1);
+	hb_supervisor_stop(&supervisor, 1);
+	ASSERT_INT_EQ(0, mloop_timer_stop_fake.call_count);
+	hb_supervisor_stop(&supervisor, 127);
+	ASSERT_INT_EQ(1, mloop_timer_stop_fake.call_count);
+	ASSERT_UINT_EQ(0, supervisor.n_active);
+
+	hb_supervisor_destroy(&supervisor);
+	return 0;
+}
+
+static int test_timeouts()
+{
+	struct hb_supervisor supervisor;
+	ASSERT_INT_EQ(0, init(&supervisor));
+
+	/* The deadlines are set from the real clock, which may not advance
+	 * between the calls, so node 70's never lines up with node 5's.
+	 */
+	hb_supervisor_start(&supervisor, 5, 1000000, 0);
+	hb_supervisor_start(&supervisor, 70, 3000000, 0);
+
+	uint64_t now = gettime_us(CLOCK_MONOTONIC);
+
+	hb_supervisor_process(&supervisor, now);
+	ASSERT_INT_EQ(0, n_timeouts_[5]);
+
+	hb_supervisor_feed(&supervisor, 70);
+	hb_supervisor_feed(&supervisor, 3);
+
+	/* Node 70 has a longer timeout and was fed */
+	hb_supervisor_process(&supervisor, supervisor.node[5].deadline);
+	ASSERT_INT_EQ(1, n_timeouts_[5]);
+	ASSERT_INT_EQ(0, n_timeouts_[70]);
+	ASSERT_INT_EQ(1, n_seen_[70]);
+	ASSERT_INT_EQ(0, n_seen_[3]);
+
+	/* Missed heartbeats repeat once per timeout */
+	hb_supervisor_process(&supervisor, supervisor.node[5].deadline);
+	ASSERT_INT_EQ(2, n_timeouts_[5]);
+	ASSERT_FALSE(hb_supervisor_is_active(&supervisor, 5));
+
+	hb_supervisor_process(&supervisor, now + 10000000);
+	ASSERT_INT_EQ(2, n_timeouts_[5]);
+	ASSERT_INT_EQ(1, n_timeouts_[70]);
+	ASSERT_INT_EQ(1, n_seen_[70]);
+
+	hb_supervisor_destroy(&supervisor);
+	return 0;
+}
+
+static int test_pings()
+{
+	struct hb_supervisor supervisor;
+	ASSERT_INT_EQ(0, init(&supervisor));
+
+	hb_supervisor_start(&supervisor, 9, 10000000, 1000);
+	uint64_t first = supervisor.node[9].ping_deadline;
+
+	hb_supervisor_process(&supervisor, first - 1);
+	ASSERT_INT_EQ(0, n_pings_[9]);
+
+	hb_supervisor_process(&supervisor, first);
+	ASSERT_INT_EQ(1, n_pings_[9]);
+	ASSERT_TRUE(supervisor.node[9].ping_deadline == first + 1000);
+
+	/* Falling far behind doesn't cause a burst of requests */
+	hb_supervisor_process(&supervisor, first + 5500);
+	ASSERT_INT_EQ(2, n_pings_[9]);
+	ASSERT_TRUE(supervisor.node[9].ping_deadline == first + 6500);
+
+	hb_supervisor_destroy(&supervisor);
+	return 0;
+}
+
+static int test_other_loop()
+{
+	RESET_FAKE(mloop_timer_new);
+	RESET_FAKE(mloop_timer_start);
+	RESET_FAKE(mloop_timer_stop);
+	RESET_FAKE(mloop_async_new);
+	RESET_FAKE(mloop_async_start);
+	RESET_FAKE(mloop_async_set_callback);
+	RESET_FAKE(mloop_async_get_context);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+	mloop_async_new_fake.return_val = (void*)0xbeefbeef;
+
+	memset(n_timeouts_, 0, sizeof(n_timeouts_));
+	memset(n_seen_, 0, sizeof(n_seen_));
+
+	struct hb_supervisor supervisor;
+	ASSERT_INT_EQ(0, hb_supervisor_init_on(&supervisor, (void*)0xf00,
+					       10000));
+	supervisor.on_timeout = on_timeout;
+	supervisor.on_seen = on_seen;
+
+	/* The timer runs for as long as the supervisor exists */
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+	hb_supervisor_start(&supervisor, 5, 1000, 0);
+	hb_supervisor_start(&supervisor, 6, 1000, 0);
+	ASSERT_INT_EQ(1, mloop_timer_start_fake.call_count);
+
+	hb_supervisor_feed(&supervisor, 6);
+	hb_supervisor_process(&supervisor, supervisor.node[5].deadline);
+
+	/* Nothing is called until the dispatch runs on the default loop */
+	ASSERT_INT_EQ(0, n_timeouts_[5]);
+	ASSERT_INT_EQ(0, n_seen_[6]);
+	ASSERT_INT_EQ(1, mloop_async_start_fake.call_count);
+
+	hb_supervisor_stop(&supervisor, 6);
+
+	mloop_async_get_context_fake.return_val = &supervisor;
+	mloop_async_set_callback_fake.arg1_val(NULL);
+	ASSERT_INT_EQ(1, n_timeouts_[5]);
+	ASSERT_INT_EQ(0, n_seen_[6]);
+
+	mloop_async_set_callback_fake.arg1_val(NULL);
+	ASSERT_INT_EQ(1, n_timeouts_[5]);
+
+	hb_supervisor_stop(&supervisor, 5);
+	ASSERT_INT_EQ(0, mloop_timer_stop_fake.call_count);
+
+	hb_supervisor_destroy(&supervisor);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_start_stop);
+	RUN_TEST(test_timeouts);
+	RUN_TEST(test_pings);
+	RUN_TEST(test_other_loop);
+	return r;
+}
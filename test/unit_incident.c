@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <utime.h>
+#include "tst.h"
+#include "mloop.h"
+#include "canopen/incident.h"
+#include "canopen/sdo.h"
+#include "trace-file.h"
+
+static int test_parse_triggers()
+{
+	struct incident_trigger triggers[8];
+
+	ASSERT_INT_EQ(4, incident_parse_triggers(triggers, 8,
+		"emcy:5:0x8130, sdo-abort heartbeat-timeout:*:, bus-off"));
+
+	ASSERT_INT_EQ(INCIDENT_TRIGGER_EMCY, triggers[0].type);
+	ASSERT_INT_EQ(5, triggers[0].nodeid);
+	ASSERT_INT_EQ(0x8130, triggers[0].code);
+
+	ASSERT_INT_EQ(INCIDENT_TRIGGER_SDO_ABORT, triggers[1].type);
+	ASSERT_INT_EQ(INCIDENT_ANY, triggers[1].nodeid);
+	ASSERT_INT_EQ(INCIDENT_ANY, triggers[1].code);
+
+	ASSERT_INT_EQ(INCIDENT_TRIGGER_HEARTBEAT_TIMEOUT, triggers[2].type);
+	ASSERT_INT_EQ(INCIDENT_ANY, triggers[2].nodeid);
+	ASSERT_INT_EQ(INCIDENT_TRIGGER_BUS_OFF, triggers[3].type);
+
+	ASSERT_INT_EQ(0, incident_parse_triggers(triggers, 8, ""));
+	ASSERT_INT_EQ(-1, incident_parse_triggers(triggers, 8, "emcy:200"));
+	ASSERT_INT_EQ(-1, incident_parse_triggers(triggers, 8, "foo"));
+	ASSERT_INT_EQ(-1, incident_parse_triggers(triggers, 8, "emcy:1:2:3"));
+	ASSERT_INT_EQ(-1, incident_parse_triggers(triggers, 1, "emcy bus-off"));
+
+	return 0;
+}
+
+static int test_match()
+{
+	struct incident_trigger trigger = {
+		.type = INCIDENT_TRIGGER_EMCY,
+		.nodeid = 5,
+		.code = INCIDENT_ANY,
+	};
+
+	ASSERT_TRUE(incident_trigger_is_match(&trigger, INCIDENT_TRIGGER_EMCY,
+					      5, 0x1000));
+	ASSERT_FALSE(incident_trigger_is_match(&trigger, INCIDENT_TRIGGER_EMCY,
+					       6, 0x1000));
+	ASSERT_FALSE(incident_trigger_is_match(&trigger,
+					       INCIDENT_TRIGGER_SDO_ABORT,
+					       5, 0x1000));
+
+	trigger.code = 0x8130;
+	ASSERT_FALSE(incident_trigger_is_match(&trigger, INCIDENT_TRIGGER_EMCY,
+					       5, 0x1000));
+
+	return 0;
+}
+
+static int test_write_frames()
+{
+	struct tb_frame frames[10];
+	memset(frames, 0, sizeof(frames));
+
+	for (int i = 0; i < 10; ++i) {
+		frames[i].timestamp = 1000 + i * 10;
+		frames[i].cf.can_id = i;
+	}
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(3, incident_write_frames(stream, frames, 10, 1020, 1040,
+					       0));
+	fclose(stream);
+
+	ASSERT_INT_EQ(3 * sizeof(struct tb_frame), size);
+	ASSERT_INT_EQ(2, ((struct tb_frame*)buffer)[0].cf.can_id);
+	free(buffer);
+
+	stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(10, incident_write_frames(stream, frames, 10, 0, ~0ULL,
+						1));
+	fclose(stream);
+
+	ASSERT_TRUE(tf_is_trace_file(buffer));
+	free(buffer);
+
+	return 0;
+}
+
+static int touch(const char* dir, const char* name, time_t mtime)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	FILE* stream = fopen(path, "w");
+	if (!stream)
+		return -1;
+	fclose(stream);
+
+	struct utimbuf times = { .actime = mtime, .modtime = mtime };
+	return utime(path, &times);
+}
+
+static int exists(const char* dir, const char* name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return access(path, F_OK) == 0;
+}
+
+static int test_prune_files()
+{
+	char dir[] = "/tmp/unit_incident.XXXXXX";
+	ASSERT_TRUE(mkdtemp(dir) != NULL);
+
+	/* More files than INCIDENT_HISTORY, e.g. left by an earlier run */
+	for (int i = 0; i < 100; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "incident-%03d-emcy%s", i,
+			 i % 2 ? TF_FILE_SUFFIX : TF_RAW_FILE_SUFFIX);
+		ASSERT_INT_EQ(0, touch(dir, name, 1000000 + i));
+	}
+
+	ASSERT_INT_EQ(0, touch(dir, "bootup.trace", 0));
+
+	ASSERT_INT_EQ(97, incident_prune_files(dir, 3));
+
+	ASSERT_TRUE(exists(dir, "incident-099-emcy" TF_FILE_SUFFIX));
+	ASSERT_TRUE(exists(dir, "incident-098-emcy" TF_RAW_FILE_SUFFIX));
+	ASSERT_TRUE(exists(dir, "incident-097-emcy" TF_FILE_SUFFIX));
+	ASSERT_FALSE(exists(dir, "incident-096-emcy" TF_RAW_FILE_SUFFIX));
+	ASSERT_FALSE(exists(dir, "incident-000-emcy" TF_RAW_FILE_SUFFIX));
+	ASSERT_TRUE(exists(dir, "bootup.trace"));
+
+	ASSERT_INT_EQ(0, incident_prune_files(dir, 3));
+
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "rm -r %s", dir);
+	ASSERT_INT_EQ(0, system(cmd));
+
+	return 0;
+}
+
+static int test_trigger_and_rate_limit()
+{
+	struct tracebuffer tb;
+	ASSERT_INT_EQ(0, tb_init(&tb, 16 * sizeof(struct tb_frame)));
+
+	struct incident_config config = {
+		.path = "/tmp",
+		.post_trigger = 1000,
+		.min_interval = 60000,
+	};
+
+	ASSERT_INT_EQ(0, incident_init(&tb, &config, "emcy:5:0x8130"));
+	ASSERT_FALSE(incident_wants_error_frames());
+
+	struct can_frame cf = { .can_id = 0x86, .can_dlc = 8 };
+	cf.data[0] = 0x30;
+	cf.data[1] = 0x81;
+	incident_feed(&cf);
+	ASSERT_FALSE(incident_get(1));
+
+	cf.can_id = 0x85;
+	incident_feed(&cf);
+
+	const struct incident* incident = incident_get(1);
+	ASSERT_TRUE(incident);
+	ASSERT_INT_EQ(INCIDENT_PENDING, incident->state);
+	ASSERT_STR_EQ("emcy:5:0x8130", incident->trigger);
+	ASSERT_TRUE(incident->end - incident->time == 1000000);
+	ASSERT_TRUE(incident->begin == 0);
+
+	ASSERT_INT_EQ(-1, incident_trigger(INCIDENT_TRIGGER_REST, INCIDENT_ANY,
+					   INCIDENT_ANY));
+	ASSERT_INT_EQ(1, incident->n_suppressed);
+	ASSERT_FALSE(incident_get(2));
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&buffer, &size);
+	incident_print_json(out);
+	fclose(out);
+
+	ASSERT_TRUE(strstr(buffer, "\"id\": 1, \"state\": \"pending\""));
+	ASSERT_TRUE(strstr(buffer, "\"suppressed\": 1"));
+	free(buffer);
+
+	incident_cleanup();
+	tb_destroy(&tb);
+	return 0;
+}
+
+static int test_sdo_abort_trigger()
+{
+	struct tracebuffer tb;
+	ASSERT_INT_EQ(0, tb_init(&tb, 16 * sizeof(struct tb_frame)));
+
+	struct incident_config config = {
+		.path = "/tmp",
+		.post_trigger = 1000,
+	};
+
+	ASSERT_INT_EQ(0, incident_init(&tb, &config,
+				       "sdo-abort:*:0x06020000 bus-off"));
+	ASSERT_TRUE(incident_wants_error_frames());
+
+	struct can_frame cf = { .can_id = 0x583, .can_dlc = 8 };
+	sdo_set_cs(&cf, SDO_SCS_ABORT);
+	sdo_set_abort_code(&cf, SDO_ABORT_NEXIST);
+	incident_feed(&cf);
+
+	const struct incident* incident = incident_get(1);
+	ASSERT_TRUE(incident);
+	ASSERT_STR_EQ("sdo-abort:3:0x6020000", incident->trigger);
+
+	cf.can_id = CAN_ERR_FLAG | 0x40;
+	cf.can_dlc = 8;
+	incident_feed(&cf);
+	ASSERT_TRUE(incident_get(2));
+
+	incident_cleanup();
+	tb_destroy(&tb);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_parse_triggers);
+	RUN_TEST(test_match);
+	RUN_TEST(test_write_frames);
+	RUN_TEST(test_prune_files);
+	RUN_TEST(test_trigger_and_rate_limit);
+	RUN_TEST(test_sdo_abort_trigger);
+	return r;
+}
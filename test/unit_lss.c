@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "tst.h"
+#include "fff.h"
+#include "socketcan.h"
+#include "sock.h"
+#include "canopen/lss.h"
+
+DEFINE_FFF_GLOBALS;
+
+FAKE_VALUE_FUNC(ssize_t, send, int, const void*, size_t, int);
+
+#define N_SLAVES 2
+
+static struct lss_slave slave_[N_SLAVES];
+static struct can_frame sent_[8];
+static int n_sent_;
+
+static int n_done_;
+static int status_;
+
+static ssize_t capture_send(int fd, const void* data, size_t size, int flags)
+{
+	(void)fd;
+	(void)flags;
+
+	if (n_sent_ < 8)
+		memcpy(&sent_[n_sent_++], data, sizeof(struct can_frame));
+
+	return size;
+}
+
+static void on_done(struct co_lss* lss, int status)
+{
+	(void)lss;
+	++n_done_;
+	status_ = status;
+}
+
+/* Delivers everything the master sent to the slaves and the answers back to
+ * the master, then lets the step time out unless the operation finished.
+ */
+static void run_bus(struct co_lss* lss)
+{
+	int i, k;
+
+	for (int step = 0; step < 1000 && n_done_ == 0; ++step) {
+		int n_sent = n_sent_;
+		n_sent_ = 0;
+
+		for (i = 0; i < n_sent; ++i)
+			for (k = 0; k < N_SLAVES; ++k) {
+				struct can_frame response;
+				if (lss_slave_feed(&slave_[k], &sent_[i],
+						   &response))
+					co_lss_feed(lss, &response);
+			}
+
+		if (n_done_ == 0 && co_lss_is_busy(lss))
+			co_lss__on_timeout(lss);
+	}
+}
+
+static int setup(struct co_lss* lss, struct sock* sock)
+{
+	static const struct lss_address address[N_SLAVES] = {
+		{ { 0x0000012e, 0x00001234, 0x00010002, 0xdeadbeef } },
+		{ { 0x0000012e, 0x00001234, 0x00010002, 0x0badcafe } },
+	};
+
+	RESET_FAKE(send);
+	send_fake.custom_fake = capture_send;
+	n_sent_ = 0;
+
+	for (int i = 0; i < N_SLAVES; ++i)
+		lss_slave_init(&slave_[i], &address[i],
+			       LSS_NODEID_UNCONFIGURED);
+
+	ASSERT_INT_EQ(0, co_lss_init(lss, sock));
+	return 0;
+}
+
+static int assign_one(struct co_lss* lss, int nodeid)
+{
+	n_done_ = 0;
+	co_lss_switch_global(lss, LSS_MODE_WAITING);
+	ASSERT_INT_EQ(0, co_lss_fastscan(lss, on_done));
+	run_bus(lss);
+	ASSERT_INT_EQ(1, n_done_);
+
+	if (status_ != 0)
+		return status_;
+
+	n_done_ = 0;
+	ASSERT_INT_EQ(0, co_lss_configure_node_id(lss, nodeid, on_done));
+	run_bus(lss);
+	ASSERT_INT_EQ(1, n_done_);
+	ASSERT_INT_EQ(0, status_);
+
+	n_done_ = 0;
+	ASSERT_INT_EQ(0, co_lss_store_configuration(lss, on_done));
+	run_bus(lss);
+	ASSERT_INT_EQ(1, n_done_);
+	ASSERT_INT_EQ(0, status_);
+
+	return 0;
+}
+
+static int test_fastscan_assigns_node_ids()
+{
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct co_lss lss;
+	ASSERT_INT_EQ(0, setup(&lss, &sock));
+
+	ASSERT_INT_EQ(0, assign_one(&lss, 20));
+	ASSERT_UINT_EQ(0x0badcafe, lss.address.id[3]);
+	ASSERT_UINT_EQ(0x00001234, lss.address.id[1]);
+	ASSERT_INT_EQ(20, slave_[1].nodeid);
+	ASSERT_TRUE(slave_[1].is_stored);
+	ASSERT_INT_EQ(LSS_NODEID_UNCONFIGURED, slave_[0].nodeid);
+
+	ASSERT_INT_EQ(0, assign_one(&lss, 21));
+	ASSERT_UINT_EQ(0xdeadbeef, lss.address.id[3]);
+	ASSERT_INT_EQ(21, slave_[0].nodeid);
+
+	ASSERT_INT_EQ(-1, assign_one(&lss, 22));
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+static int test_switch_selective()
+{
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct co_lss lss;
+	ASSERT_INT_EQ(0, setup(&lss, &sock));
+
+	struct lss_address address = slave_[0].address;
+
+	n_done_ = 0;
+	ASSERT_INT_EQ(0, co_lss_switch_selective(&lss, &address, on_done));
+	ASSERT_INT_EQ(4, n_sent_);
+	run_bus(&lss);
+	ASSERT_INT_EQ(1, n_done_);
+	ASSERT_INT_EQ(0, status_);
+	ASSERT_INT_EQ(LSS_MODE_CONFIGURATION, slave_[0].mode);
+	ASSERT_INT_EQ(LSS_MODE_WAITING, slave_[1].mode);
+
+	n_done_ = 0;
+	ASSERT_INT_EQ(0, co_lss_configure_bit_timing(&lss, 5, on_done));
+	run_bus(&lss);
+	ASSERT_INT_EQ(1, status_);
+
+	n_done_ = 0;
+	ASSERT_INT_EQ(0, co_lss_configure_bit_timing(&lss, 3, on_done));
+	run_bus(&lss);
+	ASSERT_INT_EQ(0, status_);
+	ASSERT_INT_EQ(3, slave_[0].bit_timing);
+
+	address.id[3] = 0x12345678;
+	n_done_ = 0;
+	co_lss_switch_global(&lss, LSS_MODE_WAITING);
+	ASSERT_INT_EQ(0, co_lss_switch_selective(&lss, &address, on_done));
+	run_bus(&lss);
+	ASSERT_INT_EQ(-1, status_);
+
+	co_lss_destroy(&lss);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_fastscan_assigns_node_ids);
+	RUN_TEST(test_switch_selective);
+	return r;
+}
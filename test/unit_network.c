@@ -19,6 +19,7 @@ FAKE_VALUE_FUNC(int, poll, struct pollfd*, nfds_t, int);
 FAKE_VALUE_FUNC(ssize_t, read, int, void*, size_t);
 FAKE_VALUE_FUNC(ssize_t, write, int, const void*, size_t);
 FAKE_VALUE_FUNC(int, clock_gettime, clockid_t, struct timespec*);
+FAKE_VALUE_FUNC(ssize_t, send, int, const void*, size_t, int);
 
 int test_net_write()
 {
@@ -171,11 +172,97 @@ int test_net__wait_for_bootup()
 	return 0;
 }
 
+static int discovery_n_nodes_;
+static int discovery_last_node_;
+static int discovery_n_done_;
+
+static void on_discovery_node(struct co_net_discovery* discovery, int nodeid)
+{
+	(void)discovery;
+	++discovery_n_nodes_;
+	discovery_last_node_ = nodeid;
+}
+
+static void on_discovery_done(struct co_net_discovery* discovery)
+{
+	(void)discovery;
+	++discovery_n_done_;
+}
+
+static void make_heartbeat(struct can_frame* cf, int nodeid, int state)
+{
+	memset(cf, 0, sizeof(*cf));
+	cf->can_id = R_HEARTBEAT + nodeid;
+	cf->can_dlc = 1;
+	heartbeat_set_state(cf, state);
+}
+
+int test_net_discovery()
+{
+	RESET_FAKE(send);
+	send_fake.return_val = sizeof(struct can_frame);
+
+	discovery_n_nodes_ = 0;
+	discovery_n_done_ = 0;
+
+	struct sock sock = { .fd = 42, .type = SOCK_TYPE_CAN };
+	struct co_net_discovery discovery;
+	struct can_frame cf;
+
+	char nodes_seen[128];
+	memset(nodes_seen, 0, sizeof(nodes_seen));
+
+	ASSERT_INT_EQ(0, co_net_discovery_init(&discovery, &sock, nodes_seen,
+					       1, 10));
+	discovery.on_node = on_discovery_node;
+	discovery.on_done = on_discovery_done;
+
+	co_net_discovery_expect(&discovery, 3);
+	co_net_discovery_expect(&discovery, 5);
+	co_net_discovery_expect(&discovery, 5);
+	co_net_discovery_expect(&discovery, 20);
+	ASSERT_UINT_EQ(2, discovery.n_expected);
+	ASSERT_UINT_EQ(2, discovery.n_missing);
+
+	make_heartbeat(&cf, 3, NMT_STATE_BOOTUP);
+	ASSERT_INT_LT(0, co_net_discovery_feed(&discovery, &cf));
+
+	ASSERT_INT_EQ(0, co_net_discovery_start(&discovery));
+	ASSERT_INT_EQ(10, send_fake.call_count);
+
+	ASSERT_INT_EQ(0, co_net_discovery_feed(&discovery, &cf));
+	ASSERT_INT_LT(0, co_net_discovery_feed(&discovery, &cf));
+	ASSERT_INT_EQ(1, discovery_n_nodes_);
+	ASSERT_INT_EQ(3, discovery_last_node_);
+	ASSERT_TRUE(nodes_seen[3]);
+
+	make_heartbeat(&cf, 11, NMT_STATE_BOOTUP);
+	ASSERT_INT_LT(0, co_net_discovery_feed(&discovery, &cf));
+
+	make_heartbeat(&cf, 7, NMT_STATE_OPERATIONAL);
+	ASSERT_INT_EQ(0, co_net_discovery_feed(&discovery, &cf));
+	ASSERT_INT_EQ(2, discovery_n_nodes_);
+	ASSERT_INT_EQ(0, discovery_n_done_);
+
+	make_heartbeat(&cf, 5, NMT_STATE_BOOTUP);
+	ASSERT_INT_EQ(0, co_net_discovery_feed(&discovery, &cf));
+	ASSERT_INT_EQ(3, discovery_n_nodes_);
+	ASSERT_INT_EQ(1, discovery_n_done_);
+	ASSERT_FALSE(discovery.is_running);
+
+	make_heartbeat(&cf, 8, NMT_STATE_BOOTUP);
+	ASSERT_INT_LT(0, co_net_discovery_feed(&discovery, &cf));
+
+	co_net_discovery_destroy(&discovery);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_net_write);
 	RUN_TEST(test_net_read);
+	RUN_TEST(test_net_discovery);
 //	RUN_TEST(test_net__send_nmt);
 //	RUN_TEST(test_net__wait_for_bootup);
 	return r;
@@ -0,0 +1,96 @@
+#include "tst.h"
+#include "canopen/nodeset.h"
+
+static int test_add_remove()
+{
+	struct co_nodeset set;
+	co_nodeset_clear(&set);
+
+	ASSERT_TRUE(co_nodeset_is_empty(&set));
+
+	co_nodeset_add(&set, 1);
+	co_nodeset_add(&set, 64);
+	co_nodeset_add(&set, 127);
+	co_nodeset_assign(&set, 5, 1);
+
+	ASSERT_FALSE(co_nodeset_is_empty(&set));
+	ASSERT_UINT_EQ(4, co_nodeset_count(&set));
+	ASSERT_TRUE(co_nodeset_has(&set, 64));
+	ASSERT_FALSE(co_nodeset_has(&set, 63));
+
+	co_nodeset_remove(&set, 64);
+	co_nodeset_assign(&set, 5, 0);
+	ASSERT_FALSE(co_nodeset_has(&set, 64));
+	ASSERT_UINT_EQ(2, co_nodeset_count(&set));
+
+	return 0;
+}
+
+static int test_next_prev()
+{
+	struct co_nodeset set;
+	co_nodeset_clear(&set);
+
+	ASSERT_INT_EQ(-1, co_nodeset_next(&set, 0));
+	ASSERT_INT_EQ(-1, co_nodeset_prev(&set, 127));
+
+	co_nodeset_add(&set, 0);
+	co_nodeset_add(&set, 63);
+	co_nodeset_add(&set, 100);
+
+	ASSERT_INT_EQ(0, co_nodeset_next(&set, 0));
+	ASSERT_INT_EQ(63, co_nodeset_next(&set, 1));
+	ASSERT_INT_EQ(100, co_nodeset_next(&set, 64));
+	ASSERT_INT_EQ(-1, co_nodeset_next(&set, 101));
+	ASSERT_INT_EQ(-1, co_nodeset_next(&set, 128));
+
+	ASSERT_INT_EQ(100, co_nodeset_prev(&set, 127));
+	ASSERT_INT_EQ(63, co_nodeset_prev(&set, 99));
+	ASSERT_INT_EQ(0, co_nodeset_prev(&set, 62));
+
+	return 0;
+}
+
+static int test_for_each()
+{
+	struct co_nodeset set;
+	int nodes[4];
+	int n = 0;
+	int i;
+
+	co_nodeset_clear(&set);
+	co_nodeset_add(&set, 3);
+	co_nodeset_add(&set, 70);
+	co_nodeset_add(&set, 127);
+
+	/* Removing members while iterating is allowed */
+	co_nodeset_for_each(i, &set) {
+		nodes[n++] = i;
+		co_nodeset_remove(&set, 70);
+	}
+
+	ASSERT_INT_EQ(2, n);
+	ASSERT_INT_EQ(3, nodes[0]);
+	ASSERT_INT_EQ(127, nodes[1]);
+
+	n = 0;
+	co_nodeset_add(&set, 1);
+	co_nodeset_for_each_reverse(i, &set)
+		nodes[n++] = i;
+
+	ASSERT_INT_EQ(3, n);
+	ASSERT_INT_EQ(127, nodes[0]);
+	ASSERT_INT_EQ(3, nodes[1]);
+	ASSERT_INT_EQ(1, nodes[2]);
+
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_add_remove);
+	RUN_TEST(test_next_prev);
+	RUN_TEST(test_for_each);
+	return r;
+}
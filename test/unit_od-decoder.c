@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include "tst.h"
+#include "od-decoder.h"
+#include "canopen/dcf.h"
+
+static struct od_decoder decoder_;
+
+static void learn_u32(int nodeid, int index, int subindex, uint32_t value)
+{
+	uint8_t data[4] = { value, value >> 8, value >> 16, value >> 24 };
+	od_decoder_learn(&decoder_, nodeid, index, subindex, data, 4);
+}
+
+static int test_unknown_mapping()
+{
+	char buffer[256];
+	uint8_t data[2] = { 0 };
+
+	od_decoder_init(&decoder_);
+
+	ASSERT_INT_EQ(-1, od_decoder_decode_pdo(&decoder_, buffer,
+						sizeof(buffer), 5,
+						OD_DECODER_TPDO, 1, data, 2));
+	ASSERT_INT_EQ(-1, od_decoder_decode_pdo(&decoder_, buffer,
+						sizeof(buffer), 0,
+						OD_DECODER_TPDO, 1, data, 2));
+	ASSERT_FALSE(od_decoder_find(&decoder_, 5, 0x1000, 0));
+	return 0;
+}
+
+static int test_learned_mapping()
+{
+	char buffer[256];
+	uint8_t data[4] = { 0x2a, 0x05, 0x34, 0x12 };
+
+	od_decoder_init(&decoder_);
+
+	learn_u32(5, 0x1A01, 0, 0);
+	learn_u32(5, 0x1A01, 1, 0x10010008);
+	learn_u32(5, 0x1A01, 2, 0x00050004);
+	learn_u32(5, 0x1A01, 3, 0x20000104);
+	learn_u32(5, 0x1A01, 4, 0x20000210);
+	learn_u32(5, 0x1A01, 0, 4);
+
+	ASSERT_INT_EQ(0, od_decoder_decode_pdo(&decoder_, buffer,
+					       sizeof(buffer), 5,
+					       OD_DECODER_TPDO, 2, data, 4));
+	ASSERT_STR_EQ("{error-register=42, 2000:1=0, 2000:2=0x1234}", buffer);
+
+	/* Entries that do not fit in the frame are left out */
+	ASSERT_INT_EQ(0, od_decoder_decode_pdo(&decoder_, buffer,
+					       sizeof(buffer), 5,
+					       OD_DECODER_TPDO, 2, data, 1));
+	ASSERT_STR_EQ("{error-register=42}", buffer);
+
+	ASSERT_INT_EQ(-1, od_decoder_decode_pdo(&decoder_, buffer,
+						sizeof(buffer), 5,
+						OD_DECODER_RPDO, 2, data, 4));
+	ASSERT_INT_EQ(-1, od_decoder_decode_pdo(&decoder_, buffer,
+						sizeof(buffer), 6,
+						OD_DECODER_TPDO, 2, data, 4));
+	return 0;
+}
+
+static int test_dcf_mapping()
+{
+	struct co_dcf dcf;
+	char buffer[256];
+	uint8_t n = 1;
+	uint32_t entry = 0x10000020;
+	uint8_t data[4] = { 0x91, 0x01, 0x02, 0x00 };
+
+	od_decoder_init(&decoder_);
+
+	ASSERT_INT_EQ(0, co_dcf_init(&dcf));
+	ASSERT_INT_EQ(0, co_dcf_add(&dcf, 0x1600, 0, &n, 1));
+	ASSERT_INT_EQ(0, co_dcf_add(&dcf, 0x1600, 1, &entry, 4));
+	ASSERT_INT_EQ(0, od_decoder_load_dcf(&decoder_, 7, &dcf));
+	co_dcf_destroy(&dcf);
+
+	ASSERT_INT_EQ(0, od_decoder_decode_pdo(&decoder_, buffer,
+					       sizeof(buffer), 7,
+					       OD_DECODER_RPDO, 1, data, 4));
+	ASSERT_STR_EQ("{device-type=131473}", buffer);
+	return 0;
+}
+
+static int test_format()
+{
+	char buffer[16];
+	uint8_t value[] = { 0xfe, 0xff };
+
+	od_decoder_init(&decoder_);
+
+	ASSERT_STR_EQ("\"abc\"", od_decoder_format(&decoder_, buffer,
+						   sizeof(buffer), 1, 0x1008,
+						   0, "abc", 3));
+	ASSERT_STR_EQ("65534", od_decoder_format(&decoder_, buffer,
+						 sizeof(buffer), 1, 0x1017,
+						 0, value, 2));
+	ASSERT_PTR_EQ(NULL, od_decoder_format(&decoder_, buffer,
+					      sizeof(buffer), 1, 0x2000, 0,
+					      value, 2));
+	return 0;
+}
+
+static int test_truncated_output()
+{
+	char buffer[8];
+	uint8_t data[1] = { 1 };
+
+	od_decoder_init(&decoder_);
+
+	learn_u32(1, 0x1A00, 1, 0x10010008);
+	learn_u32(1, 0x1A00, 0, 1);
+
+	ASSERT_INT_EQ(-1, od_decoder_decode_pdo(&decoder_, buffer,
+						sizeof(buffer), 1,
+						OD_DECODER_TPDO, 1, data, 1));
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_unknown_mapping);
+	RUN_TEST(test_learned_mapping);
+	RUN_TEST(test_dcf_mapping);
+	RUN_TEST(test_format);
+	RUN_TEST(test_truncated_output);
+	return r;
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "tst.h"
+#include "socketcan.h"
+#include "sock.h"
+#include "trace-buffer.h"
+#include "canopen.h"
+#include "canopen/replay.h"
+
+static char path_[] = "/tmp/unit_replay_XXXXXX";
+static struct sock sock_;
+static int peer_ = -1;
+
+static struct tb_frame make_frame(uint64_t timestamp, uint32_t can_id,
+				  const char* data, size_t size)
+{
+	struct tb_frame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.timestamp = timestamp;
+	frame.cf.can_id = can_id;
+	frame.cf.can_dlc = size;
+	memcpy(frame.cf.data, data, size);
+	return frame;
+}
+
+static int write_trace(const struct tb_frame* frames, size_t n)
+{
+	int fd = mkstemp(path_);
+	if (fd < 0)
+		return -1;
+
+	ssize_t size = write(fd, frames, n * sizeof(*frames));
+	close(fd);
+	return size == (ssize_t)(n * sizeof(*frames)) ? 0 : -1;
+}
+
+static int open_pair(void)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		return -1;
+
+	sock_init(&sock_, SOCK_TYPE_TCP, fds[0], NULL);
+	peer_ = fds[1];
+	return 0;
+}
+
+static void close_pair(void)
+{
+	sock_close(&sock_);
+	close(peer_);
+	unlink(path_);
+	strcpy(path_, "/tmp/unit_replay_XXXXXX");
+}
+
+static int read_frame(struct can_frame* cf)
+{
+	if (read(peer_, cf, sizeof(*cf)) != sizeof(*cf))
+		return -1;
+
+	cf->can_id = ntohl(cf->can_id);
+	return 0;
+}
+
+static int write_frame(uint32_t can_id, const char* data, size_t size)
+{
+	struct can_frame cf;
+
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = htonl(can_id);
+	cf.can_dlc = size;
+	memcpy(cf.data, data, size);
+	return write(peer_, &cf, sizeof(cf)) == sizeof(cf) ? 0 : -1;
+}
+
+static int test_filter()
+{
+	struct tb_frame frames[] = {
+		make_frame(1000, 0x000, "\x01\x05", 2),
+		make_frame(2000, 0x185, "\x11", 1),
+		make_frame(3000, 0x186, "\x22", 1),
+		make_frame(4000, 0x705, "\x05", 1),
+	};
+	struct co_replay_options options = {
+		.objects = CANOPEN_TPDO1 | CANOPEN_HEARTBEAT,
+	};
+	struct co_replay_stats stats;
+	struct can_frame cf;
+
+	ASSERT_INT_EQ(0, write_trace(frames, 4));
+	ASSERT_INT_EQ(0, open_pair());
+
+	co_nodeset_add(&options.nodes, 5);
+
+	ASSERT_INT_EQ(0, co_replay_sock(path_, &sock_, &options, &stats));
+	ASSERT_UINT_EQ(2, stats.n_frames);
+	ASSERT_UINT_EQ(2, stats.n_filtered);
+	ASSERT_UINT_EQ(0, stats.lateness.count);
+	ASSERT_UINT_EQ(2000, stats.trace_duration);
+
+	ASSERT_INT_EQ(0, read_frame(&cf));
+	ASSERT_UINT_EQ(0x185, cf.can_id);
+	ASSERT_UINT_EQ(0x11, cf.data[0]);
+	ASSERT_INT_EQ(0, read_frame(&cf));
+	ASSERT_UINT_EQ(0x705, cf.can_id);
+
+	close_pair();
+	return 0;
+}
+
+static int test_timing()
+{
+	struct tb_frame frames[] = {
+		make_frame(1000000, 0x185, "\x01", 1),
+		make_frame(1020000, 0x185, "\x02", 1),
+		make_frame(1040000, 0x185, "\x03", 1),
+	};
+	struct co_replay_options options = { .speed = 2.0 };
+	struct co_replay_stats stats;
+
+	ASSERT_INT_EQ(0, write_trace(frames, 3));
+	ASSERT_INT_EQ(0, open_pair());
+
+	ASSERT_INT_EQ(0, co_replay_sock(path_, &sock_, &options, &stats));
+	ASSERT_UINT_EQ(3, stats.n_frames);
+	ASSERT_UINT_EQ(3, stats.lateness.count);
+	ASSERT_UINT_EQ(40000, stats.trace_duration);
+	ASSERT_TRUE(stats.duration >= 20000);
+	ASSERT_TRUE(stats.duration < 1000000);
+
+	close_pair();
+	return 0;
+}
+
+static int test_responder()
+{
+	struct tb_frame frames[] = {
+		make_frame(1000, 0x605, "\x40\x18\x10\x01\0\0\0\0", 8),
+		make_frame(2000, 0x585, "\x43\x18\x10\x01\x78\x56\x34\x12", 8),
+		make_frame(10000, 0x705, "\x05", 1),
+		make_frame(30000, 0x705, "\x05", 1),
+	};
+	struct co_replay_options options = {
+		.speed = 1.0,
+		.is_responder = 1,
+	};
+	struct co_replay_stats stats;
+	struct can_frame cf;
+	int n_heartbeats = 0;
+	int n_responses = 0;
+
+	ASSERT_INT_EQ(0, write_trace(frames, 4));
+	ASSERT_INT_EQ(0, open_pair());
+
+	ASSERT_INT_EQ(0, write_frame(0x605, "\x40\x18\x10\x01\0\0\0\0", 8));
+	ASSERT_INT_EQ(0, write_frame(0x605, "\x40\x18\x10\x02\0\0\0\0", 8));
+
+	ASSERT_INT_EQ(0, co_replay_sock(path_, &sock_, &options, &stats));
+	ASSERT_UINT_EQ(2, stats.n_frames);
+	ASSERT_UINT_EQ(2, stats.n_filtered);
+	ASSERT_UINT_EQ(2, stats.n_requests);
+	ASSERT_UINT_EQ(1, stats.n_responses);
+	ASSERT_UINT_EQ(1, stats.n_unanswered);
+
+	for (int i = 0; i < 3; ++i) {
+		ASSERT_INT_EQ(0, read_frame(&cf));
+
+		if (cf.can_id == 0x705) {
+			n_heartbeats++;
+		} else {
+			ASSERT_UINT_EQ(0x585, cf.can_id);
+			ASSERT_UINT_EQ(0x78, cf.data[4]);
+			n_responses++;
+		}
+	}
+
+	ASSERT_INT_EQ(2, n_heartbeats);
+	ASSERT_INT_EQ(1, n_responses);
+
+	close_pair();
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_filter);
+	RUN_TEST(test_timing);
+	RUN_TEST(test_responder);
+	return r;
+}
@@ -2,6 +2,7 @@
 #include "fff.h"
 #include "canopen/sdo_req.h"
 #include "sock.h"
+#include "canopen.h"
 
 DEFINE_FFF_GLOBALS;
 
@@ -16,6 +17,15 @@ FAKE_VALUE_FUNC(void*, mloop_idle_get_context, const struct mloop_idle*);
 FAKE_VOID_FUNC(mloop_idle_set_idle_fn, struct mloop_idle*, mloop_idle_fn);
 FAKE_VOID_FUNC(mloop_idle_set_cond_fn, struct mloop_idle*, mloop_idle_cond_fn);
 FAKE_VOID_FUNC(mloop_idle_set_priority, struct mloop_idle*, unsigned long);
+FAKE_VALUE_FUNC(struct mloop_timer*, mloop_timer_new, struct mloop*);
+FAKE_VALUE_FUNC(int, mloop_timer_start, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_stop, struct mloop_timer*);
+FAKE_VALUE_FUNC(int, mloop_timer_unref, struct mloop_timer*);
+FAKE_VOID_FUNC(mloop_timer_set_time, struct mloop_timer*, uint64_t);
+FAKE_VOID_FUNC(mloop_timer_set_context, struct mloop_timer*, void*,
+	       mloop_free_fn);
+FAKE_VOID_FUNC(mloop_timer_set_callback, struct mloop_timer*, mloop_timer_fn);
+FAKE_VALUE_FUNC(void*, mloop_timer_get_context, const struct mloop_timer*);
 FAKE_VALUE_FUNC(int, sdo_async_init, struct sdo_async*, const struct sock*,
 		int);
 FAKE_VALUE_FUNC(int, sdo_async_stop, struct sdo_async*);
@@ -23,6 +33,30 @@ FAKE_VOID_FUNC(sdo_async_destroy, struct sdo_async*);
 FAKE_VALUE_FUNC(int, sdo_async_start, struct sdo_async*,
 		const struct sdo_async_info*);
 
+void sdo_req__process_queue(struct mloop_idle* idle);
+int sdo_req__have_req(struct mloop_idle* idle);
+void sdo_req__on_done(struct sdo_async* async);
+
+static int fake_sdo_async_init(struct sdo_async* async,
+			       const struct sock* sock, int nodeid)
+{
+	memset(async, 0, sizeof(*async));
+	if (sock)
+		async->sock = *sock;
+	async->nodeid = nodeid;
+	async->rsdo_cob_id = R_RSDO + nodeid;
+	async->tsdo_cob_id = R_TSDO + nodeid;
+	return 0;
+}
+
+static int fake_sdo_async_start(struct sdo_async* async,
+				const struct sdo_async_info* info)
+{
+	async->is_running = 1;
+	async->type = info->type;
+	return 0;
+}
+
 static int test_req_new_free()
 {
 	int dl_data = 1337;
@@ -53,13 +87,16 @@ static int test_req_new_free()
 static int test_req_queue_init_destroy()
 {
 	RESET_FAKE(sdo_async_init);
-	sdo_async_init_fake.return_val = 0;
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
 
 	struct mloop_idle* idle = (void*)0xdeadbeef;
 
 	RESET_FAKE(mloop_idle_new);
 	mloop_idle_new_fake.return_val = idle;
 
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
 	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
 
 	struct sdo_req_queue queue;
@@ -78,7 +115,10 @@ static int test_req_queue_init_destroy()
 static int test_req_queue_enqueue_dequeue()
 {
 	RESET_FAKE(sdo_async_init);
-	sdo_async_init_fake.return_val = 0;
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
+
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
 
 	struct sdo_req_queue queue;
 	sdo_req__queue_init(&queue, 0, 0, 3, 0);
@@ -105,6 +145,44 @@ static int test_req_queue_enqueue_dequeue()
 	return 0;
 }
 
+static int test_req_cancel()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
+
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 0, 3, 0);
+
+	struct sdo_req_info info = { .type = SDO_REQ_UPLOAD };
+	struct sdo_req* a = sdo_req_new(&info);
+	struct sdo_req* b = sdo_req_new(&info);
+
+	ASSERT_INT_LT(0, sdo_req_cancel(a));
+
+	ASSERT_INT_EQ(0, sdo_req_start(a, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(b, &queue));
+	ASSERT_INT_EQ(2, a->ref);
+
+	ASSERT_PTR_EQ(a, sdo_req_queue__dequeue(&queue));
+	ASSERT_INT_LT(0, sdo_req_cancel(a));
+
+	ASSERT_INT_EQ(0, sdo_req_cancel(b));
+	ASSERT_INT_EQ(SDO_REQ_CANCELLED, b->status);
+	ASSERT_INT_EQ(1, b->ref);
+	ASSERT_UINT_EQ(0, queue.size);
+	ASSERT_TRUE(TAILQ_EMPTY(&queue.list));
+
+	sdo_req_unref(a);
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
 static int test_req_queue_from_async()
 {
 	struct sdo_req_queue queue;
@@ -112,12 +190,370 @@ static int test_req_queue_from_async()
 	return 0;
 }
 
+static int test_rtt_estimator()
+{
+	struct sdo_rtt rtt = { 0 };
+
+	ASSERT_INT_EQ(1000, sdo_rtt_timeout(&rtt, 10, 1000));
+
+	sdo_rtt_sample(&rtt, 8000);
+	ASSERT_INT_EQ(8000, rtt.srtt);
+	ASSERT_INT_EQ(4000, rtt.rttvar);
+	ASSERT_INT_EQ(24, sdo_rtt_timeout(&rtt, 10, 1000));
+	ASSERT_INT_EQ(100, sdo_rtt_timeout(&rtt, 100, 1000));
+	ASSERT_INT_EQ(20, sdo_rtt_timeout(&rtt, 10, 20));
+
+	sdo_rtt_sample(&rtt, 16000);
+	ASSERT_INT_EQ(9000, rtt.srtt);
+	ASSERT_INT_EQ(5000, rtt.rttvar);
+
+	return 0;
+}
+
+static int test_rtt_backoff()
+{
+	struct sdo_rtt rtt = { 0 };
+
+	ASSERT_INT_EQ(1000, sdo_rtt_timeout(&rtt, 10, 5000));
+
+	sdo_rtt_timed_out(&rtt);
+	ASSERT_INT_EQ(2000, sdo_rtt_timeout(&rtt, 10, 5000));
+
+	sdo_rtt_sample(&rtt, 8000);
+	ASSERT_INT_EQ(24, sdo_rtt_timeout(&rtt, 10, 5000));
+
+	for (int i = 0; i < 10; ++i)
+		sdo_rtt_timed_out(&rtt);
+	ASSERT_INT_EQ(24 << SDO_RTT_BACKOFF_MAX,
+		      sdo_rtt_timeout(&rtt, 10, 5000));
+	ASSERT_INT_EQ(200, sdo_rtt_timeout(&rtt, 10, 200));
+
+	sdo_rtt_reset(&rtt);
+	ASSERT_FALSE(rtt.has_sample);
+	ASSERT_INT_EQ(1000, sdo_rtt_timeout(&rtt, 10, 5000));
+
+	return 0;
+}
+
+static int test_policy_parse_obj_timeouts()
+{
+	struct sdo_req_policy policy;
+	sdo_req_policy_init(&policy);
+
+	ASSERT_INT_EQ(0, sdo_req_policy_parse_obj_timeouts(&policy,
+				"1f50:1=10000, 0x2000=500"));
+	ASSERT_INT_EQ(2, policy.n_obj_timeouts);
+	ASSERT_INT_EQ(0x1f50, policy.obj_timeouts[0].index);
+	ASSERT_INT_EQ(1, policy.obj_timeouts[0].subindex);
+	ASSERT_INT_EQ(10000, policy.obj_timeouts[0].timeout);
+	ASSERT_INT_EQ(0x2000, policy.obj_timeouts[1].index);
+	ASSERT_INT_EQ(-1, policy.obj_timeouts[1].subindex);
+	ASSERT_INT_EQ(500, policy.obj_timeouts[1].timeout);
+
+	ASSERT_INT_EQ(0, sdo_req_policy_parse_obj_timeouts(&policy, ""));
+	ASSERT_INT_EQ(0, policy.n_obj_timeouts);
+
+	ASSERT_INT_LT(0, sdo_req_policy_parse_obj_timeouts(&policy, "1f50"));
+	ASSERT_INT_LT(0, sdo_req_policy_parse_obj_timeouts(&policy, "=5"));
+
+	return 0;
+}
+
+static int test_req_queue_timeout()
+{
+	struct sdo_req_queue queue;
+	memset(&queue, 0, sizeof(queue));
+	sdo_req_policy_init(&queue.policy);
+	queue.policy.timeout_min = 10;
+	queue.policy.timeout_max = 1000;
+
+	struct sdo_req req = { .index = 0x1f50, .subindex = 1 };
+	struct sdo_async* client = &queue.sdo_client;
+
+	struct sdo_async channel;
+	memset(&channel, 0, sizeof(channel));
+
+	ASSERT_INT_EQ(1000, sdo_req_queue__timeout(&queue, client, &req));
+
+	sdo_rtt_sample(&queue.sdo_client.rtt, 8000);
+	ASSERT_INT_EQ(24, sdo_req_queue__timeout(&queue, client, &req));
+	ASSERT_INT_EQ(1000, sdo_req_queue__timeout(&queue, &channel, &req));
+
+	sdo_rtt_sample(&channel.rtt, 100000);
+	ASSERT_INT_EQ(300, sdo_req_queue__timeout(&queue, &channel, &req));
+	ASSERT_INT_EQ(24, sdo_req_queue__timeout(&queue, client, &req));
+
+	queue.policy.timeout = 300;
+	ASSERT_INT_EQ(300, sdo_req_queue__timeout(&queue, client, &req));
+
+	sdo_req_policy_parse_obj_timeouts(&queue.policy, "1f50:2=7, 1f50=10000");
+	ASSERT_INT_EQ(10000, sdo_req_queue__timeout(&queue, client, &req));
+
+	req.subindex = 2;
+	ASSERT_INT_EQ(7, sdo_req_queue__timeout(&queue, client, &req));
+
+	return 0;
+}
+
+static int test_req_queue_channels()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
+
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
+	RESET_FAKE(sdo_async_start);
+	sdo_async_start_fake.custom_fake = fake_sdo_async_start;
+
+	struct sock sock = { .fd = 4, .type = SOCK_TYPE_CAN };
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, &sock, 42, 10, 0));
+
+	RESET_FAKE(mloop_idle_get_context);
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	ASSERT_INT_EQ(0, sdo_req_queue_add_channel(&queue, 0x6c0, 0x6e0));
+	ASSERT_INT_EQ(0, sdo_req_queue_add_channel(&queue, 0x6c0, 0x6e0));
+	ASSERT_INT_EQ(2, queue.n_channels);
+	ASSERT_PTR_EQ(queue.channels[1], sdo_req_channel_lookup(0x6e0));
+
+	struct sdo_req req[4];
+	memset(req, 0, sizeof(req));
+	req[0].type = SDO_REQ_UPLOAD;
+	req[1].type = SDO_REQ_UPLOAD;
+	req[2].type = SDO_REQ_DOWNLOAD;
+	req[3].type = SDO_REQ_UPLOAD;
+
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[0]));
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[1]));
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[2]));
+	ASSERT_INT_EQ(0, sdo_req_queue__enqueue(&queue, &req[3]));
+
+	/* Uploads run in parallel */
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+	sdo_req__process_queue(NULL);
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+	sdo_req__process_queue(NULL);
+
+	ASSERT_INT_EQ(2, sdo_async_start_fake.call_count);
+	ASSERT_PTR_EQ(&queue.sdo_client, sdo_async_start_fake.arg0_history[0]);
+	ASSERT_PTR_EQ(queue.channels[1], sdo_async_start_fake.arg0_history[1]);
+
+	/* The download waits for all uploads to finish */
+	queue.sdo_client.is_running = 0;
+	ASSERT_FALSE(sdo_req__have_req(NULL));
+
+	queue.channels[1]->is_running = 0;
+	ASSERT_TRUE(sdo_req__have_req(NULL));
+	sdo_req__process_queue(NULL);
+	ASSERT_INT_EQ(3, sdo_async_start_fake.call_count);
+	ASSERT_INT_EQ(SDO_REQ_DOWNLOAD, queue.sdo_client.type);
+
+	/* Nothing runs alongside the download */
+	ASSERT_FALSE(sdo_req__have_req(NULL));
+
+	sdo_req_queue_remove_channels(&queue);
+	ASSERT_INT_EQ(1, queue.n_channels);
+	ASSERT_PTR_EQ(NULL, sdo_req_channel_lookup(0x6e0));
+
+	while (sdo_req_queue__dequeue(&queue));
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_pool()
+{
+	struct sdo_req_info info = { .type = SDO_REQ_UPLOAD };
+
+	struct sdo_req* a = sdo_req_new(&info);
+	ASSERT_PTR_EQ(a->data.inline_data.bytes, a->data.data);
+	sdo_req_free(a);
+
+	struct sdo_req* b = sdo_req_new(&info);
+	ASSERT_PTR_EQ(a, b);
+	ASSERT_INT_EQ(1, b->ref);
+	sdo_req_free(b);
+
+	sdo_req_pool_cleanup();
+	return 0;
+}
+
+static int test_req_retry()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
+
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
+	RESET_FAKE(mloop_timer_set_time);
+
+	struct sdo_req_queue queue;
+	sdo_req__queue_init(&queue, 0, 0, 1, 0);
+	queue.policy.retries = 100;
+
+	struct sdo_req_info info = { .type = SDO_REQ_UPLOAD };
+	struct sdo_req* a = sdo_req_new(&info);
+	struct sdo_req* b = sdo_req_new(&info);
+
+	ASSERT_INT_EQ(0, sdo_req_start(a, &queue));
+	ASSERT_PTR_EQ(a, sdo_req_queue__dequeue(&queue));
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	async.context = a;
+	async.status = SDO_REQ_LOCAL_ABORT;
+	async.abort_code = SDO_ABORT_TIMEOUT;
+
+	/* The back-off stops growing after a while */
+	a->n_retries = 50;
+	sdo_req__on_done(&async);
+	ASSERT_UINT_EQ(51, a->n_retries);
+	ASSERT_UINT_EQ(1, queue.size);
+	ASSERT_UINT_EQ(queue.policy.backoff * 64 * 1000000ULL,
+		       mloop_timer_set_time_fake.arg1_val);
+
+	/* A retry may not take the place of a new request */
+	ASSERT_PTR_EQ(a, sdo_req_queue__dequeue(&queue));
+	ASSERT_INT_EQ(0, sdo_req_start(b, &queue));
+	sdo_req__on_done(&async);
+	ASSERT_UINT_EQ(51, a->n_retries);
+	ASSERT_UINT_EQ(1, queue.size);
+	ASSERT_INT_EQ(SDO_REQ_LOCAL_ABORT, a->status);
+
+	ASSERT_PTR_EQ(b, sdo_req_queue__dequeue(&queue));
+
+	sdo_req_unref(a);
+	sdo_req_unref(a);
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+	sdo_req_unref(b);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static struct sdo_req_queue* offline_queue_;
+static struct sdo_req* offline_next_;
+static int n_offline_done_;
+static int n_offline_timeouts_;
+
+static void on_offline_done(struct sdo_req* req)
+{
+	if (req->status == SDO_REQ_LOCAL_ABORT
+	 && req->abort_code == SDO_ABORT_TIMEOUT)
+		++n_offline_timeouts_;
+
+	/* Callbacks commonly enqueue the next request */
+	if (n_offline_done_++ == 0)
+		sdo_req_start(offline_next_, offline_queue_);
+}
+
+static int test_req_queue_offline()
+{
+	RESET_FAKE(sdo_async_init);
+	sdo_async_init_fake.custom_fake = fake_sdo_async_init;
+
+	RESET_FAKE(mloop_timer_new);
+	mloop_timer_new_fake.return_val = (void*)0xdeadbeef;
+
+	RESET_FAKE(sdo_async_start);
+
+	struct sdo_req_queue queue;
+	ASSERT_INT_EQ(0, sdo_req__queue_init(&queue, 0, 0, 3, 0));
+
+	RESET_FAKE(mloop_idle_get_context);
+	mloop_idle_get_context_fake.return_val = &queue;
+
+	struct sdo_req_info info = {
+		.type = SDO_REQ_UPLOAD,
+		.on_done = on_offline_done
+	};
+	struct sdo_req* a = sdo_req_new(&info);
+	struct sdo_req* b = sdo_req_new(&info);
+	offline_next_ = sdo_req_new(&info);
+	offline_queue_ = &queue;
+	n_offline_done_ = 0;
+	n_offline_timeouts_ = 0;
+
+	ASSERT_INT_EQ(0, sdo_req_start(a, &queue));
+	ASSERT_INT_EQ(0, sdo_req_start(b, &queue));
+
+	sdo_req_queue_set_offline(&queue, 1);
+	sdo_req__process_queue(NULL);
+
+	/* Everything queued is failed at once, but not what the callbacks
+	 * enqueued while doing so
+	 */
+	ASSERT_INT_EQ(2, n_offline_done_);
+	ASSERT_UINT_EQ(1, queue.size);
+	ASSERT_INT_EQ(0, sdo_async_start_fake.call_count);
+
+	sdo_req__process_queue(NULL);
+	ASSERT_INT_EQ(3, n_offline_done_);
+	ASSERT_INT_EQ(3, n_offline_timeouts_);
+	ASSERT_UINT_EQ(0, queue.size);
+
+	sdo_req_unref(a);
+	sdo_req_unref(b);
+	sdo_req_unref(offline_next_);
+
+	sdo_req__queue_destroy(&queue);
+	return 0;
+}
+
+static int test_req_upload_hands_over_buffer()
+{
+	struct sdo_req_queue queue;
+	memset(&queue, 0, sizeof(queue));
+	sdo_req_policy_init(&queue.policy);
+
+	struct sdo_req_info info = { .type = SDO_REQ_UPLOAD };
+	struct sdo_req* req = sdo_req_new(&info);
+	req->parent = &queue;
+
+	struct sdo_async async;
+	memset(&async, 0, sizeof(async));
+	vector_init(&async.buffer, 64);
+	vector_assign(&async.buffer, "a long upload", 14);
+	void* heap = async.buffer.data;
+
+	async.context = req;
+	async.status = SDO_REQ_OK;
+
+	sdo_req__on_done(&async);
+
+	ASSERT_INT_EQ(SDO_REQ_OK, req->status);
+	ASSERT_PTR_EQ(heap, req->data.data);
+	ASSERT_STR_EQ("a long upload", req->data.data);
+	ASSERT_PTR_EQ(async.buffer.inline_data.bytes, async.buffer.data);
+	ASSERT_UINT_EQ(0, async.buffer.index);
+
+	vector_destroy(&async.buffer);
+	sdo_req_free(req);
+	sdo_req_pool_cleanup();
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_req_new_free);
 	RUN_TEST(test_req_queue_init_destroy);
 	RUN_TEST(test_req_queue_enqueue_dequeue);
+	RUN_TEST(test_req_cancel);
 	RUN_TEST(test_req_queue_from_async);
+	RUN_TEST(test_rtt_estimator);
+	RUN_TEST(test_rtt_backoff);
+	RUN_TEST(test_policy_parse_obj_timeouts);
+	RUN_TEST(test_req_queue_timeout);
+	RUN_TEST(test_req_queue_channels);
+	RUN_TEST(test_req_retry);
+	RUN_TEST(test_req_pool);
+	RUN_TEST(test_req_queue_offline);
+	RUN_TEST(test_req_upload_hands_over_buffer);
 	return r;
 }
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "tst.h"
+#include "canopen/sdo_trace.h"
+#include "canopen/sdo_req_enums.h"
+
+static int test_hist_buckets()
+{
+	struct sdo_trace_hist hist;
+	memset(&hist, 0, sizeof(hist));
+
+	sdo_trace_hist_add(&hist, 0);
+	sdo_trace_hist_add(&hist, 1);
+	sdo_trace_hist_add(&hist, 2);
+	sdo_trace_hist_add(&hist, 3);
+	sdo_trace_hist_add(&hist, 1000);
+	sdo_trace_hist_add(&hist, ~0ULL);
+
+	ASSERT_UINT_EQ(2, hist.bucket[0]);
+	ASSERT_UINT_EQ(2, hist.bucket[1]);
+	ASSERT_UINT_EQ(1, hist.bucket[9]);
+	ASSERT_UINT_EQ(1, hist.bucket[SDO_TRACE_HIST_BUCKETS - 1]);
+	ASSERT_UINT_EQ(6, hist.count);
+	ASSERT_TRUE(hist.max == ~0ULL);
+
+	return 0;
+}
+
+static int test_hist_percentile()
+{
+	struct sdo_trace_hist hist;
+	memset(&hist, 0, sizeof(hist));
+
+	ASSERT_INT_EQ(0, sdo_trace_hist_percentile(&hist, 0.5));
+
+	int i;
+	for (i = 0; i < 90; ++i)
+		sdo_trace_hist_add(&hist, 100);
+	for (i = 0; i < 10; ++i)
+		sdo_trace_hist_add(&hist, 5000);
+
+	ASSERT_INT_EQ(128, sdo_trace_hist_percentile(&hist, 0.5));
+	ASSERT_INT_EQ(128, sdo_trace_hist_percentile(&hist, 0.9));
+	ASSERT_INT_EQ(5000, sdo_trace_hist_percentile(&hist, 0.99));
+
+	return 0;
+}
+
+static int test_record()
+{
+	ASSERT_INT_EQ(0, sdo_trace_init(NULL));
+
+	struct sdo_trace_record record = {
+		.enqueue_time = 1000,
+		.start_time = 1500,
+		.first_response_time = 1700,
+		.done_time = 2000,
+		.callback_done_time = 2100,
+		.size = 4,
+		.index = 0x1018,
+		.subindex = 1,
+		.nodeid = 5,
+		.type = SDO_REQ_UPLOAD,
+		.status = SDO_REQ_OK,
+		.n_segments = 1,
+	};
+
+	sdo_trace_record(&record);
+
+	record.status = SDO_REQ_REMOTE_ABORT;
+	record.n_retries = 2;
+	sdo_trace_record(&record);
+
+	const struct sdo_trace_node_stats* node = sdo_trace_get_node_stats(5);
+	ASSERT_UINT_EQ(2, node->total.count);
+	ASSERT_UINT_EQ(1100, node->total.max);
+	ASSERT_UINT_EQ(500, node->queue.max);
+	ASSERT_UINT_EQ(500, node->bus.max);
+	ASSERT_UINT_EQ(100, node->callback.max);
+	ASSERT_UINT_EQ(1, node->n_aborts);
+	ASSERT_UINT_EQ(2, node->n_retries);
+	ASSERT_UINT_EQ(8, node->bytes);
+
+	const struct sdo_trace_hist* obj = sdo_trace_get_obj_hist(5, 0x1018, 1);
+	ASSERT_TRUE(obj);
+	ASSERT_UINT_EQ(2, obj->count);
+	ASSERT_FALSE(sdo_trace_get_obj_hist(5, 0x1018, 2));
+	ASSERT_FALSE(sdo_trace_get_obj_hist(6, 0x1018, 1));
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&buffer, &size);
+	sdo_trace_print_json(out, 5);
+	fclose(out);
+
+	ASSERT_TRUE(strstr(buffer, "\"0x1018:0x1\": {\"count\": 2"));
+	free(buffer);
+
+	sdo_trace_cleanup();
+	return 0;
+}
+
+static int test_trace_file()
+{
+	char path[] = "/tmp/unit_sdo_trace_XXXXXX";
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	close(fd);
+
+	ASSERT_INT_EQ(0, sdo_trace_init(path));
+
+	struct sdo_trace_record record = { .nodeid = 1, .index = 0x1000 };
+	sdo_trace_record(&record);
+	sdo_trace_record(&record);
+
+	sdo_trace_cleanup();
+
+	FILE* file = fopen(path, "r");
+	ASSERT_TRUE(file);
+
+	struct sdo_trace_file_header header;
+	ASSERT_INT_EQ(1, fread(&header, sizeof(header), 1, file));
+	ASSERT_INT_EQ(0, memcmp(header.magic, SDO_TRACE_MAGIC, 8));
+	ASSERT_INT_EQ(SDO_TRACE_VERSION, header.version);
+	ASSERT_INT_EQ(sizeof(record), header.record_size);
+
+	struct sdo_trace_record records[3];
+	ASSERT_INT_EQ(2, fread(records, sizeof(record), 3, file));
+	ASSERT_INT_EQ(0x1000, records[1].index);
+
+	fclose(file);
+	unlink(path);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_hist_buckets);
+	RUN_TEST(test_hist_percentile);
+	RUN_TEST(test_record);
+	RUN_TEST(test_trace_file);
+	return r;
+}
@@ -4,6 +4,8 @@
 #include "socketcan.h"
 
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 
 int test_incomplete_buffer(void)
 {
@@ -66,10 +68,144 @@ int test_full_buffer(void)
 	return 0;
 }
 
+#define N_PRODUCERS 4
+#define N_FRAMES_PER_PRODUCER 10000
+
+static struct tracebuffer concurrent_tb_;
+
+static void* produce(void* context)
+{
+	uint8_t producer = (uintptr_t)context;
+	struct can_frame cf = { .can_id = producer, .can_dlc = 4 };
+
+	for (uint32_t i = 0; i < N_FRAMES_PER_PRODUCER; ++i) {
+		memcpy(cf.data, &i, sizeof(i));
+		tb_append(&concurrent_tb_, &cf);
+	}
+
+	return NULL;
+}
+
+int test_concurrent_producers(void)
+{
+	pthread_t threads[N_PRODUCERS];
+	size_t length = 1024;
+
+	ASSERT_INT_GE(0, tb_init(&concurrent_tb_,
+				 length * sizeof(struct tb_frame)));
+
+	for (uintptr_t i = 0; i < N_PRODUCERS; ++i)
+		pthread_create(&threads[i], NULL, produce, (void*)i);
+
+	/* Dumping while the producers are running must not disturb them */
+	FILE* null = fopen("/dev/null", "w");
+	for (int i = 0; i < 100; ++i)
+		tb_dump(&concurrent_tb_, null);
+	fclose(null);
+
+	for (int i = 0; i < N_PRODUCERS; ++i)
+		pthread_join(threads[i], NULL);
+
+	ASSERT_UINT_EQ(N_PRODUCERS * N_FRAMES_PER_PRODUCER,
+		       concurrent_tb_.header->head);
+
+	struct tb_frame* frames = malloc(length * sizeof(*frames));
+	ASSERT_UINT_EQ(length, tb_snapshot(&concurrent_tb_, frames));
+
+	/* Frames from each producer must be complete and in order */
+	int64_t last[N_PRODUCERS] = { -1, -1, -1, -1 };
+	for (size_t i = 0; i < length; ++i) {
+		uint32_t producer = frames[i].cf.can_id;
+		uint32_t value;
+		memcpy(&value, frames[i].cf.data, sizeof(value));
+
+		ASSERT_TRUE(producer < N_PRODUCERS);
+		ASSERT_INT_EQ(4, frames[i].cf.can_dlc);
+		ASSERT_TRUE((int64_t)value > last[producer]);
+		last[producer] = value;
+	}
+
+	free(frames);
+	tb_destroy(&concurrent_tb_);
+	return 0;
+}
+
+int test_ring_file(void)
+{
+	char dir[] = "/tmp/unit_trace_buffer_XXXXXX";
+	char path[64], prev_path[64];
+	struct tracebuffer tb;
+	struct tb_frame frames[4];
+
+	ASSERT_TRUE(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/ring", dir);
+	snprintf(prev_path, sizeof(prev_path), "%s/ring.prev", dir);
+
+	ASSERT_INT_EQ(0, tb_init_file(&tb, path, 3 * sizeof(struct tb_frame)));
+	ASSERT_INT_EQ(4, tb.length);
+
+	struct can_frame cf = { 0 };
+	for (int i = 0; i < 6; ++i) {
+		cf.can_id = i + 1;
+		tb_append(&tb, &cf);
+	}
+
+	/* Not destroyed, as if the process had crashed */
+	struct tracebuffer crashed = tb;
+
+	ASSERT_INT_EQ(0, tb_open_file(&tb, path));
+	ASSERT_UINT_EQ(6, tb.header->head);
+	ASSERT_UINT_EQ(4, tb_snapshot(&tb, frames));
+	ASSERT_INT_EQ(3, frames[0].cf.can_id);
+	ASSERT_INT_EQ(6, frames[3].cf.can_id);
+	tb_destroy(&tb);
+
+	/* A restart keeps the previous ring */
+	ASSERT_INT_EQ(0, tb_init_file(&tb, path, 3 * sizeof(struct tb_frame)));
+	tb_destroy(&tb);
+
+	ASSERT_INT_EQ(0, tb_open_file(&tb, prev_path));
+	ASSERT_UINT_EQ(4, tb_snapshot(&tb, frames));
+	ASSERT_INT_EQ(6, frames[3].cf.can_id);
+	tb_destroy(&tb);
+
+	ASSERT_INT_EQ(0, tb_open_file(&tb, path));
+	ASSERT_UINT_EQ(0, tb_snapshot(&tb, frames));
+	tb_destroy(&tb);
+
+	tb_destroy(&crashed);
+	unlink(path);
+	unlink(prev_path);
+	rmdir(dir);
+	return 0;
+}
+
+int test_invalid_ring_file(void)
+{
+	char path[] = "/tmp/unit_trace_buffer_XXXXXX";
+	struct tracebuffer tb;
+	char junk[100];
+
+	memset(junk, 'x', sizeof(junk));
+
+	int fd = mkstemp(path);
+	ASSERT_INT_GE(0, fd);
+	ASSERT_INT_EQ(sizeof(junk), write(fd, junk, sizeof(junk)));
+	close(fd);
+
+	ASSERT_INT_LT(0, tb_open_file(&tb, path));
+
+	unlink(path);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
 	RUN_TEST(test_incomplete_buffer);
 	RUN_TEST(test_full_buffer);
+	RUN_TEST(test_concurrent_producers);
+	RUN_TEST(test_ring_file);
+	RUN_TEST(test_invalid_ring_file);
 	return r;
 }
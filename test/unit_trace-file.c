@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include "tst.h"
+#include "trace-file.h"
+#include "lz4-block.h"
+#include "canopen/trace-convert.h"
+
+#define N_FRAMES 20000
+
+static void make_frames(struct tb_frame* frames, size_t n)
+{
+	memset(frames, 0, n * sizeof(*frames));
+
+	for (size_t i = 0; i < n; ++i) {
+		frames[i].timestamp = 1000000 + i * 100;
+		frames[i].cf.can_id = 0x180 + i % 4;
+		frames[i].cf.can_dlc = i % 9;
+		memset(frames[i].cf.data, i % 7, frames[i].cf.can_dlc);
+	}
+
+	/* Frames from different producers may be slightly out of order */
+	frames[10].timestamp -= 150;
+	frames[11].cf.can_id = 0x1234567 | CAN_EFF_FLAG;
+	frames[12].cf.can_id |= CAN_RTR_FLAG;
+}
+
+static int test_lz4_roundtrip()
+{
+	char src[4096];
+	char packed[lz4_block_bound(sizeof(src))];
+	char unpacked[sizeof(src)];
+
+	for (size_t i = 0; i < sizeof(src); ++i)
+		src[i] = i % 64 < 32 ? 'a' + i % 13 : i * 7;
+
+	int size = lz4_block_compress(packed, sizeof(packed), src, sizeof(src));
+	ASSERT_INT_LT((int)sizeof(src), size);
+	ASSERT_INT_LT(0, -size);
+
+	ASSERT_INT_EQ(sizeof(src), lz4_block_decompress(unpacked,
+							sizeof(unpacked),
+							packed, size));
+	ASSERT_INT_EQ(0, memcmp(src, unpacked, sizeof(src)));
+
+	ASSERT_INT_EQ(-1, lz4_block_decompress(unpacked, sizeof(src) - 1,
+					       packed, size));
+	ASSERT_INT_EQ(-1, lz4_block_compress(packed, 10, src, sizeof(src)));
+
+	return 0;
+}
+
+static int test_lz4_small_input()
+{
+	char packed[32];
+	char unpacked[8];
+
+	int size = lz4_block_compress(packed, sizeof(packed), "abc", 3);
+	ASSERT_INT_EQ(4, size);
+	ASSERT_INT_EQ(3, lz4_block_decompress(unpacked, sizeof(unpacked),
+					      packed, size));
+	ASSERT_INT_EQ(0, memcmp("abc", unpacked, 3));
+
+	ASSERT_INT_EQ(1, lz4_block_compress(packed, sizeof(packed), "", 0));
+	ASSERT_INT_EQ(0, lz4_block_decompress(unpacked, sizeof(unpacked),
+					      packed, 1));
+
+	return 0;
+}
+
+static int is_same_frame(const struct tb_frame* a, const struct tb_frame* b)
+{
+	return a->timestamp == b->timestamp
+	    && a->cf.can_id == b->cf.can_id
+	    && a->cf.can_dlc == b->cf.can_dlc
+	    && memcmp(a->cf.data, b->cf.data, a->cf.can_dlc) == 0;
+}
+
+static int test_roundtrip()
+{
+	static struct tb_frame frames[N_FRAMES];
+	make_frames(frames, N_FRAMES);
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, tf_write_frames(stream, frames, N_FRAMES,
+					 TF_COMPRESS_LZ4));
+	fclose(stream);
+
+	ASSERT_UINT_LT(N_FRAMES * sizeof(struct tb_frame) / 4, size);
+
+	stream = fmemopen(buffer, size, "r");
+	struct tf_reader reader;
+	ASSERT_INT_EQ(0, tf_reader_init(&reader, stream));
+	ASSERT_TRUE(reader.n_blocks > 1);
+
+	struct tb_frame frame;
+	size_t i;
+	for (i = 0; tf_reader_next(&reader, &frame) > 0; ++i)
+		ASSERT_TRUE(is_same_frame(&frames[i], &frame));
+
+	ASSERT_INT_EQ(N_FRAMES, i);
+
+	tf_reader_destroy(&reader);
+	fclose(stream);
+	free(buffer);
+	return 0;
+}
+
+static int test_out_of_order()
+{
+	static struct tb_frame frames[N_FRAMES];
+	make_frames(frames, N_FRAMES);
+
+	/* 1000, 900, 1100, 1300, 1200, 1400, ... so that every block contains
+	 * frames that are older than its first frame.
+	 */
+	static const int offset[] = { 0, -100, 100 };
+	for (size_t i = 0; i < N_FRAMES; ++i)
+		frames[i].timestamp = 1000 + (i / 3) * 300 + offset[i % 3];
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, tf_write_frames(stream, frames, N_FRAMES,
+					 TF_COMPRESS_LZ4));
+	fclose(stream);
+
+	stream = fmemopen(buffer, size, "r");
+	struct tf_reader reader;
+	ASSERT_INT_EQ(0, tf_reader_init(&reader, stream));
+	ASSERT_TRUE(reader.n_blocks > 1);
+
+	struct tb_frame frame;
+	size_t i;
+	for (i = 0; tf_reader_next(&reader, &frame) > 0; ++i)
+		ASSERT_TRUE(is_same_frame(&frames[i], &frame));
+
+	ASSERT_INT_EQ(N_FRAMES, i);
+
+	tf_reader_destroy(&reader);
+	fclose(stream);
+	free(buffer);
+	return 0;
+}
+
+static int test_seek()
+{
+	static struct tb_frame frames[N_FRAMES];
+	make_frames(frames, N_FRAMES);
+
+	char* buffer = NULL;
+	size_t size = 0;
+	FILE* stream = open_memstream(&buffer, &size);
+	ASSERT_INT_EQ(0, tf_write_frames(stream, frames, N_FRAMES,
+					 TF_COMPRESS_LZ4));
+	fclose(stream);
+
+	stream = fmemopen(buffer, size, "r");
+	struct tf_reader reader;
+	ASSERT_INT_EQ(0, tf_reader_init(&reader, stream));
+
+	struct tb_frame frame;
+	ASSERT_INT_EQ(0, tf_reader_seek(&reader, frames[15000].timestamp));
+	ASSERT_INT_EQ(1, tf_reader_next(&reader, &frame));
+	ASSERT_TRUE(is_same_frame(&frames[15000], &frame));
+
+	ASSERT_INT_EQ(0, tf_reader_seek(&reader, frames[100].timestamp + 1));
+	ASSERT_INT_EQ(1, tf_reader_next(&reader, &frame));
+	ASSERT_TRUE(is_same_frame(&frames[101], &frame));
+
+	ASSERT_INT_EQ(0, tf_reader_seek(&reader, ~0ULL));
+	ASSERT_INT_EQ(0, tf_reader_next(&reader, &frame));
+
+	tf_reader_destroy(&reader);
+	fclose(stream);
+
+	/* A file without its index can still be read and sought */
+	size_t n_blocks = reader.n_blocks;
+	size -= sizeof(struct tf_file_trailer)
+	      + n_blocks * sizeof(struct tf_index_entry);
+
+	stream = fmemopen(buffer, size, "r");
+	ASSERT_INT_EQ(0, tf_reader_init(&reader, stream));
+	ASSERT_PTR_EQ(NULL, reader.index);
+
+	ASSERT_INT_EQ(0, tf_reader_seek(&reader, frames[15000].timestamp));
+	ASSERT_INT_EQ(1, tf_reader_next(&reader, &frame));
+	ASSERT_TRUE(is_same_frame(&frames[15000], &frame));
+
+	tf_reader_destroy(&reader);
+	fclose(stream);
+	free(buffer);
+	return 0;
+}
+
+static int test_convert_candump()
+{
+	static struct tb_frame frames[100];
+	make_frames(frames, 100);
+
+	char in[] = "/tmp/unit_trace-file_XXXXXX";
+	int fd = mkstemp(in);
+	ASSERT_INT_GE(0, fd);
+	FILE* stream = fdopen(fd, "w");
+	ASSERT_INT_EQ(100, fwrite(frames, sizeof(*frames), 100, stream));
+	fclose(stream);
+
+	char candump[] = "/tmp/unit_trace-file_XXXXXX";
+	close(mkstemp(candump));
+
+	char compact[] = "/tmp/unit_trace-file_XXXXXX";
+	close(mkstemp(compact));
+
+	struct co_trace_convert_options options = {
+		.output_format = CO_TRACE_FORMAT_CANDUMP,
+		.begin = frames[20].timestamp,
+		.end = frames[29].timestamp,
+	};
+
+	ASSERT_INT_EQ(0, co_trace_convert(in, candump, &options));
+
+	memset(&options, 0, sizeof(options));
+	ASSERT_INT_EQ(0, co_trace_convert(candump, compact, &options));
+
+	stream = fopen(compact, "r");
+	struct tf_reader reader;
+	ASSERT_INT_EQ(0, tf_reader_init(&reader, stream));
+
+	struct tb_frame frame;
+	size_t i;
+	for (i = 20; tf_reader_next(&reader, &frame) > 0; ++i) {
+		frames[i].cf.can_dlc = frames[i].cf.can_id & CAN_RTR_FLAG
+				     ? 0 : frames[i].cf.can_dlc;
+		ASSERT_TRUE(is_same_frame(&frames[i], &frame));
+	}
+
+	ASSERT_INT_EQ(30, i);
+
+	tf_reader_destroy(&reader);
+	fclose(stream);
+	unlink(in);
+	unlink(candump);
+	unlink(compact);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_lz4_roundtrip);
+	RUN_TEST(test_lz4_small_input);
+	RUN_TEST(test_roundtrip);
+	RUN_TEST(test_out_of_order);
+	RUN_TEST(test_seek);
+	RUN_TEST(test_convert_candump);
+	return r;
+}
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "tst.h"
+#include "canopen.h"
+#include "canopen/sdo.h"
+#include "canopen/trace-sub.h"
+#include "net-util.h"
+
+static struct trace_sub_record records_[TRACE_SUB_BATCH_MAX];
+static int peer_ = -1;
+
+static struct trace_sub_client* open_client(size_t queue_size,
+					    unsigned int batch_size)
+{
+	struct trace_sub_config config = {
+		.queue_size = queue_size,
+		.batch_size = batch_size,
+	};
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		return NULL;
+
+	net_dont_block(fds[0]);
+	peer_ = fds[1];
+
+	return trace_sub_client_new(fds[0], &config);
+}
+
+static void close_client(struct trace_sub_client* client)
+{
+	trace_sub_client_free(client);
+	close(peer_);
+}
+
+static void feed(struct trace_sub_client* client, uint64_t timestamp,
+		 uint32_t can_id, uint8_t data0)
+{
+	struct can_frame cf = { .can_id = can_id, .can_dlc = 1 };
+	cf.data[0] = data0;
+	trace_sub_client_feed(client, timestamp, &cf);
+}
+
+static void feed_sdo(struct trace_sub_client* client, uint32_t can_id, int cs,
+		     int index)
+{
+	struct can_frame cf = { .can_id = can_id, .can_dlc = 8 };
+	sdo_set_cs(&cf, cs);
+	sdo_set_index(&cf, index);
+	trace_sub_client_feed(client, 1, &cf);
+}
+
+static int is_readable(int timeout)
+{
+	struct pollfd pollfd = { .fd = peer_, .events = POLLIN };
+	return poll(&pollfd, 1, timeout) == 1;
+}
+
+/* Returns the number of records in the next batch */
+static int read_batch(struct trace_sub_header* header)
+{
+	if (trace_sub_read_batch(peer_, header, records_) != 1)
+		return -1;
+
+	return header->n_records;
+}
+
+static int test_filter_parse()
+{
+	struct trace_sub_filter filter;
+
+	ASSERT_INT_EQ(0, trace_sub_filter_parse(&filter, ""));
+	ASSERT_TRUE(co_nodeset_is_empty(&filter.nodes));
+	ASSERT_INT_EQ(0, filter.objects);
+	ASSERT_INT_EQ(0, filter.index_min);
+	ASSERT_INT_EQ(0xffff, filter.index_max);
+
+	ASSERT_INT_EQ(0, trace_sub_filter_parse(&filter,
+		"nodes=1-3,5 objects=emcy,tpdo index=0x6000-0x6fff "
+		"decimate=10 decimate=0x181:2 interval=0x701:1000\r"));
+	ASSERT_INT_EQ(4, co_nodeset_count(&filter.nodes));
+	ASSERT_TRUE(co_nodeset_has(&filter.nodes, 5));
+	ASSERT_TRUE(filter.objects & CANOPEN_EMCY);
+	ASSERT_TRUE(filter.objects & CANOPEN_TPDO4);
+	ASSERT_FALSE(filter.objects & CANOPEN_RPDO1);
+	ASSERT_INT_EQ(0x6000, filter.index_min);
+	ASSERT_INT_EQ(0x6fff, filter.index_max);
+	ASSERT_INT_EQ(10, filter.decimation[0x182]);
+	ASSERT_INT_EQ(2, filter.decimation[0x181]);
+	ASSERT_INT_EQ(1000000, filter.min_interval[0x701]);
+	ASSERT_INT_EQ(0, filter.min_interval[0x702]);
+
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "nodes=128"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "objects=foo"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "index=2-1"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "decimate=0x800:2"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "interval=x"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "nodes"));
+	ASSERT_INT_EQ(-1, trace_sub_filter_parse(&filter, "colour=red"));
+
+	return 0;
+}
+
+static int test_nodes_and_objects()
+{
+	struct trace_sub_header header;
+	struct trace_sub_client* client = open_client(4096, 16);
+	ASSERT_TRUE(client);
+
+	feed(client, 1, 0x185, 0);
+	ASSERT_INT_EQ(0, trace_sub_client_get_stats(client)->n_frames);
+
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client,
+		"nodes=5 objects=pdo,sync"));
+
+	feed(client, 1000, 0x185, 1);
+	feed(client, 1001, 0x186, 2);
+	feed(client, 1002, 0x705, 3);
+	feed(client, 1003, 0x080, 4);
+	feed(client, 1004, 0x205, 5);
+
+	ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+	ASSERT_INT_EQ(3, read_batch(&header));
+	ASSERT_INT_EQ(0, header.seq);
+	ASSERT_INT_EQ(0, header.n_dropped);
+
+	ASSERT_INT_EQ(0x185, records_[0].can_id);
+	ASSERT_INT_EQ(1000, records_[0].timestamp);
+	ASSERT_INT_EQ(1, records_[0].data[0]);
+	ASSERT_INT_EQ(0x080, records_[1].can_id);
+	ASSERT_INT_EQ(0x205, records_[2].can_id);
+	ASSERT_INT_EQ(5, records_[2].data[0]);
+
+	const struct trace_sub_stats* stats;
+	stats = trace_sub_client_get_stats(client);
+	ASSERT_INT_EQ(3, stats->n_frames);
+	ASSERT_INT_EQ(2, stats->n_filtered);
+
+	/* Nothing is sent for an empty batch */
+	ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+	ASSERT_FALSE(is_readable(0));
+
+	close_client(client);
+	return 0;
+}
+
+static int test_full_batch_is_sent()
+{
+	struct trace_sub_header header;
+	struct trace_sub_client* client = open_client(4096, 4);
+	ASSERT_TRUE(client);
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client, ""));
+
+	for (int i = 0; i < 9; ++i)
+		feed(client, i, 0x181, i);
+
+	ASSERT_INT_EQ(4, read_batch(&header));
+	ASSERT_INT_EQ(0, header.seq);
+	ASSERT_INT_EQ(4, read_batch(&header));
+	ASSERT_INT_EQ(1, header.seq);
+	ASSERT_INT_EQ(7, records_[3].data[0]);
+	ASSERT_FALSE(is_readable(0));
+
+	ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+	ASSERT_INT_EQ(1, read_batch(&header));
+	ASSERT_INT_EQ(8, records_[0].data[0]);
+
+	close_client(client);
+	return 0;
+}
+
+static int test_decimation_and_interval()
+{
+	struct trace_sub_header header;
+	struct trace_sub_client* client = open_client(4096, 64);
+	ASSERT_TRUE(client);
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client,
+		"decimate=0x181:3 interval=0x182:10"));
+
+	for (int i = 0; i < 7; ++i)
+		feed(client, 1000 + i * 4000, 0x181, i);
+
+	for (int i = 0; i < 7; ++i)
+		feed(client, 1000 + i * 4000, 0x182, i);
+
+	feed(client, 1, 0x183, 0);
+
+	ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+	ASSERT_INT_EQ(7, read_batch(&header));
+
+	ASSERT_INT_EQ(0x181, records_[0].can_id);
+	ASSERT_INT_EQ(0, records_[0].data[0]);
+	ASSERT_INT_EQ(3, records_[1].data[0]);
+	ASSERT_INT_EQ(6, records_[2].data[0]);
+
+	/* 10 ms apart at the least */
+	ASSERT_INT_EQ(0x182, records_[3].can_id);
+	ASSERT_INT_EQ(0, records_[3].data[0]);
+	ASSERT_INT_EQ(3, records_[4].data[0]);
+	ASSERT_INT_EQ(6, records_[5].data[0]);
+
+	ASSERT_INT_EQ(0x183, records_[6].can_id);
+
+	close_client(client);
+	return 0;
+}
+
+static int test_sdo_index()
+{
+	struct trace_sub_header header;
+	struct trace_sub_client* client = open_client(4096, 64);
+	ASSERT_TRUE(client);
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client,
+		"objects=sdo index=0x6000-0x6fff"));
+
+	feed_sdo(client, 0x605, SDO_CCS_UL_INIT_REQ, 0x1000);
+	feed_sdo(client, 0x585, SDO_SCS_UL_INIT_RES, 0x1000);
+	feed_sdo(client, 0x605, SDO_CCS_UL_INIT_REQ, 0x6040);
+	feed_sdo(client, 0x585, SDO_SCS_UL_INIT_RES, 0x6040);
+	feed_sdo(client, 0x605, SDO_CCS_UL_SEG_REQ, 0);
+	feed_sdo(client, 0x585, SDO_SCS_UL_SEG_RES, 0);
+	feed_sdo(client, 0x606, SDO_CCS_UL_SEG_REQ, 0);
+
+	ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+	ASSERT_INT_EQ(4, read_batch(&header));
+	ASSERT_INT_EQ(0x605, records_[0].can_id);
+	ASSERT_INT_EQ(0x585, records_[1].can_id);
+	ASSERT_INT_EQ(0x605, records_[2].can_id);
+	ASSERT_INT_EQ(0x585, records_[3].can_id);
+
+	close_client(client);
+	return 0;
+}
+
+/* The peer does not read, so the client must drop frames rather than block,
+ * and report them once the peer catches up.
+ */
+static int test_slow_subscriber()
+{
+	struct trace_sub_header header;
+	struct trace_sub_client* client = open_client(1024, 16);
+	ASSERT_TRUE(client);
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client, ""));
+
+	for (int i = 0; i < 100000; ++i)
+		feed(client, i, 0x181, i);
+
+	const struct trace_sub_stats* stats;
+	stats = trace_sub_client_get_stats(client);
+	ASSERT_INT_EQ(100000, stats->n_frames);
+	ASSERT_TRUE(stats->n_dropped > 0);
+
+	uint64_t n_received = 0;
+	uint64_t n_dropped = 0;
+	uint32_t seq = 0;
+
+	do {
+		ASSERT_INT_EQ(0, trace_sub_client_flush(client));
+
+		while (is_readable(100)) {
+			int n = read_batch(&header);
+			ASSERT_INT_GE(0, n);
+			ASSERT_UINT_EQ(seq++, header.seq);
+			n_received += n;
+			n_dropped += header.n_dropped;
+			trace_sub_client_flush(client);
+		}
+	} while (n_received + n_dropped < stats->n_frames);
+
+	ASSERT_UINT_EQ(stats->n_dropped, n_dropped);
+	ASSERT_UINT_EQ(stats->n_frames, n_received + n_dropped);
+
+	close_client(client);
+	return 0;
+}
+
+static int test_gone_subscriber()
+{
+	struct trace_sub_client* client = open_client(4096, 16);
+	ASSERT_TRUE(client);
+	ASSERT_INT_EQ(0, trace_sub_client_subscribe(client, ""));
+
+	close(peer_);
+	feed(client, 1, 0x181, 0);
+	ASSERT_INT_EQ(-1, trace_sub_client_flush(client));
+
+	trace_sub_client_free(client);
+	return 0;
+}
+
+int main()
+{
+	int r = 0;
+	RUN_TEST(test_filter_parse);
+	RUN_TEST(test_nodes_and_objects);
+	RUN_TEST(test_full_batch_is_sent);
+	RUN_TEST(test_decimation_and_interval);
+	RUN_TEST(test_sdo_index);
+	RUN_TEST(test_slow_subscriber);
+	RUN_TEST(test_gone_subscriber);
+	return r;
+}
@@ -112,6 +112,58 @@ static int test_vector_fill()
 	return 0;
 }
 
+static int test_vector_inline()
+{
+	struct vector vector;
+	ASSERT_INT_EQ(0, vector_init(&vector, 4));
+	ASSERT_PTR_EQ(vector.inline_data.bytes, vector.data);
+	ASSERT_UINT_EQ(VECTOR_INLINE_SIZE, vector.size);
+
+	vector_assign(&vector, "1234567", 8);
+	ASSERT_PTR_EQ(vector.inline_data.bytes, vector.data);
+
+	vector_append(&vector, "89", 3);
+	ASSERT_FALSE(vector.data == vector.inline_data.bytes);
+	ASSERT_UINT_EQ(11, vector.index);
+	ASSERT_STR_EQ("1234567", vector.data);
+	ASSERT_STR_EQ("89", (char*)vector.data + 8);
+
+	vector_destroy(&vector);
+	return 0;
+}
+
+static int test_vector_swap()
+{
+	struct vector a, b, c;
+	vector_init(&a, 8);
+	vector_init(&b, 8);
+	vector_init(&c, 64);
+
+	vector_assign(&a, "a", 2);
+	vector_assign(&b, "b", 2);
+	vector_assign(&c, "c", 2);
+
+	vector_swap(&a, &b);
+	ASSERT_PTR_EQ(a.inline_data.bytes, a.data);
+	ASSERT_PTR_EQ(b.inline_data.bytes, b.data);
+	ASSERT_STR_EQ("b", a.data);
+	ASSERT_STR_EQ("a", b.data);
+
+	void* heap = c.data;
+	vector_swap(&a, &c);
+	ASSERT_PTR_EQ(heap, a.data);
+	ASSERT_PTR_EQ(c.inline_data.bytes, c.data);
+	ASSERT_STR_EQ("c", a.data);
+	ASSERT_STR_EQ("b", c.data);
+	ASSERT_UINT_EQ(64, a.size);
+	ASSERT_UINT_EQ(VECTOR_INLINE_SIZE, c.size);
+
+	vector_destroy(&a);
+	vector_destroy(&b);
+	vector_destroy(&c);
+	return 0;
+}
+
 int main()
 {
 	int r = 0;
@@ -124,5 +176,7 @@ int main()
 	RUN_TEST(test_vector_assign_once);
 	RUN_TEST(test_vector_assign_twice);
 	RUN_TEST(test_vector_fill);
+	RUN_TEST(test_vector_inline);
+	RUN_TEST(test_vector_swap);
 	return r;
 }